@@ -0,0 +1,31 @@
+/**
+  * @brief http_conn side of the scenarios in run_scenarios.sh
+  * @note serves the files under "resource_path" through conv_http_single or conv_http_multi,
+  *       so requests take the parsing,routing and static file path of a real deployment.
+  *       the model,thread pool,ET,one shot and object pool come from the config file (CONV_EVENT_CONF).
+  *       bench_http_server single|multi
+  */
+#include "http/http_conn.h"
+#include <cstdio>
+#include <string>
+
+int main(int argc,char** argv)
+{
+    std::string model = argc > 1 ? argv[1] : "single";
+    if(model == "multi")
+    {
+        hzd::conv_http_multi server;
+        server.wait();
+    }
+    else if(model == "single")
+    {
+        hzd::conv_http_single server;
+        server.wait();
+    }
+    else
+    {
+        fprintf(stderr,"usage: %s single|multi\n",argv[0]);
+        return -1;
+    }
+    return 0;
+}
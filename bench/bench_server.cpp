@@ -0,0 +1,134 @@
+/**
+  * @brief server side of the scenarios in run_scenarios.sh
+  * @note answers every request ending in "\r\n\r\n" with a fixed HTTP/1.1 response,
+  *       pipelined requests are answered in order.the model,thread pool,ET,one shot and
+  *       object pool come from the config file (CONV_EVENT_CONF),the response body size
+  *       from BENCH_RESPONSE_SIZE (2 bytes by default).
+  *       bench_server single|multi
+  */
+#include "core/conv_single.h"
+#include "core/conv_multi.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace {
+
+    const std::string& response()
+    {
+        static std::string r = [] {
+            const char* env = getenv("BENCH_RESPONSE_SIZE");
+            size_t size = env ? strtoull(env,nullptr,10) : 2;
+            return "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(size)
+                   + "\r\nConnection: keep-alive\r\n\r\n" + std::string(size,'x');
+        }();
+        return r;
+    }
+
+    class bench_conn final : public hzd::static_conn<bench_conn> {
+        char buffer[16384]{};
+        /* bytes of "\r\n\r\n" matched at the end of the last read */
+        size_t matched{0};
+        /* responses owed and the part of the current one already sent */
+        size_t pending{0};
+        size_t offset{0};
+
+        size_t _count_requests_(const char* data,size_t size)
+        {
+            static const char end[] = "\r\n\r\n";
+            size_t count = 0;
+            for(size_t i = 0;i < size;i++)
+            {
+                if(matched == 0)
+                {
+                    const void* cr = memchr(data + i,'\r',size - i);
+                    if(!cr) break;
+                    i = (const char*)cr - data;
+                }
+                if(data[i] == end[matched])
+                {
+                    if(++matched == 4)
+                    {
+                        count++;
+                        matched = 0;
+                    }
+                }
+                else matched = data[i] == '\r' ? 1 : 0;
+            }
+            return count;
+        }
+    public:
+        void init(int _socket_fd,sockaddr_in* _addr,int _epoll_fd,bool et,bool _one_shot,
+                  hzd::lock_queue<int>* cq = nullptr,bool add = true) override
+        {
+            matched = 0;
+            pending = 0;
+            offset = 0;
+            hzd::conn::init(_socket_fd,_addr,_epoll_fd,et,_one_shot,cq,add);
+        }
+        bool process_in() override
+        {
+            for(;;)
+            {
+                ssize_t n = ::recv(socket_fd,buffer,sizeof(buffer),0);
+                if(n > 0)
+                {
+                    pending += _count_requests_(buffer,(size_t)n);
+                    continue;
+                }
+                if(n == 0) return false;
+                if(errno == EINTR) continue;
+                if(errno != EAGAIN && errno != EWOULDBLOCK) return false;
+                break;
+            }
+            next(pending ? EPOLLOUT : EPOLLIN);
+            return true;
+        }
+        bool process_out() override
+        {
+            const std::string& r = response();
+            while(pending)
+            {
+                ssize_t n = ::send(socket_fd,r.data() + offset,r.size() - offset,MSG_NOSIGNAL);
+                if(n < 0)
+                {
+                    if(errno == EINTR) continue;
+                    if(errno != EAGAIN && errno != EWOULDBLOCK) return false;
+                    next(EPOLLOUT);
+                    return true;
+                }
+                offset += n;
+                if(offset == r.size())
+                {
+                    offset = 0;
+                    pending--;
+                }
+            }
+            next(EPOLLIN);
+            return true;
+        }
+    };
+}
+
+int main(int argc,char** argv)
+{
+    std::string model = argc > 1 ? argv[1] : "single";
+    response();
+    if(model == "multi")
+    {
+        hzd::conv_multi<bench_conn> server;
+        server.wait();
+    }
+    else if(model == "single")
+    {
+        hzd::conv_single<bench_conn> server;
+        server.wait();
+    }
+    else
+    {
+        fprintf(stderr,"usage: %s single|multi\n",argv[0]);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,156 @@
+/**
+  * @brief virtual conn against static_conn on small responses
+  * @note drives process() the way reactor<T> does,through a T* for every event.
+  *       io: request in and response out over a socketpair per connection
+  *       dispatch: same handlers without system calls,only the call path is measured
+  *       g++ -std=c++17 -O2 -I. -Icore/include bench/conn_dispatch.cpp -o conn_dispatch -pthread
+  */
+#include "core/include/conn.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <sys/socket.h>
+
+namespace {
+
+    const char request[] = "GET / HTTP/1.1\r\nHost: bench\r\n\r\n";
+    const char response[] = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\nConnection: keep-alive\r\n\r\nok";
+
+    /* handlers shared by both conn types,only the dispatch differs */
+    template<class C>
+    struct small_response
+    {
+        static bool in(C* c)
+        {
+            if(!c->io)
+            {
+                c->bytes += sizeof(request) - 1;
+                c->status = hzd::conn::OUT;
+                return true;
+            }
+            ssize_t n = ::recv(c->fd(),c->buffer,sizeof(c->buffer),0);
+            if(n <= 0) return false;
+            c->bytes += n;
+            c->status = hzd::conn::OUT;
+            return true;
+        }
+        static bool out(C* c)
+        {
+            if(!c->io)
+            {
+                c->bytes += sizeof(response) - 1;
+                c->status = hzd::conn::IN;
+                return true;
+            }
+            if(::send(c->fd(),response,sizeof(response) - 1,MSG_NOSIGNAL) <= 0) return false;
+            c->status = hzd::conn::IN;
+            return true;
+        }
+    };
+
+    class virtual_small : public hzd::conn {
+    public:
+        bool io{true};
+        size_t bytes{0};
+        char buffer[256]{};
+        bool process_in() override { return small_response<virtual_small>::in(this); }
+        bool process_out() override { return small_response<virtual_small>::out(this); }
+    };
+
+    class static_small final : public hzd::static_conn<static_small> {
+    public:
+        bool io{true};
+        size_t bytes{0};
+        char buffer[256]{};
+        bool process_in() override { return small_response<static_small>::in(this); }
+        bool process_out() override { return small_response<static_small>::out(this); }
+    };
+
+    struct pair_fds
+    {
+        int server;
+        int client;
+    };
+
+    template<class T>
+    double run(std::vector<T*>& conns,const std::vector<pair_fds>& fds,bool io,int rounds)
+    {
+        char sink[256];
+        for(T* c : conns)
+        {
+            c->io = io;
+            c->status = hzd::conn::IN;
+        }
+        auto begin = std::chrono::steady_clock::now();
+        for(int r = 0;r < rounds;r++)
+        {
+            for(size_t i = 0;i < conns.size();i++)
+            {
+                if(io && ::send(fds[i].client,request,sizeof(request) - 1,MSG_NOSIGNAL) <= 0) exit(-1);
+                /* request then response,two events per round like a keep-alive exchange */
+                if(!conns[i]->process() || !conns[i]->process()) exit(-1);
+                if(io && ::recv(fds[i].client,sink,sizeof(sink),0) <= 0) exit(-1);
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+        double events = 2.0 * rounds * conns.size();
+        return std::chrono::duration<double,std::nano>(end - begin).count() / events;
+    }
+
+    template<class T>
+    std::vector<T*> make(const std::vector<pair_fds>& fds)
+    {
+        std::vector<T*> conns;
+        for(const pair_fds& p : fds)
+        {
+            T* c = new T;
+            sockaddr_in addr{};
+            c->init(p.server,&addr,-1,false,true,nullptr,false);
+            conns.push_back(c);
+        }
+        return conns;
+    }
+}
+
+int main(int argc,char** argv)
+{
+    int conn_count = argc > 1 ? atoi(argv[1]) : 64;
+    int io_rounds = argc > 2 ? atoi(argv[2]) : 2000;
+    int dispatch_rounds = io_rounds * 500;
+
+    std::vector<pair_fds> fds;
+    for(int i = 0;i < conn_count;i++)
+    {
+        int sv[2];
+        if(socketpair(AF_UNIX,SOCK_STREAM,0,sv) != 0)
+        {
+            perror("socketpair");
+            return -1;
+        }
+        fds.push_back({sv[0],sv[1]});
+    }
+    std::vector<virtual_small*> v = make<virtual_small>(fds);
+    std::vector<static_small*> s = make<static_small>(fds);
+
+    /* warm up caches and branch predictors for both paths */
+    run(v,fds,false,dispatch_rounds / 10);
+    run(s,fds,false,dispatch_rounds / 10);
+
+    double v_dispatch = run(v,fds,false,dispatch_rounds);
+    double s_dispatch = run(s,fds,false,dispatch_rounds);
+    double v_io = run(v,fds,true,io_rounds);
+    double s_io = run(s,fds,true,io_rounds);
+
+    printf("connections %d\n",conn_count);
+    printf("%-10s %14s %14s %8s\n","mode","virtual ns/ev","static ns/ev","speedup");
+    printf("%-10s %14.2f %14.2f %7.2fx\n","dispatch",v_dispatch,s_dispatch,v_dispatch / s_dispatch);
+    printf("%-10s %14.2f %14.2f %7.2fx\n","io",v_io,s_io,v_io / s_io);
+
+    for(size_t i = 0;i < fds.size();i++)
+    {
+        ::close(fds[i].server);
+        ::close(fds[i].client);
+    }
+    return 0;
+}
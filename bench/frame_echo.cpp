@@ -0,0 +1,176 @@
+/**
+  * @brief echo of small length-prefixed messages,one server path against another
+  * @note the server runs in this process (conv_multi,config from CONV_EVENT_CONF),the clients
+  *       are blocking sockets with TCP_NODELAY,each sending depth messages then reading depth answers.
+  *         split  : header and payload by two send(),as send_with_header was before the frame codec
+  *         header : recv_with_header/send_with_header,one sendmsg per message
+  *         frames : frame_reader/frame_writer,every complete frame of a read answered by one send
+  *       header and split carry the trailing '\0' send_with_header counts in the size.
+  *       CONV_EVENT_CONF=conf/conf.json frame_echo split|header|frames [connections] [depth] [seconds] [size]
+  */
+#include "core/conv_multi.h"
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    class header_echo : public hzd::conn {
+        std::string data;
+    public:
+        static bool split;
+
+        bool process_in() override
+        {
+            data.clear();
+            if(!recv_with_header(data)) return false;
+            next(EPOLLOUT);
+            return true;
+        }
+        bool process_out() override
+        {
+            if(!data.empty() && data.back() == '\0') data.pop_back();
+            if(split)
+            {
+                /* header by itself,payload behind it: the second segment waits for the ACK of the first */
+                hzd::header h{data.size() + 1};
+                if(::send(socket_fd,&h,sizeof(hzd::header),MSG_NOSIGNAL) != (ssize_t)sizeof(hzd::header)) return false;
+                if(::send(socket_fd,data.c_str(),data.size() + 1,MSG_NOSIGNAL) != (ssize_t)data.size() + 1) return false;
+            }
+            else if(!send_with_header(data)) return false;
+            next(EPOLLIN);
+            return true;
+        }
+    };
+    bool header_echo::split = false;
+
+    class frame_echo : public hzd::conn {
+        hzd::frame_reader reader;
+        hzd::frame_writer writer;
+    public:
+        void init(int _socket_fd,sockaddr_in* _addr,int _epoll_fd,bool et,bool _one_shot,
+                  hzd::lock_queue<int>* cq = nullptr,bool add = true) override
+        {
+            reader.clear();
+            hzd::conn::init(_socket_fd,_addr,_epoll_fd,et,_one_shot,cq,add);
+        }
+        bool process_in() override
+        {
+            bool open = recv_frames(reader);
+            hzd::frame_view frame{};
+            writer.clear();
+            while(reader.next(frame)) writer.append(frame);
+            if(!send_frames(writer) || !open || reader.bad()) return false;
+            next(EPOLLIN);
+            return true;
+        }
+        bool process_out() override { return true; }
+    };
+
+    bool wait_port(int port)
+    {
+        for(int i = 0;i < 100;i++)
+        {
+            int fd = socket(AF_INET,SOCK_STREAM,0);
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(port);
+            addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+            bool ok = connect(fd,(sockaddr*)&addr,sizeof(addr)) == 0;
+            close(fd);
+            if(ok) return true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        return false;
+    }
+}
+
+int main(int argc,char** argv)
+{
+    std::string mode = argc > 1 ? argv[1] : "";
+    int connections = argc > 2 ? atoi(argv[2]) : 32;
+    int depth = argc > 3 ? atoi(argv[3]) : 1;
+    int seconds = argc > 4 ? atoi(argv[4]) : 5;
+    size_t size = argc > 5 ? strtoull(argv[5],nullptr,10) : 64;
+    if(mode != "split" && mode != "header" && mode != "frames")
+    {
+        fprintf(stderr,"usage: %s split|header|frames [connections] [depth] [seconds] [size]\n",argv[0]);
+        return -1;
+    }
+    /* the old wire format,size counts a trailing '\0' */
+    bool zero = mode != "frames";
+    header_echo::split = mode == "split";
+    std::thread([zero] {
+        if(zero)
+        {
+            hzd::conv_multi<header_echo> server;
+            server.wait();
+        }
+        else
+        {
+            hzd::conv_multi<frame_echo> server;
+            server.wait();
+        }
+    }).detach();
+    int port = (int32_t)hzd::configure::get_config()["port"];
+    if(!wait_port(port))
+    {
+        fprintf(stderr,"server is not listening on %d\n",port);
+        _exit(-1);
+    }
+
+    std::atomic<bool> stop{false};
+    std::atomic<long> total{0};
+    std::vector<std::thread> clients;
+    for(int c = 0;c < connections;c++)
+    {
+        clients.emplace_back([&] {
+            int fd = socket(AF_INET,SOCK_STREAM,0);
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(port);
+            addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+            if(connect(fd,(sockaddr*)&addr,sizeof(addr)) != 0) return;
+            int one = 1;
+            setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+            hzd::header h{zero ? size + 1 : size};
+            std::string message((const char*)&h,sizeof(hzd::header));
+            message.append(size,'x');
+            if(zero) message += '\0';
+            std::string batch;
+            for(int i = 0;i < depth;i++) batch += message;
+            std::vector<char> answers(message.size() * depth);
+            long n = 0;
+            while(!stop)
+            {
+                if(::send(fd,batch.data(),batch.size(),MSG_NOSIGNAL) != (ssize_t)batch.size()) break;
+                size_t got = 0;
+                while(got < answers.size())
+                {
+                    ssize_t r = ::recv(fd,answers.data() + got,answers.size() - got,0);
+                    if(r <= 0) break;
+                    got += r;
+                }
+                if(got < answers.size()) break;
+                n += depth;
+            }
+            total += n;
+            close(fd);
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    stop = true;
+    for(auto& t : clients) t.join();
+
+    printf("mode %s connections %d depth %d size %zu\n",mode.c_str(),connections,depth,size);
+    printf("%.0f msg/s\n",(double)total.load() / seconds);
+    fflush(stdout);
+    /* the server thread never returns */
+    _exit(0);
+}
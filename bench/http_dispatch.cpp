@@ -0,0 +1,191 @@
+/**
+  * @brief parse and dispatch of a static GET,the exception based path against the current one
+  * @note the old path is kept here as it was before 451da2e: the method looked up by at()
+  *       inside try,and a url with no router thrown out of CONV_CHECK_ROUTER and caught
+  *       to fall back to the static file handler.both parse the same request and look up
+  *       the same router tree,the file itself is not sent.
+  *       CONV_EVENT_CONF=conf/conf.json http_dispatch [iterations]
+  */
+#include "http/http_conn.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+
+namespace {
+
+    /* stands in for send_static(),both paths end in it */
+    size_t static_file(const std::string& url)
+    {
+        return url.size();
+    }
+
+    class probe : public hzd::http_conn {
+#define OLD_CHECK_ROUTER(_method) do{      \
+    router* r = route(req_header.url,&matched_filter);\
+        if(!r || !r->allow(req_header.method))\
+        {                                   \
+            throw std::exception();         \
+        }                                   \
+        return r->_method(this);            \
+    }while(0)
+
+        bool old_parse_header(const std::string& data)
+        {
+            size_t request_line_pos = data.find("\r\n");
+            size_t p1 = data.find(' ');
+            if(p1 != std::string::npos)
+            {
+                std::string m = data.substr(0,p1);
+                try
+                {
+                    req_header.method = http_method_map_string_to_method.at(m);
+                    size_t p2 = data.find(' ',p1+1);
+                    if(p2 != std::string::npos)
+                    {
+                        std::string url = data.substr(p1 + 1,p2 - p1 -1);
+                        size_t start = url.find('?');
+                        if(start == std::string::npos)
+                        {
+                            req_header.url = url;
+                        }
+                        else
+                        {
+                            req_header.url = url.substr(0,start);
+                            start += 1;
+                            size_t end = start;
+                            while(end != std::string::npos)
+                            {
+                                end = url.find_first_of("&=",start);
+                                std::string key = url.substr(start,end-start);
+                                start = end + 1;
+                                end = url.find_first_of('&',start);
+                                std::string value = url.substr(start,end-start);
+                                req_header.parameters.emplace(std::move(key),std::move(value));
+                                start = end + 1;
+                            }
+                        }
+                        std::string v = data.substr(p2+1,request_line_pos-p2-1);
+                        if(v == "HTTP/1.0") req_header.version = HTTP_1_0;
+                        else if(v == "HTTP/1.1") req_header.version = HTTP_1_1;
+                        else if(v == "HTTP/2.0") req_header.version = HTTP_2_0;
+                        else
+                        {
+                            throw std::exception();
+                        }
+                    }
+                }
+                catch(...)
+                {
+                    return false;
+                }
+            }
+            std::stringstream ss(data.substr(request_line_pos + 2));
+            std::string line;
+            std::string last_header;
+            while(getline(ss,line))
+            {
+                if(line.empty()) break;
+                line.erase(line.end()-1);
+                if(line[0] == ' ' || line[0] == '\t')
+                {
+                    if(!last_header.empty())
+                    {
+                        req_header.request_headers[last_header].back() += line;
+                    }
+                }
+                else
+                {
+                    auto pos = line.find(':');
+                    if(pos != std::string::npos)
+                    {
+                        std::string name = line.substr(0,pos);
+                        std::string value = line.substr(pos + 1);
+                        value.erase(0,value.find_first_not_of(' '));
+                        value.erase(value.find_last_not_of(' ') + 1);
+                        std::vector<std::string> values;
+                        if(name == "User-Agent")
+                        {
+                            values.emplace_back(value);
+                            req_header.request_headers[name] = values;
+                            continue;
+                        }
+                        std::stringstream value_ss(value);
+                        std::string value_line;
+                        while(getline(value_ss,value_line,','))
+                        {
+                                values.emplace_back(value_line);
+                        }
+                        req_header.request_headers[name] = values;
+                        last_header = name;
+                    }
+                }
+            }
+            return true;
+        }
+
+        size_t old_get()
+        {
+            try
+            {
+                OLD_CHECK_ROUTER(method_get);
+            }
+            catch(...)
+            {
+                return static_file(req_header.url);
+            }
+        }
+        size_t new_get()
+        {
+            matched_router = route(req_header.url,&matched_filter);
+            CONV_CHECK_ROUTER(method_get,return static_file(req_header.url));
+        }
+    public:
+        size_t old_path(const std::string& request)
+        {
+            clear_in();
+            if(!old_parse_header(request)) return 0;
+            return old_get();
+        }
+        size_t new_path(const std::string& request)
+        {
+            clear_in();
+            if(!parse_header(request)) return 0;
+            return new_get();
+        }
+    };
+
+    template<class F>
+    double measure(long iterations,F&& f)
+    {
+        size_t sink = 0;
+        auto begin = std::chrono::steady_clock::now();
+        for(long i = 0;i < iterations;i++) sink += f(i);
+        auto end = std::chrono::steady_clock::now();
+        if(sink == 0) exit(-1);
+        return std::chrono::duration<double,std::nano>(end - begin).count() / (double)iterations;
+    }
+}
+
+int main(int argc,char** argv)
+{
+    long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+    /* the request load_gen sends for a keep-alive static GET,cut before the blank line as process_request() does */
+    const std::string request = "GET /index.html HTTP/1.1\r\nHost: 127.0.0.1\r\n";
+
+    probe p;
+    auto old_path = [&](long) { return p.old_path(request); };
+    auto new_path = [&](long) { return p.new_path(request); };
+
+    measure(iterations / 10,old_path);
+    measure(iterations / 10,new_path);
+
+    double o = measure(iterations,old_path);
+    double n = measure(iterations,new_path);
+
+    printf("iterations %ld\n",iterations);
+    printf("%-22s %10s\n","path","ns/op");
+    printf("%-22s %10.2f\n","try+throw (before)",o);
+    printf("%-22s %10.2f\n","find+fallback (after)",n);
+    return 0;
+}
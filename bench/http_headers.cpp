@@ -0,0 +1,84 @@
+/**
+  * @brief response header serialization,the ostringstream/map path against append()+serialize()
+  * @note the old path is kept here as it was before response_header::append() existed:
+  *       every header hashed into response_headers,then written through an ostringstream.
+  *       both build "Content-Length" and "Content-Type",the new one also writes Date.
+  *       CONV_EVENT_CONF=conf/conf.json http_headers [iterations]
+  */
+#include "http/http_conn.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+
+namespace {
+
+    std::string old_to_string(hzd::http_Version version,hzd::http_Status status,
+                              const std::unordered_map<std::string,std::string>& headers)
+    {
+        std::ostringstream buffer;
+        buffer << hzd::http_version_map.at(version) << " " << std::to_string((int32_t)status) << " "
+               << hzd::http_status_map.at(status) << "\r\n";
+        for(const auto & p : headers)
+        {
+            buffer << p.first << ":" << p.second << "\r\n";
+        }
+        buffer << "\r\n";
+        return buffer.str();
+    }
+
+    template<class F>
+    double measure(long iterations,F&& f)
+    {
+        size_t sink = 0;
+        auto begin = std::chrono::steady_clock::now();
+        for(long i = 0;i < iterations;i++) sink += f(i);
+        auto end = std::chrono::steady_clock::now();
+        if(sink == 0) exit(-1);
+        return std::chrono::duration<double,std::nano>(end - begin).count() / (double)iterations;
+    }
+}
+
+int main(int argc,char** argv)
+{
+    long iterations = argc > 1 ? atol(argv[1]) : 2000000;
+    const std::string type = "text/html";
+
+    auto old_path = [&](long i) {
+        std::unordered_map<std::string,std::string> headers;
+        headers["Content-Length"] = std::to_string(1000 + (i & 1023));
+        headers["Content-Type"] = type;
+        return old_to_string(hzd::HTTP_1_1,hzd::http_Status::OK,headers).size();
+    };
+    hzd::http_conn::response_header header{};
+    header.version = hzd::HTTP_1_1;
+    header.status = hzd::http_Status::OK;
+    auto new_path = [&](long i) {
+        header.clear();
+        header.append("Content-Length",(size_t)(1000 + (i & 1023)));
+        header.append("Content-Type",type);
+        return header.serialize().size();
+    };
+    /* a user header next to the written ones,as a handler setting its own */
+    auto new_user_path = [&](long i) {
+        header.clear();
+        header.response_headers["Cache-Control"] = "no-cache";
+        header.append("Content-Length",(size_t)(1000 + (i & 1023)));
+        header.append("Content-Type",type);
+        return header.serialize().size();
+    };
+
+    measure(iterations / 10,old_path);
+    measure(iterations / 10,new_path);
+
+    double o = measure(iterations,old_path);
+    double n = measure(iterations,new_path);
+    double u = measure(iterations,new_user_path);
+
+    printf("iterations %ld\n",iterations);
+    printf("%-22s %10s\n","path","ns/op");
+    printf("%-22s %10.2f\n","ostringstream+map",o);
+    printf("%-22s %10.2f\n","append+serialize",n);
+    printf("%-22s %10.2f\n","append+serialize+user",u);
+    return 0;
+}
@@ -0,0 +1,567 @@
+/**
+  * @brief epoll based HTTP/1.1 load generator
+  * @note closed loop: every connection keeps --pipeline requests in flight.
+  *       open loop: --rate requests per second are scheduled whatever the server does,
+  *       latency is taken from the scheduled time,so a stalled server is not hidden
+  *       by the client waiting for it.--new-conn sends every request on a connection
+  *       of its own.a request whose response has not come --timeout seconds after the
+  *       connection last read anything is counted missing,and the connection is opened again.
+  *       after --duration no request is sent,the ones in flight get --timeout to be answered.
+  *       prints one JSON object,tags given by --tag key=value are copied into it,
+  *       and exits with 1 when no request was answered or a response went missing.
+  *       depends on nothing in the tree,so it builds without the async_logger submodule
+  */
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+#include <ctime>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+    /* 32 buckets per power of two,about 3% wide */
+    const int SUB_BITS = 5;
+    const int BUCKETS = (40 - SUB_BITS + 1) << SUB_BITS;
+
+    int64_t now_ns()
+    {
+        timespec ts{};
+        clock_gettime(CLOCK_MONOTONIC,&ts);
+        return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+    struct histogram
+    {
+        std::vector<uint64_t> buckets = std::vector<uint64_t>(BUCKETS,0);
+        uint64_t count{0};
+        uint64_t max{0};
+        double sum{0};
+
+        static size_t index(uint64_t v)
+        {
+            if(v < (1u << SUB_BITS)) return (size_t)v;
+            int e = 63 - __builtin_clzll(v);
+            if(e > 40) return BUCKETS - 1;
+            size_t sub = (size_t)(v >> (e - SUB_BITS)) & ((1u << SUB_BITS) - 1);
+            return ((size_t)(e - SUB_BITS + 1) << SUB_BITS) + sub;
+        }
+        static uint64_t upper(size_t i)
+        {
+            if(i < (1u << SUB_BITS)) return i + 1;
+            size_t e = (i >> SUB_BITS) + SUB_BITS - 1;
+            size_t sub = i & ((1u << SUB_BITS) - 1);
+            return (uint64_t)((1u << SUB_BITS) + sub + 1) << (e - SUB_BITS);
+        }
+        void record(uint64_t v)
+        {
+            buckets[index(v)]++;
+            count++;
+            sum += v;
+            if(v > max) max = v;
+        }
+        void merge(const histogram& o)
+        {
+            for(int i = 0;i < BUCKETS;i++) buckets[i] += o.buckets[i];
+            count += o.count;
+            sum += o.sum;
+            if(o.max > max) max = o.max;
+        }
+        uint64_t percentile(double q) const
+        {
+            if(count == 0) return 0;
+            uint64_t rank = (uint64_t)(q * count);
+            uint64_t seen = 0;
+            for(int i = 0;i < BUCKETS;i++)
+            {
+                seen += buckets[i];
+                if(seen > rank) return std::min(upper(i),max);
+            }
+            return max;
+        }
+    };
+
+    struct options
+    {
+        std::string host{"127.0.0.1"};
+        int port{9999};
+        int connections{64};
+        int threads{1};
+        double duration{10};
+        double warmup{1};
+        int pipeline{1};
+        bool new_conn{false};
+        /* requests per second over all threads,0 runs a closed loop */
+        double rate{0};
+        /* bytes of padding header added to every request */
+        size_t request_size{0};
+        /* seconds a connection with requests in flight may read nothing */
+        double timeout{2};
+        std::string path{"/"};
+        std::vector<std::pair<std::string,std::string>> tags;
+    };
+
+    struct result
+    {
+        uint64_t requests{0};
+        uint64_t errors{0};
+        /* requests sent and never answered,also counted in errors */
+        uint64_t timeouts{0};
+        uint64_t connects{0};
+        uint64_t bytes_in{0};
+        uint64_t bytes_out{0};
+        histogram latency;
+    };
+
+    struct connection
+    {
+        int fd{-1};
+        bool connected{false};
+        /* start times of requests sent and not answered */
+        std::deque<int64_t> in_flight;
+        /* open loop: start times of requests due but not sent yet */
+        std::deque<int64_t> backlog;
+        std::string out;
+        size_t out_offset{0};
+        std::string in;
+        /* body bytes of the response being read,-1 while its header is incomplete */
+        int64_t body_left{-1};
+        /* last read,or the send that put the first request in flight */
+        int64_t progress{0};
+        uint32_t events{0};
+    };
+
+    class worker {
+        const options& opt;
+        sockaddr_in addr{};
+        int epoll_fd{-1};
+        std::vector<connection> conns;
+        std::string request;
+        double rate;
+        int64_t measure_from;
+        int64_t stop_at;
+        int64_t next_due{0};
+        size_t next_conn{0};
+        int64_t next_check{0};
+        /* past stop_at,only answers of requests in flight are waited for */
+        bool draining{false};
+    public:
+        result res;
+
+        worker(const options& _opt,int count,double _rate,int64_t _measure_from,int64_t _stop_at)
+        : opt(_opt),conns(count),rate(_rate),measure_from(_measure_from),stop_at(_stop_at)
+        {
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons((uint16_t)opt.port);
+            inet_pton(AF_INET,opt.host.c_str(),&addr.sin_addr);
+            request = "GET " + opt.path + " HTTP/1.1\r\nHost: " + opt.host + "\r\n";
+            if(opt.request_size > 0) request += "X-Pad: " + std::string(opt.request_size,'p') + "\r\n";
+            if(opt.new_conn) request += "Connection: close\r\n";
+            request += "\r\n";
+        }
+        ~worker()
+        {
+            for(connection& c : conns) if(c.fd != -1) ::close(c.fd);
+            if(epoll_fd != -1) ::close(epoll_fd);
+        }
+        void run()
+        {
+            epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+            for(size_t i = 0;i < conns.size();i++) _open_(i);
+            next_due = now_ns();
+            std::vector<epoll_event> events(conns.size() + 1);
+            while(now_ns() < stop_at)
+            {
+                int timeout = 100;
+                if(rate > 0)
+                {
+                    _schedule_();
+                    int64_t wait = next_due - now_ns();
+                    timeout = wait <= 0 ? 0 : (int)std::min<int64_t>(wait / 1000000 + 1,100);
+                }
+                int n = epoll_wait(epoll_fd,events.data(),(int)events.size(),timeout);
+                if(n < 0 && errno != EINTR) break;
+                for(int i = 0;i < n;i++) _handle_((size_t)events[i].data.u64,events[i].events);
+                _check_(false);
+            }
+            draining = true;
+            int64_t give_up = stop_at + (int64_t)(opt.timeout * 1e9);
+            while(_waiting_() && now_ns() < give_up)
+            {
+                int n = epoll_wait(epoll_fd,events.data(),(int)events.size(),10);
+                if(n < 0 && errno != EINTR) break;
+                for(int i = 0;i < n;i++) _handle_((size_t)events[i].data.u64,events[i].events);
+            }
+            _check_(true);
+        }
+    private:
+        bool _measured_(int64_t start) const { return start >= measure_from; }
+        bool _measuring_() const { return now_ns() >= measure_from; }
+
+        bool _waiting_() const
+        {
+            for(const connection& c : conns) if(c.fd != -1 && !c.in_flight.empty()) return true;
+            return false;
+        }
+        /* count requests of connections silent for --timeout as missing,all of them at the end */
+        void _check_(bool end)
+        {
+            int64_t now = now_ns();
+            if(!end && now < next_check) return;
+            next_check = now + 10000000;
+            int64_t limit = (int64_t)(opt.timeout * 1e9);
+            for(size_t i = 0;i < conns.size();i++)
+            {
+                connection& c = conns[i];
+                if(c.fd == -1 || c.in_flight.empty() || (!end && now - c.progress < limit)) continue;
+                res.timeouts += c.in_flight.size();
+                res.errors += c.in_flight.size();
+                c.in_flight.clear();
+                if(!end) _reopen_(i,false);
+            }
+        }
+
+        void _watch_(size_t i,uint32_t events)
+        {
+            connection& c = conns[i];
+            if(events == c.events) return;
+            epoll_event ev{};
+            ev.events = events;
+            ev.data.u64 = i;
+            epoll_ctl(epoll_fd,c.events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,c.fd,&ev);
+            c.events = events;
+        }
+        void _open_(size_t i)
+        {
+            connection& c = conns[i];
+            c = connection();
+            c.fd = socket(AF_INET,SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,0);
+            int one = 1;
+            setsockopt(c.fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+            if(connect(c.fd,(sockaddr*)&addr,sizeof(addr)) != 0 && errno != EINPROGRESS)
+            {
+                res.errors++;
+                ::close(c.fd);
+                c.fd = -1;
+                return;
+            }
+            res.connects++;
+            _watch_(i,EPOLLOUT);
+            if(rate <= 0) _fill_(i);
+        }
+        void _reopen_(size_t i,bool error)
+        {
+            connection& c = conns[i];
+            if(error) res.errors += c.in_flight.size() ? c.in_flight.size() : 1;
+            std::deque<int64_t> backlog;
+            backlog.swap(c.backlog);
+            /* requests not answered are sent again with their original start time */
+            for(int64_t t : c.in_flight) backlog.push_back(t);
+            if(c.fd != -1) ::close(c.fd);
+            c.fd = -1;
+            if(now_ns() >= stop_at)
+            {
+                c.in_flight.clear();
+                return;
+            }
+            _open_(i);
+            for(int64_t t : backlog) conns[i].backlog.push_back(t);
+            _fill_(i);
+        }
+        /* closed loop: top up to the pipeline depth,open loop: send what is due */
+        void _fill_(size_t i)
+        {
+            connection& c = conns[i];
+            int depth = opt.new_conn ? 1 : opt.pipeline;
+            if(c.in_flight.empty()) c.progress = now_ns();
+            while(!draining && (int)c.in_flight.size() < depth)
+            {
+                int64_t start;
+                if(rate > 0)
+                {
+                    if(c.backlog.empty()) break;
+                    start = c.backlog.front();
+                    c.backlog.pop_front();
+                }
+                else start = now_ns();
+                c.in_flight.push_back(start);
+                c.out += request;
+            }
+            if(c.connected) _write_(i);
+        }
+        void _schedule_()
+        {
+            int64_t now = now_ns();
+            int64_t step = (int64_t)(1e9 / rate);
+            while(next_due <= now)
+            {
+                size_t i = next_conn++ % conns.size();
+                conns[i].backlog.push_back(next_due);
+                next_due += step;
+                if(conns[i].fd != -1) _fill_(i);
+            }
+        }
+        void _write_(size_t i)
+        {
+            connection& c = conns[i];
+            while(c.out_offset < c.out.size())
+            {
+                ssize_t n = ::send(c.fd,c.out.data() + c.out_offset,c.out.size() - c.out_offset,MSG_NOSIGNAL);
+                if(n > 0)
+                {
+                    c.out_offset += n;
+                    if(_measuring_()) res.bytes_out += n;
+                    continue;
+                }
+                if(n < 0 && errno == EINTR) continue;
+                if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                {
+                    _watch_(i,EPOLLIN | EPOLLOUT);
+                    return;
+                }
+                _reopen_(i,true);
+                return;
+            }
+            c.out.clear();
+            c.out_offset = 0;
+            _watch_(i,EPOLLIN);
+        }
+        /* one response completed on connection i */
+        void _complete_(size_t i)
+        {
+            connection& c = conns[i];
+            int64_t start = c.in_flight.front();
+            c.in_flight.pop_front();
+            int64_t now = now_ns();
+            if(_measured_(start) && now < stop_at)
+            {
+                res.requests++;
+                res.latency.record((uint64_t)((now - start) / 1000));
+            }
+        }
+        /* take complete responses out of the read buffer */
+        bool _parse_(size_t i)
+        {
+            connection& c = conns[i];
+            size_t pos = 0;
+            for(;;)
+            {
+                if(c.body_left < 0)
+                {
+                    size_t end = c.in.find("\r\n\r\n",pos);
+                    if(end == std::string::npos) break;
+                    int64_t length = 0;
+                    for(size_t p = pos;p < end;)
+                    {
+                        size_t eol = c.in.find("\r\n",p);
+                        if(eol > end) eol = end;
+                        if(eol - p > 15 && strncasecmp(c.in.data() + p,"content-length:",15) == 0)
+                            length = strtoll(c.in.c_str() + p + 15,nullptr,10);
+                        p = eol + 2;
+                    }
+                    pos = end + 4;
+                    c.body_left = length;
+                }
+                size_t have = c.in.size() - pos;
+                if((int64_t)have < c.body_left)
+                {
+                    c.body_left -= have;
+                    pos = c.in.size();
+                    break;
+                }
+                pos += c.body_left;
+                c.body_left = -1;
+                if(c.in_flight.empty()) return false;
+                _complete_(i);
+            }
+            c.in.erase(0,pos);
+            return true;
+        }
+        void _read_(size_t i)
+        {
+            connection& c = conns[i];
+            char buffer[65536];
+            for(;;)
+            {
+                ssize_t n = ::recv(c.fd,buffer,sizeof(buffer),0);
+                if(n > 0)
+                {
+                    if(_measuring_()) res.bytes_in += n;
+                    c.in.append(buffer,n);
+                    c.progress = now_ns();
+                    continue;
+                }
+                if(n < 0 && errno == EINTR) continue;
+                if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+                /* peer closed or failed */
+                if(!_parse_(i))
+                {
+                    _reopen_(i,true);
+                    return;
+                }
+                _reopen_(i,!c.in_flight.empty());
+                return;
+            }
+            if(!_parse_(i))
+            {
+                _reopen_(i,true);
+                return;
+            }
+            if(opt.new_conn && c.in_flight.empty())
+            {
+                _reopen_(i,false);
+                return;
+            }
+            _fill_(i);
+        }
+        void _handle_(size_t i,uint32_t events)
+        {
+            connection& c = conns[i];
+            if(c.fd == -1) return;
+            if(!c.connected)
+            {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(c.fd,SOL_SOCKET,SO_ERROR,&err,&len);
+                if(err != 0 || (events & (EPOLLERR | EPOLLHUP)))
+                {
+                    _reopen_(i,true);
+                    return;
+                }
+                c.connected = true;
+                _write_(i);
+                return;
+            }
+            if(events & (EPOLLIN | EPOLLERR | EPOLLHUP)) _read_(i);
+            if(conns[i].fd != -1 && conns[i].connected && (events & EPOLLOUT)) _write_(i);
+        }
+    };
+
+    void usage(const char* name)
+    {
+        fprintf(stderr,
+                "usage: %s [options]\n"
+                "  --host H          server address (127.0.0.1)\n"
+                "  --port P          server port (9999)\n"
+                "  --connections N   connections over all threads (64)\n"
+                "  --threads N       client threads,each with its own epoll (1)\n"
+                "  --duration S      measured seconds (10)\n"
+                "  --warmup S        seconds before measuring (1)\n"
+                "  --pipeline N      requests in flight per connection (1)\n"
+                "  --rate R          open loop at R requests/s,0 for a closed loop (0)\n"
+                "  --new-conn        one connection per request\n"
+                "  --request-size N  padding bytes added to every request (0)\n"
+                "  --path P          request path (/)\n"
+                "  --timeout S       seconds without a read before requests in flight are missing (2)\n"
+                "  --tag K=V         copied into the JSON output,may be repeated\n",
+                name);
+    }
+
+    std::string json_escape(const std::string& s)
+    {
+        std::string out;
+        for(char c : s)
+        {
+            if(c == '"' || c == '\\') out += '\\';
+            out += c;
+        }
+        return out;
+    }
+}
+
+int main(int argc,char** argv)
+{
+    options opt;
+    for(int i = 1;i < argc;i++)
+    {
+        std::string a = argv[i];
+        auto value = [&]() -> const char* {
+            if(i + 1 >= argc) { usage(argv[0]); exit(2); }
+            return argv[++i];
+        };
+        if(a == "--host") opt.host = value();
+        else if(a == "--port") opt.port = atoi(value());
+        else if(a == "--connections") opt.connections = atoi(value());
+        else if(a == "--threads") opt.threads = atoi(value());
+        else if(a == "--duration") opt.duration = atof(value());
+        else if(a == "--warmup") opt.warmup = atof(value());
+        else if(a == "--pipeline") opt.pipeline = atoi(value());
+        else if(a == "--rate") opt.rate = atof(value());
+        else if(a == "--new-conn") opt.new_conn = true;
+        else if(a == "--request-size") opt.request_size = strtoull(value(),nullptr,10);
+        else if(a == "--path") opt.path = value();
+        else if(a == "--timeout") opt.timeout = atof(value());
+        else if(a == "--tag")
+        {
+            std::string t = value();
+            size_t eq = t.find('=');
+            if(eq == std::string::npos) { usage(argv[0]); return 2; }
+            opt.tags.emplace_back(t.substr(0,eq),t.substr(eq + 1));
+        }
+        else { usage(argv[0]); return 2; }
+    }
+    if(opt.threads < 1) opt.threads = 1;
+    if(opt.connections < opt.threads) opt.connections = opt.threads;
+    if(opt.pipeline < 1) opt.pipeline = 1;
+
+    int64_t begin = now_ns();
+    int64_t measure_from = begin + (int64_t)(opt.warmup * 1e9);
+    int64_t stop_at = measure_from + (int64_t)(opt.duration * 1e9);
+    std::vector<std::unique_ptr<worker>> workers;
+    for(int t = 0;t < opt.threads;t++)
+    {
+        int count = opt.connections / opt.threads + (t < opt.connections % opt.threads ? 1 : 0);
+        workers.emplace_back(new worker(opt,count,opt.rate / opt.threads,measure_from,stop_at));
+    }
+    std::vector<std::thread> threads;
+    for(auto& w : workers) threads.emplace_back([&w] { w->run(); });
+    for(auto& t : threads) t.join();
+
+    result total;
+    for(auto& w : workers)
+    {
+        total.requests += w->res.requests;
+        total.errors += w->res.errors;
+        total.timeouts += w->res.timeouts;
+        total.connects += w->res.connects;
+        total.bytes_in += w->res.bytes_in;
+        total.bytes_out += w->res.bytes_out;
+        total.latency.merge(w->res.latency);
+    }
+    double seconds = opt.duration;
+    printf("{");
+    for(auto& t : opt.tags) printf("\"%s\":\"%s\",",json_escape(t.first).c_str(),json_escape(t.second).c_str());
+    printf("\"mode\":\"%s\",\"connections\":%d,\"threads\":%d,\"pipeline\":%d,\"new_conn\":%s,"
+           "\"rate\":%.0f,\"request_size\":%zu,\"duration\":%.3f,",
+           opt.rate > 0 ? "open" : "closed",opt.connections,opt.threads,opt.new_conn ? 1 : opt.pipeline,
+           opt.new_conn ? "true" : "false",opt.rate,opt.request_size,seconds);
+    printf("\"requests\":%llu,\"errors\":%llu,\"timeouts\":%llu,\"connects\":%llu,\"rps\":%.1f,"
+           "\"bytes_in\":%llu,\"bytes_out\":%llu,",
+           (unsigned long long)total.requests,(unsigned long long)total.errors,(unsigned long long)total.timeouts,
+           (unsigned long long)total.connects,
+           total.requests / seconds,(unsigned long long)total.bytes_in,(unsigned long long)total.bytes_out);
+    const histogram& h = total.latency;
+    printf("\"latency_us\":{\"mean\":%.1f,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu}}\n",
+           h.count ? h.sum / h.count : 0.0,
+           (unsigned long long)h.percentile(0.5),(unsigned long long)h.percentile(0.9),
+           (unsigned long long)h.percentile(0.99),(unsigned long long)h.percentile(0.999),
+           (unsigned long long)h.max);
+    if(total.timeouts) fprintf(stderr,"%llu responses missing\n",(unsigned long long)total.timeouts);
+    return total.requests && !total.timeouts ? 0 : 1;
+}
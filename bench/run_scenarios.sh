@@ -0,0 +1,148 @@
+#!/bin/sh
+# Runs bench_server (raw static_conn) or bench_http_server (http_conn serving a file)
+# in every scenario and drives it with load_gen under every load.
+# Prints one JSON object per run (JSON lines),to stdout or to $OUT.
+#
+#   run_scenarios.sh <dir of bench_server,bench_http_server and load_gen>
+#
+# environment:
+#   SCENARIOS   scenario names to run,all by default
+#   LOADS       load names to run,all by default
+#   DURATION    measured seconds per run (5)     WARMUP    seconds before (1)
+#   CONNECTIONS connections (64)                 THREADS   load_gen threads (2)
+#   PIPELINE    depth of the pipelined load (16) RATE      requests/s of the open loop (20000)
+#   SIZES       response body sizes (2 4096)     REQUEST_SIZE padding of requests (0)
+#   PORT        port of bench_server (9998)      OUT       result file
+set -e
+
+BIN=${1:-.}
+RAW_SERVER="$BIN/bench_server"
+HTTP_SERVER="$BIN/bench_http_server"
+LOADGEN="$BIN/load_gen"
+[ -x "$RAW_SERVER" ] && [ -x "$HTTP_SERVER" ] && [ -x "$LOADGEN" ] || {
+    echo "bench_server,bench_http_server and load_gen not found in $BIN" >&2; exit 1; }
+
+DURATION=${DURATION:-5}
+WARMUP=${WARMUP:-1}
+CONNECTIONS=${CONNECTIONS:-64}
+THREADS=${THREADS:-2}
+PIPELINE=${PIPELINE:-16}
+RATE=${RATE:-20000}
+SIZES=${SIZES:-"2 4096"}
+REQUEST_SIZE=${REQUEST_SIZE:-0}
+PORT=${PORT:-9998}
+OUT=${OUT:-/dev/stdout}
+
+# name model thread_pool et one_shot object_pool,http_ models run bench_http_server
+ALL_SCENARIOS="
+single          single      off off on  on
+single_pool_off single      off off on  off
+single_tp       single      on  off on  on
+single_et       single      off on  on  on
+single_no_1shot single      off off off on
+multi           multi       off off on  on
+multi_pool_off  multi       off off on  off
+multi_tp        multi       on  off on  on
+multi_et        multi       off on  on  on
+multi_no_1shot  multi       off off off on
+http_single     http_single off off on  on
+http_single_tp  http_single on  off on  on
+http_multi      http_multi  off off on  on
+http_multi_tp   http_multi  on  off on  on
+"
+ALL_LOADS="keepalive pipelined new_conn open_loop"
+
+WORK=$(mktemp -d)
+SERVER_PID=
+cleanup()
+{
+    [ -n "$SERVER_PID" ] && kill -INT "$SERVER_PID" 2>/dev/null && wait "$SERVER_PID" 2>/dev/null
+    rm -rf "$WORK"
+}
+trap cleanup EXIT INT TERM
+
+wanted()
+{
+    [ -z "$1" ] && return 0
+    for w in $1; do [ "$w" = "$2" ] && return 0; done
+    return 1
+}
+
+write_conf()
+{
+    # keys enabling the thread pool and the object pool switch them on by being present
+    {
+        echo '{'
+        echo '    "ip" : "127.0.0.1",'
+        echo "    \"port\" : $PORT,"
+        echo '    "max_connect_count" : 200000,'
+        echo '    "max_events_count" : 4096,'
+        echo '    "listen_queue_count" : 4096,'
+        echo '    "reactor_count" : 4,'
+        [ "$2" = on ] && echo '    "multi_thread" : true,' && echo '    "thread_count" : 8,'
+        [ "$5" = on ] && echo '    "object_pool" : true,' && echo '    "object_pool_size" : 1024,'
+        echo "    \"resource_path\" : \"$WORK/resource\","
+        echo '    "keep_alive_timeout" : 0,'
+        echo '    "keep_alive_max" : 0,'
+        echo '    "file_cache" : true,'
+        echo '    "address_reuse" : true,'
+        echo '    "config_watch" : false,'
+        echo '    "metrics" : false,'
+        echo "    \"et\" : $([ "$3" = on ] && echo true || echo false),"
+        echo "    \"one_shot\" : $([ "$4" = on ] && echo true || echo false)"
+        echo '}'
+    } > "$1"
+}
+
+wait_port()
+{
+    i=0
+    while [ $i -lt 50 ]; do
+        "$LOADGEN" --port "$PORT" --path /index.html --duration 0.05 --warmup 0 --connections 1 >/dev/null 2>&1 && return 0
+        sleep 0.1
+        i=$((i + 1))
+    done
+    return 1
+}
+
+while read -r name model tp et oneshot pool; do
+    [ -z "$name" ] && continue
+    wanted "$SCENARIOS" "$name" || continue
+    case $model in
+        http_*) server=$HTTP_SERVER; server_model=${model#http_} ;;
+        *)      server=$RAW_SERVER;  server_model=$model ;;
+    esac
+    for size in $SIZES; do
+        write_conf "$WORK/conf.json" "$tp" "$et" "$oneshot" "$pool"
+        mkdir -p "$WORK/resource"
+        head -c "$size" /dev/zero | tr '\0' 'x' > "$WORK/resource/index.html"
+        CONV_EVENT_CONF="$WORK/conf.json" BENCH_RESPONSE_SIZE=$size "$server" "$server_model" >"$WORK/server.log" 2>&1 &
+        SERVER_PID=$!
+        # a server left on the port would answer for one that failed to start
+        if ! wait_port || ! kill -0 "$SERVER_PID" 2>/dev/null; then
+            echo "$(basename "$server") did not start for $name,see its output:" >&2
+            cat "$WORK/server.log" >&2
+            exit 1
+        fi
+        for load in $ALL_LOADS; do
+            wanted "$LOADS" "$load" || continue
+            case $load in
+                keepalive) args="" ;;
+                pipelined) args="--pipeline $PIPELINE" ;;
+                new_conn)  args="--new-conn" ;;
+                open_loop) args="--rate $RATE" ;;
+            esac
+            # shellcheck disable=SC2086
+            "$LOADGEN" --port "$PORT" --path /index.html --duration "$DURATION" --warmup "$WARMUP" \
+                --connections "$CONNECTIONS" --threads "$THREADS" --request-size "$REQUEST_SIZE" $args \
+                --tag scenario="$name" --tag model="$model" --tag thread_pool="$tp" --tag et="$et" \
+                --tag one_shot="$oneshot" --tag object_pool="$pool" --tag load="$load" \
+                --tag response_size="$size" >>"$OUT" || echo "$name $load: no request answered or responses missing" >&2
+        done
+        kill -INT "$SERVER_PID"
+        wait "$SERVER_PID" 2>/dev/null || true
+        SERVER_PID=
+    done
+done <<EOF
+$ALL_SCENARIOS
+EOF
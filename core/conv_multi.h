@@ -2,8 +2,11 @@
 #define CONV_EVENT_CONV_MULTI_H
 
 #include "include/reactor.h"            /* reactor */
+#include "include/placement.h"          /* placement */
+#include "include/trace.h"              /* trace */
 #include "include/acceptor.h"           /* acceptor */
 #include <atomic>                       /* atomic */
+#include <chrono>                       /* milliseconds */
 #include "include/configure.h"          /* configure */
 #include "include/conv_base.h"          /* conv_base */
 
@@ -12,6 +15,13 @@ namespace hzd
     template<typename T>
     void multi_sigint_handler(int signum)
     {
+        /* first signal drains,a second one or drain_timeout 0 exits at once */
+        if(conv_multi<T>::drain_timeout > 0 && !conn::draining())
+        {
+            conn::draining() = true;
+            acceptor<T>::wake();
+            return;
+        }
         conv_multi<T>::run = false;
         async_logger& logger = async_logger::AsyncLogger(
                 L_INFO,"signal interrupt",__FILE__,__LINE__,__FUNCTION__
@@ -28,8 +38,31 @@ namespace hzd
         bool _thread_pool{false};
         acceptor<T> _acceptor;
         connpool<T>* conn_pool{nullptr};
+        std::vector<std::thread> threads;
+        placement balancer;
+        /**
+          * @brief wait until connections are drained or drain_timeout passed
+          * @note the acceptor has stopped,reactors close connections with nothing in flight
+          * @param None
+          * @retval None
+          */
+        void _drain_()
+        {
+            LOG_INFO("draining " + std::to_string(current_connect_count) + " connections");
+            int64_t deadline = loop_clock_ms() + (int64_t)drain_timeout * 1000;
+            while(current_connect_count > 0 && loop_clock_ms() < deadline)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(CONN_DRAIN_CHECK_MS));
+            }
+            if(current_connect_count > 0)
+                LOG_WARN("drain timeout," + std::to_string(current_connect_count) + " connections left");
+            else
+                LOG_INFO("all connections drained");
+        }
     public:
         static bool run;
+        /* seconds a graceful shutdown waits for connections,0 exits at once */
+        static int drain_timeout;
         std::vector<reactor<T>> reactors;
 
         explicit conv_multi(int reactor_count = 4)
@@ -38,6 +71,8 @@ namespace hzd
             signal(SIGINT,multi_sigint_handler<T>);
             signal(SIGTERM,multi_sigint_handler<T>);
             signal(SIGQUIT,multi_sigint_handler<T>);
+            signal(SIGHUP,config_watcher::signal_handler);
+            signal(SIGUSR1,trace::signal_handler);
 
             configure& conf = configure::get_config();
             ip = (const char*)conf.require("ip");
@@ -53,9 +88,16 @@ namespace hzd
                 ET = conf["et"];
             if(conf["reactor_count"].type != JSON_NULL)
                 reactor_count = conf["reactor_count"];
+            if(conf["drain_timeout"].type != JSON_NULL)
+                drain_timeout = (int32_t)conf["drain_timeout"];
+            metrics::load();
+            trace::load();
 
             run = true;
             reactors.resize(reactor_count);
+            balancer.init(reactors.size());
+            if(conf["max_events_count"].type != JSON_NULL)
+                conv_multi::set_max_events_count((int32_t)conf["max_events_count"]);
             reactor<T>::set_run_true();
             _acceptor.init(this);
 
@@ -204,11 +246,26 @@ namespace hzd
           */
         void set_max_events_count(int size) override
         {
-            if(size >= 0)
+            if(size > 0)
             {
                 for(auto& r : reactors) r.set_max_events_count(size);
             }
         }
+        /**
+          * @brief apply reloaded configs
+          * @note called by the acceptor thread
+          * @param None
+          * @retval None
+          */
+        void reconfigure() override
+        {
+            conv_base::reconfigure();
+            configure& conf = configure::get_config();
+            if(conf["drain_timeout"].type != JSON_NULL)
+                drain_timeout = (int32_t)conf["drain_timeout"];
+            for(auto& r : reactors) r.reconfigure();
+            balancer.load();
+        }
         /**
           * @brief set max connection count
           * @note None
@@ -228,19 +285,27 @@ namespace hzd
         {
             if(conn_pool) _acceptor.set_conn_pool(conn_pool);
             reactor<T>::set_run_true();
-            for(auto& r : reactors)
+            for(size_t i = 0;i < reactors.size();i++)
             {
-                r.init(this);
+                reactors[i].init(this,&balancer.at(i),i);
                 using func = void(*)(void*,int);
-                std::thread t(static_cast<func>(reactor<T>::work),(void*)&r,time_out);
-                t.detach();
+                threads.emplace_back(static_cast<func>(reactor<T>::work),(void*)&reactors[i],time_out);
             }
             _acceptor.work();
+            if(conn::draining()) _drain_();
+            reactor<T>::set_run_false();
+            for(auto& t : threads)
+            {
+                if(t.joinable()) t.join();
+            }
+            threads.clear();
             close();
         }
     };
     template<typename T>
     bool conv_multi<T>::run = true;
+    template<typename T>
+    int conv_multi<T>::drain_timeout = 30;
 }
 
 #endif
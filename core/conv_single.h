@@ -5,6 +5,12 @@
 #include "include/threadpool.h"         /* thread_pool */
 #include "include/configure.h"          /* configure */
 #include "include/conv_base.h"          /* conv base */
+#include "include/connector.h"          /* outbound_dispatch */
+#include "include/event_loop.h"         /* event_loop */
+#include "include/handoff.h"            /* listen_handoff */
+#include "include/admission.h"          /* admission */
+#include "include/metrics.h"            /* metrics */
+#include "include/trace.h"              /* trace */
 #include <csignal>                      /* signal */
 
 namespace hzd {
@@ -13,6 +19,12 @@ namespace hzd {
 
     template<typename T>
     void single_sigint_handler(int signum) {
+        /* first signal drains,a second one or drain_timeout 0 exits at once */
+        if(conv_single<T>::drain_timeout > 0 && !conn::draining())
+        {
+            conn::draining() = true;
+            return;
+        }
         conv_single<T>::run = false;
         async_logger& logger = async_logger::AsyncLogger(
                 L_INFO,"signal interrupt",__FILE__,__LINE__,__FUNCTION__
@@ -120,7 +132,8 @@ namespace hzd {
           */
         inline void _register_listen_fd_()
         {
-            if(epoll_add(epoll_fd,socket_fd,ET,false,false) < 0)
+            /* level triggered whatever ET is,one accept per event would leave connections behind */
+            if(epoll_add(epoll_fd,socket_fd,false,false,false) < 0)
             {
                 close();
                 perror("epoll_add");
@@ -140,8 +153,109 @@ namespace hzd {
         threadpool<T>* thread_pool{nullptr};
         connpool<T>* conn_pool{nullptr};
         lock_queue<int>* close_queue{nullptr};
+        event_loop* loop{nullptr};
+        time_t last_idle_check{0};
+        int64_t last_drain_check{0};
+        /* closes put off while a worker still held the connection */
+        std::vector<int> close_later;
+        int64_t drain_deadline{0};
+        std::string handoff_path;
+        listen_handoff handoff;
+        /* listening socket taken from the process running before */
+        bool inherited{false};
+        config_watcher watcher;
+        bool config_watch{true};
+        /* listening fd taken off epoll,pending connections wait in the kernel backlog */
+        bool paused{false};
+        /**
+          * @brief stop polling the listening fd at max_connect_count
+          * @note None
+          * @param None
+          * @retval None
+          */
+        void _pause_()
+        {
+            if(paused) return;
+            epoll_ctl(epoll_fd,EPOLL_CTL_DEL,socket_fd,nullptr);
+            paused = true;
+            LOG_WARN("max connect count reached,accepting paused");
+        }
+        /**
+          * @brief poll the listening fd again once enough connections closed
+          * @note None
+          * @param None
+          * @retval None
+          */
+        void _try_resume_()
+        {
+            if(!paused || socket_fd == -1 || current_connect_count > admission::resume_mark(max_connect_count)) return;
+            if(epoll_add(epoll_fd,socket_fd,false,false,false) < 0) return;
+            paused = false;
+            LOG_INFO("accepting resumed");
+        }
+        /**
+          * @brief replace the epoll event array
+          * @note never while the array is being walked,set_max_events_count posts it
+          * @param size size
+          * @retval None
+          */
+        void _resize_events_(int size)
+        {
+            if(size == max_events_count) return;
+            max_events_count = size;
+            if(!events) return;
+            delete []events;
+            events = new epoll_event[size];
+        }
+        /**
+          * @brief reload the config file and apply it
+          * @note None
+          * @param None
+          * @retval None
+          */
+        void _reload_()
+        {
+            if(!configure::get_config().reload())
+            {
+                LOG_WARN("config reload failed,keeping the running configs");
+                return;
+            }
+            reconfigure();
+            LOG_INFO("config reloaded from " + configure::path());
+        }
+        /**
+          * @brief stop listening and close connections with nothing in flight
+          * @note called every round while draining
+          * @param None
+          * @retval drained or drain_timeout passed
+          */
+        bool _drain_()
+        {
+            if(socket_fd != -1)
+            {
+                LOG_INFO("draining " + std::to_string(current_connect_count) + " connections");
+                epoll_del(epoll_fd,socket_fd);
+                socket_fd = -1;
+                handoff.close();
+                drain_deadline = loop_clock_ms() + (int64_t)drain_timeout * 1000;
+            }
+            close_drained();
+            if(current_connect_count == 0)
+            {
+                LOG_INFO("all connections drained");
+                return true;
+            }
+            if(loop_clock_ms() >= drain_deadline)
+            {
+                LOG_WARN("drain timeout," + std::to_string(current_connect_count) + " connections left");
+                return true;
+            }
+            return false;
+        }
     public:
         static bool run;
+        /* seconds a graceful shutdown waits for connections,0 exits at once */
+        static int drain_timeout;
         /* Constructor */
         explicit conv_single()
         {
@@ -149,6 +263,8 @@ namespace hzd {
             signal(SIGINT,single_sigint_handler<T>);
             signal(SIGTERM,single_sigint_handler<T>);
             signal(SIGQUIT,single_sigint_handler<T>);
+            signal(SIGHUP,config_watcher::signal_handler);
+            signal(SIGUSR1,trace::signal_handler);
 
             configure& conf = configure::get_config();
             ip = (const char*)conf.require("ip");
@@ -168,8 +284,24 @@ namespace hzd {
                 max_events_count = conf["max_events_count"];
             if(conf["listen_queue_count"].type != JSON_NULL)
                 listen_queue_count = conf["listen_queue_count"];
+            if(conf["drain_timeout"].type != JSON_NULL)
+                drain_timeout = (int32_t)conf["drain_timeout"];
+            handoff_path = conf["handoff_path"].type == JSON_NULL ? "" : std::string((const char*)conf["handoff_path"]);
+            config_watch = conf["config_watch"].type == JSON_NULL ? true : (bool)conf["config_watch"];
+            metrics::load();
+            trace::load();
 
-            _create_socket_();
+            int fd = handoff_path.empty() ? -1 : listen_handoff::take(handoff_path,(uint16_t)port);
+            if(fd != -1)
+            {
+                socket_fd = fd;
+                inherited = true;
+                LOG_INFO("listening socket taken over from " + handoff_path);
+            }
+            else
+            {
+                _create_socket_();
+            }
             _prepare_socket_address_();
             signal(SIGPIPE,SIG_IGN);
 
@@ -187,8 +319,10 @@ namespace hzd {
         /* define */
         #define CONNECTS_REMOVE_FD do                   \
         {                                               \
+            admission::get().release(cur_fd);           \
             connects[cur_fd]->close();                  \
             current_connect_count--;                    \
+            metrics::count(M_CLOSES);                   \
             if(conn_pool)                               \
             {                                           \
                 conn_pool->release(connects[cur_fd]);   \
@@ -204,7 +338,9 @@ namespace hzd {
         #define CONNECTS_REMOVE_FD_OUT do               \
         {                                               \
             current_connect_count--;                    \
+            metrics::count(M_CLOSES);                   \
             T* tmp = it->second;                        \
+            admission::get().release(it->first);        \
             tmp->close();                               \
             it->second = nullptr;                       \
             it++;                                       \
@@ -233,6 +369,10 @@ namespace hzd {
                 ::close(socket_fd);
                 socket_fd = -1;
             }
+            handoff.close();
+            watcher.close();
+            delete loop;
+            loop = nullptr;
             if(epoll_fd != -1)
             {
                 ::close(epoll_fd);
@@ -386,7 +526,29 @@ namespace hzd {
           * @param size size
           * @retval None
           */
-        void set_max_events_count(int size) override {if(size >= 0) max_events_count = size;}
+        void set_max_events_count(int size) override
+        {
+            if(size <= 0) return;
+            if(loop) loop->post([this,size] { _resize_events_(size); });
+            else _resize_events_(size);
+        }
+        /**
+          * @brief apply reloaded configs
+          * @note called by the thread of wait()
+          * @param None
+          * @retval None
+          */
+        void reconfigure() override
+        {
+            conv_base::reconfigure();
+            configure& conf = configure::get_config();
+            if(conf["drain_timeout"].type != JSON_NULL)
+                drain_timeout = (int32_t)conf["drain_timeout"];
+            if(conf["max_events_count"].type != JSON_NULL)
+                set_max_events_count((int32_t)conf["max_events_count"]);
+            if(thread_pool && conf["thread_count"].type != JSON_NULL)
+                thread_pool->resize((int32_t)conf["thread_count"]);
+        }
         /**
           * @brief set max connection count
           * @note None
@@ -401,6 +563,38 @@ namespace hzd {
           * @retval None
           */
         void set_listen_queue_count(int size) override {if(size >= 0) listen_queue_count = size;}
+        /**
+          * @brief close connections idle longer than their idle timeout
+          * @note runs at most once per second
+          * @param None
+          * @retval None
+          */
+        void close_idle()
+        {
+            time_t now = conn_clock();
+            if(now == last_idle_check) return;
+            last_idle_check = now;
+            for(auto& p : connects)
+            {
+                if(p.second && p.second->expired(now)) p.second->notify_close();
+            }
+        }
+        /**
+          * @brief close connections with nothing in flight
+          * @note runs while draining,at most every CONN_DRAIN_CHECK_MS
+          * @param None
+          * @retval None
+          */
+        void close_drained()
+        {
+            int64_t now = loop_clock_ms();
+            if(now - last_drain_check < CONN_DRAIN_CHECK_MS) return;
+            last_drain_check = now;
+            for(auto& p : connects)
+            {
+                if(p.second && p.second->drained()) p.second->notify_close();
+            }
+        }
         /**
           * @brief start epoll
           * @note None
@@ -409,47 +603,117 @@ namespace hzd {
           */
         virtual void wait(int time_out = 5)
         {
-            _bind_();
+            if(!inherited) _bind_();
             _prepare_epoll_event_();
-            _listen_();
+            if(!inherited) _listen_();
             _register_listen_fd_();
+            /* shared with the next process after a handoff,so accept must not block */
+            block_none(socket_fd);
+            if(!handoff_path.empty() && !handoff.open(handoff_path,epoll_fd))
+                LOG_WARN("handoff path " + handoff_path + " can not be served");
+            if(!watcher.open(epoll_fd,config_watch))
+                LOG_WARN("config file " + configure::path() + " can not be watched");
+            if(!loop)
+                loop = new event_loop;
+            if(!loop->open(epoll_fd))
+                LOG_ERROR("event loop open failed");
+            loop->bind_thread();
 
             LOG_INFO("socket already listening at " + ip + ":" + std::to_string(port));
 
+            metrics::name_thread("reactor-0");
             int ret;
             int cur_fd;
+            int64_t ready_at;
             while(run)
             {
-                while(!close_queue->empty())
+                if(conn::draining() && _drain_()) break;
+                _try_resume_();
+                close_idle();
+                if(!close_queue->empty())
+                {
+                    trace_span span(TR_CLOSE_QUEUE);
+                    uint32_t closed = 0;
+                    while(!close_queue->empty())
+                    {
+                        close_queue->pop(cur_fd);
+                        if(cur_fd == -1) continue;
+                        /* removed already and the fd maybe taken by a new connection */
+                        if(connects[cur_fd] == nullptr || connects[cur_fd]->status != conn::CLOSE) continue;
+                        /* a worker is still returning from process(),closed next round */
+                        if(connects[cur_fd]->dispatched != 0)
+                        {
+                            close_later.push_back(cur_fd);
+                            continue;
+                        }
+                        CONNECTS_REMOVE_FD;
+                        closed++;
+                    }
+                    for(int fd : close_later) close_queue->push(fd);
+                    close_later.clear();
+                    span.set_arg(closed);
+                }
                 {
-                    close_queue->pop(cur_fd);
-                    if(cur_fd == -1) continue;
-                    if(connects[cur_fd] == nullptr) continue;
-                    CONNECTS_REMOVE_FD;
+                    trace_span span(TR_EPOLL_WAIT);
+                    ret = epoll_wait(epoll_fd,events,max_events_count,loop->wait_time(paused ? ADMISSION_RESUME_CHECK_MS : time_out));
+                    span.set_arg(ret < 0 ? 0 : ret);
                 }
-                if((ret = epoll_wait(epoll_fd,events,max_events_count,time_out)) < 0)
+                if(ret < 0)
                 {
                     if(errno == EINTR) continue;
                     break;
                 }
+                metrics::count(M_EPOLL_WAITS);
+                metrics::record(M_EPOLL_BATCH,ret);
+                ready_at = metrics::enabled() && ret > 0 ? metrics::clock_us() : 0;
                 for(int event_index = 0;event_index < ret; event_index++)
                 {
                     cur_fd = events[event_index].data.fd;
+                    if(cur_fd == loop->fd())
+                    {
+                        loop->clear();
+                        continue;
+                    }
+                    if(watcher.owns(cur_fd))
+                    {
+                        if(watcher.handle(cur_fd)) _reload_();
+                        continue;
+                    }
+                    if(cur_fd == handoff.fd())
+                    {
+                        if(handoff.serve(socket_fd))
+                        {
+                            LOG_INFO("listening socket handed off,draining");
+                            conn::draining() = true;
+                        }
+                        continue;
+                    }
+                    if(outbound_dispatch(cur_fd,events[event_index].events)) continue;
+                    /* waiting in the close queue,its status must stay CLOSE */
+                    if(cur_fd != socket_fd && connects[cur_fd] != nullptr && connects[cur_fd]->status == conn::CLOSE) continue;
+                    trace::instant(TR_DISPATCH,cur_fd,(uint16_t)events[event_index].events);
                     if(cur_fd == socket_fd) {
+                        if (current_connect_count >= max_connect_count) {
+                            _pause_();
+                            continue;
+                        }
                         sockaddr_in client_addr{};
                         socklen_t len = sizeof(client_addr);
                         int client_fd = accept(socket_fd, (sockaddr *) &client_addr, &len);
-                        if (current_connect_count >= max_connect_count) {
+                        if(client_fd < 0) continue;
+                        if(!admission::get().admit(client_fd,client_addr))
+                        {
                             ::close(client_fd);
                             continue;
                         }
                         if(conn_pool)
                         {
                             T* t = conn_pool->acquire();
-                            if(!t) { ::close(client_fd);continue; }
+                            if(!t) { admission::get().release(client_fd);::close(client_fd);continue; }
                             if(connects[client_fd] != nullptr)
                             {
                                 conn_pool->release(t);
+                                admission::get().release(client_fd);
                                 ::close(client_fd);
                                 continue;
                             }
@@ -459,6 +723,7 @@ namespace hzd {
                         {
                             if(connects[client_fd] != nullptr)
                             {
+                                admission::get().release(client_fd);
                                 ::close(client_fd);
                                 continue;
                             }
@@ -466,17 +731,19 @@ namespace hzd {
                         }
                         connects[client_fd]->init(client_fd, &client_addr,epoll_fd,ET,one_shot,close_queue);
                         current_connect_count++;
+                        metrics::count(M_ACCEPTS);
                     }
                     else if(events[event_index].events & EPOLLRDHUP)
                     {
                         connects[cur_fd]->status = conn::RDHUP;
+                        metrics::count(M_EVENTS_RDHUP);
                         if(thread_pool)
                         {
                             if(!thread_pool->add(connects[cur_fd])){CONNECTS_REMOVE_FD;}
                         }
                         else
                         {
-                            if(!connects[cur_fd]->process())
+                            if(!metrics_process(connects[cur_fd],ready_at))
                             {
 
                             }
@@ -486,13 +753,14 @@ namespace hzd {
                     else if(events[event_index].events & EPOLLERR)
                     {
                         connects[cur_fd]->status = conn::ERROR;
+                        metrics::count(M_EVENTS_ERROR);
                         if(thread_pool)
                         {
                             if(!thread_pool->add(connects[cur_fd])){CONNECTS_REMOVE_FD;}
                         }
                         else
                         {
-                            if(!connects[cur_fd]->process())
+                            if(!metrics_process(connects[cur_fd],ready_at))
                             {
 
                             }
@@ -502,13 +770,14 @@ namespace hzd {
                     else if(events[event_index].events & EPOLLOUT)
                     {
                         connects[cur_fd]->status = conn::OUT;
+                        metrics::count(M_EVENTS_OUT);
                         if(thread_pool)
                         {
                             if(!thread_pool->add(connects[cur_fd])){CONNECTS_REMOVE_FD;}
                         }
                         else
                         {
-                            if(!connects[cur_fd]->process())
+                            if(!metrics_process(connects[cur_fd],ready_at))
                             {
                                 CONNECTS_REMOVE_FD;
                             }
@@ -517,13 +786,14 @@ namespace hzd {
                     else if(events[event_index].events & EPOLLIN)
                     {
                         connects[cur_fd]->status = conn::IN;
+                        metrics::count(M_EVENTS_IN);
                         if(thread_pool)
                         {
                             if(!thread_pool->add(connects[cur_fd])){CONNECTS_REMOVE_FD;}
                         }
                         else
                         {
-                            if(!connects[cur_fd]->process())
+                            if(!metrics_process(connects[cur_fd],ready_at))
                             {
                                 CONNECTS_REMOVE_FD;
                             }
@@ -534,12 +804,15 @@ namespace hzd {
                         CONNECTS_REMOVE_FD;
                     }
                 }
+                loop->run();
             }
             close();
         }
     };
     template<typename T>
     bool conv_single<T>::run = true;
+    template<typename T>
+    int conv_single<T>::drain_timeout = 30;
 }
 
 #endif
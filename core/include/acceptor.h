@@ -3,6 +3,9 @@
 
 #include "conn.h"       /* conn */
 #include "configure.h"  /* configure */
+#include "handoff.h"    /* listen_handoff */
+#include "admission.h"  /* admission */
+#include <sys/eventfd.h>    /* eventfd */
 
 namespace hzd
 {
@@ -22,8 +25,15 @@ namespace hzd
                 ::close(epoll_fd);
                 epoll_fd = -1;
             }
-            delete event;
-            reactor<T>::set_run_false();
+            if(wake_fd != -1)
+            {
+                int fd = wake_fd;
+                wake_fd = -1;
+                ::close(fd);
+            }
+            handoff.close();
+            watcher.close();
+            delete []event;
             event = nullptr;
             parent = nullptr;
         }
@@ -103,6 +113,13 @@ namespace hzd
                 LOG_ERROR("epoll add listen fd failed");
                 exit(-1);
             }
+            if(wake_fd == -1)
+                wake_fd = eventfd(0,EFD_NONBLOCK | EFD_CLOEXEC);
+            if(wake_fd != -1 && epoll_add(epoll_fd,wake_fd,false,false,false) < 0)
+            {
+                ::close(wake_fd);
+                wake_fd = -1;
+            }
         }
         /**
           * @brief prepare epoll event
@@ -137,6 +154,11 @@ namespace hzd
         */
         void _accept_()
         {
+            if(parent->current_connect_count >= parent->max_connect_count)
+            {
+                _pause_();
+                return;
+            }
             sockaddr_in client_addr{};
             socklen_t len = sizeof(client_addr);
             int fd = accept(socket_fd,(sockaddr*)&client_addr,&len);
@@ -145,16 +167,14 @@ namespace hzd
                 if(errno == EAGAIN || errno == EWOULDBLOCK) return;
                 return;
             }
-            int least = INT32_MAX;
-            int least_index = 0;
-            for(int i=0;i<parent->reactors.size();i++)
+            if(!admission::get().admit(fd,client_addr))
             {
-                if(least > parent->reactors[i].connects.size()) {
-                    least = parent->reactors[i].connects.size();
-                    least_index = i;
-                }
+                ::close(fd);
+                return;
             }
-            parent->reactors[least_index].add_conn(fd);
+            metrics::count(M_ACCEPTS);
+            parent->current_connect_count++;
+            parent->reactors[parent->balancer.pick()].add_conn(fd,client_addr);
         }
 
     protected:
@@ -168,6 +188,56 @@ namespace hzd
         epoll_event* event{nullptr};
         conv_multi<T>* parent{nullptr};
         connpool<T>* conn_pool{nullptr};
+        std::string handoff_path;
+        listen_handoff handoff;
+        /* listening socket taken from the process running before */
+        bool inherited{false};
+        config_watcher watcher;
+        bool config_watch{true};
+        /* listening fd taken off epoll,pending connections wait in the kernel backlog */
+        bool paused{false};
+        /**
+          * @brief stop polling the listening fd at max_connect_count
+          * @note None
+          * @param None
+          * @retval None
+          */
+        void _pause_()
+        {
+            if(paused) return;
+            epoll_ctl(epoll_fd,EPOLL_CTL_DEL,socket_fd,nullptr);
+            paused = true;
+            LOG_WARN("max connect count reached,accepting paused");
+        }
+        /**
+          * @brief poll the listening fd again once enough connections closed
+          * @note None
+          * @param None
+          * @retval None
+          */
+        void _try_resume_()
+        {
+            if(!paused || parent->current_connect_count > admission::resume_mark(parent->max_connect_count)) return;
+            if(epoll_add(epoll_fd,socket_fd,false,false,false) < 0) return;
+            paused = false;
+            LOG_INFO("accepting resumed");
+        }
+        /**
+          * @brief reload the config file and apply it
+          * @note None
+          * @param None
+          * @retval None
+          */
+        void _reload_()
+        {
+            if(!configure::get_config().reload())
+            {
+                LOG_WARN("config reload failed,keeping the running configs");
+                return;
+            }
+            parent->reconfigure();
+            LOG_INFO("config reloaded from " + configure::path());
+        }
     public:
         acceptor() = default;
         ~acceptor()
@@ -245,31 +315,82 @@ namespace hzd
             configure& conf = configure::get_config();
             listen_queue_count = conf["listen_queue_count"].type == JSON_NULL ? 1024 : (int32_t)conf["listen_queue_count"];
             max_event_count = conf["max_events_count"].type == JSON_NULL ? 4096 : (int32_t)conf["max_events_count"];
+            handoff_path = conf["handoff_path"].type == JSON_NULL ? "" : std::string((const char*)conf["handoff_path"]);
+            config_watch = conf["config_watch"].type == JSON_NULL ? true : (bool)conf["config_watch"];
 
-            _create_socket_();
+            int fd = handoff_path.empty() ? -1 : listen_handoff::take(handoff_path,(uint16_t)port);
+            if(fd != -1)
+            {
+                socket_fd = fd;
+                inherited = true;
+                LOG_INFO("listening socket taken over from " + handoff_path);
+            }
+            else
+            {
+                _create_socket_();
+            }
             _prepare_socket_address_();
 
             LOG_TRACE("acceptor init success");
         }
         static bool run;
+        /* eventfd waking the acceptor from epoll_wait,written by signal handlers */
+        static int wake_fd;
+        /**
+          * @brief wake the acceptor to look at run and conn::draining()
+          * @note async-signal-safe
+          * @param None
+          * @retval None
+          */
+        static void wake()
+        {
+            int fd = wake_fd;
+            if(fd == -1) return;
+            uint64_t one = 1;
+            ssize_t ret = ::write(fd,&one,sizeof(one));
+            (void)ret;
+        }
 
         void work()
         {
-            _bind_();
+            if(!inherited) _bind_();
             _prepare_epoll_event_();
             _register_listen_fd_();
-            _listen_();
+            if(!inherited) _listen_();
+            /* shared with the next process after a handoff,so accept must not block */
+            block_none(socket_fd);
+            if(!handoff_path.empty() && !handoff.open(handoff_path,epoll_fd))
+                LOG_WARN("handoff path " + handoff_path + " can not be served");
+            if(!watcher.open(epoll_fd,config_watch))
+                LOG_WARN("config file " + configure::path() + " can not be watched");
 
              LOG_INFO("socket already listening at " + ip + ":" + std::to_string(port));
 
+            metrics::name_thread("acceptor");
             int ret;
             run = true;
-            while(run)
+            while(run && !conn::draining())
             {
-                if((ret = epoll_wait(epoll_fd,event,max_event_count,-1)) >= 0)
+                _try_resume_();
+                if((ret = epoll_wait(epoll_fd,event,max_event_count,paused ? ADMISSION_RESUME_CHECK_MS : -1)) >= 0)
                 {
                     for(int i=0;i<ret;i++)
                     {
+                        if(event[i].data.fd == wake_fd) continue;
+                        if(watcher.owns(event[i].data.fd))
+                        {
+                            if(watcher.handle(event[i].data.fd)) _reload_();
+                            continue;
+                        }
+                        if(event[i].data.fd == handoff.fd())
+                        {
+                            if(handoff.serve(socket_fd))
+                            {
+                                LOG_INFO("listening socket handed off,draining");
+                                conn::draining() = true;
+                            }
+                            continue;
+                        }
                         _accept_();
                     }
                 }
@@ -284,6 +405,8 @@ namespace hzd
     };
     template<class T>
     bool acceptor<T>::run = false;
+    template<class T>
+    int acceptor<T>::wake_fd = -1;
 }
 
 #endif
@@ -0,0 +1,123 @@
+#ifndef CONV_EVENT_ADMISSION_H
+#define CONV_EVENT_ADMISSION_H
+
+#include "configure.h"              /* configure */
+#include "event_loop.h"             /* fd_table */
+#include <atomic>                   /* atomic */
+#include <netinet/in.h>             /* sockaddr_in */
+
+namespace hzd {
+
+    #define ADMISSION_IP_BUCKETS 65536
+    /* a paused listener is polled again below this percent of max_connect_count */
+    #define ADMISSION_RESUME_PERCENT 90
+    #define ADMISSION_RESUME_CHECK_MS 10
+
+    struct ip_bucket
+    {
+        std::atomic<int> count{0};
+    };
+
+    /**
+      * @brief which connections and requests are let in under load
+      * @note per source ip limit: connections are counted in buckets hashed by ip,
+      *       ips sharing a bucket share the limit.the bucket of a connection is kept
+      *       by fd,release() must run before the fd is closed.
+      *       queue delay shedding: a request whose event waited longer than
+      *       shed_queue_delay ms for a worker is answered at once (503 for http)
+      */
+    class admission {
+        ip_bucket* buckets;
+        std::atomic<int> max_per_ip{0};
+        std::atomic<int> shed_delay{0};
+
+        admission() : buckets(new ip_bucket[ADMISSION_IP_BUCKETS])
+        {
+            load();
+            configure::get_config().on_reload([this] { load(); });
+        }
+    public:
+        /* connections refused by the per ip limit */
+        std::atomic<uint64_t> rejected{0};
+        /* requests answered without processing */
+        std::atomic<uint64_t> shed_count{0};
+
+        admission(const admission&) = delete;
+        admission& operator=(const admission&) = delete;
+
+        static admission& get()
+        {
+            static admission a;
+            return a;
+        }
+        void load()
+        {
+            configure& conf = configure::get_config();
+            max_per_ip = conf["max_connect_per_ip"].type == JSON_NULL ? 0 : (int32_t)conf["max_connect_per_ip"];
+            shed_delay = conf["shed_queue_delay"].type == JSON_NULL ? 0 : (int32_t)conf["shed_queue_delay"];
+        }
+        /**
+          * @brief count an accepted connection against its source ip
+          * @note None
+          * @param fd accepted fd
+          * @param addr peer address
+          * @retval admitted or not,the caller closes fd when not
+          */
+        bool admit(int fd,const sockaddr_in& addr)
+        {
+            int limit = max_per_ip;
+            if(limit <= 0) return true;
+            uint32_t ip = addr.sin_addr.s_addr;
+            ip_bucket& b = buckets[(ip * 2654435761u) >> 16 & (ADMISSION_IP_BUCKETS - 1)];
+            if(b.count.fetch_add(1,std::memory_order_relaxed) >= limit)
+            {
+                b.count.fetch_sub(1,std::memory_order_relaxed);
+                rejected++;
+                return false;
+            }
+            if(!fd_table<ip_bucket>::put(fd,&b))
+            {
+                b.count.fetch_sub(1,std::memory_order_relaxed);
+            }
+            return true;
+        }
+        /**
+          * @brief uncount a connection
+          * @note call before the fd is closed,a reused fd belongs to another connection
+          * @param fd fd
+          * @retval None
+          */
+        void release(int fd)
+        {
+            ip_bucket* b = fd_table<ip_bucket>::find(fd);
+            if(!b) return;
+            fd_table<ip_bucket>::remove(fd);
+            b->count.fetch_sub(1,std::memory_order_relaxed);
+        }
+        /**
+          * @brief should a request be shed
+          * @note None
+          * @param queue_delay microseconds its event waited for a worker
+          * @retval shed or not
+          */
+        bool shed(int64_t queue_delay)
+        {
+            int delay = shed_delay;
+            if(delay <= 0 || queue_delay < (int64_t)delay * 1000) return false;
+            shed_count++;
+            return true;
+        }
+        /**
+          * @brief connection count a paused listener is polled again at
+          * @note None
+          * @param max_connect_count max connection count
+          * @retval connection count
+          */
+        static int resume_mark(int max_connect_count)
+        {
+            return (int)((int64_t)max_connect_count * ADMISSION_RESUME_PERCENT / 100);
+        }
+    };
+}
+
+#endif
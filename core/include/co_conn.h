@@ -0,0 +1,397 @@
+#ifndef CONV_EVENT_CO_CONN_H
+#define CONV_EVENT_CO_CONN_H
+
+/* coroutine connections need C++20,the header is empty for older standards */
+#if __cplusplus >= 202002L && defined(__has_include)
+#if __has_include(<coroutine>)
+
+#include "conn.h"                   /* conn */
+#include <coroutine>                /* coroutine_handle */
+#include <exception>                /* exception */
+#include <string>                   /* string */
+
+#define CONV_EVENT_HAS_CO_CONN 1
+
+namespace hzd {
+
+    #define CO_FRAME_POOL_CLASS 64
+    #define CO_FRAME_POOL_MAX 4096
+    #define CO_FRAME_POOL_KEEP 1024
+
+    /**
+      * @brief free lists of coroutine frames,one set per thread
+      * @note frames are created in init() and destroyed in close(),both run by the reactor
+      *       thread,so every reactor reuses its own frames without locking
+      */
+    class co_frame_pool {
+        struct node
+        {
+            node* next;
+        };
+        struct lists
+        {
+            node* heads[CO_FRAME_POOL_MAX / CO_FRAME_POOL_CLASS];
+            size_t counts[CO_FRAME_POOL_MAX / CO_FRAME_POOL_CLASS];
+            bool drained;
+        };
+        /* trivially destructible,still usable after the releaser ran at thread exit */
+        static lists& _local_()
+        {
+            static thread_local lists l{};
+            return l;
+        }
+        struct releaser
+        {
+            ~releaser()
+            {
+                lists& l = _local_();
+                for(size_t i = 0;i < CO_FRAME_POOL_MAX / CO_FRAME_POOL_CLASS;i++)
+                {
+                    while(l.heads[i])
+                    {
+                        node* n = l.heads[i];
+                        l.heads[i] = n->next;
+                        ::operator delete(n);
+                    }
+                    l.counts[i] = 0;
+                }
+                l.drained = true;
+            }
+        };
+        static void _track_()
+        {
+            static thread_local releaser r;
+            (void)r;
+        }
+    public:
+        static void* allocate(size_t size)
+        {
+            if(size == 0 || size > CO_FRAME_POOL_MAX) return ::operator new(size);
+            size_t index = (size - 1) / CO_FRAME_POOL_CLASS;
+            lists& l = _local_();
+            if(node* n = l.heads[index])
+            {
+                l.heads[index] = n->next;
+                l.counts[index]--;
+                return n;
+            }
+            _track_();
+            return ::operator new((index + 1) * CO_FRAME_POOL_CLASS);
+        }
+        static void deallocate(void* p,size_t size)
+        {
+            if(!p) return;
+            if(size == 0 || size > CO_FRAME_POOL_MAX)
+            {
+                ::operator delete(p);
+                return;
+            }
+            size_t index = (size - 1) / CO_FRAME_POOL_CLASS;
+            lists& l = _local_();
+            if(l.drained || l.counts[index] >= CO_FRAME_POOL_KEEP)
+            {
+                ::operator delete(p);
+                return;
+            }
+            node* n = (node*)p;
+            n->next = l.heads[index];
+            l.heads[index] = n;
+            l.counts[index]++;
+        }
+    };
+
+    /* coroutine of one connection,started by co_conn::init and destroyed by co_conn::close */
+    class co_task {
+    public:
+        struct promise_type
+        {
+            co_task get_return_object()
+            {
+                return co_task(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            std::suspend_always final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception()
+            {
+                try { std::rethrow_exception(std::current_exception()); }
+                catch(const std::exception& e) { LOG_ERROR(std::string("connection coroutine threw: ") + e.what()); }
+                catch(...) { LOG_ERROR("connection coroutine threw"); }
+            }
+            static void* operator new(size_t size) { return co_frame_pool::allocate(size); }
+            static void operator delete(void* p,size_t size) { co_frame_pool::deallocate(p,size); }
+        };
+        co_task() = default;
+        explicit co_task(std::coroutine_handle<promise_type> h) : handle(h) {}
+        co_task(const co_task&) = delete;
+        co_task& operator=(const co_task&) = delete;
+        co_task(co_task&& other) noexcept : handle(other.handle) { other.handle = nullptr; }
+        co_task& operator=(co_task&& other) noexcept
+        {
+            if(this != &other)
+            {
+                if(handle) handle.destroy();
+                handle = other.handle;
+                other.handle = nullptr;
+            }
+            return *this;
+        }
+        ~co_task()
+        {
+            if(handle) handle.destroy();
+        }
+        std::coroutine_handle<promise_type> handle{nullptr};
+    };
+
+    /**
+      * @brief connection written as one coroutine
+      * @note override run(),it starts when the connection is accepted and the connection
+      *       closes when it returns.read/write/sleep suspend it instead of spinning,
+      *       the reactor resumes it once the socket is ready or the timer fires.
+      *       needs one_shot (the default),a suspended coroutine is armed for one event only
+      */
+    class co_conn : public conn {
+        enum Op { CO_NONE, CO_READ, CO_WRITE, CO_SLEEP };
+
+        co_task task;
+        std::atomic<Op> op{CO_NONE};
+        ssize_t result{0};
+        char* read_data{nullptr};
+        std::string* read_string{nullptr};
+        size_t read_size{0};
+        const char* write_data{nullptr};
+        size_t write_left{0};
+        int sleep_ms{0};
+        timer_handle timer;
+
+        /**
+          * @brief one non-blocking read for the pending read
+          * @note None
+          * @param None
+          * @retval finished or would block
+          */
+        bool _try_read_()
+        {
+            size_t old = 0;
+            char* dst = read_data;
+            if(read_string)
+            {
+                old = read_string->size();
+                read_string->resize(old + read_size);
+                dst = &(*read_string)[old];
+            }
+            ssize_t r;
+            while((r = ::recv(socket_fd,dst,read_size,0)) < 0 && errno == EINTR);
+            if(read_string) read_string->resize(old + (r > 0 ? (size_t)r : 0));
+            if(r > 0) metrics::count(M_BYTES_IN,r);
+            if(r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return false;
+            result = r;
+            return true;
+        }
+        /**
+          * @brief write as much of the pending write as the socket takes
+          * @note None
+          * @param None
+          * @retval finished or would block
+          */
+        bool _try_write_()
+        {
+            while(write_left > 0)
+            {
+                ssize_t r = ::send(socket_fd,write_data,write_left,MSG_NOSIGNAL);
+                if(r < 0)
+                {
+                    if(errno == EINTR) continue;
+                    if(errno == EAGAIN || errno == EWOULDBLOCK) return false;
+                    result = 0;
+                    return true;
+                }
+                metrics::count(M_BYTES_OUT,r);
+                write_data += r;
+                write_left -= r;
+            }
+            result = 1;
+            return true;
+        }
+        /**
+          * @brief resume the coroutine and wait for what it suspended on
+          * @note the event is armed after resume() returned,so a thread of the pool never
+          *       resumes a coroutine another thread is still leaving
+          * @param arm arm the socket event or leave it to the caller
+          * @retval None
+          */
+        void _resume_(bool arm = true)
+        {
+            op = CO_NONE;
+            task.handle.resume();
+            if(task.handle.done())
+            {
+                notify_close();
+                return;
+            }
+            switch(op.load())
+            {
+                case CO_READ : {
+                    if(arm) next(EPOLLIN);
+                    break;
+                }
+                case CO_WRITE : {
+                    if(arm) next(EPOLLOUT);
+                    break;
+                }
+                case CO_SLEEP : {
+                    timer = run_after(sleep_ms,[this] {
+                        last_active = conn_clock();
+                        _resume_();
+                    });
+                    if(!timer) notify_close();
+                    break;
+                }
+                default : {
+                    break;
+                }
+            }
+        }
+        /**
+          * @brief continue the pending read or write on readiness
+          * @note None
+          * @param None
+          * @retval success or not
+          */
+        bool _drive_()
+        {
+            switch(op.load())
+            {
+                case CO_READ : {
+                    if(!_try_read_()) return next(EPOLLIN) == 0;
+                    break;
+                }
+                case CO_WRITE : {
+                    if(!_try_write_()) return next(EPOLLOUT) == 0;
+                    break;
+                }
+                default : {
+                    return true;
+                }
+            }
+            _resume_();
+            return true;
+        }
+    protected:
+        struct read_awaiter
+        {
+            co_conn* c;
+            bool await_ready() { return c->_try_read_(); }
+            void await_suspend(std::coroutine_handle<>) { c->op = CO_READ; }
+            ssize_t await_resume() const { return c->result; }
+        };
+        struct write_awaiter
+        {
+            co_conn* c;
+            bool await_ready() { return c->_try_write_(); }
+            void await_suspend(std::coroutine_handle<>) { c->op = CO_WRITE; }
+            bool await_resume() const { return c->result > 0; }
+        };
+        struct sleep_awaiter
+        {
+            co_conn* c;
+            bool await_ready() const { return c->sleep_ms <= 0; }
+            void await_suspend(std::coroutine_handle<>) { c->op = CO_SLEEP; }
+            void await_resume() const {}
+        };
+        /**
+          * @brief wait until some bytes arrive
+          * @note None
+          * @param data buffer
+          * @param size buffer size
+          * @retval awaiter,co_await gives bytes read,0 when the peer closed,-1 on error
+          */
+        read_awaiter read(char* data,size_t size)
+        {
+            read_data = data;
+            read_string = nullptr;
+            read_size = size;
+            return read_awaiter{this};
+        }
+        /**
+          * @brief wait until some bytes arrive and append them
+          * @note None
+          * @param data bytes are appended to it
+          * @param max most bytes appended at once
+          * @retval awaiter,co_await gives bytes read,0 when the peer closed,-1 on error
+          */
+        read_awaiter read(std::string& data,size_t max = 4096)
+        {
+            read_data = nullptr;
+            read_string = &data;
+            read_size = max;
+            return read_awaiter{this};
+        }
+        /**
+          * @brief wait until every byte is written
+          * @note data must stay alive until co_await returns
+          * @param data data
+          * @param size data size
+          * @retval awaiter,co_await gives success or not
+          */
+        write_awaiter write(const char* data,size_t size)
+        {
+            write_data = data;
+            write_left = size;
+            return write_awaiter{this};
+        }
+        write_awaiter write(const std::string& data)
+        {
+            return write(data.data(),data.size());
+        }
+        /**
+          * @brief suspend for a while on the timers of the reactor
+          * @note None
+          * @param ms milliseconds
+          * @retval awaiter
+          */
+        sleep_awaiter sleep(int ms)
+        {
+            sleep_ms = ms;
+            return sleep_awaiter{this};
+        }
+    public:
+        co_conn() = default;
+        ~co_conn() override
+        {
+            co_conn::close();
+        }
+        /**
+          * @brief the connection,closed once it returns
+          * @note None
+          * @param None
+          * @retval coroutine
+          */
+        virtual co_task run() = 0;
+        void init(int _socket_fd,sockaddr_in* _addr,int _epoll_fd,bool et,bool _one_shot,lock_queue<int>* cq = nullptr,bool add = true) override
+        {
+            conn::init(_socket_fd,_addr,_epoll_fd,et,_one_shot,cq,add);
+            task = run();
+            /* a conn created for an event is processed right after,it continues the io itself */
+            _resume_(add);
+        }
+        bool process_in() final { return _drive_(); }
+        bool process_out() final { return _drive_(); }
+        void close() override
+        {
+            if(timer)
+            {
+                timer->cancel();
+                timer = nullptr;
+            }
+            task = co_task();
+            op = CO_NONE;
+            conn::close();
+        }
+    };
+}
+
+#endif
+#endif
+
+#endif
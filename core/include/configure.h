@@ -2,24 +2,77 @@
 #define CONV_EVENT_CONFIGURE_H
 
 #include "json/json.h"
+#include <mutex>                    /* mutex */
+#include <atomic>                   /* atomic */
+#include <vector>                   /* vector */
+#include <functional>               /* function */
+#include <cstdlib>                  /* getenv */
+#include <cerrno>                   /* errno */
+#include <unistd.h>                 /* read write close */
+#include <sys/epoll.h>              /* epoll_ctl */
+#include <sys/eventfd.h>            /* eventfd */
+#include <sys/inotify.h>            /* inotify */
 
 namespace hzd {
 
+    #define CONFIGURE_DEFAULT_PATH "conv_event/conf/conf.json"
+    #define CONFIGURE_PATH_ENV "CONV_EVENT_CONF"
+
     class configure {
         configure() {
-            if(!configs.load_by_file_name("conv_event/conf/conf.json"))
+            if(!configs.load_by_file_name(path()))
             {
                 exit(-1);
             }
         }
         json configs;
+        std::mutex mtx;
+        std::vector<std::function<void()>> listeners;
+        std::atomic<uint64_t> generation{0};
+        static bool& _created_()
+        {
+            static bool created = false;
+            return created;
+        }
     public:
 
         configure(const configure& ) = delete;
         configure& operator=(const configure&) = delete;
 
+        /**
+          * @brief config file path
+          * @note CONV_EVENT_CONF in the environment,conv_event/conf/conf.json without it
+          * @param None
+          * @retval path
+          */
+        static std::string& path()
+        {
+            static std::string p = getenv(CONFIGURE_PATH_ENV) ? getenv(CONFIGURE_PATH_ENV) : CONFIGURE_DEFAULT_PATH;
+            return p;
+        }
+        /**
+          * @brief use another config file
+          * @note configs read by static members are loaded before main(),in that case the file
+          *       is reloaded at once.prefer CONV_EVENT_CONF when the default file does not exist
+          * @param p config file path
+          * @retval loaded or not
+          */
+        static bool set_path(const std::string& p)
+        {
+            path() = p;
+            if(!_created_()) return true;
+            return get_config().reload();
+        }
+
+        /**
+          * @brief value of key
+          * @note the reference is only valid until the next reload
+          * @param key key
+          * @retval value
+          */
         json_val& require(const std::string & key)
         {
+            std::lock_guard<std::mutex> lock(mtx);
             if(configs.has_key(key))
                 return configs[key];
             else
@@ -28,6 +81,7 @@ namespace hzd {
 
         json_val operator[](const std::string & key)
         {
+            std::lock_guard<std::mutex> lock(mtx);
             if(configs.has_key(key))
             {
                 return configs[key];
@@ -38,13 +92,178 @@ namespace hzd {
             }
         }
 
+        /**
+          * @brief read the config file again
+          * @note the old configs are kept when the file can not be parsed.
+          *       listeners run after the new configs are in place,on the calling thread
+          * @param None
+          * @retval success or not
+          */
+        bool reload()
+        {
+            json fresh;
+            if(!fresh.load_by_file_name(path())) return false;
+            std::vector<std::function<void()>> todo;
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                configs = std::move(fresh);
+                generation++;
+                todo = listeners;
+            }
+            for(auto& f : todo) f();
+            return true;
+        }
+        /**
+          * @brief run f after every reload
+          * @note for values copied out of the configs,e.g. static members
+          * @param f listener
+          * @retval true,to register from a static initializer
+          */
+        bool on_reload(std::function<void()> f)
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            listeners.push_back(std::move(f));
+            return true;
+        }
+        /* bumped by every successful reload */
+        uint64_t version() const { return generation; }
+
         static configure& get_config()
         {
             static configure conf;
+            _created_() = true;
             return conf;
         }
     };
 
+    /**
+      * @brief tells a reactor when the config file should be reloaded
+      * @note SIGHUP and changes of the config file (inotify on its directory,so editors
+      *       replacing the file by rename are seen too) both end up as a readable fd
+      *       registered on the epoll of the thread that applies the configs
+      */
+    class config_watcher {
+        int inotify_fd{-1};
+        int event_fd{-1};
+        std::string name;
+        /* event_fd of the watcher SIGHUP is delivered to */
+        static int& _signal_fd_()
+        {
+            static int fd = -1;
+            return fd;
+        }
+    public:
+        config_watcher() = default;
+        config_watcher(const config_watcher&) = delete;
+        config_watcher& operator=(const config_watcher&) = delete;
+        ~config_watcher()
+        {
+            close();
+        }
+        /**
+          * @brief register SIGHUP and,if watch_file,the config file on epoll_fd
+          * @note None
+          * @param epoll_fd epoll of the applying thread
+          * @param watch_file watch the config file or not
+          * @retval success or not
+          */
+        bool open(int epoll_fd,bool watch_file)
+        {
+            epoll_event ev{};
+            ev.events = EPOLLIN;
+            if(event_fd == -1)
+            {
+                event_fd = eventfd(0,EFD_NONBLOCK | EFD_CLOEXEC);
+                ev.data.fd = event_fd;
+                if(event_fd != -1 && epoll_ctl(epoll_fd,EPOLL_CTL_ADD,event_fd,&ev) != 0)
+                {
+                    ::close(event_fd);
+                    event_fd = -1;
+                }
+                if(event_fd != -1) _signal_fd_() = event_fd;
+            }
+            if(!watch_file || inotify_fd != -1) return event_fd != -1;
+            std::string file = configure::path();
+            size_t slash = file.rfind('/');
+            std::string dir = slash == std::string::npos ? "." : file.substr(0,slash == 0 ? 1 : slash);
+            name = slash == std::string::npos ? file : file.substr(slash + 1);
+            inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            ev.data.fd = inotify_fd;
+            if(inotify_fd < 0 || inotify_add_watch(inotify_fd,dir.c_str(),IN_CLOSE_WRITE | IN_MOVED_TO) < 0
+            || epoll_ctl(epoll_fd,EPOLL_CTL_ADD,inotify_fd,&ev) != 0)
+            {
+                if(inotify_fd >= 0) ::close(inotify_fd);
+                inotify_fd = -1;
+                return false;
+            }
+            return event_fd != -1;
+        }
+        bool owns(int fd) const
+        {
+            return fd != -1 && (fd == inotify_fd || fd == event_fd);
+        }
+        /**
+          * @brief consume the readiness of fd
+          * @note None
+          * @param fd fd owned by the watcher
+          * @retval config should be reloaded or not
+          */
+        bool handle(int fd)
+        {
+            if(fd == event_fd)
+            {
+                uint64_t count;
+                while(::read(fd,&count,sizeof(count)) < 0 && errno == EINTR);
+                return true;
+            }
+            bool changed = false;
+            alignas(inotify_event) char buffer[4096];
+            ssize_t n;
+            while((n = ::read(inotify_fd,buffer,sizeof(buffer))) > 0)
+            {
+                for(char* p = buffer;p < buffer + n;)
+                {
+                    auto* e = (inotify_event*)p;
+                    if(e->len > 0 && name == e->name) changed = true;
+                    p += sizeof(inotify_event) + e->len;
+                }
+            }
+            return changed;
+        }
+        /**
+          * @brief ask for a reload
+          * @note async-signal-safe,called by the SIGHUP handler
+          * @param None
+          * @retval None
+          */
+        static void notify()
+        {
+            int fd = _signal_fd_();
+            if(fd == -1) return;
+            uint64_t one = 1;
+            ssize_t ret = ::write(fd,&one,sizeof(one));
+            (void)ret;
+        }
+        static void signal_handler(int)
+        {
+            notify();
+        }
+        void close()
+        {
+            if(event_fd != -1)
+            {
+                if(_signal_fd_() == event_fd) _signal_fd_() = -1;
+                ::close(event_fd);
+                event_fd = -1;
+            }
+            if(inotify_fd != -1)
+            {
+                ::close(inotify_fd);
+                inotify_fd = -1;
+            }
+        }
+    };
+
 }
 
 #endif
@@ -11,11 +11,16 @@
 #include <algorithm>            /* find */
 #include <memory>               /* unique_ptr */
 #include <atomic>               /* atomic */
+#include <ctime>                /* clock_gettime */
 #include "safe_queue.h"         /* safe_queue */
 #include "lock_queue.h"         /* locK_queue */
+#include "event_loop.h"         /* event_loop */
+#include "trace.h"              /* trace */
 
 namespace hzd {
 
+/* milliseconds between two sweeps for connections to close while draining */
+#define CONN_DRAIN_CHECK_MS 50
 #define CONN_LOG_IP_PORT_FMT "client IP=%s client Port = %u",inet_ntoa(sock_addr.sin_addr),ntohs(sock_addr.sin_port)
     /**
       * @brief set fd none-blocking
@@ -46,6 +51,7 @@ namespace hzd {
         if(et) ev.events = ev.events | EPOLLET;
         if(one_shot) ev.events = ev.events | EPOLLONESHOT;
         if(none_block) block_none(socket_fd);
+        trace::instant(TR_EPOLL_CTL,socket_fd,EPOLL_CTL_ADD);
         return epoll_ctl(epoll_fd,EPOLL_CTL_ADD,socket_fd,&ev);
     }
     /**
@@ -67,6 +73,7 @@ namespace hzd {
         {
             event.events = event.events | EPOLLONESHOT;
         }
+        trace::instant(TR_EPOLL_CTL,socket_fd,EPOLL_CTL_MOD);
         return epoll_ctl(epoll_fd,EPOLL_CTL_MOD,socket_fd,&event);
     }
     /**
@@ -80,11 +87,25 @@ namespace hzd {
       */
     static int epoll_del(int epoll_fd,int socket_fd)
     {
+        trace::instant(TR_EPOLL_CTL,socket_fd,EPOLL_CTL_DEL);
         int ret = epoll_ctl(epoll_fd,EPOLL_CTL_DEL,socket_fd,nullptr);
         ::close(socket_fd);
         return ret;
     }
 
+    /**
+      * @brief coarse monotonic clock for idle checking
+      * @note None
+      * @param None
+      * @retval seconds
+      */
+    static inline time_t conn_clock()
+    {
+        timespec ts{};
+        clock_gettime(CLOCK_MONOTONIC_COARSE,&ts);
+        return ts.tv_sec;
+    }
+
     class conn : public socket_io{
         /* private member variable */
         bool ET{false};
@@ -140,14 +161,35 @@ namespace hzd {
         /* static member methods */
         /* common member variable */
         Status status{OK};
+        /* seconds without events before the connection is closed by its reactor,0 means never */
+        int idle_timeout{0};
+        std::atomic<time_t> last_active{0};
+        /* events handed to the thread pool and not processed yet,counted by threadpool<T> */
+        std::atomic<int> dispatched{0};
+        /* steady microseconds the last event was handed to the thread pool at,and how long it waited */
+        int64_t queued_at{0};
+        int64_t queue_delay{0};
+        /**
+          * @brief graceful shutdown started or not
+          * @note set by the signal handlers of conv_single and conv_multi,
+          *       connections finish what is in flight and are closed after it
+          * @param None
+          * @retval flag
+          */
+        static std::atomic<bool>& draining()
+        {
+            static std::atomic<bool> flag{false};
+            return flag;
+        }
         /* common base member methods */
         /**
           * @brief register next event
-          * @note None
+          * @note does nothing while output is captured,the owner of the capture decides the next event
           * @param event EPOLL_EVENTS
           * @retval success or not
           */
         int next(uint32_t event) const{
+            if(capture) return 0;
             return epoll_mod(epoll_fd,socket_fd,event,ET,one_shot);
         }
         /* thread safety */
@@ -158,10 +200,58 @@ namespace hzd {
                 if(close_queue) close_queue->push(socket_fd);
             }
         }
+        /**
+          * @brief event loop of the reactor owning this connection
+          * @note nullptr once the connection is closed
+          * @param None
+          * @retval loop or nullptr
+          */
+        event_loop* loop() const
+        {
+            return epoll_fd < 0 ? nullptr : event_loop::of(epoll_fd);
+        }
+        /**
+          * @brief run task on the thread of the owning reactor
+          * @note callable from any thread,the task must not outlive the connection
+          * @param task task
+          * @retval posted or not
+          */
+        bool post(std::function<void()> task) const
+        {
+            event_loop* l = loop();
+            if(!l) return false;
+            l->post(std::move(task));
+            return true;
+        }
+        /**
+          * @brief run task once on the owning reactor after delay
+          * @note cancel the timer in close() if the task uses the connection
+          * @param delay_ms delay in milliseconds
+          * @param task task
+          * @retval timer or nullptr
+          */
+        timer_handle run_after(int delay_ms,std::function<void()> task) const
+        {
+            event_loop* l = loop();
+            return l ? l->run_after(delay_ms,std::move(task)) : nullptr;
+        }
+        /**
+          * @brief run task on the owning reactor every interval
+          * @note cancel the timer in close() if the task uses the connection
+          * @param interval_ms interval in milliseconds
+          * @param task task
+          * @retval timer or nullptr
+          */
+        timer_handle run_every(int interval_ms,std::function<void()> task) const
+        {
+            event_loop* l = loop();
+            return l ? l->run_every(interval_ms,std::move(task)) : nullptr;
+        }
         /* common virtual member methods */
         virtual void init(int _socket_fd,sockaddr_in* _addr,int _epoll_fd,bool et,bool _one_shot,lock_queue<int>* cq = nullptr,bool add = true)
         {
             status = OK;
+            last_active = conn_clock();
             close_queue = cq;
             socket_fd = _socket_fd;
             sock_addr = *_addr;
@@ -224,8 +314,52 @@ namespace hzd {
             notify_close();
             return true;
         }
+        /**
+          * @brief idle longer than idle_timeout or not
+          * @note None
+          * @param now conn_clock()
+          * @retval idle or not
+          */
+        bool idle(time_t now) const
+        {
+            return idle_timeout > 0 && now - last_active >= idle_timeout;
+        }
+        /**
+          * @brief work a graceful shutdown should wait for
+          * @note asked by the reactor thread while draining,a connection not in flight is closed.
+          *       by default a partly sent or received buffer of socket_io is in flight
+          * @param None
+          * @retval in flight or not
+          */
+        virtual bool in_flight() const
+        {
+            return !already;
+        }
+        /**
+          * @brief closed by a sweep of a draining reactor or not
+          * @note a connection queued in the thread pool is never closed under it
+          * @param None
+          * @retval can be closed or not
+          */
+        bool drained() const
+        {
+            return status != CLOSE && dispatched == 0 && !in_flight();
+        }
+        /**
+          * @brief closed by the idle sweep of its reactor or not
+          * @note last_active only moves when process() starts,so a slow handler in the thread pool
+          *       looks idle.like drained(),a connection queued in or run by the pool,or with
+          *       a response in flight,is left for a later sweep
+          * @param now conn_clock()
+          * @retval can be closed or not
+          */
+        bool expired(time_t now) const
+        {
+            return idle(now) && drained();
+        }
         virtual bool process()
         {
+            last_active = conn_clock();
             switch(status)
             {
                 case CLOSE : {
@@ -264,6 +398,52 @@ namespace hzd {
         }
     };
 
+    /**
+      * @brief conn dispatched without virtual calls
+      * @note D is the connection type itself (class echo final : public static_conn<echo>).
+      *       process() is final,so reactor<D>,conv_single<D> and threadpool<D> call it directly,
+      *       and it calls the handlers of D by qualified name so they can be inlined into the
+      *       event loop.D must be the most derived type,deriving from it again is not supported
+      */
+    template<class D>
+    class static_conn : public conn {
+        D* _self_() { return static_cast<D*>(this); }
+    public:
+        bool process() final
+        {
+            last_active = conn_clock();
+            switch(status)
+            {
+                case CLOSE : {
+                    return false;
+                }
+                case IN : {
+                    bool ret = _self_()->D::process_in();
+                    if(!ret) notify_close();
+                    return ret;
+                }
+                case OUT : {
+                    bool ret = _self_()->D::process_out();
+                    if(!ret) notify_close();
+                    return ret;
+                }
+                case RDHUP : {
+                    return _self_()->D::process_rdhup();
+                }
+                case ERROR : {
+                    return _self_()->D::process_error();
+                }
+                case BAD : {
+                    return false;
+                }
+                default : {
+                    status = OK;
+                    return true;
+                }
+            }
+        }
+    };
+
     template<class T>
     class connpool
     {
@@ -306,7 +486,10 @@ namespace hzd {
             {
                 t = new T;
                 size++;
+                metrics::count(M_POOL_MISSES);
+                return t;
             }
+            metrics::count(M_POOL_HITS);
             return t;
         }
 
@@ -0,0 +1,604 @@
+#ifndef CONV_EVENT_CONNECTOR_H
+#define CONV_EVENT_CONNECTOR_H
+
+#include "conn.h"                   /* epoll_mod epoll_del socket_io */
+#include "event_loop.h"             /* fd_table */
+#include <mutex>                    /* mutex */
+#include <thread>                   /* thread */
+#include <atomic>                   /* atomic */
+#include <functional>               /* function */
+#include <unordered_map>            /* unordered_map */
+#include <poll.h>                   /* poll */
+#include <netinet/tcp.h>            /* TCP_NODELAY TCP_SYNCNT */
+#include <limits>                   /* numeric_limits */
+
+namespace hzd {
+
+    #define UPSTREAM_RING_REPLICAS 160
+
+    /* how upstream::pick() chooses a server */
+    enum upstream_Policy { ROUND_ROBIN, LEAST_CONN, CONSISTENT_HASH };
+
+    class outbound;
+    class upstream;
+
+    /**
+      * @brief fd -> outbound connection,looked up by reactors for every event
+      * @note outbound fds live on the same epoll as accepted conns,
+      *       the reactor asks this table first and hands matching events to the outbound
+      */
+    using outbound_table = fd_table<outbound>;
+
+    /* one backend of an upstream */
+    struct upstream_server
+    {
+        std::string ip;
+        uint16_t port{0};
+        int weight{1};
+        sockaddr_in addr{};
+        /* connections handed out and not released yet */
+        std::atomic<int> active{0};
+        std::atomic<int> fails{0};
+        std::atomic<time_t> down_until{0};
+        std::mutex mtx;
+        /* keep-alive connections by epoll fd of the reactor they are registered on */
+        std::unordered_map<int,std::vector<outbound*>> idle;
+
+        bool available(time_t now) const { return down_until.load() <= now; }
+    };
+
+    /**
+      * @brief non-blocking outbound connection registered on the epoll of a reactor
+      * @note events are delivered to the handler on the reactor thread,always one-shot and
+      *       level triggered,so call next() to receive the next event.
+      *       objects are recycled by their upstream and never freed while it lives
+      */
+    class outbound : public socket_io {
+    public:
+        using handler = std::function<void(outbound*,uint32_t)>;
+    private:
+        friend class upstream;
+        enum State { FREE, CONNECTING, IDLE, BUSY };
+
+        std::mutex mtx;
+        handler on_event;
+        State state{FREE};
+        int epoll_fd{-1};
+        upstream* owner{nullptr};
+        upstream_server* server{nullptr};
+        bool from_pool{false};
+    public:
+        /**
+          * @brief deliver epoll events to handler
+          * @note called by reactors,events of an fd that was closed meanwhile are dropped
+          * @param fd fd of event
+          * @param events epoll events
+          * @retval None
+          */
+        void dispatch(int fd,uint32_t events)
+        {
+            handler h;
+            {
+                std::lock_guard<std::mutex> guard(mtx);
+                if(socket_fd != fd || state == FREE) return;
+                h = on_event;
+            }
+            if(h) h(this,events);
+        }
+        void set_handler(handler h)
+        {
+            std::lock_guard<std::mutex> guard(mtx);
+            on_event = std::move(h);
+        }
+        /**
+          * @brief register next event
+          * @note None
+          * @param event EPOLL_EVENTS
+          * @retval success or not
+          */
+        int next(uint32_t event) const
+        {
+            return epoll_mod(epoll_fd,socket_fd,event,false,true);
+        }
+        int fd() const { return socket_fd; }
+        int loop() const { return epoll_fd; }
+        upstream_server* target() const { return server; }
+        /* handed out from the keep-alive pool,the server may have closed it meanwhile */
+        bool reused() const { return from_pool; }
+        /**
+          * @brief give connection back
+          * @note reusable connections stay open as keep-alive for the same reactor
+          * @param reusable response was complete and peer keeps the connection
+          * @retval None
+          */
+        inline void release(bool reusable);
+    };
+
+    /**
+      * @brief reactor hook,hand event to outbound connection if fd is one
+      * @note None
+      * @param fd fd of event
+      * @param events epoll events
+      * @retval fd was outbound or not
+      */
+    static inline bool outbound_dispatch(int fd,uint32_t events)
+    {
+        outbound* o = outbound_table::find(fd);
+        if(!o) return false;
+        o->dispatch(fd,events);
+        return true;
+    }
+
+    /**
+      * @brief group of backend servers with per-reactor keep-alive pools
+      * @note connect() runs non-blocking on the epoll given,normally the one of the calling conn,
+      *       so connect completion and all later events are handled by the same reactor.
+      *       failed connects count against a server,max_fails in a row take it out for fail_timeout
+      *       seconds.health_check() additionally probes every server from a background thread
+      */
+    class upstream {
+    public:
+        using done_handler = std::function<void(outbound*)>;
+
+        std::string name;
+        std::vector<std::unique_ptr<upstream_server>> servers;
+        int max_idle{32};
+        int max_fails{3};
+        int fail_timeout{10};
+        int connect_timeout{3};
+        upstream_Policy policy{ROUND_ROBIN};
+    private:
+        std::mutex free_mtx;
+        std::vector<std::unique_ptr<outbound>> all;
+        std::vector<outbound*> free_list;
+        std::atomic<size_t> rr{0};
+        /* smooth weighted round robin order,one entry per weight unit */
+        std::vector<upstream_server*> order;
+        /* consistent hash ring,sorted by point */
+        std::vector<std::pair<uint64_t,upstream_server*>> ring;
+        std::atomic<bool> checking{false};
+        std::thread checker;
+
+        outbound* _alloc_()
+        {
+            std::lock_guard<std::mutex> guard(free_mtx);
+            if(!free_list.empty())
+            {
+                outbound* o = free_list.back();
+                free_list.pop_back();
+                return o;
+            }
+            all.emplace_back(new outbound);
+            all.back()->owner = this;
+            return all.back().get();
+        }
+        /**
+          * @brief close connection and recycle it
+          * @note None
+          * @param o outbound
+          * @param was_busy counted in server->active or not
+          * @retval None
+          */
+        void _close_(outbound* o,bool was_busy)
+        {
+            int fd;
+            {
+                std::lock_guard<std::mutex> guard(o->mtx);
+                fd = o->socket_fd;
+                o->state = outbound::FREE;
+                o->on_event = nullptr;
+                o->socket_fd = -1;
+            }
+            if(was_busy) o->server->active--;
+            if(fd != -1)
+            {
+                outbound_table::remove(fd);
+                epoll_del(o->epoll_fd,fd);
+            }
+            std::lock_guard<std::mutex> guard(free_mtx);
+            free_list.push_back(o);
+        }
+        static uint64_t _mix_(uint64_t h)
+        {
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdULL;
+            h ^= h >> 33;
+            h *= 0xc4ceb9fe1a85ec53ULL;
+            h ^= h >> 33;
+            return h;
+        }
+        upstream_server* _pick_round_robin_(time_t now)
+        {
+            size_t start = rr++;
+            for(size_t i = 0;i < order.size();i++)
+            {
+                upstream_server* s = order[(start + i) % order.size()];
+                if(s->available(now)) return s;
+            }
+            return order[start % order.size()];
+        }
+        /**
+          * @brief rebuild round robin order
+          * @note weights 5,1,1 give a,a,b,a,c,a,a instead of a,a,a,a,a,b,c
+          * @param None
+          * @retval None
+          */
+        void _build_order_()
+        {
+            order.clear();
+            std::vector<int> current(servers.size(),0);
+            int total = 0;
+            for(auto& s : servers) total += s->weight;
+            for(int n = 0;n < total;n++)
+            {
+                size_t best = 0;
+                for(size_t i = 0;i < servers.size();i++)
+                {
+                    current[i] += servers[i]->weight;
+                    if(current[i] > current[best]) best = i;
+                }
+                current[best] -= total;
+                order.push_back(servers[best].get());
+            }
+        }
+        /**
+          * @brief available server with fewest active connections per weight
+          * @note ties are broken in round robin order so idle servers share the load
+          * @param now conn_clock()
+          * @retval server
+          */
+        upstream_server* _pick_least_conn_(time_t now)
+        {
+            size_t start = rr++;
+            upstream_server* best = nullptr;
+            for(size_t i = 0;i < servers.size();i++)
+            {
+                upstream_server* s = servers[(start + i) % servers.size()].get();
+                if(!s->available(now)) continue;
+                if(!best || (int64_t)s->active * best->weight < (int64_t)best->active * s->weight) best = s;
+            }
+            return best ? best : servers[start % servers.size()].get();
+        }
+        /**
+          * @brief first available server clockwise from key on the hash ring
+          * @note a down server only moves its own keys to the next servers on the ring
+          * @param key hash key
+          * @param now conn_clock()
+          * @retval server
+          */
+        upstream_server* _pick_hash_(uint64_t key,time_t now)
+        {
+            key = _mix_(key);
+            auto it = std::lower_bound(ring.begin(),ring.end(),std::make_pair(key,(upstream_server*)nullptr));
+            for(size_t i = 0;i < ring.size();i++,it++)
+            {
+                if(it == ring.end()) it = ring.begin();
+                if(it->second->available(now)) return it->second;
+            }
+            return ring[0].second;
+        }
+        void _fail_(upstream_server* s)
+        {
+            if(++s->fails >= max_fails)
+            {
+                s->fails = 0;
+                s->down_until = conn_clock() + fail_timeout;
+                LOG_WARN("upstream " + name + " server " + s->ip + ":" + std::to_string(s->port) + " marked down");
+            }
+        }
+        /**
+          * @brief blocking tcp probe with timeout
+          * @note None
+          * @param s server
+          * @retval reachable or not
+          */
+        bool _probe_(upstream_server* s) const
+        {
+            int fd = socket(AF_INET,SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,0);
+            if(fd < 0) return false;
+            bool ok = ::connect(fd,(sockaddr*)&s->addr,sizeof(s->addr)) == 0;
+            if(!ok && errno == EINPROGRESS)
+            {
+                pollfd p{fd,POLLOUT,0};
+                int err = 0;
+                socklen_t len = sizeof(err);
+                ok = poll(&p,1,connect_timeout * 1000) == 1
+                  && getsockopt(fd,SOL_SOCKET,SO_ERROR,&err,&len) == 0 && err == 0;
+            }
+            ::close(fd);
+            return ok;
+        }
+        /**
+          * @brief keep-alive connection is idle,any event means the server closed or misbehaved
+          * @note None
+          * @param o outbound
+          * @param events epoll events
+          * @retval None
+          */
+        void _on_idle_event_(outbound* o,uint32_t)
+        {
+            upstream_server* s = o->server;
+            {
+                std::lock_guard<std::mutex> guard(s->mtx);
+                auto& list = s->idle[o->epoll_fd];
+                auto it = std::find(list.begin(),list.end(),o);
+                if(it == list.end()) return;
+                list.erase(it);
+            }
+            _close_(o,false);
+        }
+        void _on_connect_event_(outbound* o,uint32_t events,const done_handler& done)
+        {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            if((events & (EPOLLERR | EPOLLHUP)) || getsockopt(o->socket_fd,SOL_SOCKET,SO_ERROR,&err,&len) != 0 || err != 0)
+            {
+                _fail_(o->server);
+                _close_(o,true);
+                done(nullptr);
+                return;
+            }
+            o->server->fails = 0;
+            {
+                std::lock_guard<std::mutex> guard(o->mtx);
+                o->state = outbound::BUSY;
+                o->on_event = nullptr;
+            }
+            done(o);
+        }
+    public:
+        explicit upstream(std::string _name) : name(std::move(_name)) {}
+        upstream(const upstream&) = delete;
+        upstream& operator=(const upstream&) = delete;
+        /* open connections are closed and leave outbound_table,so no reactor finds a freed outbound */
+        ~upstream()
+        {
+            checking = false;
+            if(checker.joinable()) checker.join();
+            for(auto& o : all)
+            {
+                int fd;
+                {
+                    std::lock_guard<std::mutex> guard(o->mtx);
+                    fd = o->socket_fd;
+                    o->state = outbound::FREE;
+                    o->on_event = nullptr;
+                    o->socket_fd = -1;
+                }
+                if(fd == -1) continue;
+                if(outbound_table::find(fd) == o.get()) outbound_table::remove(fd);
+                epoll_del(o->epoll_fd,fd);
+            }
+        }
+
+        /**
+          * @brief add backend server
+          * @note must be called before serving
+          * @param ip ipv4 address
+          * @param port port
+          * @param weight weight used by balancing policies
+          * @retval success or not
+          */
+        bool add_server(const std::string& ip,uint16_t port,int weight = 1)
+        {
+            std::unique_ptr<upstream_server> s(new upstream_server);
+            s->ip = ip;
+            s->port = port;
+            s->weight = weight > 0 ? weight : 1;
+            s->addr.sin_family = AF_INET;
+            s->addr.sin_port = htons(port);
+            if(inet_pton(AF_INET,ip.c_str(),&s->addr.sin_addr) != 1)
+            {
+                LOG_WARN("upstream " + name + " bad server address " + ip);
+                return false;
+            }
+            std::string id = ip + ":" + std::to_string(port) + "#";
+            for(int i = 0;i < UPSTREAM_RING_REPLICAS * s->weight;i++)
+            {
+                ring.emplace_back(_mix_(hash_key(id + std::to_string(i))),s.get());
+            }
+            std::sort(ring.begin(),ring.end());
+            servers.emplace_back(std::move(s));
+            _build_order_();
+            return true;
+        }
+        /**
+          * @brief FNV-1a hash for consistent hashing keys
+          * @note None
+          * @param data key
+          * @retval hash
+          */
+        static uint64_t hash_key(const std::string& data)
+        {
+            uint64_t h = 0xcbf29ce484222325ULL;
+            for(unsigned char c : data)
+            {
+                h ^= c;
+                h *= 0x100000001b3ULL;
+            }
+            return h;
+        }
+        /**
+          * @brief choose available server by policy
+          * @note falls back to any server when all are down
+          * @param key hash key,only used by CONSISTENT_HASH
+          * @retval server or nullptr when there are none
+          */
+        upstream_server* pick(uint64_t key = 0)
+        {
+            if(servers.empty()) return nullptr;
+            time_t now = conn_clock();
+            switch(policy)
+            {
+                case LEAST_CONN : return _pick_least_conn_(now);
+                case CONSISTENT_HASH : return _pick_hash_(key,now);
+                default : return _pick_round_robin_(now);
+            }
+        }
+        /**
+          * @brief get connection to server on epoll,reusing a keep-alive one when possible
+          * @note done runs at once on this thread for a reused connection,
+          *       otherwise on the reactor thread of epoll_fd once connected.
+          *       done gets nullptr when connecting failed
+          * @param epoll_fd epoll of the reactor that will own the connection
+          * @param s server
+          * @param done completion
+          * @retval None
+          */
+        void connect(int epoll_fd,upstream_server* s,done_handler done)
+        {
+            outbound* o = nullptr;
+            {
+                std::lock_guard<std::mutex> guard(s->mtx);
+                auto it = s->idle.find(epoll_fd);
+                if(it != s->idle.end() && !it->second.empty())
+                {
+                    o = it->second.back();
+                    it->second.pop_back();
+                }
+            }
+            s->active++;
+            if(o)
+            {
+                {
+                    std::lock_guard<std::mutex> guard(o->mtx);
+                    o->state = outbound::BUSY;
+                    o->on_event = nullptr;
+                }
+                o->from_pool = true;
+                done(o);
+                return;
+            }
+            int fd = socket(AF_INET,SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,0);
+            if(fd < 0)
+            {
+                s->active--;
+                done(nullptr);
+                return;
+            }
+            int opt = 1;
+            setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&opt,sizeof(opt));
+            /* roughly connect_timeout seconds of SYN retransmits (1s,2s,4s...) */
+            int syn = 1;
+            while(syn < 6 && (1 << (syn + 1)) - 1 < connect_timeout) syn++;
+            setsockopt(fd,IPPROTO_TCP,TCP_SYNCNT,&syn,sizeof(syn));
+            o = _alloc_();
+            o->server = s;
+            o->epoll_fd = epoll_fd;
+            o->from_pool = false;
+            o->already = true;
+            if(!outbound_table::put(fd,o))
+            {
+                ::close(fd);
+                s->active--;
+                std::lock_guard<std::mutex> guard(free_mtx);
+                free_list.push_back(o);
+                done(nullptr);
+                return;
+            }
+            int ret = ::connect(fd,(sockaddr*)&s->addr,sizeof(s->addr));
+            if(ret != 0 && errno != EINPROGRESS)
+            {
+                outbound_table::remove(fd);
+                ::close(fd);
+                _fail_(s);
+                s->active--;
+                std::lock_guard<std::mutex> guard(free_mtx);
+                free_list.push_back(o);
+                done(nullptr);
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> guard(o->mtx);
+                o->socket_fd = fd;
+                o->state = outbound::CONNECTING;
+                o->on_event = [this,done](outbound* self,uint32_t events) { _on_connect_event_(self,events,done); };
+            }
+            epoll_event ev{};
+            ev.data.fd = fd;
+            ev.events = EPOLLOUT | EPOLLRDHUP | EPOLLONESHOT;
+            if(epoll_ctl(epoll_fd,EPOLL_CTL_ADD,fd,&ev) != 0)
+            {
+                _close_(o,true);
+                done(nullptr);
+            }
+        }
+        void connect(int epoll_fd,done_handler done,uint64_t key = 0)
+        {
+            upstream_server* s = pick(key);
+            if(!s)
+            {
+                done(nullptr);
+                return;
+            }
+            connect(epoll_fd,s,std::move(done));
+        }
+        /**
+          * @brief give connection back to its pool
+          * @note None
+          * @param o outbound from connect()
+          * @param reusable keep it as keep-alive connection
+          * @retval None
+          */
+        void release(outbound* o,bool reusable)
+        {
+            upstream_server* s = o->server;
+            if(reusable)
+            {
+                std::lock_guard<std::mutex> guard(s->mtx);
+                auto& list = s->idle[o->epoll_fd];
+                if(list.size() < (size_t)max_idle)
+                {
+                    {
+                        std::lock_guard<std::mutex> o_guard(o->mtx);
+                        o->state = outbound::IDLE;
+                        o->on_event = [this](outbound* self,uint32_t events) { _on_idle_event_(self,events); };
+                    }
+                    o->already = true;
+                    list.push_back(o);
+                    s->active--;
+                    o->next(EPOLLIN);
+                    return;
+                }
+            }
+            _close_(o,true);
+        }
+        /**
+          * @brief probe every server from a background thread
+          * @note a server that accepts a tcp connection is marked up,otherwise down until a probe succeeds
+          * @param interval seconds between rounds
+          * @retval None
+          */
+        void health_check(int interval)
+        {
+            if(interval <= 0 || checking.exchange(true)) return;
+            checker = std::thread([this,interval] {
+                while(checking)
+                {
+                    for(auto& s : servers)
+                    {
+                        bool up = _probe_(s.get());
+                        time_t now = conn_clock();
+                        if(up && !s->available(now))
+                        {
+                            LOG_INFO("upstream " + name + " server " + s->ip + ":" + std::to_string(s->port) + " is up");
+                        }
+                        s->fails = 0;
+                        s->down_until = up ? 0 : std::numeric_limits<time_t>::max();
+                    }
+                    for(int i = 0;i < interval * 10 && checking;i++)
+                    {
+                        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                    }
+                }
+            });
+        }
+    };
+
+    void outbound::release(bool reusable)
+    {
+        owner->release(this,reusable);
+    }
+}
+
+#endif
@@ -3,6 +3,7 @@
 
 #include "conn.h"               /* conn */
 #include "threadpool.h"         /* thread_pool */
+#include "configure.h"          /* configure */
 #include <iostream>
 namespace hzd
 {
@@ -26,7 +27,7 @@ namespace hzd
         bool one_shot{true};
         std::string ip{};
         short port{0};
-        int max_connect_count{200000};
+        std::atomic<int> max_connect_count{200000};
         std::atomic<int> current_connect_count{0};
 
         virtual void close() = 0;
@@ -46,6 +47,19 @@ namespace hzd
         virtual void set_max_events_count(int size) = 0;
         virtual void set_max_connect_count(int size){if(size >= 0) max_connect_count = size;}
         virtual void set_listen_queue_count(int size) = 0;
+        /**
+          * @brief apply the configs safe to change while running
+          * @note called after configure::reload() by the thread watching the config,
+          *       ip,port,reactor_count,et,one_shot and pools need a restart
+          * @param None
+          * @retval None
+          */
+        virtual void reconfigure()
+        {
+            configure& conf = configure::get_config();
+            if(conf["max_connect_count"].type != JSON_NULL)
+                set_max_connect_count((int32_t)conf["max_connect_count"]);
+        }
     };
 }
 
@@ -0,0 +1,323 @@
+#ifndef CONV_EVENT_EVENT_LOOP_H
+#define CONV_EVENT_EVENT_LOOP_H
+
+#include <atomic>                   /* atomic */
+#include <functional>               /* function */
+#include <memory>                   /* shared_ptr */
+#include <vector>                   /* vector */
+#include <algorithm>                /* push_heap pop_heap */
+#include <thread>                   /* this_thread */
+#include <ctime>                    /* clock_gettime */
+#include <cerrno>                   /* errno */
+#include <unistd.h>                 /* read write close */
+#include <sys/epoll.h>              /* epoll_ctl */
+#include <sys/eventfd.h>            /* eventfd */
+#include <sys/resource.h>           /* getrlimit */
+
+namespace hzd {
+
+    #define FD_TABLE_MAX_FDS (1 << 20)
+
+    /**
+      * @brief fd -> object,lock-free lookup for every event
+      * @note sized once by RLIMIT_NOFILE,fds above it are not stored
+      */
+    template<class T>
+    class fd_table {
+        static std::atomic<T*>* _slots_(size_t& size)
+        {
+            static size_t count = 0;
+            static std::atomic<T*>* slots = [] {
+                rlimit rl{};
+                count = getrlimit(RLIMIT_NOFILE,&rl) == 0 && rl.rlim_cur != RLIM_INFINITY ? (size_t)rl.rlim_cur : FD_TABLE_MAX_FDS;
+                if(count > FD_TABLE_MAX_FDS) count = FD_TABLE_MAX_FDS;
+                auto* s = new std::atomic<T*>[count];
+                for(size_t i = 0;i < count;i++) s[i].store(nullptr,std::memory_order_relaxed);
+                return s;
+            }();
+            size = count;
+            return slots;
+        }
+    public:
+        static bool put(int fd,T* t)
+        {
+            size_t size;
+            std::atomic<T*>* slots = _slots_(size);
+            if(fd < 0 || (size_t)fd >= size) return false;
+            slots[fd].store(t,std::memory_order_release);
+            return true;
+        }
+        static void remove(int fd)
+        {
+            put(fd,nullptr);
+        }
+        static T* find(int fd)
+        {
+            size_t size;
+            std::atomic<T*>* slots = _slots_(size);
+            if(fd < 0 || (size_t)fd >= size) return nullptr;
+            return slots[fd].load(std::memory_order_acquire);
+        }
+    };
+
+    /**
+      * @brief milliseconds of monotonic clock
+      * @note None
+      * @param None
+      * @retval milliseconds
+      */
+    static inline int64_t loop_clock_ms()
+    {
+        timespec ts{};
+        clock_gettime(CLOCK_MONOTONIC,&ts);
+        return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    }
+
+    /* timer scheduled on an event_loop,cancel() may be called from any thread */
+    class loop_timer {
+        friend class event_loop;
+        std::function<void()> task;
+        int64_t when{0};
+        int interval{0};
+        uint64_t seq{0};
+        std::atomic<bool> cancelled{false};
+    public:
+        void cancel() { cancelled = true; }
+        bool active() const { return !cancelled; }
+    };
+    using timer_handle = std::shared_ptr<loop_timer>;
+
+    /**
+      * @brief closures and timers run by the thread of one reactor
+      * @note post() is lock-free from any thread: tasks are pushed on an atomic stack and
+      *       an eventfd wakes the reactor from epoll_wait,one write per batch.
+      *       timers live in a min-heap only touched by the reactor thread,timers added by
+      *       other threads are posted first.the reactor waits no longer than the nearest timer
+      */
+    class event_loop {
+        struct task_node
+        {
+            std::function<void()> task;
+            task_node* next;
+        };
+        struct timer_later
+        {
+            bool operator()(const timer_handle& a,const timer_handle& b) const
+            {
+                return a->when != b->when ? a->when > b->when : a->seq > b->seq;
+            }
+        };
+
+        int event_fd{-1};
+        int epoll_fd{-1};
+        std::atomic<task_node*> head{nullptr};
+        std::atomic<bool> signaled{false};
+        std::thread::id owner;
+        std::vector<timer_handle> timers;
+        uint64_t timer_seq{0};
+
+        void _wake_()
+        {
+            if(signaled.exchange(true)) return;
+            uint64_t one = 1;
+            while(::write(event_fd,&one,sizeof(one)) < 0 && errno == EINTR);
+        }
+        void _add_timer_(const timer_handle& t)
+        {
+            t->seq = timer_seq++;
+            timers.push_back(t);
+            std::push_heap(timers.begin(),timers.end(),timer_later());
+        }
+        timer_handle _schedule_(int delay_ms,int interval_ms,std::function<void()> task)
+        {
+            timer_handle t = std::make_shared<loop_timer>();
+            t->task = std::move(task);
+            t->interval = interval_ms > 0 ? interval_ms : 0;
+            t->when = loop_clock_ms() + (delay_ms > 0 ? delay_ms : 0);
+            if(in_loop()) _add_timer_(t);
+            else post([this,t] { _add_timer_(t); });
+            return t;
+        }
+    public:
+        event_loop() = default;
+        event_loop(const event_loop&) = delete;
+        event_loop& operator=(const event_loop&) = delete;
+        ~event_loop()
+        {
+            close();
+        }
+        /**
+          * @brief event loop of reactor owning epoll fd
+          * @note None
+          * @param epoll_fd epoll fd of a reactor
+          * @retval loop or nullptr
+          */
+        static event_loop* of(int epoll_fd)
+        {
+            return fd_table<event_loop>::find(epoll_fd);
+        }
+        /**
+          * @brief create eventfd and register it on epoll
+          * @note called by the reactor before it starts working
+          * @param _epoll_fd epoll fd of the reactor
+          * @retval success or not
+          */
+        bool open(int _epoll_fd)
+        {
+            if(event_fd != -1) return true;
+            event_fd = eventfd(0,EFD_NONBLOCK | EFD_CLOEXEC);
+            if(event_fd < 0) return false;
+            epoll_fd = _epoll_fd;
+            epoll_event ev{};
+            ev.data.fd = event_fd;
+            ev.events = EPOLLIN;
+            if(epoll_ctl(epoll_fd,EPOLL_CTL_ADD,event_fd,&ev) != 0 || !fd_table<event_loop>::put(epoll_fd,this))
+            {
+                ::close(event_fd);
+                event_fd = -1;
+                return false;
+            }
+            return true;
+        }
+        /**
+          * @brief unregister and drop tasks not run yet
+          * @note None
+          * @param None
+          * @retval None
+          */
+        void close()
+        {
+            if(event_fd != -1)
+            {
+                if(of(epoll_fd) == this) fd_table<event_loop>::remove(epoll_fd);
+                ::close(event_fd);
+                event_fd = -1;
+            }
+            task_node* n = head.exchange(nullptr);
+            while(n)
+            {
+                task_node* next = n->next;
+                delete n;
+                n = next;
+            }
+            timers.clear();
+        }
+        int fd() const { return event_fd; }
+        /* called by the reactor thread once before its first wait */
+        void bind_thread() { owner = std::this_thread::get_id(); }
+        bool in_loop() const { return owner == std::this_thread::get_id(); }
+
+        /**
+          * @brief run task on the reactor thread
+          * @note lock-free,tasks run in the order they were posted
+          * @param task task
+          * @retval None
+          */
+        void post(std::function<void()> task)
+        {
+            auto* n = new task_node{std::move(task),head.load(std::memory_order_relaxed)};
+            while(!head.compare_exchange_weak(n->next,n,std::memory_order_release,std::memory_order_relaxed));
+            if(!in_loop()) _wake_();
+        }
+        /**
+          * @brief run task once after delay
+          * @note None
+          * @param delay_ms delay in milliseconds
+          * @param task task
+          * @retval timer
+          */
+        timer_handle run_after(int delay_ms,std::function<void()> task)
+        {
+            return _schedule_(delay_ms,0,std::move(task));
+        }
+        /**
+          * @brief run task every interval until cancelled
+          * @note a late run does not cause catch-up runs
+          * @param interval_ms interval in milliseconds
+          * @param task task
+          * @retval timer
+          */
+        timer_handle run_every(int interval_ms,std::function<void()> task)
+        {
+            if(interval_ms <= 0) interval_ms = 1;
+            return _schedule_(interval_ms,interval_ms,std::move(task));
+        }
+        /**
+          * @brief epoll_wait timeout bounded by the nearest timer
+          * @note None
+          * @param time_out timeout wanted by the reactor
+          * @retval timeout in milliseconds
+          */
+        int wait_time(int time_out)
+        {
+            if(head.load(std::memory_order_relaxed)) return 0;
+            while(!timers.empty() && timers.front()->cancelled)
+            {
+                std::pop_heap(timers.begin(),timers.end(),timer_later());
+                timers.pop_back();
+            }
+            if(timers.empty()) return time_out;
+            int64_t left = timers.front()->when - loop_clock_ms();
+            if(left <= 0) return 0;
+            return time_out < 0 || left < time_out ? (int)left : time_out;
+        }
+        /**
+          * @brief consume eventfd wakeup
+          * @note flag is reset after the read so a post racing with it writes again
+          * @param None
+          * @retval None
+          */
+        void clear()
+        {
+            uint64_t count;
+            while(::read(event_fd,&count,sizeof(count)) < 0 && errno == EINTR);
+            signaled = false;
+        }
+        /**
+          * @brief run posted tasks then due timers
+          * @note called by the reactor thread after each epoll_wait
+          * @param None
+          * @retval None
+          */
+        void run()
+        {
+            task_node* n = head.exchange(nullptr,std::memory_order_acquire);
+            if(n)
+            {
+                task_node* ordered = nullptr;
+                while(n)
+                {
+                    task_node* next = n->next;
+                    n->next = ordered;
+                    ordered = n;
+                    n = next;
+                }
+                while(ordered)
+                {
+                    task_node* next = ordered->next;
+                    ordered->task();
+                    delete ordered;
+                    ordered = next;
+                }
+            }
+            if(timers.empty()) return;
+            int64_t now = loop_clock_ms();
+            while(!timers.empty() && timers.front()->when <= now)
+            {
+                std::pop_heap(timers.begin(),timers.end(),timer_later());
+                timer_handle t = std::move(timers.back());
+                timers.pop_back();
+                if(t->cancelled) continue;
+                if(t->interval > 0)
+                {
+                    t->when = now + t->interval;
+                    _add_timer_(t);
+                }
+                else t->cancelled = true;
+                t->task();
+            }
+        }
+    };
+}
+
+#endif
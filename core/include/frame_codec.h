@@ -0,0 +1,154 @@
+#ifndef CONV_EVENT_FRAME_CODEC_H
+#define CONV_EVENT_FRAME_CODEC_H
+
+#include <string>                   /* string */
+#include <cstring>                  /* memcpy memmove */
+#include <cerrno>                   /* errno */
+#include <sys/socket.h>             /* recv */
+#include "utils.h"                  /* header */
+#include "metrics.h"                /* metrics */
+
+namespace hzd {
+
+    #define FRAME_MAX_SIZE (64 * 1024 * 1024)
+    #define FRAME_READ_SIZE (16 * 1024)
+
+    /* payload of one complete frame,points into the frame_reader buffer */
+    struct frame_view
+    {
+        const char* data;
+        size_t size;
+    };
+
+    /**
+      * @brief incremental reader of hzd::header length-prefixed frames
+      * @note bytes are read straight into one growing buffer,partial headers and payloads
+      *       stay there until the rest arrives and one read may yield many frames.
+      *       views returned by next() stay valid until the following fill().
+      */
+    class frame_reader {
+        std::string buffer;
+        size_t begin{0};
+        size_t end{0};
+        size_t max_size;
+        bool broken{false};
+
+        /**
+          * @brief move unread bytes to the front and make room for need more bytes
+          * @note None
+          * @param need bytes wanted after end
+          * @retval None
+          */
+        void _reserve_(size_t need)
+        {
+            if(begin > 0)
+            {
+                if(end > begin) memmove(&buffer[0],&buffer[begin],end - begin);
+                end -= begin;
+                begin = 0;
+            }
+            if(buffer.size() - end < need)
+            {
+                size_t size = buffer.empty() ? FRAME_READ_SIZE : buffer.size();
+                while(size - end < need) size *= 2;
+                buffer.resize(size);
+            }
+        }
+    public:
+        explicit frame_reader(size_t _max_size = FRAME_MAX_SIZE) : max_size(_max_size) {}
+
+        /**
+          * @brief read everything the socket has
+          * @note None
+          * @param fd socket fd
+          * @retval 1 would block,0 peer closed,-1 error
+          */
+        int fill(int fd)
+        {
+            for(;;)
+            {
+                _reserve_(FRAME_READ_SIZE);
+                size_t space = buffer.size() - end;
+                ssize_t n = ::recv(fd,&buffer[end],space,0);
+                if(n > 0)
+                {
+                    metrics::count(M_BYTES_IN,n);
+                    end += n;
+                    /* a short read drained the socket,later data raises a new event even with ET */
+                    if((size_t)n < space) return 1;
+                    continue;
+                }
+                if(n == 0) return 0;
+                if(errno == EINTR) continue;
+                return errno == EAGAIN || errno == EWOULDBLOCK ? 1 : -1;
+            }
+        }
+        /**
+          * @brief append bytes read elsewhere
+          * @note None
+          * @param data data
+          * @param size data size
+          * @retval None
+          */
+        void feed(const char* data,size_t size)
+        {
+            _reserve_(size);
+            memcpy(&buffer[end],data,size);
+            end += size;
+        }
+        /**
+          * @brief take next complete frame
+          * @note a header larger than max size marks the reader broken
+          * @param frame output view
+          * @retval complete frame or not
+          */
+        bool next(frame_view& frame)
+        {
+            if(broken || end - begin < HEADER_SIZE) return false;
+            header h{};
+            memcpy(&h,&buffer[begin],HEADER_SIZE);
+            if(h.size > max_size)
+            {
+                broken = true;
+                return false;
+            }
+            if(end - begin - HEADER_SIZE < h.size) return false;
+            frame.data = &buffer[begin + HEADER_SIZE];
+            frame.size = (size_t)h.size;
+            begin += HEADER_SIZE + (size_t)h.size;
+            if(begin == end) begin = end = 0;
+            return true;
+        }
+        bool bad() const { return broken; }
+        size_t pending() const { return end - begin; }
+        void clear()
+        {
+            begin = end = 0;
+            broken = false;
+        }
+    };
+
+    /**
+      * @brief batch of length-prefixed frames in one contiguous buffer
+      * @note for many small frames,copying them once and writing one buffer
+      *       is cheaper than one iovec per frame and never splits a reply into several segments
+      */
+    class frame_writer {
+        std::string out;
+    public:
+        void append(const char* data,size_t size)
+        {
+            header h{size};
+            out.append((const char*)&h,HEADER_SIZE);
+            out.append(data,size);
+        }
+        void append(const frame_view& frame) { append(frame.data,frame.size); }
+        void append(const std::string& data) { append(data.data(),data.size()); }
+        const std::string& buffer() const { return out; }
+        size_t size() const { return out.size(); }
+        bool empty() const { return out.empty(); }
+        void clear() { out.clear(); }
+    };
+}
+
+#endif
@@ -0,0 +1,183 @@
+#ifndef CONV_EVENT_HANDOFF_H
+#define CONV_EVENT_HANDOFF_H
+
+#include <string>                   /* string */
+#include <cstring>                  /* memcpy */
+#include <cerrno>                   /* errno */
+#include <unistd.h>                 /* close unlink */
+#include <fcntl.h>                  /* fcntl */
+#include <sys/socket.h>             /* sendmsg recvmsg */
+#include <sys/stat.h>               /* chmod */
+#include <sys/un.h>                 /* sockaddr_un */
+#include <sys/epoll.h>              /* epoll_ctl */
+#include <netinet/in.h>             /* sockaddr_in */
+
+namespace hzd {
+
+    #define HANDOFF_REQUEST 'H'
+    #define HANDOFF_REPLY 'L'
+    #define HANDOFF_TIMEOUT_SECONDS 2
+
+    /**
+      * @brief pass the listening socket to a newly started process
+      * @note the running process serves a unix socket at handoff_path.a new process
+      *       connects to it first and receives the listening fd by SCM_RIGHTS instead of
+      *       binding the port,then serves handoff_path itself for the next upgrade.
+      *       the old process drains once the fd is handed over.the listening socket is
+      *       never closed in between,so no connection is refused during the upgrade
+      */
+    class listen_handoff {
+        int server_fd{-1};
+        std::string path;
+
+        static bool _address_(const std::string& p,sockaddr_un& addr)
+        {
+            if(p.empty() || p.size() >= sizeof(addr.sun_path)) return false;
+            addr.sun_family = AF_UNIX;
+            memcpy(addr.sun_path,p.c_str(),p.size() + 1);
+            return true;
+        }
+        static void _timeout_(int fd)
+        {
+            timeval tv{HANDOFF_TIMEOUT_SECONDS,0};
+            setsockopt(fd,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));
+            setsockopt(fd,SOL_SOCKET,SO_SNDTIMEO,&tv,sizeof(tv));
+        }
+    public:
+        listen_handoff() = default;
+        listen_handoff(const listen_handoff&) = delete;
+        listen_handoff& operator=(const listen_handoff&) = delete;
+        ~listen_handoff()
+        {
+            close();
+        }
+        /**
+          * @brief take the listening socket of a running process
+          * @note None
+          * @param p handoff path
+          * @param port expected port,a socket on another port is refused
+          * @retval listening fd or -1 when nothing runs at p
+          */
+        static int take(const std::string& p,uint16_t port)
+        {
+            sockaddr_un addr{};
+            if(!_address_(p,addr)) return -1;
+            int sock = socket(AF_UNIX,SOCK_STREAM | SOCK_CLOEXEC,0);
+            if(sock < 0) return -1;
+            _timeout_(sock);
+            char byte = HANDOFF_REQUEST;
+            if(connect(sock,(sockaddr*)&addr,sizeof(addr)) != 0 || ::send(sock,&byte,1,MSG_NOSIGNAL) != 1)
+            {
+                ::close(sock);
+                return -1;
+            }
+            iovec iov{&byte,1};
+            char control[CMSG_SPACE(sizeof(int))];
+            memset(control,0,sizeof(control));
+            msghdr msg{};
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            ssize_t n;
+            while((n = recvmsg(sock,&msg,MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR);
+            ::close(sock);
+            cmsghdr* c = CMSG_FIRSTHDR(&msg);
+            if(n != 1 || byte != HANDOFF_REPLY || !c || c->cmsg_level != SOL_SOCKET
+            || c->cmsg_type != SCM_RIGHTS || c->cmsg_len != CMSG_LEN(sizeof(int)))
+            {
+                return -1;
+            }
+            int fd;
+            memcpy(&fd,CMSG_DATA(c),sizeof(int));
+            sockaddr_in bound{};
+            socklen_t len = sizeof(bound);
+            if(getsockname(fd,(sockaddr*)&bound,&len) != 0 || bound.sin_family != AF_INET || ntohs(bound.sin_port) != port)
+            {
+                ::close(fd);
+                return -1;
+            }
+            return fd;
+        }
+        /**
+          * @brief serve handoff requests at p
+          * @note a stale socket file at p is replaced,the file is only accessible by its owner
+          * @param p handoff path
+          * @param epoll_fd epoll waiting for requests
+          * @retval success or not
+          */
+        bool open(const std::string& p,int epoll_fd)
+        {
+            sockaddr_un addr{};
+            if(!_address_(p,addr)) return false;
+            int fd = socket(AF_UNIX,SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,0);
+            if(fd < 0) return false;
+            ::unlink(p.c_str());
+            epoll_event ev{};
+            ev.data.fd = fd;
+            ev.events = EPOLLIN;
+            if(bind(fd,(sockaddr*)&addr,sizeof(addr)) != 0 || chmod(p.c_str(),0600) != 0
+            || ::listen(fd,4) != 0 || epoll_ctl(epoll_fd,EPOLL_CTL_ADD,fd,&ev) != 0)
+            {
+                ::close(fd);
+                return false;
+            }
+            server_fd = fd;
+            path = p;
+            return true;
+        }
+        int fd() const { return server_fd; }
+        /**
+          * @brief answer one handoff request with the listening fd
+          * @note stops serving,the socket file now belongs to the new process
+          * @param listen_fd listening fd
+          * @retval handed over or not
+          */
+        bool serve(int listen_fd)
+        {
+            int peer = accept4(server_fd,nullptr,nullptr,SOCK_CLOEXEC);
+            if(peer < 0) return false;
+            _timeout_(peer);
+            char byte = 0;
+            if(::recv(peer,&byte,1,0) != 1 || byte != HANDOFF_REQUEST)
+            {
+                ::close(peer);
+                return false;
+            }
+            byte = HANDOFF_REPLY;
+            iovec iov{&byte,1};
+            char control[CMSG_SPACE(sizeof(int))];
+            memset(control,0,sizeof(control));
+            msghdr msg{};
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            cmsghdr* c = CMSG_FIRSTHDR(&msg);
+            c->cmsg_level = SOL_SOCKET;
+            c->cmsg_type = SCM_RIGHTS;
+            c->cmsg_len = CMSG_LEN(sizeof(int));
+            memcpy(CMSG_DATA(c),&listen_fd,sizeof(int));
+            bool sent = sendmsg(peer,&msg,MSG_NOSIGNAL) == 1;
+            ::close(peer);
+            if(sent) close();
+            return sent;
+        }
+        /**
+          * @brief stop serving
+          * @note the socket file is left alone,it may already belong to a new process
+          * @param None
+          * @retval None
+          */
+        void close()
+        {
+            if(server_fd != -1)
+            {
+                ::close(server_fd);
+                server_fd = -1;
+            }
+        }
+    };
+}
+
+#endif
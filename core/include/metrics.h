@@ -0,0 +1,357 @@
+#ifndef CONV_EVENT_METRICS_H
+#define CONV_EVENT_METRICS_H
+
+#include "configure.h"              /* configure */
+#include "admission.h"              /* admission */
+#include "trace.h"                  /* trace */
+#include <atomic>                   /* atomic */
+#include <memory>                   /* unique_ptr */
+#include <mutex>                    /* mutex */
+#include <string>                   /* string */
+#include <vector>                   /* vector */
+#include <map>                      /* map */
+#include <ctime>                    /* clock_gettime */
+#include <cstdio>                   /* snprintf */
+
+namespace hzd {
+
+    /* 8 buckets per power of two,values up to 2^40 */
+    #define METRICS_SUB_BITS 3
+    #define METRICS_BUCKETS ((40 - METRICS_SUB_BITS + 1) << METRICS_SUB_BITS)
+    /* largest le exported,in powers of two of the unit */
+    #define METRICS_TIME_MAX_POW 26
+    #define METRICS_SIZE_MAX_POW 16
+
+    enum metric_counter {
+        M_ACCEPTS, M_CLOSES,
+        M_EVENTS_IN, M_EVENTS_OUT, M_EVENTS_RDHUP, M_EVENTS_ERROR,
+        M_BYTES_IN, M_BYTES_OUT,
+        M_POOL_HITS, M_POOL_MISSES,
+        M_QUEUE_PUSHES, M_QUEUE_POPS,
+        M_EPOLL_WAITS,
+        M_COUNTERS
+    };
+    enum metric_histogram {
+        /* events returned by one epoll_wait */
+        M_EPOLL_BATCH,
+        /* microseconds from epoll_wait returning (or the thread pool queue) to process() */
+        M_EVENT_TO_PROCESS,
+        /* microseconds in process() */
+        M_PROCESS_TIME,
+        /* microseconds from an http request being parsed to its response being sent */
+        M_HTTP_REQUEST,
+        M_HISTOGRAMS
+    };
+
+    /* written by the thread owning its shard only,so no locked instruction is needed */
+    struct metric_cell
+    {
+        std::atomic<uint64_t> v{0};
+        void add(uint64_t n)
+        {
+            v.store(v.load(std::memory_order_relaxed) + n,std::memory_order_relaxed);
+        }
+        uint64_t get() const { return v.load(std::memory_order_relaxed); }
+    };
+
+    /**
+      * @brief log-linear histogram like HdrHistogram
+      * @note values below 8 have a bucket each,above every power of two is split in 8,
+      *       so a bucket is at most 12.5% wide
+      */
+    struct metric_histogram_data
+    {
+        metric_cell buckets[METRICS_BUCKETS];
+        metric_cell sum;
+        metric_cell count;
+
+        static size_t index(uint64_t v)
+        {
+            if(v < (1u << METRICS_SUB_BITS)) return (size_t)v;
+            int e = 63 - __builtin_clzll(v);
+            if(e > 40) return METRICS_BUCKETS - 1;
+            size_t sub = (size_t)(v >> (e - METRICS_SUB_BITS)) & ((1u << METRICS_SUB_BITS) - 1);
+            return ((size_t)(e - METRICS_SUB_BITS + 1) << METRICS_SUB_BITS) + sub;
+        }
+        /* smallest value above bucket i */
+        static uint64_t upper(size_t i)
+        {
+            if(i < (1u << METRICS_SUB_BITS)) return i + 1;
+            size_t e = (i >> METRICS_SUB_BITS) + METRICS_SUB_BITS - 1;
+            size_t sub = i & ((1u << METRICS_SUB_BITS) - 1);
+            return (uint64_t)((1u << METRICS_SUB_BITS) + sub + 1) << (e - METRICS_SUB_BITS);
+        }
+        void record(uint64_t v)
+        {
+            buckets[index(v)].add(1);
+            sum.add(v);
+            count.add(1);
+        }
+    };
+
+    struct metrics_shard
+    {
+        std::string name{"other"};
+        std::atomic<bool> in_use{true};
+        metric_cell counters[M_COUNTERS];
+        metric_histogram_data histograms[M_HISTOGRAMS];
+    };
+
+    /* sums of the shards,taken on demand */
+    struct metrics_snapshot
+    {
+        std::map<std::string,std::vector<uint64_t>> counters;
+        std::vector<uint64_t> buckets[M_HISTOGRAMS];
+        uint64_t sum[M_HISTOGRAMS]{};
+        uint64_t count[M_HISTOGRAMS]{};
+
+        uint64_t total(metric_counter c) const
+        {
+            uint64_t t = 0;
+            for(auto& p : counters) t += p.second[c];
+            return t;
+        }
+        /**
+          * @brief value below which q of the recorded values are
+          * @note upper bound of the bucket holding it
+          * @param h histogram
+          * @param q 0 to 1
+          * @retval value
+          */
+        uint64_t percentile(metric_histogram h,double q) const
+        {
+            if(count[h] == 0) return 0;
+            uint64_t rank = (uint64_t)(q * count[h]);
+            uint64_t seen = 0;
+            for(size_t i = 0;i < buckets[h].size();i++)
+            {
+                seen += buckets[h][i];
+                if(seen > rank) return metric_histogram_data::upper(i);
+            }
+            return metric_histogram_data::upper(buckets[h].size() - 1);
+        }
+    };
+
+    /**
+      * @brief counters and latency histograms of the running server
+      * @note every thread writes its own shard without locks or locked instructions,
+      *       snapshot() adds them up.shards of exited threads are reused by new ones.
+      *       counters are kept per thread name (reactor-N,acceptor,worker),
+      *       histograms for the whole process.off with "metrics": false
+      */
+    class metrics {
+        struct registry
+        {
+            std::mutex mtx;
+            std::vector<std::unique_ptr<metrics_shard>> shards;
+        };
+        struct owner
+        {
+            metrics_shard* shard{nullptr};
+            ~owner()
+            {
+                if(shard) shard->in_use = false;
+            }
+        };
+        static registry& _registry_()
+        {
+            static registry r;
+            return r;
+        }
+        static metrics_shard* _acquire_()
+        {
+            registry& r = _registry_();
+            std::lock_guard<std::mutex> lock(r.mtx);
+            for(auto& s : r.shards)
+            {
+                bool expected = false;
+                if(s->in_use.compare_exchange_strong(expected,true)) return s.get();
+            }
+            r.shards.emplace_back(new metrics_shard);
+            return r.shards.back().get();
+        }
+        static void _histogram_text_(std::string& out,const metrics_snapshot& s,metric_histogram h,
+                                     const char* name,const char* help,bool seconds)
+        {
+            char line[256];
+            out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+            out.append("# TYPE ").append(name).append(" histogram\n");
+            int max_pow = seconds ? METRICS_TIME_MAX_POW : METRICS_SIZE_MAX_POW;
+            uint64_t cumulative = 0;
+            size_t i = 0;
+            for(int p = 0;p <= max_pow;p++)
+            {
+                uint64_t bound = (uint64_t)1 << p;
+                while(i < s.buckets[h].size() && metric_histogram_data::upper(i) <= bound) cumulative += s.buckets[h][i++];
+                if(seconds) snprintf(line,sizeof(line),"%s_bucket{le=\"%.9g\"} %llu\n",name,bound / 1e6,(unsigned long long)cumulative);
+                else snprintf(line,sizeof(line),"%s_bucket{le=\"%llu\"} %llu\n",name,(unsigned long long)bound,(unsigned long long)cumulative);
+                out.append(line);
+            }
+            snprintf(line,sizeof(line),"%s_bucket{le=\"+Inf\"} %llu\n",name,(unsigned long long)s.count[h]);
+            out.append(line);
+            if(seconds) snprintf(line,sizeof(line),"%s_sum %.6f\n",name,s.sum[h] / 1e6);
+            else snprintf(line,sizeof(line),"%s_sum %llu\n",name,(unsigned long long)s.sum[h]);
+            out.append(line);
+            snprintf(line,sizeof(line),"%s_count %llu\n",name,(unsigned long long)s.count[h]);
+            out.append(line);
+        }
+    public:
+        static std::atomic<bool>& enabled()
+        {
+            static std::atomic<bool> on{true};
+            return on;
+        }
+        /**
+          * @brief read "metrics" and follow config reloads
+          * @note called by conv_single and conv_multi
+          * @param None
+          * @retval None
+          */
+        static void load()
+        {
+            static bool hooked = configure::get_config().on_reload(load);
+            (void)hooked;
+            configure& conf = configure::get_config();
+            enabled() = conf["metrics"].type == JSON_NULL ? true : (bool)conf["metrics"];
+        }
+        static metrics_shard& local()
+        {
+            static thread_local owner o;
+            if(!o.shard) o.shard = _acquire_();
+            return *o.shard;
+        }
+        /* name the counters and the trace of this thread are kept under */
+        static void name_thread(const std::string& name)
+        {
+            trace::name_thread(name);
+            metrics_shard& s = local();
+            std::lock_guard<std::mutex> lock(_registry_().mtx);
+            s.name = name;
+        }
+        static int64_t clock_us()
+        {
+            timespec ts{};
+            clock_gettime(CLOCK_MONOTONIC,&ts);
+            return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+        }
+        static void count(metric_counter c,uint64_t n = 1)
+        {
+            if(!enabled().load(std::memory_order_relaxed)) return;
+            local().counters[c].add(n);
+        }
+        static void record(metric_histogram h,uint64_t v)
+        {
+            if(!enabled().load(std::memory_order_relaxed)) return;
+            local().histograms[h].record(v);
+        }
+        static metrics_snapshot snapshot()
+        {
+            metrics_snapshot s;
+            for(auto& b : s.buckets) b.assign(METRICS_BUCKETS,0);
+            registry& r = _registry_();
+            std::lock_guard<std::mutex> lock(r.mtx);
+            for(auto& shard : r.shards)
+            {
+                std::vector<uint64_t>& c = s.counters[shard->name];
+                c.resize(M_COUNTERS,0);
+                for(size_t i = 0;i < M_COUNTERS;i++) c[i] += shard->counters[i].get();
+                for(size_t h = 0;h < M_HISTOGRAMS;h++)
+                {
+                    metric_histogram_data& d = shard->histograms[h];
+                    for(size_t i = 0;i < METRICS_BUCKETS;i++) s.buckets[h][i] += d.buckets[i].get();
+                    s.sum[h] += d.sum.get();
+                    s.count[h] += d.count.get();
+                }
+            }
+            return s;
+        }
+        /**
+          * @brief all metrics in the Prometheus text format
+          * @note None
+          * @param None
+          * @retval text
+          */
+        static std::string prometheus()
+        {
+            metrics_snapshot s = snapshot();
+            std::string out;
+            char line[256];
+            struct counter_text
+            {
+                const char* name;
+                const char* help;
+                metric_counter first;
+                metric_counter last;
+                const char* labels[4];
+            };
+            const counter_text counters[] = {
+                {"conv_event_accepts_total","Connections accepted.",M_ACCEPTS,M_ACCEPTS,{nullptr}},
+                {"conv_event_closes_total","Connections closed.",M_CLOSES,M_CLOSES,{nullptr}},
+                {"conv_event_events_total","Events dispatched by type.",M_EVENTS_IN,M_EVENTS_ERROR,{"in","out","rdhup","error"}},
+                {"conv_event_received_bytes_total","Bytes received.",M_BYTES_IN,M_BYTES_IN,{nullptr}},
+                {"conv_event_sent_bytes_total","Bytes sent.",M_BYTES_OUT,M_BYTES_OUT,{nullptr}},
+                {"conv_event_conn_pool_hits_total","Connections taken from the object pool.",M_POOL_HITS,M_POOL_HITS,{nullptr}},
+                {"conv_event_conn_pool_misses_total","Connections allocated with the object pool empty.",M_POOL_MISSES,M_POOL_MISSES,{nullptr}},
+                {"conv_event_epoll_waits_total","epoll_wait calls returned.",M_EPOLL_WAITS,M_EPOLL_WAITS,{nullptr}},
+            };
+            for(const counter_text& c : counters)
+            {
+                out.append("# HELP ").append(c.name).append(" ").append(c.help).append("\n");
+                out.append("# TYPE ").append(c.name).append(" counter\n");
+                for(auto& p : s.counters)
+                {
+                    for(int i = c.first;i <= c.last;i++)
+                    {
+                        if(c.labels[0]) snprintf(line,sizeof(line),"%s{thread=\"%s\",type=\"%s\"} %llu\n",c.name,p.first.c_str(),
+                                                 c.labels[i - c.first],(unsigned long long)p.second[i]);
+                        else snprintf(line,sizeof(line),"%s{thread=\"%s\"} %llu\n",c.name,p.first.c_str(),(unsigned long long)p.second[i]);
+                        out.append(line);
+                    }
+                }
+            }
+            int64_t open = (int64_t)s.total(M_ACCEPTS) - (int64_t)s.total(M_CLOSES);
+            int64_t queued = (int64_t)s.total(M_QUEUE_PUSHES) - (int64_t)s.total(M_QUEUE_POPS);
+            /* fixed text appended as is,only the values are formatted */
+            out.append("# HELP conv_event_connections Connections open.\n"
+                       "# TYPE conv_event_connections gauge\nconv_event_connections ")
+               .append(std::to_string(open > 0 ? open : 0)).append("\n");
+            out.append("# HELP conv_event_queue_depth Items waiting in thread pools.\n"
+                       "# TYPE conv_event_queue_depth gauge\nconv_event_queue_depth ")
+               .append(std::to_string(queued > 0 ? queued : 0)).append("\n");
+            admission& a = admission::get();
+            out.append("# HELP conv_event_admission_rejected_total Connections refused by max_connect_per_ip.\n"
+                       "# TYPE conv_event_admission_rejected_total counter\nconv_event_admission_rejected_total ")
+               .append(std::to_string(a.rejected.load())).append("\n");
+            out.append("# HELP conv_event_shed_total Requests answered 503 by shed_queue_delay.\n"
+                       "# TYPE conv_event_shed_total counter\nconv_event_shed_total ")
+               .append(std::to_string(a.shed_count.load())).append("\n");
+            _histogram_text_(out,s,M_EPOLL_BATCH,"conv_event_epoll_batch_size","Events returned by one epoll_wait.",false);
+            _histogram_text_(out,s,M_EVENT_TO_PROCESS,"conv_event_event_to_process_seconds","Wait of an event before process().",true);
+            _histogram_text_(out,s,M_PROCESS_TIME,"conv_event_process_seconds","Time in process().",true);
+            _histogram_text_(out,s,M_HTTP_REQUEST,"conv_event_http_request_seconds","HTTP request parsed to response sent.",true);
+            return out;
+        }
+    };
+
+    /**
+      * @brief t->process() timed into the histograms and the trace
+      * @note None
+      * @param t connection
+      * @param ready_at clock_us() the event was ready at
+      * @param start clock_us() now,0 to read the clock
+      * @retval result of process()
+      */
+    template<class T>
+    static bool metrics_process(T* t,int64_t ready_at,int64_t start = 0)
+    {
+        trace_span span(TR_PROCESS,trace::on() ? trace_fd(t,0) : 0);
+        if(!metrics::enabled().load(std::memory_order_relaxed)) return t->process();
+        if(start == 0) start = metrics::clock_us();
+        if(ready_at > 0 && start >= ready_at) metrics::record(M_EVENT_TO_PROCESS,(uint64_t)(start - ready_at));
+        bool ret = t->process();
+        metrics::record(M_PROCESS_TIME,(uint64_t)(metrics::clock_us() - start));
+        return ret;
+    }
+}
+
+#endif
@@ -0,0 +1,168 @@
+#ifndef CONV_EVENT_PLACEMENT_H
+#define CONV_EVENT_PLACEMENT_H
+
+#include "configure.h"              /* configure */
+#include "event_loop.h"             /* loop_clock_ms */
+#include <atomic>                   /* atomic */
+#include <memory>                   /* unique_ptr */
+#include <string>                   /* string */
+
+namespace hzd {
+
+    /* how often the acceptor folds event counters into the load averages */
+    #define PLACEMENT_TICK_MS 100
+    /* time constant of the load averages */
+    #define PLACEMENT_EWMA_MS 1000
+
+    /**
+      * @brief load of one reactor as seen by the acceptor
+      * @note connections is changed by the acceptor and the reactor,events only by the
+      *       reactor.rate and the rest are only touched by the acceptor thread
+      */
+    struct reactor_load
+    {
+        std::atomic<int> connections{0};
+        std::atomic<uint64_t> events{0};
+        double rate{0};
+        uint64_t last_events{0};
+
+        /* called by the reactor thread only */
+        void count_events(int n)
+        {
+            events.store(events.load(std::memory_order_relaxed) + n,std::memory_order_relaxed);
+        }
+    };
+
+    /**
+      * @brief picks the reactor of an accepted connection
+      * @note round_robin: in turn
+      *       least_connections: fewest live connections
+      *       least_load: lowest recent event rate,then fewest connections
+      *       two_choices: the less loaded of two reactors drawn at random
+      *       pick() is called by the acceptor thread only
+      */
+    class placement {
+    public:
+        enum Policy { ROUND_ROBIN, LEAST_CONNECTIONS, LEAST_LOAD, TWO_CHOICES };
+    private:
+        std::unique_ptr<reactor_load[]> loads;
+        size_t count{0};
+        std::atomic<int> policy{LEAST_CONNECTIONS};
+        size_t next{0};
+        uint64_t seed{0x9e3779b97f4a7c15ull};
+        int64_t last_tick{0};
+
+        uint64_t _random_()
+        {
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+            return seed;
+        }
+        /**
+          * @brief fold event counters into the rates
+          * @note the weight of a sample grows with the time it covers,so a long quiet
+          *       period decays the rates as much as many short ones would
+          * @param None
+          * @retval None
+          */
+        void _tick_()
+        {
+            int64_t now = loop_clock_ms();
+            int64_t elapsed = now - last_tick;
+            if(elapsed < PLACEMENT_TICK_MS) return;
+            last_tick = now;
+            double weight = elapsed >= PLACEMENT_EWMA_MS ? 1.0 : (double)elapsed / PLACEMENT_EWMA_MS;
+            for(size_t i = 0;i < count;i++)
+            {
+                reactor_load& l = loads[i];
+                uint64_t events = l.events.load(std::memory_order_relaxed);
+                double sample = (double)(events - l.last_events) * 1000 / elapsed;
+                l.last_events = events;
+                l.rate += weight * (sample - l.rate);
+            }
+        }
+        bool _less_(size_t a,size_t b) const
+        {
+            if(loads[a].rate != loads[b].rate) return loads[a].rate < loads[b].rate;
+            return loads[a].connections < loads[b].connections;
+        }
+    public:
+        placement() = default;
+        placement(const placement&) = delete;
+        placement& operator=(const placement&) = delete;
+
+        static Policy parse(const std::string& name)
+        {
+            if(name == "round_robin") return ROUND_ROBIN;
+            if(name == "least_load") return LEAST_LOAD;
+            if(name == "two_choices") return TWO_CHOICES;
+            return LEAST_CONNECTIONS;
+        }
+        /**
+          * @brief counters for n reactors
+          * @note the policy is read from "placement" and follows config reloads
+          * @param n reactor count
+          * @retval None
+          */
+        void init(size_t n)
+        {
+            loads.reset(new reactor_load[n]);
+            count = n;
+            last_tick = loop_clock_ms();
+            load();
+        }
+        void load()
+        {
+            configure& conf = configure::get_config();
+            policy = parse(conf["placement"].type == JSON_NULL ? "" : std::string((const char*)conf["placement"]));
+        }
+        reactor_load& at(size_t i) { return loads[i]; }
+        size_t size() const { return count; }
+        /**
+          * @brief reactor for the next connection
+          * @note counts the connection on it
+          * @param None
+          * @retval reactor index
+          */
+        size_t pick()
+        {
+            size_t chosen = 0;
+            switch(policy.load(std::memory_order_relaxed))
+            {
+                case ROUND_ROBIN : {
+                    chosen = next++ % count;
+                    break;
+                }
+                case LEAST_CONNECTIONS : {
+                    for(size_t i = 1;i < count;i++)
+                    {
+                        if(loads[i].connections < loads[chosen].connections) chosen = i;
+                    }
+                    break;
+                }
+                case LEAST_LOAD : {
+                    _tick_();
+                    for(size_t i = 1;i < count;i++)
+                    {
+                        if(_less_(i,chosen)) chosen = i;
+                    }
+                    break;
+                }
+                case TWO_CHOICES : {
+                    _tick_();
+                    if(count < 2) break;
+                    size_t a = _random_() % count;
+                    size_t b = _random_() % (count - 1);
+                    if(b >= a) b++;
+                    chosen = _less_(a,b) ? a : b;
+                    break;
+                }
+            }
+            loads[chosen].connections++;
+            return chosen;
+        }
+    };
+}
+
+#endif
@@ -4,6 +4,12 @@
 #include "conn.h"           /* conn */
 #include "threadpool.h"     /* thread pool */
 #include "configure.h"      /* configure */
+#include "connector.h"      /* outbound_dispatch */
+#include "event_loop.h"     /* event_loop */
+#include "admission.h"      /* admission */
+#include "placement.h"      /* reactor_load */
+#include "metrics.h"        /* metrics */
+#include "trace.h"          /* trace */
 
 namespace hzd
 {
@@ -13,6 +19,11 @@ namespace hzd
     class reactor {
         void close()
         {
+            if(loop)
+            {
+                delete loop;
+                loop = nullptr;
+            }
             if(epoll_fd != -1)
             {
                 ::close(epoll_fd);
@@ -51,6 +62,19 @@ namespace hzd
                 exit(-1);
             }
         }
+        /**
+          * @brief replace the epoll event array
+          * @note never while the array is being walked,set_max_events_count posts it
+          * @param size size
+          * @retval None
+          */
+        void _resize_events_(int size)
+        {
+            if(size == max_events_count) return;
+            delete []events;
+            events = new epoll_event[size];
+            max_events_count = size;
+        }
     protected:
         bool ET{false};
         bool one_shot{true};
@@ -62,11 +86,21 @@ namespace hzd
         connpool<T>* conn_pool{nullptr};
         conv_multi<T>* parent{nullptr};
         lock_queue<int>* close_queue{nullptr};
+        event_loop* loop{nullptr};
+        reactor_load* load{nullptr};
+        size_t index{0};
+        time_t last_idle_check{0};
+        int64_t last_drain_check{0};
+        /* closes put off while a worker still held the connection */
+        std::vector<int> close_later;
 #define CONNECTS_REMOVE_FD_REACTOR do                   \
         {                                               \
             parent->current_connect_count--;            \
+            load->connections--;                        \
+            metrics::count(M_CLOSES);                   \
             T* tmp = connects[cur_fd];                  \
             connects[cur_fd] = nullptr;                 \
+            admission::get().release(cur_fd);           \
             tmp->close();                               \
             if(conn_pool)                               \
             {                                           \
@@ -80,8 +114,11 @@ namespace hzd
 
 #define CONNECTS_REMOVE_FD_REACTOR_OUT do{              \
             parent->current_connect_count--;            \
+            load->connections--;                        \
+            metrics::count(M_CLOSES);                   \
             T* tmp = it->second;                        \
             it->second = nullptr;                       \
+            admission::get().release(it->first);        \
             it++;                                       \
             tmp->close();                               \
             if(conn_pool)                               \
@@ -119,19 +156,38 @@ namespace hzd
             close();
         }
         /**
-  * @brief set max events count
-  * @note None
-  * @param size size
-  * @retval None
-  */
-        void set_max_events_count(int size){if(size >= 0) max_events_count = size;}
-        void init(conv_multi<T>* _parent)
+          * @brief set max events count
+          * @note applied by the reactor thread between two rounds once it runs
+          * @param size size
+          * @retval None
+          */
+        void set_max_events_count(int size)
+        {
+            if(size <= 0) return;
+            if(loop) loop->post([this,size] { _resize_events_(size); });
+            else _resize_events_(size);
+        }
+        /**
+          * @brief apply reloaded configs
+          * @note None
+          * @param None
+          * @retval None
+          */
+        void reconfigure()
+        {
+            configure& conf = configure::get_config();
+            if(conf["max_events_count"].type != JSON_NULL)
+                set_max_events_count((int32_t)conf["max_events_count"]);
+            if(thread_pool && conf["thread_count"].type != JSON_NULL)
+                thread_pool->resize((int32_t)conf["thread_count"]);
+        }
+        void init(conv_multi<T>* _parent,reactor_load* _load,size_t _index)
         {
             configure& conf = configure::get_config();
-            max_events_count = conf["max_events_count"].type == JSON_NULL ? 4096 : (int32_t)max_events_count;
-
 
             parent = _parent;
+            load = _load;
+            index = _index;
             ET = parent->ET;
             one_shot = parent->one_shot;
             if(parent->_thread_pool)
@@ -141,29 +197,117 @@ namespace hzd
             }
             close_queue = new lock_queue<int>();
             conn_pool = parent->conn_pool;
+            if(!loop)
+                loop = new event_loop;
+            if(!loop->open(epoll_fd))
+                LOG_ERROR("reactor event loop open failed");
 
             LOG_TRACE("reactor init success");
         }
-        void add_conn(int fd)
+        /**
+          * @brief take over a connection accepted for this reactor
+          * @note counted by the acceptor and placement already,the conn is created by the reactor thread
+          * @param fd accepted fd
+          * @param addr peer address
+          * @retval None
+          */
+        void add_conn(int fd,const sockaddr_in& addr)
+        {
+            loop->post([this,fd,addr] {
+                T* t = conn_pool ? conn_pool->acquire() : new T;
+                if(!t)
+                {
+                    parent->current_connect_count--;
+                    load->connections--;
+                    metrics::count(M_CLOSES);
+                    admission::get().release(fd);
+                    ::close(fd);
+                    return;
+                }
+                sockaddr_in peer = addr;
+                t->init(fd,&peer,epoll_fd,ET,one_shot,close_queue,true);
+                connects[fd] = t;
+            });
+        }
+        /**
+          * @brief close connections idle longer than their idle timeout
+          * @note runs at most once per second
+          * @param None
+          * @retval None
+          */
+        void close_idle()
+        {
+            time_t now = conn_clock();
+            if(now == last_idle_check) return;
+            last_idle_check = now;
+            for(auto& p : connects)
+            {
+                if(p.second && p.second->expired(now)) p.second->notify_close();
+            }
+        }
+        /**
+          * @brief close connections with nothing in flight
+          * @note runs while draining,at most every CONN_DRAIN_CHECK_MS
+          * @param None
+          * @retval None
+          */
+        void close_drained()
         {
-            epoll_add(epoll_fd,fd,ET,one_shot);
+            int64_t now = loop_clock_ms();
+            if(now - last_drain_check < CONN_DRAIN_CHECK_MS) return;
+            last_drain_check = now;
+            for(auto& p : connects)
+            {
+                if(p.second && p.second->drained()) p.second->notify_close();
+            }
         }
         void work(int time_out=1)
         {
             int ret,cur_fd;
-            T* t;
+            int64_t ready_at;
+            loop->bind_thread();
+            metrics::name_thread("reactor-" + std::to_string(index));
             while(run)
             {
-                while(!close_queue->empty())
+                close_idle();
+                if(conn::draining()) close_drained();
+                if(!close_queue->empty())
                 {
-                    close_queue->pop(cur_fd);
-                    if(cur_fd == -1) continue;
-                    if(connects[cur_fd] == nullptr) continue;
-                    CONNECTS_REMOVE_FD_REACTOR;
+                    trace_span span(TR_CLOSE_QUEUE);
+                    uint32_t closed = 0;
+                    while(!close_queue->empty())
+                    {
+                        close_queue->pop(cur_fd);
+                        if(cur_fd == -1) continue;
+                        /* removed already and the fd maybe taken by a new connection */
+                        if(connects[cur_fd] == nullptr || connects[cur_fd]->status != conn::CLOSE) continue;
+                        /* a worker is still returning from process(),closed next round */
+                        if(connects[cur_fd]->dispatched != 0)
+                        {
+                            close_later.push_back(cur_fd);
+                            continue;
+                        }
+                        CONNECTS_REMOVE_FD_REACTOR;
+                        closed++;
+                    }
+                    for(int fd : close_later) close_queue->push(fd);
+                    close_later.clear();
+                    span.set_arg(closed);
                 }
 
-                if((ret = epoll_wait(epoll_fd,events,max_events_count,time_out)) == 0)
                 {
+                    trace_span span(TR_EPOLL_WAIT);
+                    ret = epoll_wait(epoll_fd,events,max_events_count,loop->wait_time(time_out));
+                    span.set_arg(ret < 0 ? 0 : ret);
+                }
+                if(ret >= 0)
+                {
+                    metrics::count(M_EPOLL_WAITS);
+                    metrics::record(M_EPOLL_BATCH,ret);
+                }
+                if(ret == 0)
+                {
+                    loop->run();
                     continue;
                 }
                 else if(ret < 0)
@@ -173,43 +317,34 @@ namespace hzd
                 }
                 else
                 {
+                    load->count_events(ret);
+                    ready_at = metrics::enabled() ? metrics::clock_us() : 0;
                     for(int event_index = 0;event_index < ret; event_index++)
                     {
                         cur_fd = events[event_index].data.fd;
-
-                        if(connects[cur_fd] == nullptr)
+                        if(cur_fd == loop->fd())
                         {
-                            if(conn_pool)
-                            {
-                                t = conn_pool->acquire();
-                            }
-                            else
-                            {
-                                t = new T;
-                            }
-                            if(!t)
-                            {
-                                ::close(cur_fd);
-                                continue;
-                            }
-                            sockaddr_in addr{};
-                            socklen_t len;
-                            getsockname(cur_fd,(sockaddr*)&addr,&len);
-                            t->init(cur_fd,&addr,epoll_fd,ET,one_shot,close_queue,false);
-                            parent->current_connect_count++;
-                            connects[cur_fd] = t;
+                            loop->clear();
+                            continue;
                         }
+                        if(outbound_dispatch(cur_fd,events[event_index].events)) continue;
+                        /* stale event of a connection closed in this round */
+                        if(connects[cur_fd] == nullptr) continue;
+                        /* waiting in the close queue,its status must stay CLOSE */
+                        if(connects[cur_fd]->status == conn::CLOSE) continue;
+                        trace::instant(TR_DISPATCH,cur_fd,(uint16_t)events[event_index].events);
 
                         if(events[event_index].events & EPOLLRDHUP)
                         {
                             connects[cur_fd]->status = conn::RDHUP;
+                            metrics::count(M_EVENTS_RDHUP);
                             if(thread_pool)
                             {
                                 if(!thread_pool->add(connects[cur_fd])){CONNECTS_REMOVE_FD_REACTOR;}
                             }
                             else
                             {
-                                if(!connects[cur_fd]->process())
+                                if(!metrics_process(connects[cur_fd],ready_at))
                                 {
 
                                 }
@@ -219,13 +354,14 @@ namespace hzd
                         else if(events[event_index].events & EPOLLERR)
                         {
                             connects[cur_fd]->status = conn::ERROR;
+                            metrics::count(M_EVENTS_ERROR);
                             if(thread_pool)
                             {
                                 if(!thread_pool->add(connects[cur_fd])){CONNECTS_REMOVE_FD_REACTOR;}
                             }
                             else
                             {
-                                if(!connects[cur_fd]->process())
+                                if(!metrics_process(connects[cur_fd],ready_at))
                                 {
 
                                 }
@@ -235,13 +371,14 @@ namespace hzd
                         else if(events[event_index].events & EPOLLOUT)
                         {
                             connects[cur_fd]->status = conn::OUT;
+                            metrics::count(M_EVENTS_OUT);
                             if(thread_pool)
                             {
                                 if(!thread_pool->add(connects[cur_fd])){CONNECTS_REMOVE_FD_REACTOR;}
                             }
                             else
                             {
-                                if(!connects[cur_fd]->process())
+                                if(!metrics_process(connects[cur_fd],ready_at))
                                 {
                                     CONNECTS_REMOVE_FD_REACTOR;
                                 }
@@ -250,13 +387,14 @@ namespace hzd
                         else if(events[event_index].events & EPOLLIN)
                         {
                             connects[cur_fd]->status = conn::IN;
+                            metrics::count(M_EVENTS_IN);
                             if(thread_pool)
                             {
                                 if(!thread_pool->add(connects[cur_fd])){CONNECTS_REMOVE_FD_REACTOR;}
                             }
                             else
                             {
-                                if(!connects[cur_fd]->process())
+                                if(!metrics_process(connects[cur_fd],ready_at))
                                 {
                                     CONNECTS_REMOVE_FD_REACTOR;
                                 }
@@ -267,6 +405,7 @@ namespace hzd
                             CONNECTS_REMOVE_FD_REACTOR;
                         }
                     }
+                    loop->run();
                 }
             }
             close();
@@ -7,13 +7,18 @@
 #include <fcntl.h>                          /* fcntl */
 #include <sys/stat.h>                       /* fstat */
 #include <sys/sendfile.h>                   /* sendfile */
+#include <sys/uio.h>                        /* iovec */
 #include <csignal>                          /* SIGNAL */
 #include "utils.h"                          /* utils packet */
+#include "frame_codec.h"                    /* frame_reader */
+#include "metrics.h"                        /* metrics */
 #include <unistd.h>                         /* close */
 #include "async_logger/async_logger.hpp"    /* async_logger */
 
 namespace hzd {
 
+    #define SOCKET_IO_MAX_IOV 16
+
     class socket_io {
         /**
           * @brief base of send data
@@ -22,7 +27,7 @@ namespace hzd {
           * @retval success or not
           */
         bool send_base(const char *data) {
-            size_t send_count;
+            ssize_t send_count;
             size_t need_to_send;
 
             while (write_cursor < write_total_bytes) {
@@ -36,6 +41,42 @@ namespace hzd {
 
                     return false;
                 }
+                metrics::count(M_BYTES_OUT,send_count);
+                write_cursor += send_count;
+            }
+            return true;
+        }
+
+        /**
+          * @brief base of send vector data
+          * @note skip write_cursor bytes of iov and send the rest by one sendmsg each round
+          * @param iov iovec array
+          * @param count iovec count
+          * @retval success or not
+          */
+        bool send_vec_base(const iovec *iov, int count) {
+            iovec vec[SOCKET_IO_MAX_IOV];
+            while (write_cursor < write_total_bytes) {
+                size_t skip = write_cursor;
+                int n = 0;
+                for (int i = 0; i < count; i++) {
+                    if (skip >= iov[i].iov_len) {
+                        skip -= iov[i].iov_len;
+                        continue;
+                    }
+                    vec[n].iov_base = (char *) iov[i].iov_base + skip;
+                    vec[n].iov_len = iov[i].iov_len - skip;
+                    skip = 0;
+                    n++;
+                }
+                msghdr msg{};
+                msg.msg_iov = vec;
+                msg.msg_iovlen = n;
+                ssize_t send_count = ::sendmsg(socket_fd, &msg, MSG_NOSIGNAL);
+                if (send_count <= 0) {
+                    return false;
+                }
+                metrics::count(M_BYTES_OUT,send_count);
                 write_cursor += send_count;
             }
             return true;
@@ -68,6 +109,7 @@ namespace hzd {
                         return false;
                     }
                 }
+                metrics::count(M_BYTES_IN,read_count);
                 data += std::string(read_buffer, read_count);
                 read_cursor += read_count;
             }
@@ -83,6 +125,27 @@ namespace hzd {
         size_t read_total_bytes{0};
         int socket_fd{-1};
         bool already{true};
+        /* when set,send() and send_vec() append to it instead of writing the socket */
+        std::string* capture{nullptr};
+        /**
+          * @brief send data with hzd::header and trailing '\0' by one sendmsg
+          * @note the size in header counts the '\0',as peers of send_with_header expect
+          * @param data data
+          * @param size data size without '\0'
+          * @retval success or not
+          */
+        bool send_with_header_base(const char *data, size_t size) {
+            if (already && size == 0) {
+                return false;
+            }
+            header h{size + 1};
+            iovec iov[2];
+            iov[0].iov_base = &h;
+            iov[0].iov_len = HEADER_SIZE;
+            iov[1].iov_base = (void *) data;
+            iov[1].iov_len = size + 1;
+            return send_vec(iov, 2);
+        }
         /**
          * @brief send data by using hzd::header
          * @note None
@@ -92,19 +155,7 @@ namespace hzd {
          */
     public:
         bool send_with_header(const char *data) {
-            if (already) {
-                write_total_bytes = strlen(data) + 1;
-                write_cursor = 0;
-                if (write_total_bytes <= 1) {
-                    return false;
-                }
-                header h{write_total_bytes};
-                if (::send(socket_fd, &h, HEADER_SIZE, 0) <= 0) {
-                    return false;
-                }
-            }
-            already = send_base(data);
-            return already;
+            return send_with_header_base(data, strlen(data));
         }
 
         /**
@@ -115,35 +166,68 @@ namespace hzd {
           * @retval None
           */
         bool send_with_header(std::string &data) {
-            if (already) {
-                write_total_bytes = data.size() + 1;
-                write_cursor = 0;
-                if (write_total_bytes <= 1) {
-                    return false;
-                }
-                header h{write_total_bytes};
-                if (::send(socket_fd, &h, HEADER_SIZE, 0) <= 0) {
-                    return false;
-                }
-            }
-            already = send_base(data.c_str());
-            return already;
+            return send_with_header_base(data.c_str(), data.size());
         }
 
         bool send_with_header(std::string &&data) {
-            if (already) {
-                write_total_bytes = data.size() + 1;
-                write_cursor = 0;
-                if (write_total_bytes <= 1) {
-                    return false;
-                }
-                header h{write_total_bytes};
-                if (::send(socket_fd, &h, HEADER_SIZE, 0) <= 0) {
-                    return false;
+            return send_with_header_base(data.c_str(), data.size());
+        }
+
+        /**
+          * @brief send one length-prefixed frame
+          * @note header and payload go out by one sendmsg,the size is the exact payload size
+          * @param data payload
+          * @param size payload size
+          * @retval success or not
+          */
+        bool send_frame(const char *data, size_t size) {
+            frame_view frame{data, size};
+            return send_frames(&frame, 1);
+        }
+
+        bool send_frame(const std::string &data) {
+            return send_frame(data.data(), data.size());
+        }
+
+        /**
+          * @brief send several length-prefixed frames by one sendmsg
+          * @note count must not be more than SOCKET_IO_MAX_IOV / 2,
+          *       pass the same frames again when it returned false with errno EAGAIN
+          * @param frames payloads
+          * @param count frame count
+          * @retval success or not
+          */
+        bool send_frames(const frame_view *frames, int count) {
+            if (count <= 0 || count > SOCKET_IO_MAX_IOV / 2) {
+                return false;
+            }
+            header headers[SOCKET_IO_MAX_IOV / 2];
+            iovec iov[SOCKET_IO_MAX_IOV];
+            int n = 0;
+            for (int i = 0; i < count; i++) {
+                headers[i].size = frames[i].size;
+                iov[n].iov_base = &headers[i];
+                iov[n++].iov_len = HEADER_SIZE;
+                if (frames[i].size > 0) {
+                    iov[n].iov_base = (void *) frames[i].data;
+                    iov[n++].iov_len = frames[i].size;
                 }
             }
-            already = send_base(data.c_str());
-            return already;
+            return send_vec(iov, n);
+        }
+
+        /**
+          * @brief send every frame of writer by one send
+          * @note writer must be kept unchanged until it returned true,clear it afterwards
+          * @param writer batch of frames
+          * @retval success or not
+          */
+        bool send_frames(const frame_writer &writer) {
+            if (writer.empty()) {
+                return true;
+            }
+            iovec iov{(void *) writer.buffer().data(), writer.size()};
+            return send_vec(&iov, 1);
         }
 
         /**
@@ -154,6 +238,10 @@ namespace hzd {
           * @retval None
           */
         bool send(std::string &data, size_t size) {
+            if (capture) {
+                capture->append(data.data(), size);
+                return true;
+            }
             if (already) {
                 write_total_bytes = size;
                 write_cursor = 0;
@@ -166,6 +254,10 @@ namespace hzd {
         }
 
         bool send(std::string &&data, size_t size) {
+            if (capture) {
+                capture->append(data.data(), size);
+                return true;
+            }
             if (already) {
                 write_total_bytes = size;
                 write_cursor = 0;
@@ -178,6 +270,10 @@ namespace hzd {
         }
 
         bool send(const char *data, size_t size) {
+            if (capture) {
+                capture->append(data, size);
+                return true;
+            }
             if (already) {
                 write_total_bytes = size;
                 write_cursor = 0;
@@ -189,6 +285,37 @@ namespace hzd {
             return already;
         }
 
+        /**
+          * @brief send several buffers at once
+          * @note count must not be more than SOCKET_IO_MAX_IOV
+          * @param iov iovec array
+          * @param count iovec count
+          * @retval success or not
+          */
+        bool send_vec(const iovec *iov, int count) {
+            if (count <= 0 || count > SOCKET_IO_MAX_IOV) {
+                return false;
+            }
+            if (capture) {
+                for (int i = 0; i < count; i++) {
+                    capture->append((const char *) iov[i].iov_base, iov[i].iov_len);
+                }
+                return true;
+            }
+            if (already) {
+                write_total_bytes = 0;
+                for (int i = 0; i < count; i++) {
+                    write_total_bytes += iov[i].iov_len;
+                }
+                write_cursor = 0;
+                if (write_total_bytes <= 0) {
+                    return false;
+                }
+            }
+            already = send_vec_base(iov, count);
+            return already;
+        }
+
         bool send_file(const std::string &filename) {
             int file_fd = open(filename.c_str(), O_RDONLY);
             struct stat st{};
@@ -197,15 +324,16 @@ namespace hzd {
             write_total_bytes = st.st_size;
             while (write_cursor < write_total_bytes) {
                 auto offset = (off_t) write_cursor;
-                size_t send_count = sendfile(socket_fd, file_fd, &offset, write_total_bytes - write_cursor);
-                if (send_count == -1) {
-                    if (errno == EAGAIN) {
+                ssize_t send_count = sendfile(socket_fd, file_fd, &offset, write_total_bytes - write_cursor);
+                if (send_count <= 0) {
+                    if (send_count < 0 && errno == EAGAIN) {
                         return false;
                     }
                     close(file_fd);
                     file_fd = -1;
                     return false;
                 }
+                metrics::count(M_BYTES_OUT,send_count);
                 write_cursor += send_count;
             }
             close(file_fd);
@@ -223,16 +351,34 @@ namespace hzd {
         bool recv_with_header(std::string &data) {
             if (already) {
                 header h{};
-                if (::recv(socket_fd, &h, HEADER_SIZE, 0) <= 0) {
+                ssize_t header_count = ::recv(socket_fd, &h, HEADER_SIZE, 0);
+                if (header_count <= 0) {
+                    return false;
+                }
+                metrics::count(M_BYTES_IN,header_count);
+                /* the size comes from the peer,nothing is reserved past what a frame may be */
+                if (h.size > FRAME_MAX_SIZE) {
                     return false;
                 }
                 read_total_bytes = h.size;
                 read_cursor = 0;
+                data.reserve(data.size() + h.size);
             }
             already = recv_base(data);
             return already;
         }
 
+        /**
+          * @brief read length-prefixed frames into reader
+          * @note take complete frames by reader.next() afterwards,also when it returned false,
+          *       then close the connection if reader.bad()
+          * @param reader frame reader of this connection
+          * @retval false when peer closed or socket failed
+          */
+        bool recv_frames(frame_reader &reader) {
+            return reader.fill(socket_fd) > 0;
+        }
+
         /**
           * @brief recv data by given size
           * @note None
@@ -267,7 +413,7 @@ namespace hzd {
         bool recv_file(const std::string &download_path, size_t size) {
             read_cursor = 0;
             read_total_bytes = size;
-            size_t read_count;
+            ssize_t read_count;
             FILE *fp = fopen(download_path.c_str(), "wb");
             while (read_cursor < read_total_bytes) {
                 bzero(read_buffer, sizeof(read_buffer));
@@ -288,6 +434,7 @@ namespace hzd {
                         return false;
                     }
                 }
+                metrics::count(M_BYTES_IN,read_count);
                 fwrite(read_buffer, read_count, 1, fp);
                 read_cursor += read_count;
             }
@@ -4,12 +4,15 @@
 #include <thread>                       /* thread */
 #include <queue>                        /* queue */
 #include <unordered_map>                /* unordered_map */
+#include <mutex>                        /* mutex */
 #if __cplusplus <= 201703L
 #include <condition_variable>           /* condition_variable */
 #else
 #include <semaphore>                    /* mutex semaphore */
 #endif
 #include "async_logger/async_logger.hpp" /* async_logger */
+#include "metrics.h"                    /* metrics */
+#include "trace.h"                      /* trace */
 
 namespace hzd
 {
@@ -39,19 +42,75 @@ namespace hzd
     };
     #endif
 
+    /* items with a dispatched counter (hzd::conn) count their runs waiting in or taken by the pool */
+    template<class T>
+    static auto threadpool_count(T* t,int delta,int) -> decltype(t->dispatched += delta,void())
+    {
+        t->dispatched += delta;
+    }
+    template<class T>
+    static void threadpool_count(T*,int,long) {}
+
+    /* steady microseconds */
+    static inline int64_t threadpool_clock()
+    {
+        return metrics::clock_us();
+    }
+    /* items with a queue clock (hzd::conn) learn how long they waited for a worker,
+       returns when the item was queued,0 when unknown */
+    template<class T>
+    static auto threadpool_stamp(T* t,bool taken,int64_t now,int) -> decltype(t->queue_delay = t->queued_at,int64_t())
+    {
+        if(taken) t->queue_delay = now - t->queued_at;
+        else t->queued_at = now;
+        return t->queued_at;
+    }
+    template<class T>
+    static int64_t threadpool_stamp(T*,bool,int64_t,long) { return 0; }
+
     template<class T>
     class threadpool {
     private:
-        int thread_count;
+        struct worker
+        {
+            std::thread thread;
+            std::atomic<bool> finished{false};
+        };
+        /* wanted worker count,live follows it */
+        std::atomic<int> thread_count;
+        std::atomic<int> live{0};
         int max_process_count;
         lock_queue<T*> process_pool{};
-        std::vector<std::shared_ptr<std::thread>> threads;
+        std::vector<std::shared_ptr<worker>> threads;
+        std::mutex resize_mtx;
         #if __cplusplus > 201703L
         std::counting_semaphore<0> sem{0};
         #else
         hzd::counting_semaphore<0> sem{0};
         #endif
-        bool stop{false};
+        std::atomic<bool> stop{false};
+
+        void _spawn_()
+        {
+            auto w = std::make_shared<worker>();
+            live++;
+            w->thread = std::thread([this,w] {
+                metrics::name_thread("worker");
+                run();
+                w->finished = true;
+            });
+            threads.push_back(w);
+        }
+        /* a worker leaves while more are live than wanted */
+        bool _retire_()
+        {
+            int l = live;
+            while(l > thread_count)
+            {
+                if(live.compare_exchange_weak(l,l - 1)) return true;
+            }
+            return false;
+        }
     public:
         explicit threadpool(int _thread_count = 8,int _max_process_count =40000)
         : thread_count(_thread_count),max_process_count(_max_process_count)
@@ -62,32 +121,66 @@ namespace hzd
                 exit(-1);
             }
             for(int i=0;i<thread_count;i++) {
-                std::shared_ptr<std::thread> t = std::make_shared<std::thread>(work,this);
-                threads.emplace_back(t);
-                t->detach();
+                _spawn_();
             }
             LOG_TRACE(
                     "thread pool init success,thread count ="
-                    + std::to_string(thread_count)
+                    + std::to_string(thread_count.load())
                     + " max_process_count = "
                     + std::to_string(max_process_count)
                     );
         }
+        /**
+          * @brief stop and join workers
+          * @note a worker finishes the process() it is running,queued items are dropped
+          * @param None
+          * @retval None
+          */
         ~threadpool()
         {
             stop = true;
+            std::lock_guard<std::mutex> lock(resize_mtx);
+            for(size_t i = 0;i < threads.size();i++) sem.release();
+            for(auto& w : threads)
+            {
+                std::thread& t = w->thread;
+                if(t.joinable() && t.get_id() != std::this_thread::get_id()) t.join();
+                else if(t.joinable()) t.detach();
+            }
         }
-        static void* work(void* arg)
+        /**
+          * @brief change the worker count while running
+          * @note callable from any thread.extra workers leave after the process() they are
+          *       running,queued items stay for the others
+          * @param count worker count
+          * @retval None
+          */
+        void resize(int count)
         {
-            auto pool = (threadpool*)arg;
-            pool->run();
-            return pool;
+            if(count <= 0 || stop) return;
+            std::lock_guard<std::mutex> lock(resize_mtx);
+            for(auto it = threads.begin();it != threads.end();)
+            {
+                if((*it)->finished)
+                {
+                    if((*it)->thread.joinable()) (*it)->thread.join();
+                    it = threads.erase(it);
+                }
+                else it++;
+            }
+            thread_count = count;
+            int l = live;
+            for(;l < count;l++) _spawn_();
+            for(;l > count;l--) sem.release();
+            LOG_TRACE("thread pool resized,thread count = " + std::to_string(count));
         }
+        int size() const { return thread_count; }
         void run()
         {
             while(!stop)
             {
                 sem.acquire();
+                if(_retire_()) return;
                 T* con = nullptr;
                 if(process_pool.empty())
                 {
@@ -98,7 +191,11 @@ namespace hzd
                 {
                     continue;
                 }
-                con->process();
+                int64_t now = threadpool_clock();
+                int64_t queued_at = threadpool_stamp(con,true,now,0);
+                metrics::count(M_QUEUE_POPS);
+                metrics_process(con,queued_at,now);
+                threadpool_count(con,-1,0);
             }
         }
 
@@ -109,6 +206,10 @@ namespace hzd
                 LOG_WARN("thread pool overload");
                 return false;
             }
+            threadpool_count(t,1,0);
+            if(trace::on()) trace::instant(TR_HANDOFF,trace_fd(t,0));
+            threadpool_stamp(t,false,threadpool_clock(),0);
+            metrics::count(M_QUEUE_PUSHES);
             process_pool.push(t);
             sem.release();
             return true;
@@ -0,0 +1,358 @@
+#ifndef CONV_EVENT_TRACE_H
+#define CONV_EVENT_TRACE_H
+
+#include "configure.h"              /* configure */
+#include "async_logger/async_logger.hpp" /* async_logger */
+#include <atomic>                   /* atomic */
+#include <memory>                   /* unique_ptr */
+#include <mutex>                    /* mutex */
+#include <string>                   /* string */
+#include <vector>                   /* vector */
+#include <thread>                   /* thread */
+#include <cstdio>                   /* fopen fprintf */
+#include <ctime>                    /* clock_gettime */
+#include <cerrno>                   /* errno */
+#include <unistd.h>                 /* getpid syscall */
+#include <sys/syscall.h>            /* SYS_gettid */
+#include <sys/eventfd.h>            /* eventfd */
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>              /* __rdtsc */
+#endif
+
+namespace hzd {
+
+    /* records kept per thread,the oldest are overwritten */
+    #define TRACE_RING_SIZE 16384
+    #define TRACE_DEFAULT_PATH "conv_event_trace.json"
+
+    enum trace_type {
+        /* span: time blocked in epoll_wait,arg events returned,its end is the wakeup */
+        TR_EPOLL_WAIT,
+        /* span: close queue drained by a reactor,arg connections closed */
+        TR_CLOSE_QUEUE,
+        /* instant: event of fd arg taken from epoll,extra the epoll events */
+        TR_DISPATCH,
+        /* instant: connection of fd arg queued to the thread pool */
+        TR_HANDOFF,
+        /* span: process() of fd arg */
+        TR_PROCESS,
+        /* instant: epoll_ctl on fd arg,extra the operation */
+        TR_EPOLL_CTL,
+        TR_TYPES
+    };
+
+    struct trace_record
+    {
+        uint64_t start;
+        uint64_t end;
+        uint32_t arg;
+        uint16_t type;
+        uint16_t extra;
+    };
+
+    /**
+      * @brief records of one thread
+      * @note written by its thread only.a reader copies the slots,then drops what head
+      *       moved past meanwhile,so a dump never stops the writer
+      */
+    struct trace_ring
+    {
+        std::string name{"other"};
+        long tid{0};
+        std::atomic<bool> in_use{true};
+        std::atomic<uint64_t> head{0};
+        trace_record slots[TRACE_RING_SIZE];
+    };
+
+    /**
+      * @brief event loop tracing for finding stalls
+      * @note off unless "trace" is true,then every thread fills its own ring with
+      *       TSC timestamped records.SIGUSR1 (or dump()) writes all rings as a Chrome
+      *       trace / Perfetto JSON file to "trace_path",from a thread of its own so a
+      *       stalled reactor can still be dumped
+      */
+    class trace {
+        struct registry
+        {
+            std::mutex mtx;
+            std::vector<std::unique_ptr<trace_ring>> rings;
+        };
+        struct owner
+        {
+            trace_ring* ring{nullptr};
+            std::string name{"other"};
+            ~owner()
+            {
+                if(ring) ring->in_use = false;
+            }
+        };
+        /* tsc and monotonic nanoseconds read together,for converting ticks */
+        struct clock_pair
+        {
+            uint64_t tsc;
+            int64_t ns;
+        };
+        static registry& _registry_()
+        {
+            static registry r;
+            return r;
+        }
+        static owner& _owner_()
+        {
+            static thread_local owner o;
+            return o;
+        }
+        static trace_ring* _acquire_(const std::string& name)
+        {
+            registry& r = _registry_();
+            std::lock_guard<std::mutex> lock(r.mtx);
+            trace_ring* ring = nullptr;
+            for(auto& s : r.rings)
+            {
+                bool expected = false;
+                if(s->in_use.compare_exchange_strong(expected,true))
+                {
+                    ring = s.get();
+                    break;
+                }
+            }
+            if(!ring)
+            {
+                r.rings.emplace_back(new trace_ring);
+                ring = r.rings.back().get();
+            }
+            /* records of the thread that left would show up under the new name and tid,
+               dump() holds the lock,so it never sees head move back */
+            ring->head.store(0,std::memory_order_release);
+            ring->tid = (long)syscall(SYS_gettid);
+            ring->name = name;
+            return ring;
+        }
+        static int64_t _ns_()
+        {
+            timespec ts{};
+            clock_gettime(CLOCK_MONOTONIC,&ts);
+            return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+        }
+        static clock_pair _pair_()
+        {
+            return {ticks(),_ns_()};
+        }
+        static clock_pair& _origin_()
+        {
+            static clock_pair origin = _pair_();
+            return origin;
+        }
+        static int& _signal_fd_()
+        {
+            static int fd = -1;
+            return fd;
+        }
+        static std::string& _path_()
+        {
+            static std::string path = TRACE_DEFAULT_PATH;
+            return path;
+        }
+        static const char* _name_(uint16_t type)
+        {
+            static const char* names[TR_TYPES] = {"epoll_wait","close_queue","dispatch","threadpool_add","process","epoll_ctl"};
+            return type < TR_TYPES ? names[type] : "unknown";
+        }
+        static bool _span_(uint16_t type)
+        {
+            return type == TR_EPOLL_WAIT || type == TR_CLOSE_QUEUE || type == TR_PROCESS;
+        }
+        /* waits for SIGUSR1 and dumps */
+        static void _dumper_(int fd)
+        {
+            uint64_t count;
+            for(;;)
+            {
+                ssize_t n = ::read(fd,&count,sizeof(count));
+                if(n < 0 && errno == EINTR) continue;
+                if(n < 0) return;
+                std::string path;
+                {
+                    std::lock_guard<std::mutex> lock(_registry_().mtx);
+                    path = _path_();
+                }
+                if(dump(path)) LOG_INFO("trace written to " + path);
+                else LOG_WARN("trace can not be written to " + path);
+            }
+        }
+    public:
+        static std::atomic<bool>& enabled()
+        {
+            static std::atomic<bool> on{false};
+            return on;
+        }
+        static bool on()
+        {
+            return enabled().load(std::memory_order_relaxed);
+        }
+        /**
+          * @brief read "trace" and "trace_path" and follow config reloads
+          * @note the dumping thread is started the first time tracing is on
+          * @param None
+          * @retval None
+          */
+        static void load()
+        {
+            static bool hooked = configure::get_config().on_reload(load);
+            (void)hooked;
+            configure& conf = configure::get_config();
+            bool wanted = conf["trace"].type == JSON_NULL ? false : (bool)conf["trace"];
+            std::string path = conf["trace_path"].type == JSON_NULL ? TRACE_DEFAULT_PATH : std::string((const char*)conf["trace_path"]);
+            {
+                std::lock_guard<std::mutex> lock(_registry_().mtx);
+                _path_() = path;
+            }
+            _origin_();
+            if(wanted && _signal_fd_() == -1)
+            {
+                int fd = eventfd(0,EFD_CLOEXEC);
+                if(fd != -1)
+                {
+                    std::thread(_dumper_,fd).detach();
+                    _signal_fd_() = fd;
+                }
+            }
+            enabled() = wanted;
+        }
+        static void signal_handler(int)
+        {
+            int fd = _signal_fd_();
+            if(fd == -1) return;
+            uint64_t one = 1;
+            ssize_t ret = ::write(fd,&one,sizeof(one));
+            (void)ret;
+        }
+        /* cycle counter where there is one,nanoseconds elsewhere */
+        static uint64_t ticks()
+        {
+        #if defined(__x86_64__) || defined(__i386__)
+            return __rdtsc();
+        #else
+            return (uint64_t)_ns_();
+        #endif
+        }
+        /* ring of this thread,allocated by its first record */
+        static trace_ring& local()
+        {
+            owner& o = _owner_();
+            if(!o.ring) o.ring = _acquire_(o.name);
+            return *o.ring;
+        }
+        static void name_thread(const std::string& name)
+        {
+            owner& o = _owner_();
+            o.name = name;
+            if(!o.ring) return;
+            std::lock_guard<std::mutex> lock(_registry_().mtx);
+            o.ring->name = name;
+        }
+        static void record(trace_type type,uint64_t start,uint64_t end,uint32_t arg,uint16_t extra = 0)
+        {
+            trace_ring& r = local();
+            uint64_t h = r.head.load(std::memory_order_relaxed);
+            trace_record& rec = r.slots[h & (TRACE_RING_SIZE - 1)];
+            rec.start = start;
+            rec.end = end;
+            rec.arg = arg;
+            rec.type = (uint16_t)type;
+            rec.extra = extra;
+            r.head.store(h + 1,std::memory_order_release);
+        }
+        static void instant(trace_type type,uint32_t arg,uint16_t extra = 0)
+        {
+            if(!on()) return;
+            uint64_t t = ticks();
+            record(type,t,t,arg,extra);
+        }
+        /**
+          * @brief write all rings as Chrome trace JSON
+          * @note spans are complete ("X") events,so a ring that wrapped never leaves one half open
+          * @param path file
+          * @retval success or not
+          */
+        static bool dump(const std::string& path)
+        {
+            FILE* fp = fopen(path.c_str(),"w");
+            if(!fp) return false;
+            clock_pair origin = _origin_();
+            clock_pair now = _pair_();
+            double ns_per_tick = now.tsc > origin.tsc ? (double)(now.ns - origin.ns) / (double)(now.tsc - origin.tsc) : 1.0;
+            int pid = (int)getpid();
+            std::vector<trace_record> copy(TRACE_RING_SIZE);
+            bool first = true;
+            fprintf(fp,"{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+            registry& r = _registry_();
+            std::lock_guard<std::mutex> lock(r.mtx);
+            for(auto& ring : r.rings)
+            {
+                fprintf(fp,"%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%ld,\"args\":{\"name\":\"%s\"}}",
+                        first ? "" : ",\n",pid,ring->tid,ring->name.c_str());
+                first = false;
+                uint64_t head = ring->head.load(std::memory_order_acquire);
+                uint64_t base = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+                for(uint64_t i = base;i < head;i++) copy[i - base] = ring->slots[i & (TRACE_RING_SIZE - 1)];
+                /* the writer may have reused the oldest slots while they were copied */
+                uint64_t after = ring->head.load(std::memory_order_acquire);
+                uint64_t valid = after + 1 > base + TRACE_RING_SIZE ? after + 1 - TRACE_RING_SIZE : base;
+                for(uint64_t i = valid;i < head;i++)
+                {
+                    const trace_record& rec = copy[i - base];
+                    double ts = ((double)(int64_t)(rec.start - origin.tsc) * ns_per_tick) / 1000.0;
+                    if(!_span_(rec.type))
+                    {
+                        fprintf(fp,",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%d,\"tid\":%ld,"
+                                   "\"args\":{\"fd\":%u,\"extra\":%u}}",
+                                _name_(rec.type),ts,pid,ring->tid,rec.arg,rec.extra);
+                    }
+                    else
+                    {
+                        double dur = (double)(rec.end - rec.start) * ns_per_tick / 1000.0;
+                        fprintf(fp,",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%ld,"
+                                   "\"args\":{\"%s\":%u}}",
+                                _name_(rec.type),ts,dur,pid,ring->tid,rec.type == TR_PROCESS ? "fd" : "count",rec.arg);
+                    }
+                }
+            }
+            fprintf(fp,"\n]}\n");
+            return fclose(fp) == 0;
+        }
+    };
+
+    /* fd of items having one (hzd::conn) */
+    template<class T>
+    static auto trace_fd(T* t,int) -> decltype((uint32_t)t->fd())
+    {
+        return (uint32_t)t->fd();
+    }
+    template<class T>
+    static uint32_t trace_fd(T*,long) { return 0; }
+
+    /**
+      * @brief records a span from construction to destruction
+      * @note nothing is recorded when tracing was off at construction
+      */
+    class trace_span {
+        trace_type type;
+        uint32_t arg;
+        uint64_t start{0};
+    public:
+        trace_span(trace_type _type,uint32_t _arg = 0) : type(_type),arg(_arg)
+        {
+            if(trace::on()) start = trace::ticks();
+        }
+        trace_span(const trace_span&) = delete;
+        trace_span& operator=(const trace_span&) = delete;
+        void set_arg(uint32_t _arg) { arg = _arg; }
+        ~trace_span()
+        {
+            if(start) trace::record(type,start,trace::ticks(),arg);
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,415 @@
+#ifndef CONV_EVENT_FILE_CACHE_H
+#define CONV_EVENT_FILE_CACHE_H
+
+#include <string>               /* string */
+#include <list>                 /* list */
+#include <unordered_map>        /* unordered_map */
+#include <vector>               /* vector */
+#include <algorithm>            /* find */
+#include <memory>               /* shared_ptr */
+#include <mutex>                /* mutex */
+#include <thread>               /* thread */
+#include <atomic>               /* atomic */
+#include <ctime>                /* gmtime_r strftime */
+#include <cerrno>               /* errno */
+#include <fcntl.h>              /* open */
+#include <unistd.h>             /* close pread */
+#include <poll.h>               /* poll */
+#include <sys/stat.h>           /* fstat */
+#include <sys/inotify.h>        /* inotify */
+#include "async_logger/async_logger.hpp"    /* async_logger */
+
+namespace hzd {
+
+    #define FILE_CACHE_SHARD_COUNT 16
+
+    class file_cache {
+    public:
+        /* one cached static file : open fd, stat and the header lines that never change */
+        struct entry
+        {
+            std::string url;
+            int fd{-1};
+            struct stat file_stat{};
+            std::string content_type;
+            std::string etag;
+            std::string last_modified;
+            std::string header_text;
+            std::string content;
+            bool in_memory{false};
+
+            entry() = default;
+            entry(const entry&) = delete;
+            entry& operator=(const entry&) = delete;
+            ~entry()
+            {
+                if(fd != -1)
+                {
+                    ::close(fd);
+                    fd = -1;
+                }
+            }
+        };
+    private:
+        struct shard
+        {
+            std::mutex mtx;
+            std::list<std::shared_ptr<entry>> lru;
+            std::unordered_map<std::string,std::list<std::shared_ptr<entry>>::iterator> index;
+            size_t memory{0};
+            /* bumped by every invalidation,a load that began before one is not cached */
+            uint64_t generation{0};
+        };
+
+        shard shards[FILE_CACHE_SHARD_COUNT];
+        size_t shard_capacity;
+        size_t shard_memory;
+        size_t small_file_size;
+
+        int inotify_fd{-1};
+        std::mutex watch_mtx;
+        /* url directories of a watched directory,more than one when reached through a symlink */
+        std::unordered_map<int,std::vector<std::string>> watches;
+        std::unordered_map<std::string,int> watched_dirs;
+        std::atomic<bool> stop{false};
+        std::thread watcher;
+
+        inline shard& shard_of(const std::string& url)
+        {
+            return shards[std::hash<std::string>()(url) % FILE_CACHE_SHARD_COUNT];
+        }
+        /**
+          * @brief remove one entry from shard (shard must be locked)
+          * @note None
+          * @param s shard
+          * @param it iterator of index
+          * @retval None
+          */
+        static void _erase_(shard& s,std::unordered_map<std::string,std::list<std::shared_ptr<entry>>::iterator>::iterator it)
+        {
+            s.memory -= (*it->second)->content.size();
+            s.lru.erase(it->second);
+            s.index.erase(it);
+        }
+        /**
+          * @brief watch directory of url by inotify
+          * @note file_name is the real path,url_dir is the url prefix of the directory.
+          *       a directory that does not exist has no file to cache and is not warned about
+          * @param file_name real file path
+          * @param url normalized url of file
+          * @retval None
+          */
+        void _watch_(const std::string& file_name,const std::string& url)
+        {
+            if(inotify_fd == -1) return;
+            size_t slash = file_name.find_last_of('/');
+            size_t url_slash = url.find_last_of('/');
+            std::string dir = slash == std::string::npos ? "." : file_name.substr(0,slash);
+            std::string url_dir = url_slash == std::string::npos ? "" : url.substr(0,url_slash);
+            std::lock_guard<std::mutex> guard(watch_mtx);
+            if(watched_dirs.find(dir) != watched_dirs.end()) return;
+            int wd = inotify_add_watch(inotify_fd,dir.c_str(),
+                                       IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                                       IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF);
+            if(wd < 0)
+            {
+                if(errno != ENOENT && errno != ENOTDIR) LOG_WARN("file cache inotify watch failed: " + dir);
+                return;
+            }
+            /* the same directory by another path gives the same wd */
+            std::vector<std::string>& url_dirs = watches[wd];
+            if(std::find(url_dirs.begin(),url_dirs.end(),url_dir) == url_dirs.end()) url_dirs.push_back(url_dir);
+            watched_dirs[dir] = wd;
+        }
+        /**
+          * @brief inotify watcher loop,invalidate entries when files changed
+          * @note None
+          * @param None
+          * @retval None
+          */
+        void _watch_loop_()
+        {
+            alignas(inotify_event) char buffer[4096];
+            pollfd pfd{inotify_fd,POLLIN,0};
+            while(!stop)
+            {
+                if(poll(&pfd,1,500) <= 0) continue;
+                ssize_t len = read(inotify_fd,buffer,sizeof(buffer));
+                if(len <= 0) continue;
+                for(char* p = buffer;p < buffer + len;)
+                {
+                    auto* ev = (inotify_event*)p;
+                    p += sizeof(inotify_event) + ev->len;
+                    std::vector<std::string> url_dirs;
+                    {
+                        std::lock_guard<std::mutex> guard(watch_mtx);
+                        auto it = watches.find(ev->wd);
+                        if(it == watches.end()) continue;
+                        url_dirs = it->second;
+                        if(ev->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF))
+                        {
+                            for(auto d = watched_dirs.begin();d != watched_dirs.end();)
+                            {
+                                if(d->second == ev->wd) d = watched_dirs.erase(d);
+                                else d++;
+                            }
+                            watches.erase(it);
+                        }
+                    }
+                    if(ev->len > 0)
+                    {
+                        for(const auto& url_dir : url_dirs) invalidate(url_dir + "/" + ev->name);
+                    }
+                    else
+                    {
+                        clear();
+                    }
+                }
+            }
+        }
+    public:
+        /**
+          * @brief create file cache
+          * @note capacity and memory are split between shards
+          * @param capacity max entries count
+          * @param memory max bytes of file contents hold in memory
+          * @param _small_file_size files not larger than this are hold in memory
+          * @retval None
+          */
+        explicit file_cache(size_t capacity = 4096,size_t memory = 64 * 1024 * 1024,size_t _small_file_size = 64 * 1024)
+        : shard_capacity(capacity / FILE_CACHE_SHARD_COUNT + 1),
+          shard_memory(memory / FILE_CACHE_SHARD_COUNT),
+          small_file_size(_small_file_size)
+        {
+            inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if(inotify_fd < 0)
+            {
+                inotify_fd = -1;
+                LOG_WARN("file cache inotify init failed,cache will not be invalidated");
+            }
+            else
+            {
+                watcher = std::thread(&file_cache::_watch_loop_,this);
+            }
+            LOG_TRACE("file cache init success,capacity = " + std::to_string(capacity));
+        }
+        ~file_cache()
+        {
+            stop = true;
+            if(watcher.joinable()) watcher.join();
+            if(inotify_fd != -1)
+            {
+                ::close(inotify_fd);
+                inotify_fd = -1;
+            }
+        }
+        file_cache(const file_cache&) = delete;
+        file_cache& operator=(const file_cache&) = delete;
+
+        /**
+          * @brief url as cache key,repeated '/' and "." segments removed
+          * @note "/img//x.png" and "/./img/x.png" name the file of "/img/x.png",so they share
+          *       its entry and are invalidated with it.".." is left as it is
+          * @param url url
+          * @retval normalized url
+          */
+        static std::string normalize(const std::string& url)
+        {
+            std::string out;
+            out.reserve(url.size());
+            size_t i = 0;
+            while(i < url.size())
+            {
+                if(url[i] != '/')
+                {
+                    out += url[i++];
+                    continue;
+                }
+                while(i + 1 < url.size() && url[i + 1] == '/') i++;
+                if(i + 1 < url.size() && url[i + 1] == '.' && (i + 2 == url.size() || url[i + 2] == '/'))
+                {
+                    i += 2;
+                    continue;
+                }
+                out += '/';
+                i++;
+            }
+            return out;
+        }
+        /* url has nothing normalize() would remove,it is its own key without a copy */
+        static bool normal(const std::string& url)
+        {
+            for(size_t i = 0;i + 1 < url.size();i++)
+            {
+                if(url[i] != '/') continue;
+                if(url[i + 1] == '/') return false;
+                if(url[i + 1] == '.' && (i + 2 == url.size() || url[i + 2] == '/')) return false;
+            }
+            return true;
+        }
+        /**
+          * @brief find cached entry by url
+          * @note None
+          * @param url url
+          * @retval entry or nullptr
+          */
+        std::shared_ptr<entry> acquire(const std::string& url)
+        {
+            if(!normal(url)) return acquire(normalize(url));
+            shard& s = shard_of(url);
+            std::lock_guard<std::mutex> guard(s.mtx);
+            auto it = s.index.find(url);
+            if(it == s.index.end()) return nullptr;
+            s.lru.splice(s.lru.begin(),s.lru,it->second);
+            return *it->second;
+        }
+        /**
+          * @brief format time as http date
+          * @note None
+          * @param t time
+          * @retval like "Sun, 06 Nov 1994 08:49:37 GMT"
+          */
+        static std::string http_date(time_t t)
+        {
+            struct tm tm{};
+            char buffer[32];
+            gmtime_r(&t,&tm);
+            size_t n = strftime(buffer,sizeof(buffer),"%a, %d %b %Y %H:%M:%S GMT",&tm);
+            return {buffer,n};
+        }
+        /**
+          * @brief strong entity tag derived from inode,size and mtime
+          * @note None
+          * @param st file stat
+          * @retval etag with quotes
+          */
+        static std::string etag_of(const struct stat& st)
+        {
+            char buffer[64];
+            int n = snprintf(buffer,sizeof(buffer),"\"%lx-%lx-%lx\"",
+                             (unsigned long)st.st_ino,(unsigned long)st.st_size,(unsigned long)st.st_mtime);
+            return {buffer,(size_t)n};
+        }
+        /**
+          * @brief open file and build entry without caching it
+          * @note only readable regular files,others return nullptr
+          * @param url url
+          * @param file_name real file path
+          * @param content_type mime type of file
+          * @param small_file_size files not larger than this are read into memory
+          * @retval entry or nullptr
+          */
+        static std::shared_ptr<entry> open_entry(const std::string& url,const std::string& file_name,
+                                                 const std::string& content_type,size_t small_file_size)
+        {
+            auto e = std::make_shared<entry>();
+            e->url = url;
+            e->fd = open(file_name.c_str(),O_RDONLY | O_CLOEXEC);
+            if(e->fd < 0) return nullptr;
+            if(fstat(e->fd,&e->file_stat) < 0
+            || !S_ISREG(e->file_stat.st_mode)
+            || !(e->file_stat.st_mode & S_IROTH))
+            {
+                return nullptr;
+            }
+            e->content_type = content_type;
+            e->etag = etag_of(e->file_stat);
+            e->last_modified = http_date(e->file_stat.st_mtime);
+            e->header_text = "Content-Length:" + std::to_string(e->file_stat.st_size) + "\r\n"
+                           + "Content-Type:" + content_type + "\r\n"
+                           + "ETag:" + e->etag + "\r\n"
+                           + "Last-Modified:" + e->last_modified + "\r\n"
+                           + "Accept-Ranges:bytes\r\n";
+            if((size_t)e->file_stat.st_size <= small_file_size)
+            {
+                e->content.resize(e->file_stat.st_size);
+                size_t cursor = 0;
+                while(cursor < e->content.size())
+                {
+                    ssize_t n = pread(e->fd,&e->content[cursor],e->content.size() - cursor,(off_t)cursor);
+                    if(n <= 0) return nullptr;
+                    cursor += n;
+                }
+                e->in_memory = true;
+                ::close(e->fd);
+                e->fd = -1;
+            }
+            return e;
+        }
+        /**
+          * @brief open file and put it into cache
+          * @note only readable regular files are cached,others return nullptr.
+          *       the directory is watched before the file is read,and the entry is returned
+          *       without caching it when an invalidation of its shard came in between,
+          *       so a change while loading is never missed
+          * @param url url as cache key,normalized first
+          * @param file_name real file path
+          * @param content_type mime type of file
+          * @retval entry or nullptr
+          */
+        std::shared_ptr<entry> load(const std::string& url,const std::string& file_name,const std::string& content_type)
+        {
+            if(!normal(url)) return load(normalize(url),normalize(file_name),content_type);
+            _watch_(file_name,url);
+            shard& s = shard_of(url);
+            uint64_t generation;
+            {
+                std::lock_guard<std::mutex> guard(s.mtx);
+                generation = s.generation;
+            }
+            auto e = open_entry(url,file_name,content_type,small_file_size);
+            if(!e) return nullptr;
+
+            std::lock_guard<std::mutex> guard(s.mtx);
+            if(s.generation != generation) return e;
+            auto it = s.index.find(url);
+            if(it != s.index.end()) _erase_(s,it);
+            s.lru.push_front(e);
+            s.index[url] = s.lru.begin();
+            s.memory += e->content.size();
+            while(!s.lru.empty() && (s.index.size() > shard_capacity || s.memory > shard_memory))
+            {
+                _erase_(s,s.index.find(s.lru.back()->url));
+            }
+            return e;
+        }
+        /**
+          * @brief drop cached entry of url
+          * @note connections holding the entry keep it alive until sent
+          * @param url url
+          * @retval None
+          */
+        void invalidate(const std::string& url)
+        {
+            if(!normal(url))
+            {
+                invalidate(normalize(url));
+                return;
+            }
+            shard& s = shard_of(url);
+            std::lock_guard<std::mutex> guard(s.mtx);
+            s.generation++;
+            auto it = s.index.find(url);
+            if(it != s.index.end()) _erase_(s,it);
+        }
+        /**
+          * @brief drop all cached entries
+          * @note None
+          * @param None
+          * @retval None
+          */
+        void clear()
+        {
+            for(auto& s : shards)
+            {
+                std::lock_guard<std::mutex> guard(s.mtx);
+                s.generation++;
+                s.index.clear();
+                s.lru.clear();
+                s.memory = 0;
+            }
+        }
+    };
+}
+
+#endif
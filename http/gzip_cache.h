@@ -0,0 +1,244 @@
+#ifndef CONV_EVENT_GZIP_CACHE_H
+#define CONV_EVENT_GZIP_CACHE_H
+
+#include <string>               /* string */
+#include <list>                 /* list */
+#include <unordered_map>        /* unordered_map */
+#include <memory>               /* shared_ptr */
+#include <mutex>                /* mutex */
+#include <fcntl.h>              /* open */
+#include <unistd.h>             /* close pread */
+#include <sys/stat.h>           /* fstat */
+#include <zlib.h>               /* deflate */
+#include "http/file_cache.h"    /* file_cache */
+#include "async_logger/async_logger.hpp"    /* async_logger */
+
+namespace hzd {
+
+    enum http_Encoding { IDENTITY, GZIP, DEFLATE };
+
+    class gzip_cache {
+    public:
+        /* compressed body of one file,data is empty when compression is not worth it */
+        struct record
+        {
+            std::string key;
+            struct timespec mtime{};
+            off_t size{0};
+            std::string etag;
+            std::string header_text;
+            std::string data;
+        };
+        /* bytes charged for a record,records of files not worth compressing are charged too */
+        static size_t cost(const record& r)
+        {
+            return sizeof(record) + r.key.size() + r.etag.size() + r.header_text.size() + r.data.size();
+        }
+        /**
+          * @brief entity tag of an encoded body
+          * @note encoded bodies are different representations,so they never share the tag of the file
+          * @param etag tag of the file with quotes
+          * @param encoding GZIP or DEFLATE
+          * @retval etag with quotes
+          */
+        static std::string encoded_etag(const std::string& etag,http_Encoding encoding)
+        {
+            if(etag.size() < 2) return etag;
+            return etag.substr(0,etag.size() - 1) + (encoding == GZIP ? "-gzip\"" : "-deflate\"");
+        }
+    private:
+        std::mutex mtx;
+        std::list<std::shared_ptr<record>> lru;
+        std::unordered_map<std::string,std::list<std::shared_ptr<record>>::iterator> index;
+        size_t memory{0};
+        size_t max_memory;
+        size_t max_file_size;
+        int level;
+
+        /**
+          * @brief read whole file by pread
+          * @note None
+          * @param fd file fd
+          * @param size file size
+          * @param out output
+          * @retval success or not
+          */
+        static bool _read_all_(int fd,size_t size,std::string& out)
+        {
+            out.resize(size);
+            size_t cursor = 0;
+            while(cursor < size)
+            {
+                ssize_t n = pread(fd,&out[cursor],size - cursor,(off_t)cursor);
+                if(n <= 0) return false;
+                cursor += n;
+            }
+            return true;
+        }
+        /**
+          * @brief read precompressed sibling file.gz if it is not older than the file
+          * @note None
+          * @param file_name real file path
+          * @param st stat of original file
+          * @param out output
+          * @retval found or not
+          */
+        bool _load_sibling_(const std::string& file_name,const struct stat& st,std::string& out) const
+        {
+            int fd = open((file_name + ".gz").c_str(),O_RDONLY | O_CLOEXEC);
+            if(fd < 0) return false;
+            struct stat gz_stat{};
+            bool ok = fstat(fd,&gz_stat) == 0
+                    && S_ISREG(gz_stat.st_mode)
+                    && gz_stat.st_mtime >= st.st_mtime
+                    && (size_t)gz_stat.st_size <= max_file_size
+                    && _read_all_(fd,gz_stat.st_size,out);
+            ::close(fd);
+            return ok;
+        }
+        /**
+          * @brief compress data by zlib
+          * @note GZIP uses gzip wrapper,DEFLATE uses zlib wrapper
+          * @param in input
+          * @param encoding GZIP or DEFLATE
+          * @param out output
+          * @retval success or not
+          */
+        bool _compress_(const std::string& in,http_Encoding encoding,std::string& out) const
+        {
+            z_stream zs{};
+            if(deflateInit2(&zs,level,Z_DEFLATED,encoding == GZIP ? 15 + 16 : 15,8,Z_DEFAULT_STRATEGY) != Z_OK)
+            {
+                return false;
+            }
+            out.resize(deflateBound(&zs,in.size()));
+            zs.next_in = (Bytef*)in.data();
+            zs.avail_in = (uInt)in.size();
+            zs.next_out = (Bytef*)&out[0];
+            zs.avail_out = (uInt)out.size();
+            int ret = deflate(&zs,Z_FINISH);
+            out.resize(zs.total_out);
+            deflateEnd(&zs);
+            return ret == Z_STREAM_END;
+        }
+    public:
+        /**
+          * @brief create gzip cache
+          * @note None
+          * @param _max_memory max bytes of records,compressed data included
+          * @param _max_file_size files larger than this are never compressed
+          * @param _level zlib compression level
+          * @retval None
+          */
+        explicit gzip_cache(size_t _max_memory = 32 * 1024 * 1024,size_t _max_file_size = 1024 * 1024,int _level = 6)
+        : max_memory(_max_memory),max_file_size(_max_file_size),level(_level)
+        {
+            LOG_TRACE("gzip cache init success");
+        }
+        gzip_cache(const gzip_cache&) = delete;
+        gzip_cache& operator=(const gzip_cache&) = delete;
+
+        /**
+          * @brief mime types worth compressing
+          * @note None
+          * @param content_type content type
+          * @retval compressible or not
+          */
+        static bool compressible(const std::string& content_type)
+        {
+            return content_type.compare(0,5,"text/") == 0
+                || content_type == "application/javascript"
+                || content_type == "application/json"
+                || content_type == "application/xml"
+                || content_type == "image/svg+xml"
+                || content_type == "application/xhtml+xml"
+                || content_type == "application/rss+xml"
+                || content_type == "application/atom+xml";
+        }
+        /**
+          * @brief get compressed body of file,compress or load file.gz on first use
+          * @note content may be nullptr,then file is read from fd
+          * @param url url
+          * @param file_name real file path
+          * @param content_type content type
+          * @param st stat of file
+          * @param fd file fd
+          * @param content file content already in memory
+          * @param encoding GZIP or DEFLATE
+          * @retval record or nullptr (record->data empty means send identity)
+          */
+        std::shared_ptr<record> acquire(const std::string& url,const std::string& file_name,const std::string& content_type,
+                                        const struct stat& st,int fd,const std::string* content,http_Encoding encoding)
+        {
+            if((size_t)st.st_size > max_file_size) return nullptr;
+            std::string key = url + (encoding == GZIP ? ":gzip" : ":deflate");
+            {
+                std::lock_guard<std::mutex> guard(mtx);
+                auto it = index.find(key);
+                if(it != index.end())
+                {
+                    auto& r = *it->second;
+                    if(r->size == st.st_size
+                    && r->mtime.tv_sec == st.st_mtim.tv_sec
+                    && r->mtime.tv_nsec == st.st_mtim.tv_nsec)
+                    {
+                        lru.splice(lru.begin(),lru,it->second);
+                        return r;
+                    }
+                    memory -= cost(*r);
+                    lru.erase(it->second);
+                    index.erase(it);
+                }
+            }
+
+            auto r = std::make_shared<record>();
+            r->key = key;
+            r->mtime = st.st_mtim;
+            r->size = st.st_size;
+            if(encoding != GZIP || !_load_sibling_(file_name,st,r->data))
+            {
+                std::string raw;
+                if(!content)
+                {
+                    if(fd < 0 || !_read_all_(fd,st.st_size,raw)) return nullptr;
+                    content = &raw;
+                }
+                if(!_compress_(*content,encoding,r->data) || r->data.size() >= content->size())
+                {
+                    r->data.clear();
+                }
+            }
+            if(!r->data.empty())
+            {
+                r->etag = encoded_etag(file_cache::etag_of(st),encoding);
+                r->header_text = "Content-Length:" + std::to_string(r->data.size()) + "\r\n"
+                               + "Content-Type:" + content_type + "\r\n"
+                               + "Content-Encoding:" + (encoding == GZIP ? "gzip" : "deflate") + "\r\n"
+                               + "ETag:" + r->etag + "\r\n"
+                               + "Last-Modified:" + file_cache::http_date(st.st_mtime) + "\r\n"
+                               + "Vary:Accept-Encoding\r\n";
+            }
+
+            std::lock_guard<std::mutex> guard(mtx);
+            auto it = index.find(key);
+            if(it != index.end())
+            {
+                memory -= cost(**it->second);
+                lru.erase(it->second);
+                index.erase(it);
+            }
+            lru.push_front(r);
+            index[key] = lru.begin();
+            memory += cost(*r);
+            while(memory > max_memory && !lru.empty())
+            {
+                memory -= cost(*lru.back());
+                index.erase(lru.back()->key);
+                lru.pop_back();
+            }
+            return r;
+        }
+    };
+}
+
+#endif
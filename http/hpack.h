@@ -0,0 +1,562 @@
+#ifndef CONV_EVENT_HPACK_H
+#define CONV_EVENT_HPACK_H
+
+#include <string>               /* string */
+#include <vector>               /* vector */
+#include <deque>                /* deque */
+#include <utility>              /* pair */
+#include <cstdint>              /* uint8_t */
+#include <cstring>              /* strcmp */
+
+namespace hzd {
+
+    #define HPACK_STATIC_TABLE_SIZE 61
+    #define HPACK_ENTRY_OVERHEAD 32
+    #define HPACK_DEFAULT_TABLE_SIZE 4096
+
+    using hpack_field = std::pair<std::string,std::string>;
+
+    /* RFC 7541 Appendix A */
+    static const char* const hpack_static_table[HPACK_STATIC_TABLE_SIZE][2] = {
+            {":authority",""},
+            {":method","GET"},
+            {":method","POST"},
+            {":path","/"},
+            {":path","/index.html"},
+            {":scheme","http"},
+            {":scheme","https"},
+            {":status","200"},
+            {":status","204"},
+            {":status","206"},
+            {":status","304"},
+            {":status","400"},
+            {":status","404"},
+            {":status","500"},
+            {"accept-charset",""},
+            {"accept-encoding","gzip, deflate"},
+            {"accept-language",""},
+            {"accept-ranges",""},
+            {"accept",""},
+            {"access-control-allow-origin",""},
+            {"age",""},
+            {"allow",""},
+            {"authorization",""},
+            {"cache-control",""},
+            {"content-disposition",""},
+            {"content-encoding",""},
+            {"content-language",""},
+            {"content-length",""},
+            {"content-location",""},
+            {"content-range",""},
+            {"content-type",""},
+            {"cookie",""},
+            {"date",""},
+            {"etag",""},
+            {"expect",""},
+            {"expires",""},
+            {"from",""},
+            {"host",""},
+            {"if-match",""},
+            {"if-modified-since",""},
+            {"if-none-match",""},
+            {"if-range",""},
+            {"if-unmodified-since",""},
+            {"last-modified",""},
+            {"link",""},
+            {"location",""},
+            {"max-forwards",""},
+            {"proxy-authenticate",""},
+            {"proxy-authorization",""},
+            {"range",""},
+            {"referer",""},
+            {"refresh",""},
+            {"retry-after",""},
+            {"server",""},
+            {"set-cookie",""},
+            {"strict-transport-security",""},
+            {"transfer-encoding",""},
+            {"user-agent",""},
+            {"vary",""},
+            {"via",""},
+            {"www-authenticate",""}
+    };
+
+    /* RFC 7541 Appendix B,symbol 256 is EOS */
+    static const uint32_t hpack_huffman_codes[257] = {
+            0x1ff8,0x7fffd8,0xfffffe2,0xfffffe3,0xfffffe4,0xfffffe5,0xfffffe6,0xfffffe7,
+            0xfffffe8,0xffffea,0x3ffffffc,0xfffffe9,0xfffffea,0x3ffffffd,0xfffffeb,0xfffffec,
+            0xfffffed,0xfffffee,0xfffffef,0xffffff0,0xffffff1,0xffffff2,0x3ffffffe,0xffffff3,
+            0xffffff4,0xffffff5,0xffffff6,0xffffff7,0xffffff8,0xffffff9,0xffffffa,0xffffffb,
+            0x14,0x3f8,0x3f9,0xffa,0x1ff9,0x15,0xf8,0x7fa,
+            0x3fa,0x3fb,0xf9,0x7fb,0xfa,0x16,0x17,0x18,
+            0x0,0x1,0x2,0x19,0x1a,0x1b,0x1c,0x1d,
+            0x1e,0x1f,0x5c,0xfb,0x7ffc,0x20,0xffb,0x3fc,
+            0x1ffa,0x21,0x5d,0x5e,0x5f,0x60,0x61,0x62,
+            0x63,0x64,0x65,0x66,0x67,0x68,0x69,0x6a,
+            0x6b,0x6c,0x6d,0x6e,0x6f,0x70,0x71,0x72,
+            0xfc,0x73,0xfd,0x1ffb,0x7fff0,0x1ffc,0x3ffc,0x22,
+            0x7ffd,0x3,0x23,0x4,0x24,0x5,0x25,0x26,
+            0x27,0x6,0x74,0x75,0x28,0x29,0x2a,0x7,
+            0x2b,0x76,0x2c,0x8,0x9,0x2d,0x77,0x78,
+            0x79,0x7a,0x7b,0x7ffe,0x7fc,0x3ffd,0x1ffd,0xffffffc,
+            0xfffe6,0x3fffd2,0xfffe7,0xfffe8,0x3fffd3,0x3fffd4,0x3fffd5,0x7fffd9,
+            0x3fffd6,0x7fffda,0x7fffdb,0x7fffdc,0x7fffdd,0x7fffde,0xffffeb,0x7fffdf,
+            0xffffec,0xffffed,0x3fffd7,0x7fffe0,0xffffee,0x7fffe1,0x7fffe2,0x7fffe3,
+            0x7fffe4,0x1fffdc,0x3fffd8,0x7fffe5,0x3fffd9,0x7fffe6,0x7fffe7,0xffffef,
+            0x3fffda,0x1fffdd,0xfffe9,0x3fffdb,0x3fffdc,0x7fffe8,0x7fffe9,0x1fffde,
+            0x7fffea,0x3fffdd,0x3fffde,0xfffff0,0x1fffdf,0x3fffdf,0x7fffeb,0x7fffec,
+            0x1fffe0,0x1fffe1,0x3fffe0,0x1fffe2,0x7fffed,0x3fffe1,0x7fffee,0x7fffef,
+            0xfffea,0x3fffe2,0x3fffe3,0x3fffe4,0x7ffff0,0x3fffe5,0x3fffe6,0x7ffff1,
+            0x3ffffe0,0x3ffffe1,0xfffeb,0x7fff1,0x3fffe7,0x7ffff2,0x3fffe8,0x1ffffec,
+            0x3ffffe2,0x3ffffe3,0x3ffffe4,0x7ffffde,0x7ffffdf,0x3ffffe5,0xfffff1,0x1ffffed,
+            0x7fff2,0x1fffe3,0x3ffffe6,0x7ffffe0,0x7ffffe1,0x3ffffe7,0x7ffffe2,0xfffff2,
+            0x1fffe4,0x1fffe5,0x3ffffe8,0x3ffffe9,0xffffffd,0x7ffffe3,0x7ffffe4,0x7ffffe5,
+            0xfffec,0xfffff3,0xfffed,0x1fffe6,0x3fffe9,0x1fffe7,0x1fffe8,0x7ffff3,
+            0x3fffea,0x3fffeb,0x1ffffee,0x1ffffef,0xfffff4,0xfffff5,0x3ffffea,0x7ffff4,
+            0x3ffffeb,0x7ffffe6,0x3ffffec,0x3ffffed,0x7ffffe7,0x7ffffe8,0x7ffffe9,0x7ffffea,
+            0x7ffffeb,0xffffffe,0x7ffffec,0x7ffffed,0x7ffffee,0x7ffffef,0x7fffff0,0x3ffffee,
+            0x3fffffff
+    };
+    static const uint8_t hpack_huffman_lengths[257] = {
+            13,23,28,28,28,28,28,28,28,24,30,28,28,30,28,28,
+            28,28,28,28,28,28,30,28,28,28,28,28,28,28,28,28,
+            6,10,10,12,13,6,8,11,10,10,8,11,8,6,6,6,
+            5,5,5,6,6,6,6,6,6,6,7,8,15,6,12,10,
+            13,6,7,7,7,7,7,7,7,7,7,7,7,7,7,7,
+            7,7,7,7,7,7,7,7,8,7,8,13,19,13,14,6,
+            15,5,6,5,6,5,6,6,6,5,7,7,6,6,6,5,
+            6,7,6,5,5,6,7,7,7,7,7,15,11,14,13,28,
+            20,22,20,20,22,22,22,23,22,23,23,23,23,23,24,23,
+            24,24,22,23,24,23,23,23,23,21,22,23,22,23,23,24,
+            22,21,20,22,22,23,23,21,23,22,22,24,21,22,23,23,
+            21,21,22,21,23,22,23,23,20,22,22,22,23,22,22,23,
+            26,26,20,19,22,23,22,25,26,26,26,27,27,26,24,25,
+            19,21,26,27,27,26,27,24,21,21,26,26,28,27,27,27,
+            20,24,20,21,22,21,21,23,22,22,25,25,24,24,26,23,
+            26,27,26,26,27,27,27,27,27,28,27,27,27,27,27,26,
+            30
+    };
+
+    /**
+      * @brief huffman code of RFC 7541 Appendix B
+      * @note decode walks a binary tree built once,encode packs codes into bytes padded with EOS bits
+      */
+    class hpack_huffman {
+        struct node
+        {
+            int16_t child[2]{-1,-1};
+            int16_t symbol{-1};
+        };
+
+        static const std::vector<node>& tree()
+        {
+            static const std::vector<node> nodes = []{
+                std::vector<node> t(1);
+                for(int symbol = 0;symbol < 257;symbol++)
+                {
+                    size_t cur = 0;
+                    for(int bit = hpack_huffman_lengths[symbol] - 1;bit >= 0;bit--)
+                    {
+                        int b = (int)((hpack_huffman_codes[symbol] >> bit) & 1);
+                        if(t[cur].child[b] == -1)
+                        {
+                            t[cur].child[b] = (int16_t)t.size();
+                            t.emplace_back();
+                        }
+                        cur = (size_t)t[cur].child[b];
+                    }
+                    t[cur].symbol = (int16_t)symbol;
+                }
+                return t;
+            }();
+            return nodes;
+        }
+    public:
+        /**
+          * @brief encoded size of string
+          * @note None
+          * @param s string
+          * @retval bytes
+          */
+        static size_t encoded_size(const std::string& s)
+        {
+            size_t bits = 0;
+            for(unsigned char c : s) bits += hpack_huffman_lengths[c];
+            return (bits + 7) / 8;
+        }
+        /**
+          * @brief append huffman code of string
+          * @note None
+          * @param s string
+          * @param out output
+          * @retval None
+          */
+        static void encode(const std::string& s,std::string& out)
+        {
+            uint64_t acc = 0;
+            int bits = 0;
+            for(unsigned char c : s)
+            {
+                acc = (acc << hpack_huffman_lengths[c]) | hpack_huffman_codes[c];
+                bits += hpack_huffman_lengths[c];
+                while(bits >= 8)
+                {
+                    bits -= 8;
+                    out.push_back((char)(acc >> bits));
+                }
+                acc &= ((uint64_t)1 << bits) - 1;
+            }
+            if(bits > 0)
+            {
+                out.push_back((char)((acc << (8 - bits)) | (0xff >> bits)));
+            }
+        }
+        /**
+          * @brief decode huffman string
+          * @note padding must be shorter than 8 bits and all ones,EOS is an error
+          * @param p data
+          * @param size data size
+          * @param out output
+          * @retval success or not
+          */
+        static bool decode(const uint8_t* p,size_t size,std::string& out)
+        {
+            const std::vector<node>& t = tree();
+            size_t cur = 0;
+            int pending = 0;
+            bool ones = true;
+            for(size_t i = 0;i < size;i++)
+            {
+                for(int bit = 7;bit >= 0;bit--)
+                {
+                    int b = (p[i] >> bit) & 1;
+                    int16_t next = t[cur].child[b];
+                    if(next == -1) return false;
+                    cur = (size_t)next;
+                    pending++;
+                    ones = ones && b;
+                    if(t[cur].symbol != -1)
+                    {
+                        if(t[cur].symbol == 256) return false;
+                        out.push_back((char)t[cur].symbol);
+                        cur = 0;
+                        pending = 0;
+                        ones = true;
+                    }
+                }
+            }
+            return pending < 8 && ones;
+        }
+    };
+
+    /**
+      * @brief static and dynamic table of one direction
+      * @note index 1..61 is the static table,newest dynamic entry is 62
+      */
+    class hpack_table {
+        std::deque<hpack_field> entries;
+        size_t size{0};
+        size_t max_size{HPACK_DEFAULT_TABLE_SIZE};
+
+        void _evict_(size_t limit)
+        {
+            while(size > limit && !entries.empty())
+            {
+                size -= entry_size(entries.back().first,entries.back().second);
+                entries.pop_back();
+            }
+        }
+    public:
+        static size_t entry_size(const std::string& name,const std::string& value)
+        {
+            return name.size() + value.size() + HPACK_ENTRY_OVERHEAD;
+        }
+        size_t capacity() const { return max_size; }
+        /**
+          * @brief change max size of dynamic table
+          * @note entries are evicted until they fit
+          * @param _max_size new max size
+          * @retval None
+          */
+        void resize(size_t _max_size)
+        {
+            max_size = _max_size;
+            _evict_(max_size);
+        }
+        /**
+          * @brief insert entry as the newest one
+          * @note an entry larger than the table empties it
+          * @param name name
+          * @param value value
+          * @retval None
+          */
+        void add(const std::string& name,const std::string& value)
+        {
+            size_t n = entry_size(name,value);
+            if(n > max_size)
+            {
+                _evict_(0);
+                return;
+            }
+            _evict_(max_size - n);
+            entries.emplace_front(name,value);
+            size += n;
+        }
+        /**
+          * @brief copy entry of index
+          * @note None
+          * @param index 1-based index
+          * @param name output name
+          * @param value output value,may be nullptr
+          * @retval found or not
+          */
+        bool get(size_t index,std::string& name,std::string* value) const
+        {
+            if(index == 0) return false;
+            if(index <= HPACK_STATIC_TABLE_SIZE)
+            {
+                name = hpack_static_table[index - 1][0];
+                if(value) *value = hpack_static_table[index - 1][1];
+                return true;
+            }
+            index -= HPACK_STATIC_TABLE_SIZE + 1;
+            if(index >= entries.size()) return false;
+            name = entries[index].first;
+            if(value) *value = entries[index].second;
+            return true;
+        }
+        /**
+          * @brief find index of field
+          * @note exact match is preferred,otherwise the first entry with the same name
+          * @param name name
+          * @param value value
+          * @param exact output exact match or not
+          * @retval index or 0
+          */
+        size_t find(const std::string& name,const std::string& value,bool& exact) const
+        {
+            size_t name_index = 0;
+            exact = false;
+            for(size_t i = 0;i < HPACK_STATIC_TABLE_SIZE;i++)
+            {
+                if(strcmp(hpack_static_table[i][0],name.c_str()) != 0) continue;
+                if(strcmp(hpack_static_table[i][1],value.c_str()) == 0)
+                {
+                    exact = true;
+                    return i + 1;
+                }
+                if(!name_index) name_index = i + 1;
+            }
+            for(size_t i = 0;i < entries.size();i++)
+            {
+                if(entries[i].first != name) continue;
+                if(entries[i].second == value)
+                {
+                    exact = true;
+                    return i + HPACK_STATIC_TABLE_SIZE + 1;
+                }
+                if(!name_index) name_index = i + HPACK_STATIC_TABLE_SIZE + 1;
+            }
+            return name_index;
+        }
+    };
+
+    /**
+      * @brief decoder of header blocks received from peer
+      * @note one decoder per connection,blocks must be decoded in order
+      */
+    class hpack_decoder {
+        hpack_table table;
+        size_t max_table_size{HPACK_DEFAULT_TABLE_SIZE};
+        bool too_large{false};
+
+        static bool _integer_(const uint8_t*& p,const uint8_t* end,int prefix,size_t& value)
+        {
+            if(p >= end) return false;
+            size_t mask = (1u << prefix) - 1;
+            value = *p++ & mask;
+            if(value < mask) return true;
+            for(int shift = 0;shift <= 28;shift += 7)
+            {
+                if(p >= end) return false;
+                uint8_t b = *p++;
+                value += (size_t)(b & 0x7f) << shift;
+                if(!(b & 0x80)) return true;
+            }
+            return false;
+        }
+        static bool _string_(const uint8_t*& p,const uint8_t* end,std::string& out)
+        {
+            if(p >= end) return false;
+            bool huffman = *p & 0x80;
+            size_t length;
+            if(!_integer_(p,end,7,length) || length > (size_t)(end - p)) return false;
+            out.clear();
+            if(huffman)
+            {
+                if(!hpack_huffman::decode(p,length,out)) return false;
+            }
+            else
+            {
+                out.assign((const char*)p,length);
+            }
+            p += length;
+            return true;
+        }
+    public:
+        /**
+          * @brief decode one complete header block
+          * @note decoded fields are appended to fields.they are counted like SETTINGS_MAX_HEADER_LIST_SIZE,
+          *       name and value plus 32 per field,and decoding stops once they pass max_list_size,
+          *       so a small block of index references can't expand without bound
+          * @param data header block
+          * @param size header block size
+          * @param fields output fields
+          * @param max_list_size bytes the decoded fields may take
+          * @retval success or not (failure is a connection error,list_too_large() tells which)
+          */
+        bool decode(const uint8_t* data,size_t size,std::vector<hpack_field>& fields,size_t max_list_size = SIZE_MAX)
+        {
+            const uint8_t* p = data;
+            const uint8_t* end = data + size;
+            bool first = true;
+            size_t list_size = 0;
+            too_large = false;
+            while(p < end)
+            {
+                uint8_t b = *p;
+                size_t index;
+                if(b & 0x80)
+                {
+                    if(!_integer_(p,end,7,index)) return false;
+                    fields.emplace_back();
+                    if(!table.get(index,fields.back().first,&fields.back().second)) return false;
+                }
+                else if((b & 0xe0) == 0x20)
+                {
+                    if(!first || !_integer_(p,end,5,index) || index > max_table_size) return false;
+                    table.resize(index);
+                    continue;
+                }
+                else
+                {
+                    int prefix = (b & 0x40) ? 6 : 4;
+                    if(!_integer_(p,end,prefix,index)) return false;
+                    fields.emplace_back();
+                    hpack_field& f = fields.back();
+                    if(index == 0)
+                    {
+                        if(!_string_(p,end,f.first)) return false;
+                    }
+                    else if(!table.get(index,f.first,nullptr))
+                    {
+                        return false;
+                    }
+                    if(!_string_(p,end,f.second)) return false;
+                    if(prefix == 6) table.add(f.first,f.second);
+                }
+                first = false;
+                list_size += hpack_table::entry_size(fields.back().first,fields.back().second);
+                if(list_size > max_list_size)
+                {
+                    too_large = true;
+                    return false;
+                }
+            }
+            return true;
+        }
+        /* the last decode() failed because its fields passed max_list_size */
+        bool list_too_large() const { return too_large; }
+    };
+
+    /**
+      * @brief encoder of header blocks sent to peer
+      * @note fields that change on every response are never put into the dynamic table
+      */
+    class hpack_encoder {
+        hpack_table table;
+        bool size_update{false};
+
+        static void _integer_(std::string& out,int prefix,uint8_t flags,size_t value)
+        {
+            size_t mask = (1u << prefix) - 1;
+            if(value < mask)
+            {
+                out.push_back((char)(flags | value));
+                return;
+            }
+            out.push_back((char)(flags | mask));
+            value -= mask;
+            while(value >= 0x80)
+            {
+                out.push_back((char)(0x80 | (value & 0x7f)));
+                value >>= 7;
+            }
+            out.push_back((char)value);
+        }
+        static void _string_(std::string& out,const std::string& s)
+        {
+            size_t huffman = hpack_huffman::encoded_size(s);
+            if(huffman < s.size())
+            {
+                _integer_(out,7,0x80,huffman);
+                hpack_huffman::encode(s,out);
+            }
+            else
+            {
+                _integer_(out,7,0,s.size());
+                out += s;
+            }
+        }
+        static bool _indexable_(const std::string& name)
+        {
+            return name != "content-length" && name != "date" && name != "etag"
+                && name != "last-modified" && name != "content-range" && name != "location"
+                && name != "set-cookie";
+        }
+    public:
+        /**
+          * @brief apply SETTINGS_HEADER_TABLE_SIZE of peer
+          * @note the table never grows beyond the default size,the change is signalled in the next block
+          * @param size max size allowed by peer
+          * @retval None
+          */
+        void set_max_table_size(size_t size)
+        {
+            if(size > HPACK_DEFAULT_TABLE_SIZE) size = HPACK_DEFAULT_TABLE_SIZE;
+            if(size == table.capacity()) return;
+            table.resize(size);
+            size_update = true;
+        }
+        /**
+          * @brief append one field to header block
+          * @note name must be lower case
+          * @param name name
+          * @param value value
+          * @param out header block
+          * @retval None
+          */
+        void encode(const std::string& name,const std::string& value,std::string& out)
+        {
+            if(size_update)
+            {
+                _integer_(out,5,0x20,table.capacity());
+                size_update = false;
+            }
+            bool exact;
+            size_t index = table.find(name,value,exact);
+            if(exact)
+            {
+                _integer_(out,7,0x80,index);
+                return;
+            }
+            bool indexing = _indexable_(name);
+            _integer_(out,indexing ? 6 : 4,indexing ? 0x40 : 0,index);
+            if(!index) _string_(out,name);
+            _string_(out,value);
+            if(indexing) table.add(name,value);
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,903 @@
+#ifndef CONV_EVENT_HTTP2_CONN_H
+#define CONV_EVENT_HTTP2_CONN_H
+
+#include "http/http_conn.h"     /* http_conn */
+#include "http/hpack.h"         /* hpack_encoder hpack_decoder */
+#include <unordered_map>        /* unordered_map */
+#include <algorithm>            /* min */
+#include <cctype>               /* tolower */
+#include <netinet/tcp.h>        /* TCP_NODELAY */
+
+namespace hzd {
+
+    #define HTTP2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+    #define HTTP2_PREFACE_SIZE 24
+    #define HTTP2_FRAME_HEADER_SIZE 9
+    #define HTTP2_DEFAULT_WINDOW 65535
+    #define HTTP2_MAX_WINDOW 0x7fffffff
+    #define HTTP2_DEFAULT_FRAME_SIZE 16384
+    #define HTTP2_MAX_FRAME_SIZE 16777215
+    #define HTTP2_MAX_HEADER_BLOCK (64 * 1024)
+    /* SETTINGS_MAX_HEADER_LIST_SIZE announced,decoded header fields of one block */
+    #define HTTP2_MAX_HEADER_LIST (64 * 1024)
+    #define HTTP2_FLUSH_SIZE (256 * 1024)
+
+    enum http2_Frame_Type
+    {
+        H2_DATA,
+        H2_HEADERS,
+        H2_PRIORITY,
+        H2_RST_STREAM,
+        H2_SETTINGS,
+        H2_PUSH_PROMISE,
+        H2_PING,
+        H2_GOAWAY,
+        H2_WINDOW_UPDATE,
+        H2_CONTINUATION,
+    };
+
+    enum http2_Flag
+    {
+        H2_END_STREAM = 0x1,
+        H2_ACK = 0x1,
+        H2_END_HEADERS = 0x4,
+        H2_PADDED = 0x8,
+        H2_PRIORITY_FLAG = 0x20,
+    };
+
+    enum http2_Error
+    {
+        H2_NO_ERROR,
+        H2_PROTOCOL_ERROR,
+        H2_INTERNAL_ERROR,
+        H2_FLOW_CONTROL_ERROR,
+        H2_SETTINGS_TIMEOUT,
+        H2_STREAM_CLOSED,
+        H2_FRAME_SIZE_ERROR,
+        H2_REFUSED_STREAM,
+        H2_CANCEL,
+        H2_COMPRESSION_ERROR,
+        H2_CONNECT_ERROR,
+        H2_ENHANCE_YOUR_CALM,
+    };
+
+    enum http2_Setting
+    {
+        H2_HEADER_TABLE_SIZE = 1,
+        H2_ENABLE_PUSH,
+        H2_MAX_CONCURRENT_STREAMS,
+        H2_INITIAL_WINDOW_SIZE,
+        H2_MAX_FRAME_SIZE,
+        H2_MAX_HEADER_LIST_SIZE,
+    };
+
+    /**
+      * @brief h2c connection,speaks HTTP/1.x until the client sends the preface or asks for "Upgrade: h2c"
+      * @note every stream is dispatched to the registered routers like an HTTP/1.x request.
+      *       the router's response is captured and converted into HEADERS and DATA frames,
+      *       so routers,filters and static files work unchanged.
+      */
+    class http2_conn : public http_conn {
+        enum Mode { HTTP1, PREFACE, HTTP2 };
+        struct stream
+        {
+            uint32_t id{0};
+            std::vector<hpack_field> fields;
+            std::string body;
+            bool remote_closed{false};
+            int64_t send_window{HTTP2_DEFAULT_WINDOW};
+            int64_t recv_window{HTTP2_DEFAULT_WINDOW};
+            size_t held{0};
+            std::string pending;
+            size_t pending_cursor{0};
+        };
+
+        Mode mode{HTTP1};
+        std::string in;
+        std::string out;
+        std::unordered_map<uint32_t,stream> streams;
+        hpack_decoder decoder;
+        hpack_encoder encoder;
+        std::string header_block;
+        uint32_t header_stream{0};
+        uint8_t header_flags{0};
+        uint32_t last_stream_id{0};
+        int64_t conn_send_window{HTTP2_DEFAULT_WINDOW};
+        int64_t conn_recv_window{HTTP2_DEFAULT_WINDOW};
+        size_t conn_refund{0};
+        int64_t peer_initial_window{HTTP2_DEFAULT_WINDOW};
+        size_t peer_max_frame{HTTP2_DEFAULT_FRAME_SIZE};
+        bool peer_goaway{false};
+
+        static inline uint32_t _u32_(const uint8_t* p)
+        {
+            return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+        }
+        static inline void _put_u32_(std::string& s,uint32_t v)
+        {
+            char b[4] = {(char)(v >> 24),(char)(v >> 16),(char)(v >> 8),(char)v};
+            s.append(b,4);
+        }
+        /**
+          * @brief decode base64url without padding
+          * @note used for HTTP2-Settings of upgrade request
+          * @param in encoded text
+          * @param result decoded bytes
+          * @retval success or not
+          */
+        static bool _base64url_decode_(const std::string& in,std::string& result)
+        {
+            uint32_t acc = 0;
+            int bits = 0;
+            for(char c : in)
+            {
+                int v;
+                if(c >= 'A' && c <= 'Z') v = c - 'A';
+                else if(c >= 'a' && c <= 'z') v = c - 'a' + 26;
+                else if(c >= '0' && c <= '9') v = c - '0' + 52;
+                else if(c == '-' || c == '+') v = 62;
+                else if(c == '_' || c == '/') v = 63;
+                else if(c == '=') break;
+                else return false;
+                acc = (acc << 6) | (uint32_t)v;
+                bits += 6;
+                if(bits >= 8)
+                {
+                    bits -= 8;
+                    result.push_back((char)(acc >> bits));
+                }
+            }
+            return true;
+        }
+        /**
+          * @brief "content-type" to "Content-Type"
+          * @note request headers of http_conn are looked up by canonical name
+          * @param name lower case name
+          * @retval canonical name
+          */
+        static std::string _canonical_(const std::string& name)
+        {
+            std::string s = name;
+            bool upper = true;
+            for(char& c : s)
+            {
+                if(upper && c >= 'a' && c <= 'z') c = (char)(c - 'a' + 'A');
+                upper = c == '-';
+            }
+            return s;
+        }
+        /* connection-specific HTTP/1.x headers are not allowed in HTTP/2 */
+        static bool _hop_by_hop_(const std::string& name)
+        {
+            return name == "connection" || name == "keep-alive" || name == "proxy-connection"
+                || name == "transfer-encoding" || name == "upgrade";
+        }
+        void _frame_(size_t length,uint8_t type,uint8_t flags,uint32_t id)
+        {
+            char h[HTTP2_FRAME_HEADER_SIZE] = {
+                    (char)(length >> 16),(char)(length >> 8),(char)length,
+                    (char)type,(char)flags,
+                    (char)((id >> 24) & 0x7f),(char)(id >> 16),(char)(id >> 8),(char)id
+            };
+            out.append(h,HTTP2_FRAME_HEADER_SIZE);
+        }
+        bool _flush_()
+        {
+            if(out.empty()) return true;
+            while(!send(out.data(),out.size()))
+            {
+                if(errno == EAGAIN) continue;
+                out.clear();
+                notify_close();
+                return false;
+            }
+            out.clear();
+            return true;
+        }
+        /* receive window of a stream,a whole body of http2_max_body fits in it */
+        static int64_t _local_window_()
+        {
+            return std::max<int64_t>(HTTP2_DEFAULT_WINDOW,std::min<int64_t>((int64_t)max_body + 1,HTTP2_MAX_WINDOW));
+        }
+        /**
+          * @brief send our SETTINGS and open the connection window as wide as a stream's
+          * @note the connection window starts at 65535 whatever SETTINGS say,only WINDOW_UPDATE grows it.
+          *       a header block decoding past HTTP2_MAX_HEADER_LIST is answered GOAWAY ENHANCE_YOUR_CALM
+          * @param None
+          * @retval None
+          */
+        void _send_settings_()
+        {
+            _frame_(18,H2_SETTINGS,0,0);
+            char b[2] = {0,(char)H2_MAX_CONCURRENT_STREAMS};
+            out.append(b,2);
+            _put_u32_(out,(uint32_t)max_concurrent_streams);
+            b[1] = (char)H2_INITIAL_WINDOW_SIZE;
+            out.append(b,2);
+            _put_u32_(out,(uint32_t)_local_window_());
+            b[1] = (char)H2_MAX_HEADER_LIST_SIZE;
+            out.append(b,2);
+            _put_u32_(out,HTTP2_MAX_HEADER_LIST);
+            if(_local_window_() > conn_recv_window)
+            {
+                _window_update_(0,(uint32_t)(_local_window_() - conn_recv_window));
+                conn_recv_window = _local_window_();
+            }
+        }
+        void _window_update_(uint32_t id,uint32_t increment)
+        {
+            _frame_(4,H2_WINDOW_UPDATE,0,id);
+            _put_u32_(out,increment);
+        }
+        void _rst_(uint32_t id,http2_Error error)
+        {
+            _frame_(4,H2_RST_STREAM,0,id);
+            _put_u32_(out,error);
+            auto it = streams.find(id);
+            if(it == streams.end()) return;
+            _release_(it->second);
+            streams.erase(it);
+        }
+        /**
+          * @brief give body bytes a stream holds back to the connection window
+          * @note called once the body is consumed or the stream is gone,
+          *       so the peer can't have more than one window of bodies buffered here
+          * @param s stream
+          * @retval None
+          */
+        void _release_(stream& s)
+        {
+            conn_refund += s.held;
+            s.held = 0;
+        }
+        /* send WINDOW_UPDATE for connection bytes released while handling frames,one frame per batch */
+        void _flush_refund_()
+        {
+            if(conn_refund == 0) return;
+            _window_update_(0,(uint32_t)conn_refund);
+            conn_recv_window += (int64_t)conn_refund;
+            conn_refund = 0;
+        }
+        /**
+          * @brief connection error : send GOAWAY and close
+          * @note None
+          * @param error error code
+          * @retval false
+          */
+        bool _goaway_(http2_Error error)
+        {
+            _frame_(8,H2_GOAWAY,0,0);
+            _put_u32_(out,last_stream_id);
+            _put_u32_(out,error);
+            _flush_();
+            notify_close();
+            return false;
+        }
+        /**
+          * @brief apply SETTINGS payload of peer
+          * @note None
+          * @param p payload
+          * @param length payload length (multiple of 6)
+          * @retval H2_NO_ERROR or connection error
+          */
+        http2_Error _apply_settings_(const uint8_t* p,size_t length)
+        {
+            for(size_t i = 0;i + 6 <= length;i += 6)
+            {
+                uint16_t id = (uint16_t)((p[i] << 8) | p[i + 1]);
+                uint32_t value = _u32_(p + i + 2);
+                switch(id)
+                {
+                    case H2_HEADER_TABLE_SIZE : {
+                        encoder.set_max_table_size(value);
+                        break;
+                    }
+                    case H2_ENABLE_PUSH : {
+                        if(value > 1) return H2_PROTOCOL_ERROR;
+                        break;
+                    }
+                    case H2_INITIAL_WINDOW_SIZE : {
+                        if(value > HTTP2_MAX_WINDOW) return H2_FLOW_CONTROL_ERROR;
+                        int64_t delta = (int64_t)value - peer_initial_window;
+                        for(auto& p : streams) p.second.send_window += delta;
+                        peer_initial_window = value;
+                        break;
+                    }
+                    case H2_MAX_FRAME_SIZE : {
+                        if(value < HTTP2_DEFAULT_FRAME_SIZE || value > HTTP2_MAX_FRAME_SIZE) return H2_PROTOCOL_ERROR;
+                        peer_max_frame = value;
+                        break;
+                    }
+                    default : break;
+                }
+            }
+            return H2_NO_ERROR;
+        }
+        /**
+          * @brief send DATA of stream as far as flow control windows allow
+          * @note None
+          * @param s stream
+          * @retval whole response sent or not
+          */
+        bool _send_data_(stream& s)
+        {
+            while(s.pending_cursor < s.pending.size())
+            {
+                int64_t window = std::min(conn_send_window,s.send_window);
+                if(window <= 0) return false;
+                size_t n = std::min(std::min(s.pending.size() - s.pending_cursor,(size_t)window),peer_max_frame);
+                bool last = s.pending_cursor + n == s.pending.size();
+                _frame_(n,H2_DATA,last ? H2_END_STREAM : 0,s.id);
+                out.append(s.pending,s.pending_cursor,n);
+                s.pending_cursor += n;
+                conn_send_window -= (int64_t)n;
+                s.send_window -= (int64_t)n;
+                if(out.size() >= HTTP2_FLUSH_SIZE && !_flush_()) return false;
+            }
+            return true;
+        }
+        /**
+          * @brief send pending DATA of all streams,finished streams are closed
+          * @note None
+          * @param None
+          * @retval None
+          */
+        void _send_all_()
+        {
+            for(auto it = streams.begin();it != streams.end();)
+            {
+                if(!it->second.pending.empty() && _send_data_(it->second) && it->second.remote_closed)
+                {
+                    it = streams.erase(it);
+                }
+                else
+                {
+                    it++;
+                }
+            }
+        }
+        /**
+          * @brief convert captured HTTP/1.x response into frames of stream
+          * @note None
+          * @param s stream
+          * @param response captured response
+          * @retval None
+          */
+        void _respond_(stream& s,std::string& response)
+        {
+            size_t head_end = response.find("\r\n\r\n");
+            if(response.size() < 12 || response.compare(0,5,"HTTP/") != 0 || head_end == std::string::npos)
+            {
+                _rst_(s.id,H2_INTERNAL_ERROR);
+                return;
+            }
+            std::string block;
+            encoder.encode(":status",response.substr(9,3),block);
+            size_t line = response.find("\r\n") + 2;
+            while(line < head_end)
+            {
+                size_t eol = response.find("\r\n",line);
+                size_t colon = response.find(':',line);
+                if(colon != std::string::npos && colon < eol)
+                {
+                    std::string name = response.substr(line,colon - line);
+                    for(char& c : name) c = (char)tolower(c);
+                    size_t begin = response.find_first_not_of(' ',colon + 1);
+                    std::string value = begin >= eol ? std::string() : response.substr(begin,eol - begin);
+                    if(!_hop_by_hop_(name)) encoder.encode(name,value,block);
+                }
+                line = eol + 2;
+            }
+            bool has_body = response.size() > head_end + 4 && req_header.method != HEAD;
+            size_t cursor = 0;
+            do
+            {
+                size_t n = std::min(block.size() - cursor,peer_max_frame);
+                uint8_t flags = cursor + n == block.size() ? H2_END_HEADERS : 0;
+                if(cursor == 0 && !has_body) flags |= H2_END_STREAM;
+                _frame_(n,cursor == 0 ? H2_HEADERS : H2_CONTINUATION,flags,s.id);
+                out.append(block,cursor,n);
+                cursor += n;
+            } while(cursor < block.size());
+            if(!has_body)
+            {
+                if(s.remote_closed) streams.erase(s.id);
+                return;
+            }
+            s.pending = std::move(response);
+            s.pending_cursor = head_end + 4;
+            uint32_t id = s.id;
+            if(_send_data_(s) && s.remote_closed) streams.erase(id);
+        }
+        /**
+          * @brief run routers for current request with output captured,then answer on stream
+          * @note None
+          * @param s stream
+          * @retval None
+          */
+        void _serve_(stream& s)
+        {
+            std::string response;
+            keep_alive = true;
+            connection_text.clear();
+            capture = &response;
+            http_conn::process_out();
+            capture = nullptr;
+            _respond_(s,response);
+        }
+        /**
+          * @brief build HTTP/1.x request of stream and serve it
+          * @note None
+          * @param s stream whose request is complete
+          * @retval None
+          */
+        void _dispatch_(stream& s)
+        {
+            std::string method,path,host;
+            std::string text;
+            for(const auto& f : s.fields)
+            {
+                if(f.first == ":method") method = f.second;
+                else if(f.first == ":path") path = f.second;
+                else if(f.first == ":authority") host = f.second;
+            }
+            if(method.empty() || path.empty() || path[0] != '/')
+            {
+                _rst_(s.id,H2_PROTOCOL_ERROR);
+                return;
+            }
+            text = method + " " + path + " HTTP/2.0\r\n";
+            if(!host.empty()) text += "Host: " + host + "\r\n";
+            for(const auto& f : s.fields)
+            {
+                if(f.first.empty() || f.first[0] == ':') continue;
+                text += _canonical_(f.first) + ": " + f.second + "\r\n";
+            }
+            text += "\r\n";
+            clear_in();
+            if(!parse_header(text))
+            {
+                _rst_(s.id,H2_PROTOCOL_ERROR);
+                return;
+            }
+            if(req_header.method == POST) parse_body(s.body);
+            req_body.raw = std::move(s.body);
+            s.fields.clear();
+            s.body.clear();
+            _release_(s);
+            _serve_(s);
+        }
+        /**
+          * @brief answer 413 on a stream whose body went past http2_max_body
+          * @note the 413 ends the stream from our side,if it's already gone RST_STREAM NO_ERROR
+          *       tells the peer to stop sending the rest of the body
+          * @param s stream
+          * @retval None
+          */
+        void _too_large_(stream& s)
+        {
+            uint32_t id = s.id;
+            _release_(s);
+            s.fields.clear();
+            s.body.clear();
+            s.remote_closed = true;
+            clear_in();
+            clear_out();
+            res_header.version = HTTP_1_1;
+            std::string response;
+            keep_alive = true;
+            connection_text.clear();
+            capture = &response;
+            send_status(http_Status::Request_Entity_Too_Large);
+            capture = nullptr;
+            _respond_(s,response);
+            if(streams.find(id) == streams.end())
+            {
+                _frame_(4,H2_RST_STREAM,0,id);
+                _put_u32_(out,H2_NO_ERROR);
+            }
+        }
+        /**
+          * @brief header block is complete,open stream or take trailers
+          * @note None
+          * @param None
+          * @retval success or not (false means connection closed)
+          */
+        bool _on_header_block_()
+        {
+            std::vector<hpack_field> fields;
+            bool ok = decoder.decode((const uint8_t*)header_block.data(),header_block.size(),fields,HTTP2_MAX_HEADER_LIST);
+            uint32_t id = header_stream;
+            bool end = header_flags & H2_END_STREAM;
+            header_block.clear();
+            header_stream = 0;
+            /* the dynamic table is out of step with the peer's after a failed block either way */
+            if(!ok) return _goaway_(decoder.list_too_large() ? H2_ENHANCE_YOUR_CALM : H2_COMPRESSION_ERROR);
+
+            auto it = streams.find(id);
+            if(it != streams.end())
+            {
+                if(it->second.remote_closed || !end)
+                {
+                    _rst_(id,it->second.remote_closed ? H2_STREAM_CLOSED : H2_PROTOCOL_ERROR);
+                    return true;
+                }
+                it->second.remote_closed = true;
+                _dispatch_(it->second);
+                return true;
+            }
+            if(!(id & 1)) return _goaway_(H2_PROTOCOL_ERROR);
+            if(id <= last_stream_id) return _goaway_(H2_STREAM_CLOSED);
+            last_stream_id = id;
+            if(peer_goaway || streams.size() >= (size_t)max_concurrent_streams)
+            {
+                _rst_(id,H2_REFUSED_STREAM);
+                return true;
+            }
+            stream& s = streams[id];
+            s.id = id;
+            s.fields = std::move(fields);
+            s.send_window = peer_initial_window;
+            s.recv_window = _local_window_();
+            s.remote_closed = end;
+            if(end) _dispatch_(s);
+            return true;
+        }
+        /**
+          * @brief strip padding of DATA or HEADERS payload
+          * @note None
+          * @param flags frame flags
+          * @param p payload,moved past pad length
+          * @param length payload length,shrunk to data length
+          * @retval success or not
+          */
+        static bool _unpad_(uint8_t flags,const uint8_t*& p,size_t& length)
+        {
+            if(!(flags & H2_PADDED)) return true;
+            if(length < 1) return false;
+            size_t pad = p[0];
+            p++;
+            length--;
+            if(pad > length) return false;
+            length -= pad;
+            return true;
+        }
+        /**
+          * @brief handle one frame
+          * @note None
+          * @param type frame type
+          * @param flags frame flags
+          * @param id stream id
+          * @param p payload
+          * @param length payload length
+          * @retval success or not (false means connection closed)
+          */
+        bool _on_frame_(uint8_t type,uint8_t flags,uint32_t id,const uint8_t* p,size_t length)
+        {
+            if(header_stream && (type != H2_CONTINUATION || id != header_stream))
+            {
+                return _goaway_(H2_PROTOCOL_ERROR);
+            }
+            switch(type)
+            {
+                case H2_DATA : {
+                    if(id == 0) return _goaway_(H2_PROTOCOL_ERROR);
+                    /* the whole frame counts against both windows,padding included */
+                    size_t frame_length = length;
+                    if((int64_t)frame_length > conn_recv_window) return _goaway_(H2_FLOW_CONTROL_ERROR);
+                    conn_recv_window -= (int64_t)frame_length;
+                    if(!_unpad_(flags,p,length)) return _goaway_(H2_PROTOCOL_ERROR);
+                    auto it = streams.find(id);
+                    if(it == streams.end() || it->second.remote_closed)
+                    {
+                        conn_refund += frame_length;
+                        if(id > last_stream_id) return _goaway_(H2_PROTOCOL_ERROR);
+                        _frame_(4,H2_RST_STREAM,0,id);
+                        _put_u32_(out,H2_STREAM_CLOSED);
+                        return true;
+                    }
+                    stream& s = it->second;
+                    if((int64_t)frame_length > s.recv_window)
+                    {
+                        conn_refund += frame_length;
+                        _rst_(id,H2_FLOW_CONTROL_ERROR);
+                        return true;
+                    }
+                    s.recv_window -= (int64_t)frame_length;
+                    /* padding and bodies past the limit are dropped,their bytes are given back at once */
+                    size_t dropped = frame_length - length;
+                    bool too_large = s.body.size() + length > (size_t)max_body;
+                    if(too_large) dropped = frame_length;
+                    conn_refund += dropped;
+                    if(too_large)
+                    {
+                        _too_large_(s);
+                        return true;
+                    }
+                    if(dropped > 0 && !(flags & H2_END_STREAM))
+                    {
+                        s.recv_window += (int64_t)dropped;
+                        _window_update_(id,(uint32_t)dropped);
+                    }
+                    s.body.append((const char*)p,length);
+                    s.held += length;
+                    if(flags & H2_END_STREAM)
+                    {
+                        s.remote_closed = true;
+                        _dispatch_(s);
+                    }
+                    return true;
+                }
+                case H2_HEADERS : {
+                    if(id == 0) return _goaway_(H2_PROTOCOL_ERROR);
+                    if(!_unpad_(flags,p,length)) return _goaway_(H2_PROTOCOL_ERROR);
+                    if(flags & H2_PRIORITY_FLAG)
+                    {
+                        if(length < 5) return _goaway_(H2_FRAME_SIZE_ERROR);
+                        p += 5;
+                        length -= 5;
+                    }
+                    header_block.assign((const char*)p,length);
+                    header_stream = id;
+                    header_flags = flags;
+                    if(flags & H2_END_HEADERS) return _on_header_block_();
+                    return true;
+                }
+                case H2_CONTINUATION : {
+                    if(!header_stream) return _goaway_(H2_PROTOCOL_ERROR);
+                    header_block.append((const char*)p,length);
+                    if(header_block.size() > HTTP2_MAX_HEADER_BLOCK) return _goaway_(H2_ENHANCE_YOUR_CALM);
+                    if(flags & H2_END_HEADERS) return _on_header_block_();
+                    return true;
+                }
+                case H2_PRIORITY : {
+                    if(id == 0) return _goaway_(H2_PROTOCOL_ERROR);
+                    if(length != 5) return _goaway_(H2_FRAME_SIZE_ERROR);
+                    return true;
+                }
+                case H2_RST_STREAM : {
+                    if(id == 0 || id > last_stream_id) return _goaway_(H2_PROTOCOL_ERROR);
+                    if(length != 4) return _goaway_(H2_FRAME_SIZE_ERROR);
+                    auto it = streams.find(id);
+                    if(it == streams.end()) return true;
+                    _release_(it->second);
+                    streams.erase(it);
+                    return true;
+                }
+                case H2_SETTINGS : {
+                    if(id != 0) return _goaway_(H2_PROTOCOL_ERROR);
+                    if(flags & H2_ACK)
+                    {
+                        if(length != 0) return _goaway_(H2_FRAME_SIZE_ERROR);
+                        return true;
+                    }
+                    if(length % 6 != 0) return _goaway_(H2_FRAME_SIZE_ERROR);
+                    http2_Error error = _apply_settings_(p,length);
+                    if(error != H2_NO_ERROR) return _goaway_(error);
+                    _frame_(0,H2_SETTINGS,H2_ACK,0);
+                    _send_all_();
+                    return true;
+                }
+                case H2_PUSH_PROMISE : {
+                    return _goaway_(H2_PROTOCOL_ERROR);
+                }
+                case H2_PING : {
+                    if(id != 0) return _goaway_(H2_PROTOCOL_ERROR);
+                    if(length != 8) return _goaway_(H2_FRAME_SIZE_ERROR);
+                    if(!(flags & H2_ACK))
+                    {
+                        _frame_(8,H2_PING,H2_ACK,0);
+                        out.append((const char*)p,8);
+                    }
+                    return true;
+                }
+                case H2_GOAWAY : {
+                    if(id != 0) return _goaway_(H2_PROTOCOL_ERROR);
+                    peer_goaway = true;
+                    return true;
+                }
+                case H2_WINDOW_UPDATE : {
+                    if(length != 4) return _goaway_(H2_FRAME_SIZE_ERROR);
+                    uint32_t increment = _u32_(p) & 0x7fffffff;
+                    if(id == 0)
+                    {
+                        if(increment == 0) return _goaway_(H2_PROTOCOL_ERROR);
+                        conn_send_window += increment;
+                        if(conn_send_window > HTTP2_MAX_WINDOW) return _goaway_(H2_FLOW_CONTROL_ERROR);
+                        _send_all_();
+                        return true;
+                    }
+                    auto it = streams.find(id);
+                    if(it == streams.end()) return true;
+                    if(increment == 0)
+                    {
+                        _rst_(id,H2_PROTOCOL_ERROR);
+                        return true;
+                    }
+                    it->second.send_window += increment;
+                    if(it->second.send_window > HTTP2_MAX_WINDOW)
+                    {
+                        _rst_(id,H2_FLOW_CONTROL_ERROR);
+                        return true;
+                    }
+                    if(!it->second.pending.empty() && _send_data_(it->second) && it->second.remote_closed)
+                    {
+                        streams.erase(it);
+                    }
+                    return true;
+                }
+                default : return true;
+            }
+        }
+        /**
+          * @brief handle all complete frames in receive buffer
+          * @note None
+          * @param None
+          * @retval success or not
+          */
+        bool _on_frames_()
+        {
+            size_t cursor = 0;
+            while(in.size() - cursor >= HTTP2_FRAME_HEADER_SIZE)
+            {
+                auto* h = (const uint8_t*)in.data() + cursor;
+                size_t length = ((size_t)h[0] << 16) | ((size_t)h[1] << 8) | h[2];
+                if(length > HTTP2_DEFAULT_FRAME_SIZE) return _goaway_(H2_FRAME_SIZE_ERROR);
+                if(in.size() - cursor < HTTP2_FRAME_HEADER_SIZE + length) break;
+                uint32_t id = _u32_(h + 5) & 0x7fffffff;
+                if(!_on_frame_(h[3],h[4],id,h + HTTP2_FRAME_HEADER_SIZE,length)) return false;
+                cursor += HTTP2_FRAME_HEADER_SIZE + length;
+            }
+            in.erase(0,cursor);
+            _flush_refund_();
+            return true;
+        }
+        /**
+          * @brief answer "Upgrade: h2c" request with 101 and serve it as stream 1
+          * @note invalid HTTP2-Settings keeps the connection on HTTP/1.1
+          * @param None
+          * @retval success or not
+          */
+        bool _upgrade_()
+        {
+            const std::vector<std::string>* values = header_values("HTTP2-Settings");
+            std::string settings;
+            if(!values || values->size() != 1
+            || !_base64url_decode_((*values)[0],settings) || settings.size() % 6 != 0)
+            {
+                return http_conn::process_out();
+            }
+            static const char switching[] = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+            out.append(switching,sizeof(switching) - 1);
+            _start_();
+            mode = PREFACE;
+            _send_settings_();
+            http2_Error error = _apply_settings_((const uint8_t*)settings.data(),settings.size());
+            if(error != H2_NO_ERROR) return _goaway_(error);
+            last_stream_id = 1;
+            stream& s = streams[1];
+            s.id = 1;
+            s.send_window = peer_initial_window;
+            s.remote_closed = true;
+            _serve_(s);
+            if(!_flush_()) return false;
+            busy = !streams.empty() || !out.empty();
+            next(EPOLLIN);
+            return true;
+        }
+        /**
+          * @brief switch connection to HTTP/2
+          * @note frames are small and answered by WINDOW_UPDATE,so Nagle is turned off
+          * @param None
+          * @retval None
+          */
+        void _start_()
+        {
+            mode = HTTP2;
+            int opt = 1;
+            setsockopt(socket_fd,IPPROTO_TCP,TCP_NODELAY,&opt,sizeof(opt));
+        }
+        bool _wants_upgrade_()
+        {
+            return header_has_token("Upgrade","h2c") && header_has_token("Connection","HTTP2-Settings");
+        }
+    public:
+        static int max_concurrent_streams;
+        static int max_body;
+
+        void init(int _socket_fd,sockaddr_in* _addr,int _epoll_fd,bool et,bool _one_shot,lock_queue<int>* cq = nullptr,bool add = true) override
+        {
+            http_conn::init(_socket_fd,_addr,_epoll_fd,et,_one_shot,cq,add);
+            mode = HTTP1;
+            in.clear();
+            out.clear();
+            streams.clear();
+            decoder = hpack_decoder();
+            encoder = hpack_encoder();
+            header_block.clear();
+            header_stream = 0;
+            last_stream_id = 0;
+            conn_send_window = HTTP2_DEFAULT_WINDOW;
+            conn_recv_window = HTTP2_DEFAULT_WINDOW;
+            conn_refund = 0;
+            peer_initial_window = HTTP2_DEFAULT_WINDOW;
+            peer_max_frame = HTTP2_DEFAULT_FRAME_SIZE;
+            peer_goaway = false;
+        }
+        bool process_in() override
+        {
+            std::string data;
+            if(!recv_all(data))
+            {
+                notify_close();
+                return false;
+            }
+            in += data;
+            if(mode == HTTP1)
+            {
+                size_t n = std::min(in.size(),(size_t)HTTP2_PREFACE_SIZE);
+                if(!input.empty() || in.compare(0,n,HTTP2_PREFACE,n) != 0)
+                {
+                    input += in;
+                    in.clear();
+                    return process_request();
+                }
+                if(in.empty() || in.size() < HTTP2_PREFACE_SIZE) { next(EPOLLIN); return true; }
+                in.erase(0,HTTP2_PREFACE_SIZE);
+                _start_();
+                _send_settings_();
+            }
+            else if(mode == PREFACE)
+            {
+                size_t n = std::min(in.size(),(size_t)HTTP2_PREFACE_SIZE);
+                if(in.compare(0,n,HTTP2_PREFACE,n) != 0) return _goaway_(H2_PROTOCOL_ERROR);
+                if(in.size() < HTTP2_PREFACE_SIZE) { next(EPOLLIN); return true; }
+                in.erase(0,HTTP2_PREFACE_SIZE);
+                mode = HTTP2;
+            }
+            if(!_on_frames_()) return false;
+            if(!_flush_()) return false;
+            busy = !streams.empty() || !out.empty();
+            if(peer_goaway && streams.empty())
+            {
+                notify_close();
+                return true;
+            }
+            next(EPOLLIN);
+            return true;
+        }
+        bool process_out() override
+        {
+            if(mode == HTTP1 && _wants_upgrade_()) return _upgrade_();
+            return http_conn::process_out();
+        }
+    };
+    int http2_conn::max_concurrent_streams = configure::get_config()["http2_max_streams"].type == JSON_NULL ?
+                                             128 : (int32_t)configure::get_config()["http2_max_streams"];
+    int http2_conn::max_body = configure::get_config()["http2_max_body"].type == JSON_NULL ?
+                               16777216 : (int32_t)configure::get_config()["http2_max_body"];
+
+    class conv_http2_multi : conv_multi<http2_conn>
+    {
+    public:
+        void wait(int time_out=5) override
+        {
+            LOG_INFO("running at: http://127.0.0.1:" + std::to_string(port) + " (HTTP/1.1 and h2c)");
+            http_conn::build_routers();
+            conv_multi<http2_conn>::wait(time_out);
+        }
+    };
+
+    class conv_http2_single : conv_single<http2_conn>
+    {
+    public:
+        void wait(int time_out=5) override
+        {
+            LOG_INFO("running at: http://127.0.0.1:" + std::to_string(port) + " (HTTP/1.1 and h2c)");
+            http_conn::build_routers();
+            conv_single<http2_conn>::wait(time_out);
+        }
+    };
+}
+
+#endif
@@ -4,13 +4,21 @@
 #include "core/include/conn.h"  /* conn */
 #include "core/conv_single.h"   /* conv_single*/
 #include "core/conv_multi.h"    /* conv_multi */
+#include "core/include/admission.h" /* admission */
+#include "core/include/metrics.h"   /* metrics */
+#include "http/file_cache.h"    /* file_cache */
+#include "http/gzip_cache.h"    /* gzip_cache */
+#include "http/router_tree.h"   /* router_tree */
+#include <mutex>                /* once_flag */
 #include <sys/stat.h>           /* fstat */
-#include <exception>            /* exception */
 #include <sys/sendfile.h>       /* sendfile */
+#include <strings.h>            /* strncasecmp */
 #include <memory>               /* shared_ptr */
 #include <utility>              /* types */
 
 namespace hzd {
+    /* bytes a request line and its headers may take */
+    #define HTTP_MAX_HEADER_SIZE (64 * 1024)
     enum http_Methods {  GET, POST, PUT, PATCH, DELETE, TRACE, HEAD, OPTIONS, CONNECT    };
     /* region http_method_map */
     const std::unordered_map<http_Methods, std::string> http_method_map
@@ -86,7 +94,12 @@ namespace hzd {
         Too_Early = 425,
         Upgrade_Required = 426,
         Retry_With = 449,
-        Unavailable_For_Legal_Reasons = 451
+        Unavailable_For_Legal_Reasons = 451,
+        Internal_Server_Error = 500,
+        Not_Implemented = 501,
+        Bad_Gateway = 502,
+        Service_Unavailable = 503,
+        Gateway_Timeout = 504
     };
     /* region http_status_map */
     const std::unordered_map<http_Status, std::string> http_status_map
@@ -136,9 +149,79 @@ namespace hzd {
                     {http_Status::Too_Early,                       "Too Early"},
                     {http_Status::Upgrade_Required,                "Upgrade Required"},
                     {http_Status::Retry_With,                      "Retry With"},
-                    {http_Status::Unavailable_For_Legal_Reasons,   "Unavailable For Legal Reasons"}
+                    {http_Status::Unavailable_For_Legal_Reasons,   "Unavailable For Legal Reasons"},
+                    {http_Status::Internal_Server_Error,           "Internal Server Error"},
+                    {http_Status::Not_Implemented,                 "Not Implemented"},
+                    {http_Status::Bad_Gateway,                     "Bad Gateway"},
+                    {http_Status::Service_Unavailable,             "Service Unavailable"},
+                    {http_Status::Gateway_Timeout,                 "Gateway Timeout"}
             };
     /* endregion */
+    /* region http_status_text */
+    /**
+      * @brief reason phrase of status code
+      * @note switch table,folded by compiler for constant status
+      * @param status http status
+      * @retval reason phrase
+      */
+    inline const char* http_status_text(http_Status status)
+    {
+        switch(status)
+        {
+            case http_Status::Continue : return "Continue";
+            case http_Status::Switching_Protocols : return "Switching Protocols";
+            case http_Status::Processing : return "Processing";
+            case http_Status::OK : return "OK";
+            case http_Status::Created : return "Created";
+            case http_Status::Accepted : return "Accepted";
+            case http_Status::Non_Authoritative_information : return "Non-Authoritative Information";
+            case http_Status::No_Content : return "No Content";
+            case http_Status::Reset_Content : return "Reset Content";
+            case http_Status::Partial_Content : return "Partial Content";
+            case http_Status::Multi_Status : return "Multi-Status";
+            case http_Status::Multiple_Choice : return "Multiple Choices";
+            case http_Status::Moved_Permanently : return "Moved Permanently";
+            case http_Status::Move_Temporarily : return "Moved Temporarily";
+            case http_Status::See_Other : return "See Other";
+            case http_Status::Not_Modified : return "Not Modified";
+            case http_Status::Use_Proxy : return "Use Proxy";
+            case http_Status::Switch_Proxy : return "Switch Proxy";
+            case http_Status::Temporary_Redirect : return "Temporary Redirect";
+            case http_Status::Bad_Request : return "Bad Request";
+            case http_Status::Unauthorized : return "Unauthorized";
+            case http_Status::Payment_Required : return "Payment Required";
+            case http_Status::Forbidden : return "Forbidden";
+            case http_Status::Not_Found : return "Not Found";
+            case http_Status::Method_Not_Allowed : return "Method Not Allowed";
+            case http_Status::Not_Acceptable : return "Not Acceptable";
+            case http_Status::Proxy_Authentication_Required : return "Proxy Authentication Required";
+            case http_Status::Request_Timeout : return "Request Timeout";
+            case http_Status::Conflict : return "Conflict";
+            case http_Status::Gone : return "Gone";
+            case http_Status::Length_Required : return "Length Required";
+            case http_Status::Precondition_Failed : return "Precondition Failed";
+            case http_Status::Request_Entity_Too_Large : return "Request Entity Too Large";
+            case http_Status::Request_URI_Too_Long : return "Request-URI Too Long";
+            case http_Status::Unsupported_Media_Type : return "Unsupported Media Type";
+            case http_Status::Requested_Range_Not_Satisfiable : return "Requested Range Not Satisfiable";
+            case http_Status::Expectation_Failed : return "Expectation Failed";
+            case http_Status::I_Am_A_Teapot : return "I'm a teapot";
+            case http_Status::Misdirected_Request : return "Misdirected Request";
+            case http_Status::Unprocessable_Entity : return "Unprocessable Entity";
+            case http_Status::Locked : return "Locked";
+            case http_Status::Too_Early : return "Too Early";
+            case http_Status::Upgrade_Required : return "Upgrade Required";
+            case http_Status::Retry_With : return "Retry With";
+            case http_Status::Unavailable_For_Legal_Reasons : return "Unavailable For Legal Reasons";
+            case http_Status::Internal_Server_Error : return "Internal Server Error";
+            case http_Status::Not_Implemented : return "Not Implemented";
+            case http_Status::Bad_Gateway : return "Bad Gateway";
+            case http_Status::Service_Unavailable : return "Service Unavailable";
+            case http_Status::Gateway_Timeout : return "Gateway Timeout";
+        }
+        return "Unknown";
+    }
+    /* endregion */
     enum class http_Header {
         Accept,
         AcceptCharset,
@@ -414,6 +497,45 @@ namespace hzd {
                     {HTTP_2_0,"HTTP/2.0"},
             };
     /* endregion */
+    /* region http_version_text */
+    constexpr const char* http_version_text[] = { "HTTP/1.0 ","HTTP/1.1 ","HTTP/2.0 " };
+    /* endregion */
+    /**
+      * @brief append status line like "HTTP/1.1 200 OK\r\n"
+      * @note None
+      * @param out output buffer
+      * @param version http version
+      * @param status http status
+      * @retval None
+      */
+    inline void append_status_line(std::string& out,http_Version version,http_Status status)
+    {
+        auto code = (int32_t)status;
+        const char digits[4] = { char('0' + code / 100),char('0' + code / 10 % 10),char('0' + code % 10),' ' };
+        out.append(http_version_text[version],9);
+        out.append(digits,4);
+        out.append(http_status_text(status));
+        out.append("\r\n",2);
+    }
+    /**
+      * @brief "Date:...\r\n" line of current second
+      * @note formatted at most once per second per thread
+      * @param None
+      * @retval date header line
+      */
+    inline const std::string& http_date_line()
+    {
+        thread_local time_t last{0};
+        thread_local std::string line;
+        timespec ts{};
+        clock_gettime(CLOCK_REALTIME_COARSE,&ts);
+        if(ts.tv_sec != last || line.empty())
+        {
+            last = ts.tv_sec;
+            line = "Date:" + file_cache::http_date(last) + "\r\n";
+        }
+        return line;
+    }
     /* region http_content_type_map */
     std::unordered_map<std::string,std::string> http_content_type_map
             {
@@ -526,20 +648,40 @@ namespace hzd {
                     {"avi", "video/x-msvideo"},
             };
     /* endregion */
+
+    /**
+      * @brief work a suspended request continues with,e.g. a proxied response
+      * @note while a conn has a relay,EPOLLOUT goes to resume() instead of routing a new request.
+      *       detach() is called when the conn closes first
+      */
+    class http_relay {
+    public:
+        virtual ~http_relay() = default;
+        virtual bool resume() = 0;
+        virtual void detach() = 0;
+    };
+
+    class http_proxy_session;
     class http_conn : public conn {
+        friend class http_proxy_session;
     public:
         struct request_header
         {
             http_Methods method;
             std::string url;
+            std::string query;
             http_Version version;
             std::unordered_map<std::string,std::string> parameters;
             std::unordered_map<std::string,std::vector<std::string>> request_headers;
+            route_param route_params[ROUTER_TREE_MAX_PARAMS];
+            size_t route_param_count{0};
             void clear()
             {
                 url.clear();
+                query.clear();
                 parameters.clear();
                 request_headers.clear();
+                route_param_count = 0;
             }
         } req_header;
 
@@ -548,8 +690,11 @@ namespace hzd {
             std::unordered_map<std::string,std::vector<std::string>> request_body_headers;
             std::unordered_map<std::string,std::string> form;
             std::unordered_map<std::string,std::pair<std::string,std::string>> files;
+            /* raw body as received,kept for forwarding */
+            std::string raw;
             void clear()
             {
+                raw.clear();
                 boundary.clear();
                 request_body_headers.clear();
                 form.clear();
@@ -562,21 +707,90 @@ namespace hzd {
             http_Version version;
             http_Status status;
             std::unordered_map<std::string,std::string> response_headers;
+            std::string header_lines;
             std::string header_text;
-            std::string to_string()
+            /**
+              * @brief append header line without hashing
+              * @note None
+              * @param name header name
+              * @param value header value
+              * @retval None
+              */
+            template<size_t N>
+            void append(const char (&name)[N],const std::string& value)
+            {
+                header_lines.append(name,N - 1);
+                header_lines += ':';
+                header_lines += value;
+                header_lines.append("\r\n",2);
+            }
+            template<size_t N>
+            void append(const char (&name)[N],size_t value)
+            {
+                char digits[24];
+                char* p = digits + sizeof(digits);
+                do { *--p = char('0' + value % 10); value /= 10; } while(value);
+                header_lines.append(name,N - 1);
+                header_lines += ':';
+                header_lines.append(p,digits + sizeof(digits) - p);
+                header_lines.append("\r\n",2);
+            }
+            /**
+              * @brief whether a header line of this name was written already
+              * @note names compare case insensitively,Date is always written by serialize()
+              * @param name header name
+              * @retval written or not
+              */
+            bool written(const std::string& name) const
+            {
+                if(strcasecmp(name.c_str(),"Date") == 0) return true;
+                size_t pos = 0;
+                while(pos < header_lines.size())
+                {
+                    if(header_lines.size() - pos > name.size()
+                    && header_lines[pos + name.size()] == ':'
+                    && strncasecmp(header_lines.data() + pos,name.data(),name.size()) == 0)
+                    {
+                        return true;
+                    }
+                    pos = header_lines.find("\r\n",pos);
+                    if(pos == std::string::npos) break;
+                    pos += 2;
+                }
+                return false;
+            }
+            /**
+              * @brief build header text into the reused buffer
+              * @note entries of response_headers already written by append() are skipped,
+              *       so a response never carries two Content-Length or Location lines
+              * @param None
+              * @retval header text
+              */
+            const std::string& serialize()
             {
-                std::ostringstream buffer;
-                buffer << http_version_map.at(version) << " " << std::to_string((int32_t)status) << " " << http_status_map.at(status) << "\r\n";
+                header_text.clear();
+                append_status_line(header_text,version,status);
+                header_text += http_date_line();
+                header_text += header_lines;
                 for(const auto & p : response_headers)
                 {
-                    buffer << p.first << ":" << p.second << "\r\n";
+                    if(written(p.first)) continue;
+                    header_text += p.first;
+                    header_text += ':';
+                    header_text += p.second;
+                    header_text.append("\r\n",2);
                 }
-                buffer << "\r\n";
-                return buffer.str();
+                header_text.append("\r\n",2);
+                return header_text;
+            }
+            std::string to_string()
+            {
+                return serialize();
             }
             void clear()
             {
                 response_headers.clear();
+                header_lines.clear();
                 header_text.clear();
             }
         } res_header;
@@ -587,12 +801,16 @@ namespace hzd {
             std::string body_text;
             int file_fd;
             struct stat file_stat{};
+            std::shared_ptr<file_cache::entry> cached;
+            std::shared_ptr<gzip_cache::record> encoded;
             void clear()
             {
                 file_name.clear();
                 body_text.clear();
                 file_stat = {};
                 file_fd = -1;
+                cached.reset();
+                encoded.reset();
             }
         } res_body;
 
@@ -624,57 +842,102 @@ namespace hzd {
         bool redirect(std::string url)
         {
             res_header.status = http_Status::See_Other;
-            res_header.response_headers["Location"] = std::move(url);
+            res_header.append("Location",url);
             if(!send_response_header()) {return false;}
-            http_1_0_close();
+            keep_alive_or_close();
             return true;
         }
         bool render(std::string file_path)
         {
             req_header.url = std::move(file_path);
-            load_file();
-            if(!send_response_header()) { return false; }
-            write_total_bytes = res_body.file_stat.st_size;
-            write_cursor = 0;
-            if(!send_response_body()) { return false; }
-            http_1_0_close();
-            return true;
+            return send_static();
         }
         bool forward(const std::string&  url,http_Methods method = GET){
+            filter* f = nullptr;
+            router* r = route(url,&f);
+            if(!r) return send_status(http_Status::Not_Found);
             switch(method)
             {
                 case GET : {
-                    return routers[url]->method_get(this);
+                    return r->method_get(this);
                 }
                 case POST : {
-                    return routers[url]->method_post(this);
+                    return r->method_post(this);
                 }
                 case PUT : {
-                    return routers[url]->method_put(this);
+                    return r->method_put(this);
                 }
                 case PATCH : {
-                    return routers[url]->method_patch(this);
+                    return r->method_patch(this);
                 }
                 case DELETE : {
-                    return routers[url]->method_delete(this);
+                    return r->method_delete(this);
                 }
                 case TRACE : {
-                    return routers[url]->method_trace(this);
+                    return r->method_trace(this);
                 }
                 case HEAD : {
-                    return routers[url]->method_head(this);
+                    return r->method_head(this);
                 }
                 case OPTIONS : {
-                    return routers[url]->method_options(this);
+                    return r->method_options(this);
                 }
                 case CONNECT : {
-                    return routers[url]->method_connect(this);
+                    return r->method_connect(this);
+                }
+            }
+            return false;
+        }
+        /**
+          * @brief get path parameter captured by router pattern
+          * @note ":id" in "/user/:id" is got by path_param("id")
+          * @param name parameter name
+          * @retval parameter value or empty string
+          */
+        std::string path_param(const std::string& name) const
+        {
+            for(size_t i = 0;i < req_header.route_param_count;i++)
+            {
+                const route_param& p = req_header.route_params[i];
+                if(name.size() == p.name_size && name.compare(0,p.name_size,p.name,p.name_size) == 0)
+                {
+                    return {p.value,p.value_size};
                 }
             }
+            return {};
+        }
+        void init(int _socket_fd,sockaddr_in* _addr,int _epoll_fd,bool et,bool _one_shot,lock_queue<int>* cq = nullptr,bool add = true) override
+        {
+            conn::init(_socket_fd,_addr,_epoll_fd,et,_one_shot,cq,add);
+            request_count = 0;
+            request_begin = 0;
+            keep_alive = true;
+            busy = false;
+            connection_text.clear();
+            input.clear();
+            head_size = 0;
+            body_size = 0;
+            has_body = false;
+            peer_closed = false;
+            idle_timeout = keep_alive_timeout;
+            relay.reset();
+        }
+        void close() override
+        {
+            if(relay)
+            {
+                relay->detach();
+                relay.reset();
+            }
+            conn::close();
+        }
+        bool in_flight() const override
+        {
+            return busy || conn::in_flight();
         }
         bool send_str(const std::string& str,const std::string& type = "text/html"){
-            res_header.response_headers["Content-Length"] = std::to_string(str.size());
-            res_header.response_headers["Content-Type"] = type;
+            res_header.append("Content-Length",str.size());
+            res_header.append("Content-Type",type);
             res_header.status = http_Status::OK;
 
             if(!send_response_header()) return false;
@@ -686,7 +949,7 @@ namespace hzd {
                 notify_close();
                 return false;
             }
-            http_1_0_close();
+            keep_alive_or_close();
             return true;
         }
 
@@ -694,17 +957,6 @@ namespace hzd {
         class filter{
             std::vector<http_Methods> _not_allow_;
         public:
-            struct node
-            {
-                std::unordered_map<std::string,std::shared_ptr<node>> children;
-                filter* _filter;
-
-                node()
-                {
-                    _filter = nullptr;
-                }
-            };
-
             std::string url;
             explicit filter(std::string&& _url,std::vector<http_Methods>&& not_allow = {})
             {
@@ -720,111 +972,214 @@ namespace hzd {
 
         static void register_router(router* r) {
             if(!r) return;
+            if(routes_built)
+            {
+                LOG_ERROR("router " + r->url + " registered after routers were built,ignored");
+                return;
+            }
             routers[r->url] = r;
         }
+        /**
+          * @brief add function run once right before routers are built
+          * @note used by modules creating routers from configuration
+          * @param loader loader
+          * @retval None
+          */
+        static void register_loader(void (*loader)())
+        {
+            if(!loader) return;
+            if(routes_built)
+            {
+                LOG_ERROR("loader registered after routers were built,ignored");
+                return;
+            }
+            loaders.push_back(loader);
+        }
+        /**
+          * @brief freeze registered routers and filters into router tree
+          * @note called once before serving,later calls do nothing.routers,filters and loaders
+          *       registered after it are refused with an error,the tree is read without locks.
+          *       a filter url ending with '*' covers its directory and everything below it,
+          *       any other filter url covers itself and everything below it
+          * @param None
+          * @retval None
+          */
+        static void build_routers()
+        {
+            std::call_once(routes_once,[]{
+                for(auto loader : loaders) loader();
+                for(const auto& p : routers) routes.insert(p.first,p.second);
+                for(filter* f : filters)
+                {
+                    size_t size = f->url.size();
+                    if(f->url[size-1] == '*') size -= 2;
+                    routes.insert_filter(f->url.substr(0,size),f);
+                }
+                routes.build();
+                routes_built = true;
+            });
+        }
         static void register_filter(filter* f)
         {
             if(!f) return;
+            if(routes_built)
+            {
+                LOG_ERROR("filter " + f->url + " registered after routers were built,ignored");
+                return;
+            }
             _register_filter(std::forward<filter*>(f));
         }
     protected:
 
         const static std::string base_path;
+        /* reloaded with the config,new values apply to the next requests */
+        static std::atomic<int> keep_alive_timeout;
+        static std::atomic<int> keep_alive_max;
+        static bool reload_hooked;
+        static file_cache* cache;
+        static gzip_cache* gzip;
 
         static std::unordered_map<std::string,router*> routers;
-        static std::unordered_map<std::string,std::shared_ptr<filter::node>> filters;
+        static router_tree<router,filter> routes;
+        static std::once_flag routes_once;
+        static std::atomic<bool> routes_built;
+        static std::vector<filter*> filters;
+        static std::vector<void (*)()> loaders;
+
+        /* keep-alive state,decided once per request after the header is parsed */
+        size_t request_count{0};
+        bool keep_alive{true};
+        std::string connection_text;
+        /* a request was read and its response is not completely sent yet */
+        std::atomic<bool> busy{false};
+        /* clock_us() the request being answered was parsed at,0 when none */
+        int64_t request_begin{0};
+
+        /* received bytes no request has taken yet,and how the request being received splits them */
+        std::string input;
+        size_t head_size{0};
+        size_t body_size{0};
+        bool has_body{false};
+        bool peer_closed{false};
+        static int max_request_body;
+
+        /* suspended request,set while e.g. a proxied response is relayed */
+        std::shared_ptr<http_relay> relay;
+
+        /* router and filter of current request,found by one lookup in process_out */
+        router* matched_router{nullptr};
+        filter* matched_filter{nullptr};
+
+        /**
+          * @brief find router and filter of url,path parameters are saved in req_header
+          * @note never allocates or throws
+          * @param url url
+          * @param f output filter or nullptr
+          * @retval router or nullptr
+          */
+        router* route(const std::string& url,filter** f)
+        {
+            build_routers();
+            return routes.find(url.data(),url.size(),req_header.route_params,req_header.route_param_count,f);
+        }
 
         static void _register_filter(filter* f)
         {
             if(f->url.size() < 2 || f->url[0] != '/' || f->url[f->url.size()-1] == '/') {
                 return;
             }
-            auto cur = filters["/"];
-            if(f->url[1] == '*')
-            {
-                cur->_filter = f;
-                return;
-            }
-            size_t pre = 1;
-            size_t pos = f->url.find('/',pre);
-            std::string sub_str;
-            while(pos != std::string::npos)
-            {
-                sub_str = f->url.substr(pre,pos-pre);
-                cur->children[sub_str] = std::make_shared<filter::node>();
-                cur = cur->children[sub_str];
-                pre = pos+1;
-                pos = f->url.find('/',pre);
-            }
-            sub_str = f->url.substr(pre);
-            if(sub_str == "*")
-            {
-                cur->_filter = f;
+            size_t star = f->url.find('*');
+            if(star != std::string::npos && (star != f->url.size()-1 || f->url[star-1] != '/')) {
+                LOG_WARN("filter url " + f->url + " ignored,'*' is only allowed as last segment");
                 return;
             }
-            cur->children[sub_str] = std::make_shared<filter::node>();
-            cur = cur->children[sub_str];
-            cur->_filter = f;
+            filters.push_back(f);
         }
 
-        static filter* match(const std::string& url)
-        {
-            if(url.empty()) return nullptr;
-            if(url[0] != '/') return nullptr;
-            if(url[1] == '*') return filters["/"]->_filter;
-            auto cur = filters["/"];
-            filter* tmp = cur->_filter;
-            size_t pre = 1;
-            size_t pos = url.find('/',pre);
-            std::string sub_str;
-            while(pos != std::string::npos && pos < url.size()-1)
-            {
-                sub_str = url.substr(pre,pos-pre);
-                if(cur->children.find(sub_str) == cur->children.end())
+        static file_cache* _create_file_cache_()
+        {
+            configure& conf = configure::get_config();
+            if(conf["file_cache"].type == JSON_NULL || !conf["file_cache"]) return nullptr;
+            return new file_cache(
+                    conf["file_cache_size"].type == JSON_NULL ? 4096 : (int32_t)conf["file_cache_size"],
+                    conf["file_cache_memory"].type == JSON_NULL ? 64 * 1024 * 1024 : (int32_t)conf["file_cache_memory"],
+                    conf["file_cache_small_file"].type == JSON_NULL ? 64 * 1024 : (int32_t)conf["file_cache_small_file"]
+                    );
+        }
+        static gzip_cache* _create_gzip_cache_()
+        {
+            configure& conf = configure::get_config();
+            if(conf["gzip"].type == JSON_NULL || !conf["gzip"]) return nullptr;
+            return new gzip_cache(
+                    conf["gzip_cache_memory"].type == JSON_NULL ? 32 * 1024 * 1024 : (int32_t)conf["gzip_cache_memory"],
+                    conf["gzip_max_size"].type == JSON_NULL ? 1024 * 1024 : (int32_t)conf["gzip_max_size"],
+                    conf["gzip_level"].type == JSON_NULL ? 6 : (int32_t)conf["gzip_level"]
+                    );
+        }
+        static std::string content_type_of(const std::string& file_name)
+        {
+            size_t dot = file_name.find_last_of('.');
+            if(dot == std::string::npos) return http_content_type_map["txt"];
+            auto it = http_content_type_map.find(file_name.substr(dot+1));
+            if(it == http_content_type_map.end()) return "application/octet-stream";
+            return it->second;
+        }
+        static const std::string& ok_status_line(http_Version version)
+        {
+            static const std::string lines[] = {
+                    std::string(http_version_text[HTTP_1_0]) + "200 OK\r\n",
+                    std::string(http_version_text[HTTP_1_1]) + "200 OK\r\n",
+                    std::string(http_version_text[HTTP_2_0]) + "200 OK\r\n",
+            };
+            return lines[version];
+        }
+    protected:
+        bool send_file_base(int file_fd)
+        {
+            if(capture)
+            {
+                size_t base = capture->size();
+                capture->resize(base + write_total_bytes - write_cursor);
+                while(write_cursor < write_total_bytes)
                 {
-                    return tmp;
+                    ssize_t n = pread(file_fd,&(*capture)[base],write_total_bytes - write_cursor,(off_t)write_cursor);
+                    if(n <= 0)
+                    {
+                        capture->resize(base);
+                        return false;
+                    }
+                    base += n;
+                    write_cursor += n;
                 }
-                cur = cur->children[sub_str];
-                tmp = cur->_filter;
-                pre = pos+1;
-                pos = url.find('/',pre);
-            }
-            if(pos == url.size()-1)
-            {
-                sub_str = url.substr(pre,pos-pre-1);
+                return true;
             }
-            else sub_str = url.substr(pre);
-            if(cur->children.find(sub_str) == cur->children.end())
+            while(write_cursor < write_total_bytes)
             {
-                return tmp;
+                auto offset = (off_t)write_cursor;
+                ssize_t send_count = sendfile(socket_fd,file_fd,&offset,write_total_bytes-write_cursor);
+                if(send_count <= 0)
+                {
+                    return false;
+                }
+                metrics::count(M_BYTES_OUT,send_count);
+                write_cursor += send_count;
             }
-            cur = cur->children[sub_str];
-            tmp = cur->_filter;
-            return tmp;
+            return true;
         }
-
-
-    private:
         bool send_response_body_base()
         {
             signal(SIGPIPE,SIG_IGN);
             if(res_body.file_fd != -1)
             {
-                while(write_cursor < write_total_bytes)
+                if(!send_file_base(res_body.file_fd))
                 {
-                    auto offset = (off_t)write_cursor;
-                    size_t send_count = sendfile(socket_fd,res_body.file_fd,&offset,write_total_bytes-write_cursor);
-                    if(send_count == -1)
+                    if(errno == EAGAIN)
                     {
-                        if(errno == EAGAIN)
-                        {
-                            return false;
-                        }
-                        ::close(res_body.file_fd);
-                        res_body.file_fd = -1;
                         return false;
                     }
-                    write_cursor += send_count;
+                    ::close(res_body.file_fd);
+                    res_body.file_fd = -1;
+                    return false;
                 }
                 ::close(res_body.file_fd);
                 res_body.file_fd = -1;
@@ -839,52 +1194,52 @@ namespace hzd {
         }
         bool parse_header(const std::string& data)
         {
+            /* "METHOD url VERSION\r\n",anything else is a bad request */
             size_t request_line_pos = data.find("\r\n");
+            if(request_line_pos == std::string::npos) return false;
             size_t p1 = data.find(' ');
-            if(p1 != std::string::npos)
+            if(p1 == std::string::npos || p1 >= request_line_pos) return false;
+            size_t p2 = data.find(' ',p1+1);
+            if(p2 == std::string::npos || p2 >= request_line_pos || p2 == p1 + 1) return false;
             {
-                std::string m = data.substr(0,p1);
-                try
+                auto method = http_method_map_string_to_method.find(data.substr(0,p1));
+                if(method == http_method_map_string_to_method.end())
                 {
-                    req_header.method = http_method_map_string_to_method.at(m);
-                    size_t p2 = data.find(' ',p1+1);
-                    if(p2 != std::string::npos)
+                    return false;
+                }
+                req_header.method = method->second;
+                {
+                    std::string url = data.substr(p1 + 1,p2 - p1 -1);
+                    size_t start = url.find('?');
+                    if(start == std::string::npos)
                     {
-                        std::string url = data.substr(p1 + 1,p2 - p1 -1);
-                        size_t start = url.find('?');
-                        if(start == std::string::npos)
-                        {
-                            req_header.url = url;
-                        }
-                        else
-                        {
-                            req_header.url = url.substr(0,start);
-                            start += 1;
-                            size_t end = start;
-                            while(end != std::string::npos)
-                            {
-                                end = url.find_first_of("&=",start);
-                                std::string key = url.substr(start,end-start);
-                                start = end + 1;
-                                end = url.find_first_of('&',start);
-                                std::string value = url.substr(start,end-start);
-                                req_header.parameters.emplace(std::move(key),std::move(value));
-                                start = end + 1;
-                            }
-                        }
-                        std::string v = data.substr(p2+1,request_line_pos-p2-1);
-                        if(v == "HTTP/1.0") req_header.version = HTTP_1_0;
-                        else if(v == "HTTP/1.1") req_header.version = HTTP_1_1;
-                        else if(v == "HTTP/2.0") req_header.version = HTTP_2_0;
-                        else
+                        req_header.url = url;
+                    }
+                    else
+                    {
+                        req_header.url = url.substr(0,start);
+                        start += 1;
+                        req_header.query = url.substr(start);
+                        while(start < url.size())
                         {
-                            throw std::exception();
+                            size_t end = url.find('&',start);
+                            if(end == std::string::npos) end = url.size();
+                            size_t equal = url.find('=',start);
+                            if(equal > end) equal = end;
+                            std::string key = url.substr(start,equal-start);
+                            std::string value = equal < end ? url.substr(equal+1,end-equal-1) : std::string();
+                            if(!key.empty()) req_header.parameters.emplace(std::move(key),std::move(value));
+                            start = end + 1;
                         }
                     }
-                }
-                catch(...)
-                {
-                    return false;
+                    std::string v = data.substr(p2+1,request_line_pos-p2-1);
+                    if(v == "HTTP/1.0") req_header.version = HTTP_1_0;
+                    else if(v == "HTTP/1.1") req_header.version = HTTP_1_1;
+                    else if(v == "HTTP/2.0") req_header.version = HTTP_2_0;
+                    else
+                    {
+                        return false;
+                    }
                 }
             }
             std::stringstream ss(data.substr(request_line_pos + 2));
@@ -933,8 +1288,10 @@ namespace hzd {
         bool parse_body(const std::string& body)
         {
             req_body.clear();
+            auto type = req_header.request_headers.find("Content-Type");
+            if(type == req_header.request_headers.end() || type->second.empty()) return false;
 
-            if(req_header.request_headers["Content-Type"][0].find("multipart/form-data") != std::string::npos)
+            if(type->second[0].find("multipart/form-data") != std::string::npos)
             {
                 size_t boundary_end = body.find("\r\n");
                 req_body.boundary = body.substr(0,boundary_end);
@@ -986,7 +1343,7 @@ namespace hzd {
                 }
                 return true;
             }
-            else if(req_header.request_headers["Content-Type"][0].find("application/x-www-form-urlencoded") != std::string::npos)
+            else if(type->second[0].find("application/x-www-form-urlencoded") != std::string::npos)
             {
                 std::stringstream ss(body);
                 std::string line;
@@ -1004,14 +1361,18 @@ namespace hzd {
         }
         inline void build_body_text()
         {
-            std::ostringstream buffer;
-            buffer << "<h1> " << std::to_string((int32_t)res_header.status) << " " << http_status_map.at(res_header.status) << "</h1>";
-            res_body.body_text = buffer.str();
+            auto code = (int32_t)res_header.status;
+            const char digits[4] = { char('0' + code / 100),char('0' + code / 10 % 10),char('0' + code % 10),' ' };
+            res_body.body_text.assign("<h1> ",5);
+            res_body.body_text.append(digits,4);
+            res_body.body_text.append(http_status_text(res_header.status));
+            res_body.body_text.append("</h1>",5);
         }
         bool send_response_header()
         {
-            res_header.header_text = res_header.to_string();
-            while(!send(res_header.header_text,res_header.header_text.size()))
+            res_header.header_lines += connection_text;
+            const std::string& text = res_header.serialize();
+            while(!send(text.data(),text.size()))
             {
                 if(errno == EAGAIN) continue;
                 ::close(res_body.file_fd);
@@ -1031,14 +1392,59 @@ namespace hzd {
             }
             return true;
         }
+        /**
+          * @brief answer status and close connection
+          * @note the request is not served,headers appended to res_header before are kept
+          * @param status status
+          * @retval false
+          */
+        bool refuse(http_Status status)
+        {
+            res_header.status = status;
+            build_body_text();
+            res_header.append("Content-Length",res_body.body_text.size());
+            keep_alive = false;
+            connection_text = "Connection:close\r\n";
+            if(send_response_header())
+            {
+                send(res_body.body_text,res_body.body_text.size());
+            }
+            notify_close();
+            return false;
+        }
+        /**
+          * @brief answer 400 Bad Request and close connection
+          * @note used when request line can not be parsed or the body ends early
+          * @param None
+          * @retval false
+          */
+        bool bad_request()
+        {
+            clear_out();
+            res_header.version = HTTP_1_1;
+            return refuse(http_Status::Bad_Request);
+        }
+        /**
+          * @brief answer 503 Service Unavailable and close connection
+          * @note used when the request waited too long for a worker,nothing else is done for it
+          * @param None
+          * @retval false
+          */
+        bool service_unavailable()
+        {
+            clear_out();
+            res_header.version = req_header.version;
+            res_header.append("Retry-After",std::string("1"));
+            return refuse(http_Status::Service_Unavailable);
+        }
         inline bool method_not_allow()
         {
             res_header.status = http_Status::Method_Not_Allowed;
             build_body_text();
-            res_header.response_headers["Content-Length"] = std::to_string(res_body.body_text.size());
+            res_header.append("Content-Length",res_body.body_text.size());
             if(!send_response_header()) { return false; }
             if(!send_response_body()) { return false; }
-            http_1_0_close();
+            keep_alive_or_close();
             return true;
         }
         bool load_file()
@@ -1049,232 +1455,778 @@ namespace hzd {
             {
                 res_header.status = http_Status::Not_Found;
                 build_body_text();
-                res_header.response_headers["Content-Length"] = std::to_string(res_body.body_text.size());
+                res_header.append("Content-Length",res_body.body_text.size());
                 return false;
             }
             if(!(res_body.file_stat.st_mode & S_IROTH))
             {
                 res_header.status = http_Status::Forbidden;
                 build_body_text();
-                res_header.response_headers["Content-Length"] = std::to_string(res_body.body_text.size());
+                res_header.append("Content-Length",res_body.body_text.size());
                 return false;
             }
             if(S_ISDIR(res_body.file_stat.st_mode))
             {
                 res_header.status = http_Status::Bad_Request;
                 build_body_text();
-                res_header.response_headers["Content-Length"] = std::to_string(res_body.body_text.size());
+                res_header.append("Content-Length",res_body.body_text.size());
                 return false;
             }
 
-            res_header.response_headers["Content-Length"] = std::to_string(res_body.file_stat.st_size);
-            size_t dot = res_body.file_name.find_last_of('.');
-            if(dot == std::string::npos) res_header.response_headers["Content-Type"] = http_content_type_map["plain"];
-            std::string t = res_body.file_name.substr(dot+1);
-            try{
-                res_header.response_headers["Content-Type"] = http_content_type_map.at(t);
-            }
-            catch (...)
-            {
-                res_header.response_headers["Content-Type"] = "application/octet-stream";
-            }
+            res_header.append("Content-Length",(size_t)res_body.file_stat.st_size);
+            res_header.append("Content-Type",content_type_of(res_body.file_name));
             res_header.status = http_Status::OK;
             return true;
         }
-        inline void clear_in()
+        /**
+          * @brief choose content encoding by Accept-Encoding
+          * @note gzip is preferred over deflate,codings with q=0 are skipped
+          * @param None
+          * @retval encoding
+          */
+        http_Encoding accept_encoding()
         {
-            req_header.clear();
+            auto it = req_header.request_headers.find("Accept-Encoding");
+            if(it == req_header.request_headers.end()) return IDENTITY;
+            bool deflate = false;
+            for(const auto& value : it->second)
+            {
+                size_t begin = value.find_first_not_of(' ');
+                if(begin == std::string::npos) continue;
+                size_t end = value.find(';',begin);
+                std::string coding = value.substr(begin,end == std::string::npos ? std::string::npos : end - begin);
+                coding.erase(coding.find_last_not_of(' ') + 1);
+                if(end != std::string::npos)
+                {
+                    size_t q = value.find("q=",end);
+                    if(q != std::string::npos && strtod(value.c_str() + q + 2,nullptr) <= 0) continue;
+                }
+                if(coding == "gzip" || coding == "x-gzip" || coding == "*") return GZIP;
+                if(coding == "deflate") deflate = true;
+            }
+            return deflate ? DEFLATE : IDENTITY;
         }
-        inline void clear_out()
+        /**
+          * @brief get compressed body for this request
+          * @note None
+          * @param file_name real file path
+          * @param content_type content type
+          * @param st stat of file
+          * @param fd file fd
+          * @param content file content already in memory
+          * @retval record or nullptr when identity should be sent
+          */
+        std::shared_ptr<gzip_cache::record> encoded_body(const std::string& file_name,const std::string& content_type,
+                                                         const struct stat& st,int fd,const std::string* content)
         {
-            res_header.clear();
-            res_body.clear();
+            if(!gzip || !gzip_cache::compressible(content_type)) return nullptr;
+            http_Encoding encoding = accept_encoding();
+            if(encoding == IDENTITY) return nullptr;
+            auto r = gzip->acquire(req_header.url,file_name,content_type,st,fd,content,encoding);
+            if(!r || r->data.empty()) return nullptr;
+            return r;
+        }
+        /**
+          * @brief whether the body of a file depends on Accept-Encoding
+          * @note identity responses of such files carry Vary too,or a cache could hand them to gzip clients and back
+          * @param content_type content type
+          * @retval varies or not
+          */
+        static bool varies(const std::string& content_type)
+        {
+            return gzip && gzip_cache::compressible(content_type);
         }
-        inline void http_1_0_close()
+        /**
+          * @brief entity tag of the body this request gets
+          * @note None
+          * @param e file entry
+          * @retval etag of the encoded body or of the file
+          */
+        std::string selected_etag(const std::shared_ptr<file_cache::entry>& e)
         {
-            if(res_header.version == http_Version::HTTP_1_0)
+            if(!varies(e->content_type)) return e->etag;
+            auto r = encoded_body(base_path + req_header.url,e->content_type,e->file_stat,e->fd,
+                                  e->in_memory ? &e->content : nullptr);
+            return r ? r->etag : e->etag;
+        }
+        /**
+          * @brief send compressed body from gzip cache
+          * @note None
+          * @param r gzip cache record
+          * @retval success or not
+          */
+        bool send_encoded(const std::shared_ptr<gzip_cache::record>& r)
+        {
+            res_body.encoded = r;
+            res_header.status = http_Status::OK;
+            const std::string& status_line = ok_status_line(res_header.version);
+            const std::string& date_line = http_date_line();
+            iovec iov[6];
+            iov[0] = {(void*)status_line.data(),status_line.size()};
+            iov[1] = {(void*)date_line.data(),date_line.size()};
+            iov[2] = {(void*)connection_text.data(),connection_text.size()};
+            iov[3] = {(void*)r->header_text.data(),r->header_text.size()};
+            iov[4] = {(void*)"\r\n",2};
+            iov[5] = {(void*)r->data.data(),r->data.size()};
+            while(!send_vec(iov,6))
             {
+                if(errno == EAGAIN) continue;
                 notify_close();
+                return false;
             }
-            else
+            keep_alive_or_close();
+            return true;
+        }
+        /**
+          * @brief join all values of request header
+          * @note values split by ',' are joined back,empty string if not found
+          * @param name header name
+          * @retval header value
+          */
+        std::string header_value(const std::string& name)
+        {
+            auto it = req_header.request_headers.find(name);
+            if(it == req_header.request_headers.end()) return {};
+            std::string value;
+            for(const auto& v : it->second)
             {
-                next(EPOLLIN);
+                if(!value.empty()) value += ',';
+                value += v;
             }
+            return value;
         }
-
-        bool send_status(http_Status status)
+        /**
+          * @brief compare entity tags,weak prefix is ignored
+          * @note None
+          * @param tag tag from request
+          * @param etag tag of file
+          * @retval match or not
+          */
+        static bool etag_match(std::string tag,const std::string& etag)
         {
-            res_header.status = status;
-            build_body_text();
-            res_header.response_headers["Content-Length"] = std::to_string(res_body.body_text.size());
-            if(!send_response_header()) return false;
-            if(!send_response_body()) return false;
-            http_1_0_close();
+            tag.erase(0,tag.find_first_not_of(' '));
+            tag.erase(tag.find_last_not_of(' ') + 1);
+            if(tag == "*") return true;
+            if(tag.compare(0,2,"W/") == 0) tag.erase(0,2);
+            return tag == etag;
+        }
+        /**
+          * @brief check If-None-Match and If-Modified-Since
+          * @note If-Modified-Since is ignored when If-None-Match exists
+          * @param e file entry
+          * @retval not modified or not
+          */
+        bool not_modified(const std::shared_ptr<file_cache::entry>& e)
+        {
+            auto it = req_header.request_headers.find("If-None-Match");
+            if(it != req_header.request_headers.end())
+            {
+                std::string etag = selected_etag(e);
+                for(const auto& tag : it->second)
+                {
+                    if(etag_match(tag,etag)) return true;
+                }
+                return false;
+            }
+            std::string since = header_value("If-Modified-Since");
+            if(since.empty()) return false;
+            if(since == e->last_modified) return true;
+            struct tm tm{};
+            if(!strptime(since.c_str(),"%a, %d %b %Y %H:%M:%S GMT",&tm)) return false;
+            return e->file_stat.st_mtime <= timegm(&tm);
+        }
+        /**
+          * @brief send 304 Not Modified
+          * @note None
+          * @param e file entry
+          * @retval success or not
+          */
+        bool send_not_modified(const std::shared_ptr<file_cache::entry>& e)
+        {
+            res_header.status = http_Status::Not_Modified;
+            res_header.append("ETag",selected_etag(e));
+            res_header.append("Last-Modified",e->last_modified);
+            if(varies(e->content_type)) res_header.append("Vary","Accept-Encoding");
+            if(!send_response_header()) { return false; }
+            keep_alive_or_close();
             return true;
         }
-
-#define CONV_CHECK_ROUTER(_method) do{      \
-    auto r = routers.at(req_header.url);    \
-        if(!r->allow(req_header.method))    \
-        {                                   \
-            throw std::exception();         \
-        }                                   \
-        return r->_method(this);            \
-    }while(0)
-
-        virtual bool process_get()
+        struct byte_range
+        {
+            size_t first;
+            size_t last;
+        };
+        /**
+          * @brief parse Range header (with If-Range)
+          * @note at most 16 ranges,more are treated as no range
+          * @param e file entry
+          * @param ranges output ranges
+          * @retval 1 ranges ok,0 no range (send whole file),-1 not satisfiable
+          */
+        int parse_range(const std::shared_ptr<file_cache::entry>& e,std::vector<byte_range>& ranges)
         {
-            try
+            if(req_header.method != GET) return 0;
+            std::string spec = header_value("Range");
+            if(spec.compare(0,6,"bytes=") != 0) return 0;
+            std::string if_range = header_value("If-Range");
+            if(!if_range.empty())
             {
-                CONV_CHECK_ROUTER(method_get);
+                if(if_range[0] == '"' || if_range.compare(0,2,"W/") == 0)
+                {
+                    if(if_range != e->etag) return 0;
+                }
+                else if(if_range != e->last_modified) return 0;
             }
-            catch(...)
+            auto size = (size_t)e->file_stat.st_size;
+            size_t pre = 6;
+            while(pre < spec.size())
             {
-                load_file();
-                if(!send_response_header()) { return false; }
-                write_total_bytes = res_body.file_stat.st_size;
-                write_cursor = 0;
-                if(!send_response_body()) { return false; }
-                http_1_0_close();
-                return true;
+                size_t pos = spec.find(',',pre);
+                if(pos == std::string::npos) pos = spec.size();
+                std::string r = spec.substr(pre,pos - pre);
+                pre = pos + 1;
+                r.erase(0,r.find_first_not_of(' '));
+                r.erase(r.find_last_not_of(' ') + 1);
+                if(r.empty()) continue;
+                size_t dash = r.find('-');
+                if(dash == std::string::npos) return 0;
+                char* end = nullptr;
+                if(dash == 0)
+                {
+                    size_t suffix = strtoull(r.c_str() + 1,&end,10);
+                    if(*end != '\0' || r.size() == 1) return 0;
+                    if(suffix == 0 || size == 0) continue;
+                    ranges.push_back({suffix >= size ? 0 : size - suffix,size - 1});
+                }
+                else
+                {
+                    size_t first = strtoull(r.c_str(),&end,10);
+                    if(end != r.c_str() + dash) return 0;
+                    size_t last = size - 1;
+                    if(dash + 1 < r.size())
+                    {
+                        last = strtoull(r.c_str() + dash + 1,&end,10);
+                        if(*end != '\0' || last < first) return 0;
+                        if(last >= size) last = size - 1;
+                    }
+                    if(first >= size) continue;
+                    ranges.push_back({first,last});
+                }
+                if(ranges.size() > 16) return 0;
             }
+            return ranges.empty() ? -1 : 1;
         }
-        virtual bool process_post()
+        /**
+          * @brief send part of file entry
+          * @note None
+          * @param e file entry
+          * @param first first byte
+          * @param last last byte
+          * @retval success or not
+          */
+        bool send_entry_range(const std::shared_ptr<file_cache::entry>& e,size_t first,size_t last)
         {
-            try
+            if(e->in_memory)
             {
-                CONV_CHECK_ROUTER(method_post);
+                while(!send(e->content.data() + first,last - first + 1))
+                {
+                    if(errno == EAGAIN) continue;
+                    notify_close();
+                    return false;
+                }
+                return true;
             }
-            catch(...) 
+            write_cursor = first;
+            write_total_bytes = last + 1;
+            while(!send_file_base(e->fd))
             {
-                method_not_allow();
-                return true;
+                if(errno == EAGAIN) continue;
+                notify_close();
+                return false;
             }
+            return true;
         }
-        virtual bool process_put()
+        /**
+          * @brief send 206 Partial Content,multipart/byteranges for several ranges
+          * @note None
+          * @param e file entry
+          * @param ranges ranges
+          * @retval success or not
+          */
+        bool send_ranges(const std::shared_ptr<file_cache::entry>& e,const std::vector<byte_range>& ranges)
         {
-            try
+            res_body.cached = e;
+            res_header.status = http_Status::Partial_Content;
+            res_header.append("ETag",e->etag);
+            res_header.append("Last-Modified",e->last_modified);
+            if(varies(e->content_type)) res_header.append("Vary","Accept-Encoding");
+            std::string total = "/" + std::to_string(e->file_stat.st_size);
+            if(ranges.size() == 1)
             {
-                CONV_CHECK_ROUTER(method_put);
+                const byte_range& r = ranges[0];
+                res_header.append("Content-Type",e->content_type);
+                res_header.append("Content-Range","bytes " + std::to_string(r.first) + "-" + std::to_string(r.last) + total);
+                res_header.append("Content-Length",r.last - r.first + 1);
+                if(!send_response_header()) { return false; }
+                if(!send_entry_range(e,r.first,r.last)) { return false; }
+                keep_alive_or_close();
+                return true;
             }
-            catch(...) 
+            static const std::string boundary = "conv_event_byteranges";
+            std::vector<std::string> parts;
+            size_t length = 0;
+            for(const auto& r : ranges)
             {
-                method_not_allow();
-                return true;
+                parts.emplace_back("\r\n--" + boundary + "\r\n"
+                                   + "Content-Type:" + e->content_type + "\r\n"
+                                   + "Content-Range:bytes " + std::to_string(r.first) + "-" + std::to_string(r.last) + total
+                                   + "\r\n\r\n");
+                length += parts.back().size() + r.last - r.first + 1;
             }
-        }
-        virtual bool process_patch()
-        {
-            try
+            std::string tail = "\r\n--" + boundary + "--\r\n";
+            length += tail.size();
+            res_header.append("Content-Type","multipart/byteranges; boundary=" + boundary);
+            res_header.append("Content-Length",length);
+            if(!send_response_header()) { return false; }
+            for(size_t i = 0;i < ranges.size();i++)
             {
-                CONV_CHECK_ROUTER(method_patch);
+                while(!send(parts[i],parts[i].size()))
+                {
+                    if(errno == EAGAIN) continue;
+                    notify_close();
+                    return false;
+                }
+                if(!send_entry_range(e,ranges[i].first,ranges[i].last)) { return false; }
             }
-            catch(...)
+            while(!send(tail,tail.size()))
             {
-                method_not_allow();
-                return true;
+                if(errno == EAGAIN) continue;
+                notify_close();
+                return false;
             }
+            keep_alive_or_close();
+            return true;
         }
-        virtual bool process_delete()
+        /**
+          * @brief send cached static file
+          * @note small files go out with header by one sendmsg,others sendfile from the cached fd
+          * @param e cache entry
+          * @retval success or not
+          */
+        bool send_cached(const std::shared_ptr<file_cache::entry>& e)
         {
-            try
+            res_body.cached = e;
+            res_header.status = http_Status::OK;
+            const std::string& status_line = ok_status_line(res_header.version);
+            const std::string& date_line = http_date_line();
+            static const std::string vary_text = "Vary:Accept-Encoding\r\n";
+            iovec iov[7];
+            iov[0] = {(void*)status_line.data(),status_line.size()};
+            iov[1] = {(void*)date_line.data(),date_line.size()};
+            iov[2] = {(void*)connection_text.data(),connection_text.size()};
+            iov[3] = {(void*)e->header_text.data(),e->header_text.size()};
+            int count = 4;
+            if(varies(e->content_type))
             {
-                CONV_CHECK_ROUTER(method_delete);
+                iov[count++] = {(void*)vary_text.data(),vary_text.size()};
             }
-            catch(...)
+            iov[count++] = {(void*)"\r\n",2};
+            if(e->in_memory && !e->content.empty())
             {
-                method_not_allow();
-                return true;
+                iov[count++] = {(void*)e->content.data(),e->content.size()};
             }
+            while(!send_vec(iov,count))
+            {
+                if(errno == EAGAIN) continue;
+                notify_close();
+                return false;
+            }
+            if(!e->in_memory)
+            {
+                write_total_bytes = e->file_stat.st_size;
+                write_cursor = 0;
+                while(!send_file_base(e->fd))
+                {
+                    if(errno == EAGAIN) continue;
+                    notify_close();
+                    return false;
+                }
+            }
+            keep_alive_or_close();
+            return true;
         }
-        virtual bool process_trace()
+        /**
+          * @brief send static file of request url
+          * @note try file cache first,fall back to load_file
+          * @param None
+          * @retval success or not
+          */
+        bool send_static()
         {
-            try
+            std::shared_ptr<file_cache::entry> e;
+            if(cache)
             {
-                CONV_CHECK_ROUTER(method_trace);
+                e = cache->acquire(req_header.url);
+                if(!e) e = cache->load(req_header.url,base_path + req_header.url,content_type_of(req_header.url));
             }
-            catch(...)
+            else
             {
-                method_not_allow();
-                return true;
+                e = file_cache::open_entry(req_header.url,base_path + req_header.url,content_type_of(req_header.url),0);
+            }
+            if(e)
+            {
+                if(not_modified(e)) return send_not_modified(e);
+                std::vector<byte_range> ranges;
+                int ret = parse_range(e,ranges);
+                if(ret > 0) return send_ranges(e,ranges);
+                if(ret < 0)
+                {
+                    res_header.append("Content-Range","bytes */" + std::to_string(e->file_stat.st_size));
+                    return send_status(http_Status::Requested_Range_Not_Satisfiable);
+                }
+                auto r = encoded_body(base_path + req_header.url,e->content_type,e->file_stat,e->fd,
+                                      e->in_memory ? &e->content : nullptr);
+                if(r) return send_encoded(r);
+                return send_cached(e);
             }
+            load_file();
+            if(!send_response_header()) { return false; }
+            write_total_bytes = res_body.file_stat.st_size;
+            write_cursor = 0;
+            if(!send_response_body()) { return false; }
+            keep_alive_or_close();
+            return true;
         }
-        virtual bool process_head()
+        inline void clear_in()
         {
-            try
+            req_header.clear();
+            req_body.raw.clear();
+        }
+        inline void clear_out()
+        {
+            res_header.clear();
+            res_body.clear();
+        }
+        /**
+          * @brief compare header names ignoring case
+          * @note None
+          * @param name header name
+          * @param other header name to compare with
+          * @retval same or not
+          */
+        static bool header_is(const std::string& name,const char* other)
+        {
+            return name.size() == strlen(other) && strncasecmp(name.data(),other,name.size()) == 0;
+        }
+        /**
+          * @brief has comma separated token in header value or not
+          * @note tokens are trimmed of spaces and tabs and compared case-insensitively
+          * @param value header value
+          * @param token token
+          * @retval has or not
+          */
+        static bool has_token(const std::string& value,const char* token)
+        {
+            size_t size = strlen(token);
+            size_t begin = 0;
+            while(begin < value.size())
             {
-                CONV_CHECK_ROUTER(method_head);
+                size_t end = value.find(',',begin);
+                if(end == std::string::npos) end = value.size();
+                size_t b = value.find_first_not_of(" \t",begin);
+                size_t e = end;
+                while(e > b && (value[e - 1] == ' ' || value[e - 1] == '\t')) e--;
+                if(b < e && e - b == size && strncasecmp(value.data() + b,token,size) == 0) return true;
+                begin = end + 1;
             }
-            catch(...)
+            return false;
+        }
+        /**
+          * @brief find request header ignoring case of name
+          * @note the name as written is looked up first,the scan is only for other cases
+          * @param name header name
+          * @retval values or nullptr
+          */
+        const std::vector<std::string>* header_values(const char* name) const
+        {
+            auto it = req_header.request_headers.find(name);
+            if(it != req_header.request_headers.end()) return &it->second;
+            for(const auto& p : req_header.request_headers)
             {
-                method_not_allow();
-                return true;
+                if(header_is(p.first,name)) return &p.second;
             }
+            return nullptr;
         }
-        virtual bool process_options()
+        /**
+          * @brief has comma separated token in request header or not
+          * @note name and token are compared case-insensitively
+          * @param name header name
+          * @param token token
+          * @retval has or not
+          */
+        bool header_has_token(const char* name,const char* token) const
         {
-            try
+            const std::vector<std::string>* values = header_values(name);
+            if(!values) return false;
+            for(const auto& v : *values)
             {
-                CONV_CHECK_ROUTER(method_options);
+                if(has_token(v,token)) return true;
             }
-            catch(...)
+            return false;
+        }
+        /**
+          * @brief decide whether connection is kept after this request
+          * @note HTTP/1.1 keeps alive unless "Connection: close",HTTP/1.0 only with "Connection: keep-alive".
+          *       the last request allowed by keep_alive_max,or any request while draining,
+          *       is answered with "Connection: close"
+          * @param None
+          * @retval None
+          */
+        void decide_keep_alive()
+        {
+            request_count++;
+            if(req_header.version == HTTP_1_0)
             {
-                method_not_allow();
-                return true;
+                keep_alive = header_has_token("Connection","keep-alive");
+            }
+            else
+            {
+                keep_alive = !header_has_token("Connection","close");
+            }
+            if(keep_alive_max > 0 && request_count >= (size_t)keep_alive_max) keep_alive = false;
+            if(conn::draining()) keep_alive = false;
+
+            connection_text.clear();
+            if(!keep_alive)
+            {
+                connection_text.append("Connection:close\r\n");
+                return;
+            }
+            if(req_header.version == HTTP_1_0) connection_text.append("Connection:keep-alive\r\n");
+            if(keep_alive_timeout > 0 || keep_alive_max > 0)
+            {
+                connection_text.append("Keep-Alive:");
+                if(keep_alive_timeout > 0)
+                {
+                    connection_text.append("timeout=");
+                    connection_text.append(std::to_string(keep_alive_timeout));
+                }
+                if(keep_alive_max > 0)
+                {
+                    if(keep_alive_timeout > 0) connection_text.append(", ");
+                    connection_text.append("max=");
+                    connection_text.append(std::to_string(keep_alive_max - request_count));
+                }
+                connection_text.append("\r\n");
             }
         }
-        virtual bool process_connect()
+        /**
+          * @brief go on with the next request or close after response is sent
+          * @note a pipelined request already in input is taken before EPOLLIN is waited for,
+          *       req_header then holds that request
+          * @param None
+          * @retval None
+          */
+        inline void keep_alive_or_close()
         {
-            try
+            if(request_begin)
             {
-                CONV_CHECK_ROUTER(method_connect);
+                metrics::record(M_HTTP_REQUEST,(uint64_t)(metrics::clock_us() - request_begin));
+                request_begin = 0;
             }
-            catch(...)
+            busy = false;
+            if(!keep_alive)
             {
-                method_not_allow();
-                return true;
+                notify_close();
+            }
+            else if(capture || (input.empty() && !peer_closed))
+            {
+                next(EPOLLIN);
+            }
+            else
+            {
+                process_request();
             }
         }
+        /* kept for routers written against older versions */
+        inline void http_1_0_close() { keep_alive_or_close(); }
 
-        bool process_in() override
+        bool send_status(http_Status status)
+        {
+            res_header.status = status;
+            build_body_text();
+            res_header.append("Content-Length",res_body.body_text.size());
+            if(!send_response_header()) return false;
+            if(!send_response_body()) return false;
+            keep_alive_or_close();
+            return true;
+        }
+
+#define CONV_CHECK_ROUTER(_method,_fallback) do{    \
+        router* r = matched_router;                 \
+        if(!r || !r->allow(req_header.method))      \
+        {                                           \
+            _fallback;                              \
+        }                                           \
+        return r->_method(this);                    \
+    }while(0)
+
+        virtual bool process_get()
+        {
+            CONV_CHECK_ROUTER(method_get,return send_static());
+        }
+        virtual bool process_post()
+        {
+            CONV_CHECK_ROUTER(method_post,method_not_allow();return true);
+        }
+        virtual bool process_put()
+        {
+            CONV_CHECK_ROUTER(method_put,method_not_allow();return true);
+        }
+        virtual bool process_patch()
+        {
+            CONV_CHECK_ROUTER(method_patch,method_not_allow();return true);
+        }
+        virtual bool process_delete()
+        {
+            CONV_CHECK_ROUTER(method_delete,method_not_allow();return true);
+        }
+        virtual bool process_trace()
+        {
+            CONV_CHECK_ROUTER(method_trace,method_not_allow();return true);
+        }
+        virtual bool process_head()
+        {
+            CONV_CHECK_ROUTER(method_head,method_not_allow();return true);
+        }
+        virtual bool process_options()
+        {
+            CONV_CHECK_ROUTER(method_options,method_not_allow();return true);
+        }
+        virtual bool process_connect()
         {
-            clear_in();
+            CONV_CHECK_ROUTER(method_connect,method_not_allow();return true);
+        }
 
-            std::string data;
-            if(!recv_all(data))
+        /**
+          * @brief read what the socket has into input
+          * @note peer_closed is set when the peer shut its side,what came before it is still served
+          * @param None
+          * @retval false when the socket failed
+          */
+        bool read_input()
+        {
+            while(true)
             {
-                notify_close();
-                return false;
+                ssize_t n = ::recv(socket_fd,read_buffer,sizeof(read_buffer),0);
+                if(n > 0)
+                {
+                    metrics::count(M_BYTES_IN,n);
+                    input.append(read_buffer,n);
+                    continue;
+                }
+                if(n == 0)
+                {
+                    peer_closed = true;
+                    return true;
+                }
+                if(errno == EINTR) continue;
+                return errno == EAGAIN || errno == EWOULDBLOCK;
             }
-            if(data.empty()) { next(EPOLLIN); return true; }
-            size_t divide = data.find("\r\n\r\n");
-            std::string header = data.substr(0,divide + 2);
-            if(!parse_header(header))
+        }
+        bool process_in() override
+        {
+            if(!read_input())
             {
                 notify_close();
                 return false;
             }
-            if(req_header.method == POST)
+            return process_request();
+        }
+        /**
+          * @brief take the next HTTP/1.x request out of input and wait for EPOLLOUT
+          * @note an incomplete request waits for EPOLLIN with its bytes kept in input,the header
+          *       is parsed once.a header past HTTP_MAX_HEADER_SIZE or a body the peer closed
+          *       before sending is answered 400,a Content-Length past http_max_body 413
+          * @param None
+          * @retval success or not
+          */
+        bool process_request()
+        {
+            if(head_size == 0)
             {
-                std::string body = data.substr(divide+4);
-                size_t cur{0};
-                while((cur = strtoll(req_header.request_headers["Content-Length"][0].c_str(),nullptr,10)) > body.size())
+                size_t divide = input.find("\r\n\r\n");
+                if(divide == std::string::npos)
                 {
-                    recv(body,cur - body.size());
+                    if(input.size() > HTTP_MAX_HEADER_SIZE) return bad_request();
+                    if(peer_closed)
+                    {
+                        notify_close();
+                        return false;
+                    }
+                    next(EPOLLIN);
+                    return true;
                 }
-                parse_body(body);
+                clear_in();
+                request_begin = metrics::enabled() ? metrics::clock_us() : 0;
+                if(divide > HTTP_MAX_HEADER_SIZE || !parse_header(input.substr(0,divide + 2)))
+                {
+                    return bad_request();
+                }
+                if(admission::get().shed(queue_delay)) return service_unavailable();
+                decide_keep_alive();
+                has_body = req_header.method == POST;
+                body_size = 0;
+                auto length = req_header.request_headers.find("Content-Length");
+                if(length != req_header.request_headers.end() && !length->second.empty())
+                {
+                    const std::string& v = length->second[0];
+                    if(v.empty() || v.size() > 19 || v.find_first_not_of("0123456789") != std::string::npos)
+                    {
+                        return bad_request();
+                    }
+                    body_size = strtoull(v.c_str(),nullptr,10);
+                    if(body_size > (size_t)max_request_body)
+                    {
+                        clear_out();
+                        res_header.version = req_header.version;
+                        return refuse(http_Status::Request_Entity_Too_Large);
+                    }
+                    has_body = true;
+                }
+                head_size = divide + 4;
+            }
+            if(input.size() - head_size < body_size)
+            {
+                if(peer_closed) return bad_request();
+                next(EPOLLIN);
+                return true;
             }
+            if(has_body)
+            {
+                std::string body = input.substr(head_size,body_size);
+                if(req_header.method == POST) parse_body(body);
+                req_body.raw = std::move(body);
+            }
+            input.erase(0,head_size + body_size);
+            head_size = 0;
+            busy = true;
             next(EPOLLOUT);
             return true;
         }
         bool process_out() override
         {
+            if(relay)
+            {
+                std::shared_ptr<http_relay> r = relay;
+                return r->resume();
+            }
             clear_out();
             res_header.version = req_header.version;
-            filter* f = match(req_header.url);
-            if(f)
+            matched_router = route(req_header.url,&matched_filter);
+            if(matched_filter)
             {
-                if(!f->allow(this))
+                if(!matched_filter->allow(this))
                 {
                     return send_status(http_Status::Forbidden);
                 }
@@ -1316,8 +2268,46 @@ namespace hzd {
     using filter = http_conn::filter;
     using hzd::http_Methods;
     const std::string http_conn::base_path = configure::get_config().require("resource_path");
+    std::atomic<int> http_conn::keep_alive_timeout{configure::get_config()["keep_alive_timeout"].type == JSON_NULL ?
+                                        15 : (int32_t)configure::get_config()["keep_alive_timeout"]};
+    std::atomic<int> http_conn::keep_alive_max{configure::get_config()["keep_alive_max"].type == JSON_NULL ?
+                                    100 : (int32_t)configure::get_config()["keep_alive_max"]};
+    bool http_conn::reload_hooked = configure::get_config().on_reload([] {
+        configure& conf = configure::get_config();
+        keep_alive_timeout = conf["keep_alive_timeout"].type == JSON_NULL ? 15 : (int32_t)conf["keep_alive_timeout"];
+        keep_alive_max = conf["keep_alive_max"].type == JSON_NULL ? 100 : (int32_t)conf["keep_alive_max"];
+    });
+    int http_conn::max_request_body = configure::get_config()["http_max_body"].type == JSON_NULL ?
+                                      16777216 : (int32_t)configure::get_config()["http_max_body"];
+    file_cache* http_conn::cache = http_conn::_create_file_cache_();
+    gzip_cache* http_conn::gzip = http_conn::_create_gzip_cache_();
     std::unordered_map<std::string,router*> http_conn::routers;
-    std::unordered_map<std::string,std::shared_ptr<filter::node>> http_conn::filters { {"/",std::make_shared<filter::node>()} };
+    router_tree<router,filter> http_conn::routes;
+    std::once_flag http_conn::routes_once;
+    std::atomic<bool> http_conn::routes_built{false};
+    std::vector<filter*> http_conn::filters;
+    std::vector<void (*)()> http_conn::loaders;
+
+    /**
+      * @brief serves metrics::prometheus() for scrapers
+      * @note at "metrics_path","/metrics" without it,an empty path serves nothing
+      */
+    class metrics_router : public http_conn::router {
+    public:
+        explicit metrics_router(std::string url) : router(std::move(url),{GET}) {}
+
+        bool method_get(http_conn* c) override
+        {
+            return c->send_str(metrics::prometheus(),"text/plain; version=0.0.4");
+        }
+        static void load_config()
+        {
+            configure& conf = configure::get_config();
+            std::string url = conf["metrics_path"].type == JSON_NULL ? "/metrics" : std::string((const char*)conf["metrics_path"]);
+            if(!url.empty()) new metrics_router(url);
+        }
+    };
+    static const bool metrics_loader_registered = (http_conn::register_loader(metrics_router::load_config),true);
 
     class conv_http_multi : conv_multi<http_conn>
     {
@@ -1325,6 +2315,7 @@ namespace hzd {
         void wait(int time_out=5) override
         {
             LOG_INFO("running at: http://127.0.0.1:" + std::to_string(port));
+            http_conn::build_routers();
             conv_multi<http_conn>::wait(time_out);
         }
     };
@@ -1335,6 +2326,7 @@ namespace hzd {
         void wait(int time_out=5) override
         {
             LOG_INFO("running at: http://127.0.0.1:" + std::to_string(port));
+            http_conn::build_routers();
             conv_single<http_conn>::wait(time_out);
         }
     };
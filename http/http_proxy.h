@@ -0,0 +1,700 @@
+#ifndef CONV_EVENT_HTTP_PROXY_H
+#define CONV_EVENT_HTTP_PROXY_H
+
+#include "http/http_conn.h"             /* http_conn */
+#include "core/include/connector.h"     /* upstream outbound */
+#include <mutex>                        /* recursive_mutex */
+#include <memory>                       /* shared_ptr */
+
+namespace hzd {
+
+    #define HTTP_PROXY_MAX_HEAD (64 * 1024)
+    #define HTTP_PROXY_READ_SIZE (64 * 1024)
+    #define HTTP_PROXY_READ_ROUNDS 16
+
+    /**
+      * @brief one request forwarded from an http_conn to an upstream
+      * @note everything after the request is written runs on the reactor of the client conn.
+      *       response bytes are written to the client as they arrive,when the client socket is full
+      *       the rest is kept and the upstream is not read again until resume() flushed it,
+      *       so at most one read of the response is buffered.
+      *       a reused keep-alive connection that fails before answering is retried once on a new one
+      */
+    class http_proxy_session : public http_relay,public std::enable_shared_from_this<http_proxy_session> {
+        enum Body { NONE, LENGTH, CHUNKED, UNTIL_CLOSE };
+        enum Chunk { SIZE, DATA, DATA_CRLF, TRAILER, END };
+
+        std::recursive_mutex mtx;
+        http_conn* client;
+        upstream* up;
+        upstream_server* server{nullptr};
+        outbound* o{nullptr};
+        size_t connect_tries{0};
+        http_Version version;
+        bool head_request;
+        uint64_t key{0};
+
+        std::string request;
+        size_t request_offset{0};
+        bool received{false};
+
+        std::string head;
+        bool head_sent{false};
+        Body body{NONE};
+        size_t remain{0};
+        Chunk chunk{SIZE};
+        std::string line;
+        bool dechunk{false};
+        bool upstream_keep_alive{true};
+        bool done{false};
+
+        std::string out;
+        std::string pending;
+        size_t pending_offset{0};
+
+        static bool _hop_by_hop_(const std::string& name)
+        {
+            for(const char* h : {"Connection","Keep-Alive","Proxy-Connection","TE","Trailer","Upgrade","Transfer-Encoding"})
+            {
+                if(http_conn::header_is(name,h)) return true;
+            }
+            return false;
+        }
+        std::string _client_ip_() const
+        {
+            sockaddr_in peer{};
+            socklen_t len = sizeof(peer);
+            if(getpeername(client->socket_fd,(sockaddr*)&peer,&len) != 0) return {};
+            char ip[INET_ADDRSTRLEN] = {0};
+            inet_ntop(AF_INET,&peer.sin_addr,ip,sizeof(ip));
+            return ip;
+        }
+        /**
+          * @brief build HTTP/1.1 keep-alive request for upstream from the parsed client request
+          * @note hop-by-hop headers are dropped,the client address is appended to X-Forwarded-For
+          * @param None
+          * @retval None
+          */
+        void _build_request_()
+        {
+            http_conn::request_header& h = client->req_header;
+            request.clear();
+            request += http_method_map.at(h.method);
+            request += ' ';
+            request += h.url;
+            if(!h.query.empty())
+            {
+                request += '?';
+                request += h.query;
+            }
+            request.append(" HTTP/1.1\r\n");
+            std::string forwarded;
+            bool host = false;
+            for(const auto& p : h.request_headers)
+            {
+                if(_hop_by_hop_(p.first) || http_conn::header_is(p.first,"Content-Length") || http_conn::header_is(p.first,"Expect")) continue;
+                std::string value;
+                for(const auto& v : p.second)
+                {
+                    if(!value.empty()) value += ',';
+                    value += v;
+                }
+                if(http_conn::header_is(p.first,"X-Forwarded-For"))
+                {
+                    forwarded = value;
+                    continue;
+                }
+                if(http_conn::header_is(p.first,"Host")) host = true;
+                request += p.first;
+                request += ':';
+                request += value;
+                request.append("\r\n",2);
+            }
+            if(!host && server)
+            {
+                request += "Host:" + server->ip + ":" + std::to_string(server->port) + "\r\n";
+            }
+            std::string ip = _client_ip_();
+            if(!ip.empty()) forwarded = forwarded.empty() ? ip : forwarded + ", " + ip;
+            if(!forwarded.empty()) request += "X-Forwarded-For:" + forwarded + "\r\n";
+            request.append("Connection:keep-alive\r\n");
+            const std::string& raw = client->req_body.raw;
+            if(!raw.empty() || h.method == POST || h.method == PUT || h.method == PATCH)
+            {
+                request += "Content-Length:" + std::to_string(raw.size()) + "\r\n";
+            }
+            request.append("\r\n",2);
+            request += raw;
+        }
+        void _connect_()
+        {
+            connect_tries++;
+            std::shared_ptr<http_proxy_session> self = shared_from_this();
+            up->connect(client->epoll_fd,server,[self](outbound* ob) { self->_on_connected_(ob); });
+        }
+        void _on_connected_(outbound* ob)
+        {
+            std::lock_guard<std::recursive_mutex> guard(mtx);
+            if(!client)
+            {
+                if(ob) ob->release(false);
+                return;
+            }
+            if(!ob)
+            {
+                /* try the next server the policy picks,every server at most about once */
+                if(connect_tries < up->servers.size() && (server = up->pick(key)) != nullptr)
+                {
+                    _connect_();
+                    return;
+                }
+                _reply_(http_Status::Bad_Gateway);
+                return;
+            }
+            o = ob;
+            received = false;
+            request_offset = 0;
+            std::shared_ptr<http_proxy_session> self = shared_from_this();
+            o->set_handler([self](outbound* x,uint32_t events) { self->_on_event_(x,events); });
+            _write_request_();
+        }
+        void _write_request_()
+        {
+            while(request_offset < request.size())
+            {
+                ssize_t n = ::send(o->fd(),request.data() + request_offset,request.size() - request_offset,MSG_NOSIGNAL);
+                if(n > 0)
+                {
+                    metrics::count(M_BYTES_OUT,n);
+                    request_offset += n;
+                    continue;
+                }
+                if(n < 0 && errno == EINTR) continue;
+                if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                {
+                    o->next(EPOLLOUT);
+                    return;
+                }
+                _upstream_error_();
+                return;
+            }
+            o->next(EPOLLIN);
+        }
+        void _on_event_(outbound* ob,uint32_t events)
+        {
+            std::lock_guard<std::recursive_mutex> guard(mtx);
+            if(ob != o || !client) return;
+            if(request_offset < request.size())
+            {
+                if(events & (EPOLLERR | EPOLLHUP))
+                {
+                    _upstream_error_();
+                    return;
+                }
+                _write_request_();
+                return;
+            }
+            if((events & EPOLLERR) && !(events & EPOLLIN))
+            {
+                _upstream_error_();
+                return;
+            }
+            _read_();
+        }
+        void _read_()
+        {
+            char buffer[HTTP_PROXY_READ_SIZE];
+            for(int round = 0;round < HTTP_PROXY_READ_ROUNDS;round++)
+            {
+                ssize_t n = ::recv(o->fd(),buffer,sizeof(buffer),0);
+                if(n > 0)
+                {
+                    metrics::count(M_BYTES_IN,n);
+                    received = true;
+                    if(!_consume_(buffer,n)) return;
+                    continue;
+                }
+                if(n == 0)
+                {
+                    _upstream_eof_();
+                    return;
+                }
+                if(errno == EINTR) continue;
+                if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+                _upstream_error_();
+                return;
+            }
+            o->next(EPOLLIN);
+        }
+        /**
+          * @brief parse response head and build the one sent to client
+          * @note None
+          * @param None
+          * @retval valid or not
+          */
+        bool _parse_head_(size_t head_size)
+        {
+            size_t line_end = head.find("\r\n");
+            if(head.compare(0,5,"HTTP/") != 0 || line_end == std::string::npos || line_end < 12) return false;
+            int status = atoi(head.c_str() + 9);
+            if(status < 100 || status > 999) return false;
+            if(head.compare(0,8,"HTTP/1.0") == 0) upstream_keep_alive = false;
+            bool length = false;
+            bool chunked = false;
+            out.assign(http_version_text[version],9);
+            out.append(head,9,line_end + 2 - 9);
+            size_t begin = line_end + 2;
+            std::string name,value;
+            while(begin < head_size)
+            {
+                size_t end = head.find("\r\n",begin);
+                if(end == std::string::npos || end >= head_size) break;
+                size_t colon = head.find(':',begin);
+                if(colon == std::string::npos || colon > end)
+                {
+                    begin = end + 2;
+                    continue;
+                }
+                name.assign(head,begin,colon - begin);
+                value.assign(head,colon + 1,end - colon - 1);
+                value.erase(0,value.find_first_not_of(" \t"));
+                if(http_conn::header_is(name,"Connection"))
+                {
+                    if(http_conn::has_token(value,"close")) upstream_keep_alive = false;
+                    if(http_conn::has_token(value,"keep-alive") && head.compare(0,8,"HTTP/1.0") == 0) upstream_keep_alive = true;
+                }
+                else if(http_conn::header_is(name,"Transfer-Encoding"))
+                {
+                    chunked = http_conn::has_token(value,"chunked");
+                }
+                else if(http_conn::header_is(name,"Content-Length"))
+                {
+                    length = true;
+                    remain = strtoull(value.c_str(),nullptr,10);
+                }
+                if(!_hop_by_hop_(name)) out.append(head,begin,end + 2 - begin);
+                begin = end + 2;
+            }
+            if(head_request || status == 204 || status == 304) body = NONE;
+            else if(chunked) body = CHUNKED;
+            else if(length) body = remain ? LENGTH : NONE;
+            else body = UNTIL_CLOSE;
+            if(body == UNTIL_CLOSE) upstream_keep_alive = false;
+            dechunk = body == CHUNKED && version == HTTP_1_0;
+            if(body == CHUNKED && !dechunk) out.append("Transfer-Encoding:chunked\r\n");
+            if(body == UNTIL_CLOSE || dechunk)
+            {
+                client->keep_alive = false;
+                client->connection_text = "Connection:close\r\n";
+            }
+            out += client->connection_text;
+            out.append("\r\n",2);
+            return true;
+        }
+        /**
+          * @brief append body bytes to be forwarded
+          * @note chunked bodies are followed to find their end,and stripped for HTTP/1.0 clients
+          * @param p data
+          * @param n data size
+          * @retval valid or not
+          */
+        bool _body_(const char* p,size_t n)
+        {
+            if(body == NONE)
+            {
+                done = true;
+                if(n) upstream_keep_alive = false;
+                return true;
+            }
+            if(body == UNTIL_CLOSE)
+            {
+                out.append(p,n);
+                return true;
+            }
+            if(body == LENGTH)
+            {
+                size_t take = n < remain ? n : remain;
+                out.append(p,take);
+                remain -= take;
+                if(!remain)
+                {
+                    done = true;
+                    if(take < n) upstream_keep_alive = false;
+                }
+                return true;
+            }
+            size_t i = 0;
+            while(i < n && chunk != END)
+            {
+                if(chunk == SIZE || chunk == TRAILER)
+                {
+                    const char* nl = (const char*)memchr(p + i,'\n',n - i);
+                    size_t end = nl ? nl - p + 1 : n;
+                    if(!dechunk) out.append(p + i,end - i);
+                    line.append(p + i,end - i);
+                    i = end;
+                    if(!nl)
+                    {
+                        if(line.size() > 4096) return false;
+                        continue;
+                    }
+                    if(chunk == SIZE)
+                    {
+                        if(!isxdigit((unsigned char)line[0])) return false;
+                        remain = strtoull(line.c_str(),nullptr,16);
+                        chunk = remain ? DATA : TRAILER;
+                    }
+                    else if(line == "\r\n" || line == "\n")
+                    {
+                        chunk = END;
+                    }
+                    line.clear();
+                }
+                else
+                {
+                    size_t take = n - i < remain ? n - i : remain;
+                    if(chunk == DATA || !dechunk) out.append(p + i,take);
+                    i += take;
+                    remain -= take;
+                    if(remain) continue;
+                    if(chunk == DATA)
+                    {
+                        chunk = DATA_CRLF;
+                        remain = 2;
+                    }
+                    else chunk = SIZE;
+                }
+            }
+            if(chunk == END)
+            {
+                done = true;
+                if(i < n) upstream_keep_alive = false;
+            }
+            return true;
+        }
+        /**
+          * @brief handle bytes read from upstream
+          * @note None
+          * @param p data
+          * @param n data size
+          * @retval keep reading upstream or not
+          */
+        bool _consume_(const char* p,size_t n)
+        {
+            out.clear();
+            if(!head_sent)
+            {
+                head.append(p,n);
+                size_t divide = head.find("\r\n\r\n");
+                if(divide == std::string::npos)
+                {
+                    if(head.size() <= HTTP_PROXY_MAX_HEAD) return true;
+                    _upstream_error_();
+                    return false;
+                }
+                /* interim responses like 100 Continue are dropped */
+                if(head.compare(0,10,"HTTP/1.1 1") == 0 || head.compare(0,10,"HTTP/1.0 1") == 0)
+                {
+                    head.erase(0,divide + 4);
+                    return head.empty() || _consume_(nullptr,0);
+                }
+                if(!_parse_head_(divide + 4))
+                {
+                    _upstream_error_();
+                    return false;
+                }
+                head_sent = true;
+                std::string rest = head.substr(divide + 4);
+                head.clear();
+                if(!_body_(rest.data(),rest.size()))
+                {
+                    _abort_();
+                    return false;
+                }
+            }
+            else if(!_body_(p,n))
+            {
+                _abort_();
+                return false;
+            }
+            return _deliver_();
+        }
+        /**
+          * @brief write forwarded bytes to client
+          * @note None
+          * @param None
+          * @retval keep reading upstream or not
+          */
+        bool _deliver_()
+        {
+            size_t offset = 0;
+            while(offset < out.size())
+            {
+                ssize_t n = ::send(client->socket_fd,out.data() + offset,out.size() - offset,MSG_NOSIGNAL);
+                if(n > 0)
+                {
+                    metrics::count(M_BYTES_OUT,n);
+                    offset += n;
+                    continue;
+                }
+                if(n < 0 && errno == EINTR) continue;
+                if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                {
+                    pending.assign(out,offset,std::string::npos);
+                    pending_offset = 0;
+                    client->last_active = conn_clock();
+                    client->next(EPOLLOUT);
+                    return false;
+                }
+                _abort_();
+                return false;
+            }
+            client->last_active = conn_clock();
+            if(done)
+            {
+                _finish_();
+                return false;
+            }
+            return true;
+        }
+        void _upstream_eof_()
+        {
+            if(head_sent && body == UNTIL_CLOSE)
+            {
+                done = true;
+                o->release(false);
+                o = nullptr;
+                if(pending.empty()) _finish_();
+                return;
+            }
+            _upstream_error_();
+        }
+        void _upstream_error_()
+        {
+            bool reused = o->reused();
+            o->release(false);
+            o = nullptr;
+            if(!received && reused)
+            {
+                /* keep-alive connection closed by the server meanwhile */
+                _connect_();
+                return;
+            }
+            if(!head_sent)
+            {
+                _reply_(http_Status::Bad_Gateway);
+                return;
+            }
+            _abort_();
+        }
+        void _finish_()
+        {
+            if(o)
+            {
+                o->release(upstream_keep_alive);
+                o = nullptr;
+            }
+            http_conn* c = client;
+            client = nullptr;
+            c->relay.reset();
+            c->keep_alive_or_close();
+        }
+        void _abort_()
+        {
+            if(o)
+            {
+                o->release(false);
+                o = nullptr;
+            }
+            http_conn* c = client;
+            client = nullptr;
+            c->relay.reset();
+            c->notify_close();
+        }
+        void _reply_(http_Status status)
+        {
+            http_conn* c = client;
+            client = nullptr;
+            c->relay.reset();
+            c->clear_out();
+            c->res_header.version = version;
+            c->send_status(status);
+        }
+    public:
+        http_proxy_session(http_conn* c,upstream* _up)
+        : client(c),up(_up),version(c->req_header.version),head_request(c->req_header.method == HEAD) {}
+
+        /**
+          * @brief forward current request of conn to upstream
+          * @note the conn is not re-armed until the response is relayed,only HTTP/1.x conns can be proxied
+          * @param c client conn
+          * @param up upstream
+          * @param hash_url consistent hashing by url instead of client address
+          * @retval success or not
+          */
+        static bool start(http_conn* c,upstream* up,bool hash_url)
+        {
+            if(c->capture) return c->send_status(http_Status::Not_Implemented);
+            std::shared_ptr<http_proxy_session> s = std::make_shared<http_proxy_session>(c,up);
+            std::lock_guard<std::recursive_mutex> guard(s->mtx);
+            if(up->policy == CONSISTENT_HASH)
+            {
+                s->key = upstream::hash_key(hash_url ? c->req_header.url : s->_client_ip_());
+            }
+            s->server = up->pick(s->key);
+            if(!s->server)
+            {
+                s->_reply_(http_Status::Bad_Gateway);
+                return true;
+            }
+            s->_build_request_();
+            /* the response goes out in pieces as it arrives,do not let them wait for acks */
+            int opt = 1;
+            setsockopt(c->socket_fd,IPPROTO_TCP,TCP_NODELAY,&opt,sizeof(opt));
+            c->relay = s;
+            s->_connect_();
+            return true;
+        }
+        /**
+          * @brief flush response bytes the client socket could not take
+          * @note called from process_out of the client conn
+          * @param None
+          * @retval success or not
+          */
+        bool resume() override
+        {
+            std::lock_guard<std::recursive_mutex> guard(mtx);
+            if(!client) return true;
+            while(pending_offset < pending.size())
+            {
+                ssize_t n = ::send(client->socket_fd,pending.data() + pending_offset,pending.size() - pending_offset,MSG_NOSIGNAL);
+                if(n > 0)
+                {
+                    metrics::count(M_BYTES_OUT,n);
+                    pending_offset += n;
+                    continue;
+                }
+                if(n < 0 && errno == EINTR) continue;
+                if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                {
+                    client->next(EPOLLOUT);
+                    return true;
+                }
+                _abort_();
+                return true;
+            }
+            pending.clear();
+            pending_offset = 0;
+            client->last_active = conn_clock();
+            if(done) _finish_();
+            else if(o) o->next(EPOLLIN);
+            return true;
+        }
+        void detach() override
+        {
+            std::lock_guard<std::recursive_mutex> guard(mtx);
+            client = nullptr;
+            if(o)
+            {
+                o->release(false);
+                o = nullptr;
+            }
+        }
+    };
+
+    /**
+      * @brief router forwarding its url pattern to an upstream
+      * @note routes and upstreams may also come from "upstreams" and "proxy" in conf.json
+      */
+    class http_proxy : public http_conn::router {
+        upstream* up;
+        bool hash_url;
+    public:
+        http_proxy(std::string url,upstream* _up,bool _hash_url = false)
+        : router(std::move(url),{GET,POST,PUT,PATCH,DELETE,HEAD,OPTIONS}),up(_up),hash_url(_hash_url) {}
+
+        bool method_get(http_conn* c) override { return http_proxy_session::start(c,up,hash_url); }
+        bool method_post(http_conn* c) override { return http_proxy_session::start(c,up,hash_url); }
+        bool method_put(http_conn* c) override { return http_proxy_session::start(c,up,hash_url); }
+        bool method_patch(http_conn* c) override { return http_proxy_session::start(c,up,hash_url); }
+        bool method_delete(http_conn* c) override { return http_proxy_session::start(c,up,hash_url); }
+        bool method_head(http_conn* c) override { return http_proxy_session::start(c,up,hash_url); }
+        bool method_options(http_conn* c) override { return http_proxy_session::start(c,up,hash_url); }
+
+        /**
+          * @brief upstreams from conf.json by name
+          * @note never freed,routers keep pointing to them until exit
+          * @param None
+          * @retval upstreams
+          */
+        static std::unordered_map<std::string,upstream*>& upstreams()
+        {
+            static std::unordered_map<std::string,upstream*> ups;
+            return ups;
+        }
+        /**
+          * @brief create upstreams and proxy routes of conf.json
+          * @note servers are "ip:port" or "ip:port:weight"
+          * @param None
+          * @retval None
+          */
+        static void load_config()
+        {
+            configure& conf = configure::get_config();
+            json_val ups = conf["upstreams"];
+            for(size_t i = 0;ups.type == JSON_ARRAY && i < ups.size();i++)
+            {
+                json_val& u = ups[i];
+                if(u.type != JSON_JSON || u["name"].type != JSON_STRING || u["servers"].type != JSON_ARRAY)
+                {
+                    LOG_WARN("upstream ignored,name and servers are required");
+                    continue;
+                }
+                auto* up = new upstream(std::string((const char*)u["name"]));
+                std::string policy = u["policy"].type == JSON_STRING ? std::string((const char*)u["policy"]) : "round_robin";
+                if(policy == "least_conn") up->policy = LEAST_CONN;
+                else if(policy == "consistent_hash") up->policy = CONSISTENT_HASH;
+                else if(policy != "round_robin") LOG_WARN("upstream " + up->name + " unknown policy " + policy);
+                up->max_idle = u["max_idle"].type == JSON_NULL ? up->max_idle : (int32_t)u["max_idle"];
+                up->max_fails = u["max_fails"].type == JSON_NULL ? up->max_fails : (int32_t)u["max_fails"];
+                up->fail_timeout = u["fail_timeout"].type == JSON_NULL ? up->fail_timeout : (int32_t)u["fail_timeout"];
+                up->connect_timeout = u["connect_timeout"].type == JSON_NULL ? up->connect_timeout : (int32_t)u["connect_timeout"];
+                json_val& servers = u["servers"];
+                for(size_t j = 0;j < servers.size();j++)
+                {
+                    if(servers[j].type != JSON_STRING) continue;
+                    std::string s = std::string((const char*)servers[j]);
+                    size_t colon = s.find(':');
+                    if(colon == std::string::npos)
+                    {
+                        LOG_WARN("upstream " + up->name + " server " + s + " ignored,port is required");
+                        continue;
+                    }
+                    size_t weight = s.find(':',colon + 1);
+                    up->add_server(s.substr(0,colon),(uint16_t)atoi(s.c_str() + colon + 1),
+                                   weight == std::string::npos ? 1 : atoi(s.c_str() + weight + 1));
+                }
+                if(u["health_check"].type != JSON_NULL) up->health_check((int32_t)u["health_check"]);
+                upstreams()[up->name] = up;
+            }
+            json_val routes = conf["proxy"];
+            for(size_t i = 0;routes.type == JSON_ARRAY && i < routes.size();i++)
+            {
+                json_val& r = routes[i];
+                if(r.type != JSON_JSON || r["url"].type != JSON_STRING || r["upstream"].type != JSON_STRING) continue;
+                auto it = upstreams().find(std::string((const char*)r["upstream"]));
+                if(it == upstreams().end())
+                {
+                    LOG_WARN("proxy " + std::string((const char*)r["url"]) + " ignored,no upstream " + std::string((const char*)r["upstream"]));
+                    continue;
+                }
+                bool hash_url = r["hash"].type == JSON_STRING && std::string((const char*)r["hash"]) == "url";
+                new http_proxy(std::string((const char*)r["url"]),it->second,hash_url);
+            }
+        }
+    };
+    /* proxy routes of conf.json join the routers when they are built */
+    static const bool http_proxy_loader_registered = (http_conn::register_loader(http_proxy::load_config),true);
+}
+
+#endif
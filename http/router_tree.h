@@ -0,0 +1,292 @@
+#ifndef CONV_EVENT_ROUTER_TREE_H
+#define CONV_EVENT_ROUTER_TREE_H
+
+#include <string>               /* string */
+#include <vector>               /* vector */
+#include <memory>               /* unique_ptr */
+#include <deque>                /* deque */
+#include <cstring>              /* memcmp */
+#include <cstdint>              /* uint32_t */
+#include "async_logger/async_logger.hpp"    /* async_logger */
+
+namespace hzd {
+
+    #define ROUTER_TREE_MAX_PARAMS 8
+
+    /* path parameter captured by router_tree,points into the url and the tree */
+    struct route_param
+    {
+        const char* name;
+        size_t name_size;
+        const char* value;
+        size_t value_size;
+    };
+
+    /**
+      * @brief compressed radix tree of url patterns and filter prefixes
+      * @note patterns support static text, ":name" (one segment) and "*name" (rest of url,last only).
+      *       filters are static prefixes applied to the prefix itself and everything below it.
+      *       insert() all patterns then build() once,build() flattens the tree into one vector
+      *       and find() never allocates.
+      */
+    template<class T,class F>
+    class router_tree {
+        struct build_node
+        {
+            std::string prefix;
+            bool is_param{false};
+            std::string name;
+            std::vector<std::unique_ptr<build_node>> children;
+            std::unique_ptr<build_node> param;
+            T* value{nullptr};
+            T* wildcard{nullptr};
+            std::string wildcard_name;
+            F* filter{nullptr};
+        };
+        struct node
+        {
+            uint32_t prefix{0};
+            uint32_t prefix_size{0};
+            uint32_t name{0};
+            uint32_t name_size{0};
+            uint32_t wildcard_name{0};
+            uint32_t wildcard_name_size{0};
+            uint32_t first_child{0};
+            uint32_t child_count{0};
+            int32_t param_child{-1};
+            bool is_param{false};
+            T* value{nullptr};
+            T* wildcard{nullptr};
+            F* filter{nullptr};
+        };
+
+        std::unique_ptr<build_node> root{new build_node};
+        std::vector<node> nodes;
+        std::string pool;
+
+        /**
+          * @brief insert static text under node,splitting existing edges
+          * @note None
+          * @param cur node
+          * @param text static text
+          * @retval node of the end of text
+          */
+        static build_node* _insert_static_(build_node* cur,std::string text)
+        {
+            while(!text.empty())
+            {
+                std::unique_ptr<build_node>* next = nullptr;
+                for(auto& child : cur->children)
+                {
+                    if(child->prefix[0] == text[0]) { next = &child; break; }
+                }
+                if(!next)
+                {
+                    std::unique_ptr<build_node> child(new build_node);
+                    child->prefix = text;
+                    cur->children.emplace_back(std::move(child));
+                    return cur->children.back().get();
+                }
+                size_t common = 0;
+                std::string& prefix = (*next)->prefix;
+                while(common < prefix.size() && common < text.size() && prefix[common] == text[common]) common++;
+                if(common < prefix.size())
+                {
+                    std::unique_ptr<build_node> mid(new build_node);
+                    mid->prefix = prefix.substr(0,common);
+                    prefix.erase(0,common);
+                    mid->children.emplace_back(std::move(*next));
+                    *next = std::move(mid);
+                }
+                cur = next->get();
+                text.erase(0,common);
+            }
+            return cur;
+        }
+        uint32_t _intern_(const std::string& s)
+        {
+            auto offset = (uint32_t)pool.size();
+            pool += s;
+            return offset;
+        }
+        node _make_(const build_node* b)
+        {
+            node n;
+            n.prefix = _intern_(b->prefix);
+            n.prefix_size = (uint32_t)b->prefix.size();
+            n.name = _intern_(b->name);
+            n.name_size = (uint32_t)b->name.size();
+            n.wildcard_name = _intern_(b->wildcard_name);
+            n.wildcard_name_size = (uint32_t)b->wildcard_name.size();
+            n.is_param = b->is_param;
+            n.value = b->value;
+            n.wildcard = b->wildcard;
+            n.filter = b->filter;
+            return n;
+        }
+        T* _find_(uint32_t index,const char* p,size_t n,route_param* params,size_t& count,F** filter) const
+        {
+            const node& cur = nodes[index];
+            size_t saved = count;
+            if(cur.is_param)
+            {
+                size_t len = 0;
+                while(len < n && p[len] != '/') len++;
+                if(len == 0 || count >= ROUTER_TREE_MAX_PARAMS) return nullptr;
+                params[count++] = { pool.data() + cur.name,cur.name_size,p,len };
+                p += len;
+                n -= len;
+            }
+            else
+            {
+                if(n < cur.prefix_size || memcmp(p,pool.data() + cur.prefix,cur.prefix_size) != 0) return nullptr;
+                p += cur.prefix_size;
+                n -= cur.prefix_size;
+                if(cur.filter && (n == 0 || *p == '/')) *filter = cur.filter;
+            }
+            if(n == 0 && cur.value) return cur.value;
+            if(n > 0)
+            {
+                for(uint32_t i = cur.first_child;i < cur.first_child + cur.child_count;i++)
+                {
+                    if(pool[nodes[i].prefix] != *p) continue;
+                    T* t = _find_(i,p,n,params,count,filter);
+                    if(t) return t;
+                    break;
+                }
+                if(cur.param_child != -1)
+                {
+                    T* t = _find_((uint32_t)cur.param_child,p,n,params,count,filter);
+                    if(t) return t;
+                }
+            }
+            if(cur.wildcard && count < ROUTER_TREE_MAX_PARAMS)
+            {
+                params[count++] = { pool.data() + cur.wildcard_name,cur.wildcard_name_size,p,n };
+                return cur.wildcard;
+            }
+            count = saved;
+            return nullptr;
+        }
+    public:
+        router_tree() = default;
+        router_tree(const router_tree&) = delete;
+        router_tree& operator=(const router_tree&) = delete;
+
+        /**
+          * @brief insert url pattern
+          * @note must be called before build()
+          * @param pattern static text with ":name" segments and an optional trailing "*name"
+          * @param value value
+          * @retval None
+          */
+        void insert(const std::string& pattern,T* value)
+        {
+            if(!root) return;
+            build_node* cur = root.get();
+            size_t i = 0;
+            while(i < pattern.size())
+            {
+                if(pattern[i] == ':')
+                {
+                    size_t end = pattern.find('/',i);
+                    if(end == std::string::npos) end = pattern.size();
+                    std::string name = pattern.substr(i + 1,end - i - 1);
+                    if(!cur->param)
+                    {
+                        cur->param.reset(new build_node);
+                        cur->param->is_param = true;
+                        cur->param->name = name;
+                    }
+                    else if(cur->param->name != name)
+                    {
+                        LOG_WARN("router pattern " + pattern + " conflicts with :" + cur->param->name);
+                    }
+                    cur = cur->param.get();
+                    i = end;
+                    continue;
+                }
+                if(pattern[i] == '*')
+                {
+                    cur->wildcard = value;
+                    cur->wildcard_name = pattern.substr(i + 1);
+                    return;
+                }
+                size_t end = pattern.find_first_of(":*",i);
+                if(end == std::string::npos) end = pattern.size();
+                cur = _insert_static_(cur,pattern.substr(i,end - i));
+                i = end;
+            }
+            cur->value = value;
+        }
+        /**
+          * @brief insert filter prefix
+          * @note must be called before build(),"" means all urls
+          * @param prefix static url prefix like "/admin"
+          * @param f filter
+          * @retval None
+          */
+        void insert_filter(const std::string& prefix,F* f)
+        {
+            if(!root) return;
+            _insert_static_(root.get(),prefix)->filter = f;
+        }
+        /**
+          * @brief flatten tree into read-only node array
+          * @note children of one node are stored contiguously
+          * @param None
+          * @retval None
+          */
+        void build()
+        {
+            if(!root) return;
+            nodes.clear();
+            pool.clear();
+            std::deque<std::pair<const build_node*,uint32_t>> q;
+            nodes.push_back(_make_(root.get()));
+            q.emplace_back(root.get(),0);
+            while(!q.empty())
+            {
+                const build_node* b = q.front().first;
+                uint32_t index = q.front().second;
+                q.pop_front();
+                auto first = (uint32_t)nodes.size();
+                for(const auto& child : b->children)
+                {
+                    q.emplace_back(child.get(),(uint32_t)nodes.size());
+                    nodes.push_back(_make_(child.get()));
+                }
+                nodes[index].first_child = first;
+                nodes[index].child_count = (uint32_t)b->children.size();
+                if(b->param)
+                {
+                    nodes[index].param_child = (int32_t)nodes.size();
+                    q.emplace_back(b->param.get(),(uint32_t)nodes.size());
+                    nodes.push_back(_make_(b->param.get()));
+                }
+            }
+            root.reset();
+            LOG_TRACE("router tree built,node count = " + std::to_string(nodes.size()));
+        }
+        bool built() const { return !root; }
+        /**
+          * @brief find value and deepest filter of url in one pass
+          * @note static text wins over ":name",":name" wins over "*name"
+          * @param path url
+          * @param size url size
+          * @param params output path parameters (ROUTER_TREE_MAX_PARAMS at most)
+          * @param count output parameter count
+          * @param filter output filter or nullptr
+          * @retval value or nullptr
+          */
+        T* find(const char* path,size_t size,route_param* params,size_t& count,F** filter) const
+        {
+            count = 0;
+            *filter = nullptr;
+            if(nodes.empty()) return nullptr;
+            return _find_(0,path,size,params,count,filter);
+        }
+    };
+}
+
+#endif
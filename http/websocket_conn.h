@@ -0,0 +1,761 @@
+#ifndef CONV_EVENT_WEBSOCKET_CONN_H
+#define CONV_EVENT_WEBSOCKET_CONN_H
+
+#include "http/http_conn.h"     /* http_conn */
+#include <deque>                /* deque */
+#include <mutex>                /* mutex */
+#include <unordered_set>        /* unordered_set */
+#if defined(__SSE2__)
+#include <emmintrin.h>          /* _mm_xor_si128 */
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>          /* _mm256_xor_si256 */
+#endif
+
+namespace hzd {
+
+    #define WEBSOCKET_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+    #define WEBSOCKET_MAX_HEADER_SIZE 14
+
+    enum websocket_Opcode
+    {
+        WS_CONTINUATION = 0x0,
+        WS_TEXT = 0x1,
+        WS_BINARY = 0x2,
+        WS_CLOSE = 0x8,
+        WS_PING = 0x9,
+        WS_PONG = 0xA,
+    };
+
+    enum websocket_Close_Code
+    {
+        WS_NORMAL = 1000,
+        WS_GOING_AWAY = 1001,
+        WS_PROTOCOL_ERROR = 1002,
+        WS_UNSUPPORTED_DATA = 1003,
+        WS_INVALID_PAYLOAD = 1007,
+        WS_POLICY_VIOLATION = 1008,
+        WS_MESSAGE_TOO_BIG = 1009,
+        WS_INTERNAL_ERROR = 1011,
+    };
+
+    /* one serialized server frame,shared by every connection it is sent to */
+    using websocket_frame = std::shared_ptr<const std::string>;
+
+    /**
+      * @brief sha1 digest
+      * @note only used for Sec-WebSocket-Accept
+      * @param data data
+      * @param digest output 20 bytes
+      * @retval None
+      */
+    static void websocket_sha1(const std::string& data,uint8_t digest[20])
+    {
+        uint32_t h[5] = {0x67452301,0xEFCDAB89,0x98BADCFE,0x10325476,0xC3D2E1F0};
+        std::string msg = data;
+        uint64_t bits = (uint64_t)data.size() * 8;
+        msg.push_back((char)0x80);
+        while(msg.size() % 64 != 56) msg.push_back(0);
+        for(int i = 7;i >= 0;i--) msg.push_back((char)(bits >> (i * 8)));
+        auto rol = [](uint32_t x,int n) { return (x << n) | (x >> (32 - n)); };
+        for(size_t chunk = 0;chunk < msg.size();chunk += 64)
+        {
+            uint32_t w[80];
+            for(int i = 0;i < 16;i++)
+            {
+                const auto* p = (const uint8_t*)msg.data() + chunk + i * 4;
+                w[i] = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+            }
+            for(int i = 16;i < 80;i++) w[i] = rol(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16],1);
+            uint32_t a = h[0],b = h[1],c = h[2],d = h[3],e = h[4];
+            for(int i = 0;i < 80;i++)
+            {
+                uint32_t f,k;
+                if(i < 20) { f = (b & c) | (~b & d); k = 0x5A827999; }
+                else if(i < 40) { f = b ^ c ^ d; k = 0x6ED9EBA1; }
+                else if(i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+                else { f = b ^ c ^ d; k = 0xCA62C1D6; }
+                uint32_t t = rol(a,5) + f + e + k + w[i];
+                e = d; d = c; c = rol(b,30); b = a; a = t;
+            }
+            h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+        }
+        for(int i = 0;i < 20;i++) digest[i] = (uint8_t)(h[i / 4] >> (24 - (i % 4) * 8));
+    }
+    /**
+      * @brief base64 encode
+      * @note None
+      * @param data data
+      * @param size data size
+      * @retval encoded text with padding
+      */
+    static std::string websocket_base64(const uint8_t* data,size_t size)
+    {
+        static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        std::string out;
+        for(size_t i = 0;i < size;i += 3)
+        {
+            uint32_t v = (uint32_t)data[i] << 16;
+            if(i + 1 < size) v |= (uint32_t)data[i + 1] << 8;
+            if(i + 2 < size) v |= data[i + 2];
+            out.push_back(table[(v >> 18) & 63]);
+            out.push_back(table[(v >> 12) & 63]);
+            out.push_back(i + 1 < size ? table[(v >> 6) & 63] : '=');
+            out.push_back(i + 2 < size ? table[v & 63] : '=');
+        }
+        return out;
+    }
+    /**
+      * @brief xor payload with masking key in place
+      * @note 32/16/8 bytes per step,every step is a multiple of 4 so the key phase never shifts
+      * @param p payload
+      * @param n payload size
+      * @param key masking key
+      * @retval None
+      */
+    static void websocket_unmask(char* p,size_t n,const uint8_t key[4])
+    {
+        size_t i = 0;
+        uint32_t k;
+        memcpy(&k,key,4);
+#if defined(__AVX2__)
+        __m256i m256 = _mm256_set1_epi32((int)k);
+        for(;i + 32 <= n;i += 32)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+            _mm256_storeu_si256((__m256i*)(p + i),_mm256_xor_si256(v,m256));
+        }
+#endif
+#if defined(__SSE2__)
+        __m128i m128 = _mm_set1_epi32((int)k);
+        for(;i + 16 <= n;i += 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+            _mm_storeu_si128((__m128i*)(p + i),_mm_xor_si128(v,m128));
+        }
+#endif
+        uint64_t k64 = ((uint64_t)k << 32) | k;
+        for(;i + 8 <= n;i += 8)
+        {
+            uint64_t v;
+            memcpy(&v,p + i,8);
+            v ^= k64;
+            memcpy(p + i,&v,8);
+        }
+        for(;i < n;i++) p[i] = (char)(p[i] ^ key[i & 3]);
+    }
+    /**
+      * @brief validate utf-8 text
+      * @note overlong forms,surrogates and code points above U+10FFFF are rejected
+      * @param s text
+      * @retval valid or not
+      */
+    static bool websocket_valid_utf8(const std::string& s)
+    {
+        const auto* p = (const uint8_t*)s.data();
+        const uint8_t* end = p + s.size();
+        while(p < end)
+        {
+            uint8_t c = *p;
+            if(c < 0x80) { p++; continue; }
+            int n;
+            uint32_t cp;
+            if((c & 0xE0) == 0xC0) { n = 1; cp = c & 0x1F; }
+            else if((c & 0xF0) == 0xE0) { n = 2; cp = c & 0x0F; }
+            else if((c & 0xF8) == 0xF0) { n = 3; cp = c & 0x07; }
+            else return false;
+            if(end - p <= n) return false;
+            for(int i = 1;i <= n;i++)
+            {
+                if((p[i] & 0xC0) != 0x80) return false;
+                cp = (cp << 6) | (p[i] & 0x3F);
+            }
+            if((n == 1 && cp < 0x80) || (n == 2 && cp < 0x800) || (n == 3 && cp < 0x10000)) return false;
+            if(cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) return false;
+            p += n + 1;
+        }
+        return true;
+    }
+    /**
+      * @brief close code allowed in a close frame
+      * @note 1005,1006 and 1015 are only reported locally,never sent
+      * @param code close code
+      * @retval valid or not
+      */
+    static inline bool websocket_valid_close_code(uint16_t code)
+    {
+        if(code >= 3000 && code <= 4999) return true;
+        return code >= 1000 && code <= 1014 && code != 1004 && code != 1005 && code != 1006;
+    }
+    /**
+      * @brief serialize server frame
+      * @note server frames are never masked
+      * @param opcode opcode
+      * @param data payload
+      * @param size payload size
+      * @retval frame
+      */
+    static websocket_frame websocket_make_frame(websocket_Opcode opcode,const char* data,size_t size)
+    {
+        auto frame = std::make_shared<std::string>();
+        frame->reserve(size + WEBSOCKET_MAX_HEADER_SIZE);
+        frame->push_back((char)(0x80 | opcode));
+        if(size < 126)
+        {
+            frame->push_back((char)size);
+        }
+        else if(size <= 0xFFFF)
+        {
+            frame->push_back((char)126);
+            frame->push_back((char)(size >> 8));
+            frame->push_back((char)size);
+        }
+        else
+        {
+            frame->push_back((char)127);
+            for(int i = 7;i >= 0;i--) frame->push_back((char)((uint64_t)size >> (i * 8)));
+        }
+        frame->append(data,size);
+        return frame;
+    }
+
+    class websocket_conn;
+
+    /**
+      * @brief set of websocket connections that receive the same broadcasts
+      * @note thread safe,a frame is serialized once and queued on every member
+      */
+    class websocket_group {
+        std::mutex mtx;
+        std::unordered_set<websocket_conn*> members;
+    public:
+        websocket_group() = default;
+        websocket_group(const websocket_group&) = delete;
+        websocket_group& operator=(const websocket_group&) = delete;
+
+        inline void join(websocket_conn* c);
+        inline void leave(websocket_conn* c);
+        inline size_t size()
+        {
+            std::lock_guard<std::mutex> guard(mtx);
+            return members.size();
+        }
+        /**
+          * @brief send frame to every member
+          * @note None
+          * @param frame serialized frame
+          * @retval members the frame was queued on
+          */
+        inline size_t broadcast(const websocket_frame& frame);
+        size_t broadcast(const std::string& message,bool binary = false)
+        {
+            return broadcast(websocket_make_frame(binary ? WS_BINARY : WS_TEXT,message.data(),message.size()));
+        }
+    };
+
+    /**
+      * @brief websocket connection,speaks HTTP/1.x until a request asks for "Upgrade: websocket"
+      * @note derive from it and override on_open/on_message/on_close.
+      *       sends may come from any thread : frames are written under a mutex,whatever does not fit
+      *       into the socket is queued and written on EPOLLOUT.
+      */
+    class websocket_conn : public http_conn {
+        struct outbound
+        {
+            websocket_frame frame;
+            size_t offset;
+        };
+        enum State { HTTP, OPEN, CLOSING };
+
+        State state{HTTP};
+        std::mutex in_mtx;
+        std::mutex out_mtx;
+        std::deque<outbound> out_queue;
+        size_t out_bytes{0};
+        bool out_closed{false};
+        std::string in;
+        std::string message;
+        uint8_t message_opcode{0};
+        bool close_sent{false};
+        std::mutex group_mtx;
+        std::vector<websocket_group*> groups;
+
+        /**
+          * @brief write queued frames until socket would block (out_mtx must be locked)
+          * @note None
+          * @param None
+          * @retval false on socket error
+          */
+        bool _drain_()
+        {
+            while(!out_queue.empty())
+            {
+                outbound& o = out_queue.front();
+                while(o.offset < o.frame->size())
+                {
+                    ssize_t n = ::send(socket_fd,o.frame->data() + o.offset,o.frame->size() - o.offset,MSG_NOSIGNAL);
+                    if(n > 0)
+                    {
+                        metrics::count(M_BYTES_OUT,n);
+                        o.offset += n;
+                        out_bytes -= n;
+                        continue;
+                    }
+                    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+                }
+                out_queue.pop_front();
+            }
+            return true;
+        }
+        /**
+          * @brief register next event,EPOLLOUT while frames are queued (out_mtx must be locked)
+          * @note None
+          * @param None
+          * @retval None
+          */
+        void _rearm_()
+        {
+            if(out_closed) return;
+            next(EPOLLIN | (out_queue.empty() ? 0u : (uint32_t)EPOLLOUT));
+        }
+        /**
+          * @brief answer handshake with 101 and open websocket
+          * @note None
+          * @param None
+          * @retval success or not
+          */
+        bool _open_()
+        {
+            const std::vector<std::string>* key = header_values("Sec-WebSocket-Key");
+            if(!key || key->size() != 1 || !header_has_token("Sec-WebSocket-Version","13"))
+            {
+                res_header.append("Sec-WebSocket-Version",std::string("13"));
+                return send_status(http_Status::Bad_Request);
+            }
+            if(!on_upgrade()) return send_status(http_Status::Forbidden);
+            uint8_t digest[20];
+            websocket_sha1((*key)[0] + WEBSOCKET_GUID,digest);
+            auto response = std::make_shared<std::string>("HTTP/1.1 101 Switching Protocols\r\n"
+                                                          "Upgrade: websocket\r\n"
+                                                          "Connection: Upgrade\r\n"
+                                                          "Sec-WebSocket-Accept: ");
+            *response += websocket_base64(digest,20) + "\r\n\r\n";
+            state = OPEN;
+            idle_timeout = websocket_idle_timeout;
+            if(!queue(response)) return false;
+            everyone().join(this);
+            on_open();
+            std::lock_guard<std::mutex> guard(out_mtx);
+            _rearm_();
+            return true;
+        }
+        /**
+          * @brief send close frame and close the connection
+          * @note the connection doesn't wait for the peer's close frame,close() writes what is
+          *       queued,the close frame included,before the socket is shut.
+          *       a code that can't be sent (1005,1006,1015...) gives a close frame without code
+          * @param code close code
+          * @retval None
+          */
+        void _fail_(uint16_t code)
+        {
+            if(!close_sent)
+            {
+                char payload[2] = {(char)(code >> 8),(char)code};
+                close_sent = true;
+                queue(websocket_make_frame(WS_CLOSE,payload,websocket_valid_close_code(code) ? 2 : 0));
+            }
+            state = CLOSING;
+            notify_close();
+        }
+        /**
+          * @brief handle one complete frame
+          * @note payload is already unmasked
+          * @param fin FIN bit
+          * @param opcode opcode
+          * @param payload payload
+          * @param size payload size
+          * @retval keep reading or not
+          */
+        bool _on_frame_(bool fin,uint8_t opcode,const char* payload,size_t size)
+        {
+            switch(opcode)
+            {
+                case WS_CONTINUATION :
+                case WS_TEXT :
+                case WS_BINARY : {
+                    if((opcode == WS_CONTINUATION) == (message_opcode == 0))
+                    {
+                        _fail_(WS_PROTOCOL_ERROR);
+                        return false;
+                    }
+                    if(opcode != WS_CONTINUATION) message_opcode = opcode;
+                    if(message.size() + size > (size_t)websocket_max_message)
+                    {
+                        _fail_(WS_MESSAGE_TOO_BIG);
+                        return false;
+                    }
+                    message.append(payload,size);
+                    if(!fin) return true;
+                    bool binary = message_opcode == WS_BINARY;
+                    message_opcode = 0;
+                    if(!binary && !websocket_valid_utf8(message))
+                    {
+                        _fail_(WS_INVALID_PAYLOAD);
+                        return false;
+                    }
+                    bool ok = on_message(message,binary);
+                    message.clear();
+                    if(!ok)
+                    {
+                        _fail_(WS_NORMAL);
+                        return false;
+                    }
+                    return true;
+                }
+                case WS_PING : {
+                    queue(websocket_make_frame(WS_PONG,payload,size));
+                    return true;
+                }
+                case WS_PONG : {
+                    return true;
+                }
+                case WS_CLOSE : {
+                    uint16_t code = WS_NORMAL;
+                    if(size == 1)
+                    {
+                        _fail_(WS_PROTOCOL_ERROR);
+                        return false;
+                    }
+                    if(size >= 2) code = (uint16_t)(((uint8_t)payload[0] << 8) | (uint8_t)payload[1]);
+                    if(size >= 2 && !websocket_valid_close_code(code))
+                    {
+                        _fail_(WS_PROTOCOL_ERROR);
+                        return false;
+                    }
+                    if(size > 2 && !websocket_valid_utf8(std::string(payload + 2,size - 2)))
+                    {
+                        _fail_(WS_INVALID_PAYLOAD);
+                        return false;
+                    }
+                    if(!close_sent)
+                    {
+                        close_sent = true;
+                        queue(websocket_make_frame(WS_CLOSE,payload,size >= 2 ? 2 : 0));
+                    }
+                    on_close(code);
+                    state = CLOSING;
+                    notify_close();
+                    return false;
+                }
+                default : {
+                    _fail_(WS_PROTOCOL_ERROR);
+                    return false;
+                }
+            }
+        }
+        /**
+          * @brief parse all complete frames in receive buffer
+          * @note None
+          * @param None
+          * @retval keep reading or not
+          */
+        bool _on_frames_()
+        {
+            size_t cursor = 0;
+            while(in.size() - cursor >= 2)
+            {
+                auto* h = (uint8_t*)&in[cursor];
+                bool fin = h[0] & 0x80;
+                uint8_t opcode = h[0] & 0x0F;
+                size_t length = h[1] & 0x7F;
+                size_t header = 2;
+                if((h[0] & 0x70) || !(h[1] & 0x80))
+                {
+                    _fail_(WS_PROTOCOL_ERROR);
+                    return false;
+                }
+                if(opcode & 0x08)
+                {
+                    if(!fin || length > 125)
+                    {
+                        _fail_(WS_PROTOCOL_ERROR);
+                        return false;
+                    }
+                }
+                if(length == 126)
+                {
+                    if(in.size() - cursor < 4) break;
+                    length = ((size_t)h[2] << 8) | h[3];
+                    header = 4;
+                }
+                else if(length == 127)
+                {
+                    if(in.size() - cursor < 10) break;
+                    uint64_t l = 0;
+                    for(int i = 0;i < 8;i++) l = (l << 8) | h[2 + i];
+                    if(l > (uint64_t)websocket_max_message)
+                    {
+                        _fail_(WS_MESSAGE_TOO_BIG);
+                        return false;
+                    }
+                    length = (size_t)l;
+                    header = 10;
+                }
+                if(in.size() - cursor < header + 4 + length) break;
+                uint8_t key[4];
+                memcpy(key,h + header,4);
+                char* payload = &in[cursor + header + 4];
+                websocket_unmask(payload,length,key);
+                cursor += header + 4 + length;
+                if(!_on_frame_(fin,opcode,payload,length)) return false;
+            }
+            in.erase(0,cursor);
+            return true;
+        }
+        bool _wants_upgrade_()
+        {
+            return req_header.method == GET && header_has_token("Upgrade","websocket") && header_has_token("Connection","Upgrade");
+        }
+    public:
+        /* reloaded with the config */
+        static std::atomic<int> websocket_max_message;
+        static std::atomic<int> websocket_max_pending;
+        static std::atomic<int> websocket_idle_timeout;
+        static bool reload_hooked;
+
+        /* group of all open websocket connections */
+        static websocket_group& everyone()
+        {
+            static websocket_group group;
+            return group;
+        }
+
+        /**
+          * @brief called on upgrade request,return false to answer 403
+          * @note req_header holds the handshake request
+          * @param None
+          * @retval accept or not
+          */
+        virtual bool on_upgrade() { return true; }
+        /**
+          * @brief called once the websocket is open
+          * @note None
+          * @param None
+          * @retval None
+          */
+        virtual void on_open() {}
+        /**
+          * @brief called for every complete message
+          * @note fragments are already joined,text is valid utf-8
+          * @param data message
+          * @param binary binary or text
+          * @retval keep connection or not
+          */
+        virtual bool on_message(std::string& /*data*/,bool /*binary*/) { return true; }
+        /**
+          * @brief called when peer sends close frame
+          * @note None
+          * @param code close code of peer
+          * @retval None
+          */
+        virtual void on_close(uint16_t /*code*/) {}
+
+        /**
+          * @brief queue frame on this connection
+          * @note callable from any thread,written at once when the socket is free.
+          *       a connection with more than websocket_max_pending bytes queued is closed
+          * @param frame serialized frame
+          * @retval queued or not
+          */
+        bool queue(const websocket_frame& frame)
+        {
+            std::lock_guard<std::mutex> guard(out_mtx);
+            if(out_closed) return false;
+            bool idle = out_queue.empty();
+            out_queue.push_back({frame,0});
+            out_bytes += frame->size();
+            if(idle && !_drain_())
+            {
+                out_closed = true;
+                notify_close();
+                return false;
+            }
+            if(out_bytes > (size_t)websocket_max_pending)
+            {
+                LOG_WARN("websocket peer too slow,closed");
+                out_closed = true;
+                notify_close();
+                return false;
+            }
+            if(idle && !out_queue.empty()) _rearm_();
+            return true;
+        }
+        bool send_text(const std::string& data)
+        {
+            return queue(websocket_make_frame(WS_TEXT,data.data(),data.size()));
+        }
+        bool send_binary(const std::string& data)
+        {
+            return queue(websocket_make_frame(WS_BINARY,data.data(),data.size()));
+        }
+        void send_close(uint16_t code = WS_NORMAL)
+        {
+            _fail_(code);
+        }
+        void init(int _socket_fd,sockaddr_in* _addr,int _epoll_fd,bool et,bool _one_shot,lock_queue<int>* cq = nullptr,bool add = true) override
+        {
+            {
+                std::lock_guard<std::mutex> guard(out_mtx);
+                out_queue.clear();
+                out_bytes = 0;
+                out_closed = false;
+            }
+            state = HTTP;
+            in.clear();
+            message.clear();
+            message_opcode = 0;
+            close_sent = false;
+            http_conn::init(_socket_fd,_addr,_epoll_fd,et,_one_shot,cq,add);
+        }
+        void close() override
+        {
+            std::vector<websocket_group*> joined;
+            {
+                std::lock_guard<std::mutex> guard(group_mtx);
+                joined.swap(groups);
+            }
+            for(websocket_group* g : joined) g->leave(this);
+            {
+                std::lock_guard<std::mutex> guard(out_mtx);
+                if(state == OPEN && !close_sent && !out_closed && conn::draining())
+                {
+                    char payload[2] = {(char)(WS_GOING_AWAY >> 8),(char)WS_GOING_AWAY};
+                    close_sent = true;
+                    out_queue.push_back({websocket_make_frame(WS_CLOSE,payload,2),0});
+                }
+                if(state != HTTP && !out_queue.empty()) _drain_();
+                out_closed = true;
+                out_queue.clear();
+                out_bytes = 0;
+            }
+            state = HTTP;
+            http_conn::close();
+        }
+        /* an open websocket waits only for its queued frames while draining */
+        bool in_flight() const override
+        {
+            if(state == HTTP) return http_conn::in_flight();
+            return out_bytes > 0;
+        }
+        bool process_in() override
+        {
+            if(state == HTTP) return http_conn::process_in();
+            std::lock_guard<std::mutex> in_guard(in_mtx);
+            if(state != OPEN) return true;
+            std::string data;
+            if(!recv_all(data))
+            {
+                notify_close();
+                return false;
+            }
+            in += data;
+            if(!_on_frames_()) return true;
+            std::lock_guard<std::mutex> guard(out_mtx);
+            _rearm_();
+            return true;
+        }
+        bool process_out() override
+        {
+            if(state == HTTP)
+            {
+                if(_wants_upgrade_()) return _open_();
+                return http_conn::process_out();
+            }
+            std::lock_guard<std::mutex> guard(out_mtx);
+            if(!_drain_())
+            {
+                out_closed = true;
+                notify_close();
+                return false;
+            }
+            _rearm_();
+            return true;
+        }
+
+        friend class websocket_group;
+    };
+    std::atomic<int> websocket_conn::websocket_max_message{configure::get_config()["websocket_max_message"].type == JSON_NULL ?
+                                                16 * 1024 * 1024 : (int32_t)configure::get_config()["websocket_max_message"]};
+    std::atomic<int> websocket_conn::websocket_max_pending{configure::get_config()["websocket_max_pending"].type == JSON_NULL ?
+                                                4 * 1024 * 1024 : (int32_t)configure::get_config()["websocket_max_pending"]};
+    std::atomic<int> websocket_conn::websocket_idle_timeout{configure::get_config()["websocket_idle_timeout"].type == JSON_NULL ?
+                                                 0 : (int32_t)configure::get_config()["websocket_idle_timeout"]};
+    bool websocket_conn::reload_hooked = configure::get_config().on_reload([] {
+        configure& conf = configure::get_config();
+        websocket_max_message = conf["websocket_max_message"].type == JSON_NULL ?
+                                16 * 1024 * 1024 : (int32_t)conf["websocket_max_message"];
+        websocket_max_pending = conf["websocket_max_pending"].type == JSON_NULL ?
+                                4 * 1024 * 1024 : (int32_t)conf["websocket_max_pending"];
+        websocket_idle_timeout = conf["websocket_idle_timeout"].type == JSON_NULL ?
+                                 0 : (int32_t)conf["websocket_idle_timeout"];
+    });
+
+    void websocket_group::join(websocket_conn* c)
+    {
+        {
+            std::lock_guard<std::mutex> guard(mtx);
+            if(!members.insert(c).second) return;
+        }
+        std::lock_guard<std::mutex> guard(c->group_mtx);
+        c->groups.push_back(this);
+    }
+    void websocket_group::leave(websocket_conn* c)
+    {
+        {
+            std::lock_guard<std::mutex> guard(mtx);
+            members.erase(c);
+        }
+        std::lock_guard<std::mutex> guard(c->group_mtx);
+        auto it = std::find(c->groups.begin(),c->groups.end(),this);
+        if(it != c->groups.end()) c->groups.erase(it);
+    }
+    size_t websocket_group::broadcast(const websocket_frame& frame)
+    {
+        std::lock_guard<std::mutex> guard(mtx);
+        size_t count = 0;
+        for(websocket_conn* c : members)
+        {
+            if(c->queue(frame)) count++;
+        }
+        return count;
+    }
+
+    template<class T>
+    class conv_websocket_multi : conv_multi<T>
+    {
+        static_assert(std::is_base_of<websocket_conn,T>::value,"must derived from class hzd::websocket_conn.");
+    public:
+        void wait(int time_out=5) override
+        {
+            LOG_INFO("running at: ws://127.0.0.1:" + std::to_string(this->port));
+            http_conn::build_routers();
+            conv_multi<T>::wait(time_out);
+        }
+    };
+
+    template<class T>
+    class conv_websocket_single : conv_single<T>
+    {
+        static_assert(std::is_base_of<websocket_conn,T>::value,"must derived from class hzd::websocket_conn.");
+    public:
+        void wait(int time_out=5) override
+        {
+            LOG_INFO("running at: ws://127.0.0.1:" + std::to_string(this->port));
+            http_conn::build_routers();
+            conv_single<T>::wait(time_out);
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,526 @@
+#ifndef CONV_EVENT_RPC_CONN_H
+#define CONV_EVENT_RPC_CONN_H
+
+#include "core/include/conn.h"  /* conn */
+#include "core/conv_single.h"   /* conv_single */
+#include "core/conv_multi.h"    /* conv_multi */
+#include <mutex>                /* mutex */
+#include <memory>               /* shared_ptr */
+#include <future>               /* promise future */
+#include <thread>               /* thread */
+#include <functional>           /* function */
+#include <unordered_map>        /* unordered_map */
+#include <netinet/tcp.h>        /* TCP_NODELAY */
+
+namespace hzd {
+
+    enum rpc_Type : uint8_t { RPC_REQUEST = 0, RPC_RESPONSE = 1 };
+
+    enum rpc_Status : uint8_t
+    {
+        RPC_OK = 0,
+        RPC_NO_METHOD = 1,
+        RPC_ERROR = 2,
+        RPC_BAD_REQUEST = 3,
+        RPC_BUSY = 4,
+        RPC_CLOSED = 5,
+    };
+
+    /* follows hzd::header inside every frame,method name and body come after it */
+    #pragma pack(1)
+    struct rpc_header           /* 12 byte */
+    {
+        uint64_t id;            /* chosen by client,echoed in response */
+        uint8_t type;           /* rpc_Type */
+        uint8_t status;         /* rpc_Status,0 in requests */
+        uint16_t method_size;   /* 0 in responses */
+    };
+    #define RPC_HEADER_SIZE sizeof(rpc_header)
+    #pragma pack()
+
+    /* result of one call on rpc_client */
+    struct rpc_result
+    {
+        rpc_Status status{RPC_CLOSED};
+        std::string body;
+    };
+
+    /**
+      * @brief shared state between a connection and the calls it dispatched
+      * @note owner is cleared under mtx when the connection closes,
+      *       so calls finishing later drop their response instead of touching a reused conn.
+      *       calls counts the dispatched calls whose response isn't written yet
+      */
+    class rpc_conn;
+    struct rpc_session
+    {
+        std::mutex mtx;
+        rpc_conn* owner{nullptr};
+        std::string out;
+        size_t out_offset{0};
+        bool corked{false};
+        std::atomic<int> calls{0};
+    };
+
+    /**
+      * @brief server side of the rpc protocol
+      * @note requests are hzd::header frames carrying rpc_header + method name + body,
+      *       every request is run on the rpc worker pool so one connection may have many
+      *       calls in flight and responses go back in completion order,matched by id.
+      *       with "rpc_thread_count" 0 calls run inline in the reactor thread,in order.
+      */
+    class rpc_conn : public conn {
+    public:
+        #define RPC_METHOD(m) m static_##m;
+        class method
+        {
+        public:
+            std::string name;
+            explicit method(std::string&& _name) : name(std::move(_name))
+            {
+                register_method(this);
+            }
+            /**
+              * @brief run method
+              * @note called concurrently from worker threads
+              * @param request request body
+              * @param response response body
+              * @retval status sent with the response
+              */
+            virtual rpc_Status call(const std::string& request,std::string& response) = 0;
+        };
+
+        static int rpc_thread_count;
+        static int rpc_max_pending;
+        static int rpc_max_frame;
+
+        static void register_method(method* m)
+        {
+            if(!m) return;
+            if(methods().count(m->name)) LOG_WARN("rpc method " + m->name + " registered twice");
+            methods()[m->name] = m;
+        }
+    private:
+        /* one dispatched request,run by the worker pool */
+        struct call
+        {
+            std::shared_ptr<rpc_session> session;
+            method* m;
+            uint64_t id;
+            std::string body;
+            bool process()
+            {
+                std::string response;
+                rpc_Status status = m->call(body,response);
+                reply(session,id,status,response);
+                session->calls--;
+                delete this;
+                return true;
+            }
+        };
+
+        std::shared_ptr<rpc_session> session;
+        std::mutex in_mtx;
+        frame_reader reader{(size_t)rpc_max_frame};
+
+        static std::unordered_map<std::string,method*>& methods()
+        {
+            static std::unordered_map<std::string,method*> table;
+            return table;
+        }
+        /* joined at exit,after the calls they are running */
+        static threadpool<call>* workers()
+        {
+            static std::unique_ptr<threadpool<call>> pool{rpc_thread_count > 0 ? new threadpool<call>(rpc_thread_count) : nullptr};
+            return pool.get();
+        }
+        /**
+          * @brief write all buffered output that fits into the socket (session locked)
+          * @note None
+          * @param None
+          * @retval false on socket error
+          */
+        bool _flush_()
+        {
+            std::string& out = session->out;
+            while(session->out_offset < out.size())
+            {
+                ssize_t n = ::send(socket_fd,out.data() + session->out_offset,out.size() - session->out_offset,MSG_NOSIGNAL);
+                if(n > 0)
+                {
+                    metrics::count(M_BYTES_OUT,n);
+                    session->out_offset += n;
+                    continue;
+                }
+                if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+                return false;
+            }
+            if(session->out_offset == out.size())
+            {
+                out.clear();
+                session->out_offset = 0;
+            }
+            return true;
+        }
+        /**
+          * @brief register next event,EPOLLOUT while output is buffered (session locked)
+          * @note None
+          * @param None
+          * @retval None
+          */
+        void _rearm_()
+        {
+            next(EPOLLIN | (session->out.empty() ? 0u : (uint32_t)EPOLLOUT));
+        }
+        /**
+          * @brief send one response (session locked)
+          * @note header,rpc_header and body go out by one sendmsg when nothing is buffered,
+          *       otherwise they are appended and flushed with the rest
+          * @param id request id
+          * @param status status
+          * @param body response body
+          * @retval None
+          */
+        void _write_(uint64_t id,rpc_Status status,const std::string& body)
+        {
+            header h{RPC_HEADER_SIZE + body.size()};
+            rpc_header r{id,RPC_RESPONSE,status,0};
+            std::string& out = session->out;
+            size_t skip = 0;
+            if(out.empty() && !session->corked)
+            {
+                iovec iov[3] = {{&h,HEADER_SIZE},{&r,RPC_HEADER_SIZE},{(void*)body.data(),body.size()}};
+                msghdr msg{};
+                msg.msg_iov = iov;
+                msg.msg_iovlen = 3;
+                ssize_t n = ::sendmsg(socket_fd,&msg,MSG_NOSIGNAL);
+                if(n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+                {
+                    notify_close();
+                    return;
+                }
+                skip = n < 0 ? 0 : (size_t)n;
+                metrics::count(M_BYTES_OUT,skip);
+                if(skip == h.size + HEADER_SIZE) return;
+            }
+            std::string frame;
+            frame.reserve(HEADER_SIZE + RPC_HEADER_SIZE + body.size());
+            frame.append((const char*)&h,HEADER_SIZE);
+            frame.append((const char*)&r,RPC_HEADER_SIZE);
+            frame.append(body);
+            out.append(frame,skip,std::string::npos);
+            if(out.size() - session->out_offset > (size_t)rpc_max_pending)
+            {
+                LOG_WARN("rpc peer too slow,closed");
+                notify_close();
+                return;
+            }
+            if(!session->corked) _rearm_();
+        }
+        /**
+          * @brief send response of a call
+          * @note callable from any thread,dropped when the connection is already closed
+          * @param s session of connection
+          * @param id request id
+          * @param status status
+          * @param body response body
+          * @retval None
+          */
+        static void reply(const std::shared_ptr<rpc_session>& s,uint64_t id,rpc_Status status,const std::string& body)
+        {
+            std::lock_guard<std::mutex> guard(s->mtx);
+            if(s->owner) s->owner->_write_(id,status,body);
+        }
+        /**
+          * @brief dispatch one request frame
+          * @note None
+          * @param frame frame payload
+          * @retval false on malformed frame
+          */
+        bool _dispatch_(const frame_view& frame)
+        {
+            rpc_header r{};
+            if(frame.size < RPC_HEADER_SIZE) return false;
+            memcpy(&r,frame.data,RPC_HEADER_SIZE);
+            if(r.type != RPC_REQUEST || frame.size - RPC_HEADER_SIZE < r.method_size) return false;
+            std::string name(frame.data + RPC_HEADER_SIZE,r.method_size);
+            auto it = methods().find(name);
+            if(it == methods().end())
+            {
+                reply(session,r.id,RPC_NO_METHOD,std::string());
+                return true;
+            }
+            size_t offset = RPC_HEADER_SIZE + r.method_size;
+            auto* c = new call{session,it->second,r.id,std::string(frame.data + offset,frame.size - offset)};
+            session->calls++;
+            threadpool<call>* pool = workers();
+            if(!pool)
+            {
+                c->process();
+                return true;
+            }
+            if(!pool->add(c))
+            {
+                reply(session,r.id,RPC_BUSY,std::string());
+                session->calls--;
+                delete c;
+            }
+            return true;
+        }
+    public:
+        void init(int _socket_fd,sockaddr_in* _addr,int _epoll_fd,bool et,bool _one_shot,lock_queue<int>* cq = nullptr,bool add = true) override
+        {
+            reader.clear();
+            session = std::make_shared<rpc_session>();
+            session->owner = this;
+            int opt = 1;
+            setsockopt(_socket_fd,IPPROTO_TCP,TCP_NODELAY,&opt,sizeof(opt));
+            conn::init(_socket_fd,_addr,_epoll_fd,et,_one_shot,cq,add);
+        }
+        void close() override
+        {
+            if(session)
+            {
+                std::lock_guard<std::mutex> guard(session->mtx);
+                session->owner = nullptr;
+                session->out.clear();
+            }
+            session.reset();
+            conn::close();
+        }
+        /* calls still run by the workers or responses still buffered keep it open */
+        bool in_flight() const override
+        {
+            if(!session) return conn::in_flight();
+            if(session->calls > 0) return true;
+            std::lock_guard<std::mutex> guard(session->mtx);
+            return !session->out.empty() || conn::in_flight();
+        }
+        bool process_in() override
+        {
+            std::lock_guard<std::mutex> in_guard(in_mtx);
+            if(!session) return false;
+            bool ok = recv_frames(reader);
+            {
+                std::lock_guard<std::mutex> guard(session->mtx);
+                session->corked = true;
+            }
+            frame_view frame{};
+            bool valid = true;
+            while(valid && reader.next(frame)) valid = _dispatch_(frame);
+            std::lock_guard<std::mutex> guard(session->mtx);
+            session->corked = false;
+            if(!ok || !valid || reader.bad() || !_flush_())
+            {
+                notify_close();
+                return false;
+            }
+            _rearm_();
+            return true;
+        }
+        bool process_out() override
+        {
+            if(!session) return false;
+            std::lock_guard<std::mutex> guard(session->mtx);
+            if(!_flush_())
+            {
+                notify_close();
+                return false;
+            }
+            _rearm_();
+            return true;
+        }
+    };
+    int rpc_conn::rpc_thread_count = configure::get_config()["rpc_thread_count"].type == JSON_NULL ?
+                                     8 : (int32_t)configure::get_config()["rpc_thread_count"];
+    int rpc_conn::rpc_max_pending = configure::get_config()["rpc_max_pending"].type == JSON_NULL ?
+                                    16 * 1024 * 1024 : (int32_t)configure::get_config()["rpc_max_pending"];
+    int rpc_conn::rpc_max_frame = configure::get_config()["rpc_max_frame"].type == JSON_NULL ?
+                                  16 * 1024 * 1024 : (int32_t)configure::get_config()["rpc_max_frame"];
+
+    /**
+      * @brief blocking rpc client with pipelining
+      * @note any number of threads may call at once over one connection,
+      *       requests are written as they come and a reader thread completes them by id
+      */
+    class rpc_client {
+        int fd{-1};
+        std::mutex write_mtx;
+        std::mutex pending_mtx;
+        std::unordered_map<uint64_t,std::function<void(rpc_result&&)>> pending;
+        uint64_t next_id{1};
+        bool closed{false};
+        std::thread reader_thread;
+
+        /**
+          * @brief complete responses until the connection closes
+          * @note None
+          * @param None
+          * @retval None
+          */
+        void _read_loop_()
+        {
+            frame_reader reader;
+            frame_view frame{};
+            for(;;)
+            {
+                int ret = reader.fill(fd);
+                while(reader.next(frame))
+                {
+                    rpc_header r{};
+                    if(frame.size < RPC_HEADER_SIZE) { ret = -1; break; }
+                    memcpy(&r,frame.data,RPC_HEADER_SIZE);
+                    std::function<void(rpc_result&&)> done;
+                    {
+                        std::lock_guard<std::mutex> guard(pending_mtx);
+                        auto it = pending.find(r.id);
+                        if(it == pending.end()) continue;
+                        done = std::move(it->second);
+                        pending.erase(it);
+                    }
+                    rpc_result result;
+                    result.status = (rpc_Status)r.status;
+                    result.body.assign(frame.data + RPC_HEADER_SIZE,frame.size - RPC_HEADER_SIZE);
+                    done(std::move(result));
+                }
+                if(ret <= 0 || reader.bad()) break;
+            }
+            std::unordered_map<uint64_t,std::function<void(rpc_result&&)>> left;
+            {
+                std::lock_guard<std::mutex> guard(pending_mtx);
+                closed = true;
+                left.swap(pending);
+            }
+            for(auto& p : left) p.second(rpc_result());
+        }
+    public:
+        rpc_client() = default;
+        rpc_client(const rpc_client&) = delete;
+        rpc_client& operator=(const rpc_client&) = delete;
+        ~rpc_client() { close(); }
+
+        /**
+          * @brief connect to rpc server
+          * @note a connected client is refused,close() it first
+          * @param ip server ip
+          * @param port server port
+          * @retval success or not
+          */
+        bool connect(const std::string& ip,uint16_t port)
+        {
+            if(fd != -1 || reader_thread.joinable()) return false;
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(port);
+            if(inet_pton(AF_INET,ip.c_str(),&addr.sin_addr) != 1) return false;
+            fd = socket(AF_INET,SOCK_STREAM | SOCK_CLOEXEC,0);
+            if(fd < 0) return false;
+            if(::connect(fd,(sockaddr*)&addr,sizeof(addr)) != 0)
+            {
+                ::close(fd);
+                fd = -1;
+                return false;
+            }
+            int opt = 1;
+            setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&opt,sizeof(opt));
+            closed = false;
+            reader_thread = std::thread(&rpc_client::_read_loop_,this);
+            return true;
+        }
+        void close()
+        {
+            if(fd == -1) return;
+            shutdown(fd,SHUT_RDWR);
+            if(reader_thread.joinable()) reader_thread.join();
+            ::close(fd);
+            fd = -1;
+        }
+        /**
+          * @brief send request,done is called from the reader thread with the result
+          * @note done gets RPC_CLOSED when the connection fails first
+          * @param name method name
+          * @param body request body
+          * @param done completion
+          * @retval None
+          */
+        void call_async(const std::string& name,const std::string& body,std::function<void(rpc_result&&)> done)
+        {
+            uint64_t id;
+            {
+                std::lock_guard<std::mutex> guard(pending_mtx);
+                if(closed || fd == -1)
+                {
+                    done(rpc_result());
+                    return;
+                }
+                id = next_id++;
+                pending.emplace(id,std::move(done));
+            }
+            header h{RPC_HEADER_SIZE + name.size() + body.size()};
+            rpc_header r{id,RPC_REQUEST,RPC_OK,(uint16_t)name.size()};
+            iovec iov[4] = {{&h,HEADER_SIZE},{&r,RPC_HEADER_SIZE},
+                            {(void*)name.data(),name.size()},{(void*)body.data(),body.size()}};
+            size_t total = HEADER_SIZE + h.size;
+            size_t sent = 0;
+            std::lock_guard<std::mutex> guard(write_mtx);
+            while(sent < total)
+            {
+                iovec vec[4];
+                int n = 0;
+                size_t skip = sent;
+                for(auto& v : iov)
+                {
+                    if(skip >= v.iov_len) { skip -= v.iov_len; continue; }
+                    vec[n].iov_base = (char*)v.iov_base + skip;
+                    vec[n++].iov_len = v.iov_len - skip;
+                    skip = 0;
+                }
+                msghdr msg{};
+                msg.msg_iov = vec;
+                msg.msg_iovlen = n;
+                ssize_t ret = ::sendmsg(fd,&msg,MSG_NOSIGNAL);
+                if(ret <= 0)
+                {
+                    if(ret < 0 && errno == EINTR) continue;
+                    shutdown(fd,SHUT_RDWR);
+                    return;
+                }
+                metrics::count(M_BYTES_OUT,ret);
+                sent += ret;
+            }
+        }
+        std::future<rpc_result> call_future(const std::string& name,const std::string& body)
+        {
+            auto p = std::make_shared<std::promise<rpc_result>>();
+            std::future<rpc_result> f = p->get_future();
+            call_async(name,body,[p](rpc_result&& r){ p->set_value(std::move(r)); });
+            return f;
+        }
+        rpc_result call(const std::string& name,const std::string& body)
+        {
+            return call_future(name,body).get();
+        }
+    };
+
+    class conv_rpc_multi : conv_multi<rpc_conn>
+    {
+    public:
+        void wait(int time_out=5) override
+        {
+            LOG_INFO("rpc running at: 127.0.0.1:" + std::to_string(port));
+            conv_multi<rpc_conn>::wait(time_out);
+        }
+    };
+
+    class conv_rpc_single : conv_single<rpc_conn>
+    {
+    public:
+        void wait(int time_out=5) override
+        {
+            LOG_INFO("rpc running at: 127.0.0.1:" + std::to_string(port));
+            conv_single<rpc_conn>::wait(time_out);
+        }
+    };
+}
+
+#endif
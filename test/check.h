@@ -0,0 +1,95 @@
+#ifndef CONV_EVENT_TEST_CHECK_H
+#define CONV_EVENT_TEST_CHECK_H
+
+#include "core/include/conn.h"
+#include <cstdio>
+#include <string>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+/* failed checks are printed and counted,main returns check_failures() */
+inline int& check_failures()
+{
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(cond) do                                                          \
+{                                                                               \
+    if(!(cond))                                                                 \
+    {                                                                           \
+        fprintf(stderr,"%s:%d: CHECK(%s) failed\n",__FILE__,__LINE__,#cond);    \
+        check_failures()++;                                                     \
+    }                                                                           \
+}while(0)
+
+/**
+  * @brief a conn of type T on one end of a socketpair,the test is the peer on the other end
+  * @note the conn is on no epoll,drive() hands it events the way a reactor does.
+  *       blocking reads of the peer give up after 5 seconds
+  */
+template<class T>
+class conn_pair
+{
+    int sv[2]{-1,-1};
+    sockaddr_in addr{};
+public:
+    T* c{nullptr};
+
+    conn_pair()
+    {
+        if(socketpair(AF_UNIX,SOCK_STREAM,0,sv) != 0) return;
+        fcntl(sv[0],F_SETFL,fcntl(sv[0],F_GETFL) | O_NONBLOCK);
+        timeval tv{5,0};
+        setsockopt(sv[1],SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));
+        c = new T;
+        c->init(sv[0],&addr,-1,false,true,nullptr,false);
+    }
+    ~conn_pair()
+    {
+        /* close() of the conn closes its end */
+        if(c) c->close();
+        delete c;
+        close_peer();
+    }
+    conn_pair(const conn_pair&) = delete;
+    conn_pair& operator=(const conn_pair&) = delete;
+
+    int peer() const { return sv[1]; }
+    /* write all of data from the peer */
+    bool send(const std::string& data)
+    {
+        return ::send(sv[1],data.data(),data.size(),MSG_NOSIGNAL) == (ssize_t)data.size();
+    }
+    /* everything waiting for the peer,without blocking */
+    std::string read()
+    {
+        std::string data;
+        char buffer[65536];
+        ssize_t n;
+        while((n = ::recv(sv[1],buffer,sizeof(buffer),MSG_DONTWAIT)) > 0) data.append(buffer,n);
+        return data;
+    }
+    /* the peer sends nothing more */
+    void shutdown_peer() { ::shutdown(sv[1],SHUT_WR); }
+    void close_peer()
+    {
+        if(sv[1] != -1) ::close(sv[1]);
+        sv[1] = -1;
+    }
+};
+
+/**
+  * @brief let c handle one event the way its reactor would
+  * @param c connection
+  * @param status hzd::conn::IN,OUT,...
+  * @retval what process() returned
+  */
+inline bool drive(hzd::conn* c,hzd::conn::Status status)
+{
+    c->status = status;
+    return c->process();
+}
+
+#endif
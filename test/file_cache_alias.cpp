@@ -0,0 +1,77 @@
+/**
+  * @brief every url naming a cached file shares its entry and loses it when the file changes
+  * @note "//x.txt" used to get an entry of its own that no change dropped,and a directory
+  *       reached through a symlink only invalidated the url it was first loaded by
+  */
+#include "http/file_cache.h"
+#include "test/check.h"
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+
+namespace {
+
+    void write_file(const std::string& name,const std::string& text)
+    {
+        std::ofstream out(name,std::ios::trunc);
+        out << text;
+    }
+
+    /* the watcher polls every 500ms,give it a few rounds */
+    bool dropped(hzd::file_cache& cache,const std::string& url)
+    {
+        for(int i = 0;i < 40;i++)
+        {
+            if(!cache.acquire(url)) return true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        return false;
+    }
+}
+
+int main()
+{
+    CHECK(hzd::file_cache::normalize("//img/./x.png") == "/img/x.png");
+    CHECK(hzd::file_cache::normalize("/img//x.png/.") == "/img/x.png");
+    CHECK(hzd::file_cache::normalize("/.well-known/x") == "/.well-known/x");
+    CHECK(hzd::file_cache::normal("/.well-known/x"));
+    CHECK(!hzd::file_cache::normal("/a/./b"));
+
+    char root_template[] = "/tmp/file_cache_alias.XXXXXX";
+    char* root = mkdtemp(root_template);
+    CHECK(root != nullptr);
+    if(!root) return 1;
+    std::string base = root;
+    CHECK(system(("mkdir " + base + "/real && ln -s real " + base + "/link").c_str()) == 0);
+    write_file(base + "/x.txt","one");
+    write_file(base + "/real/y.txt","one");
+
+    {
+        hzd::file_cache cache;
+
+        /* aliases of one url are one entry */
+        auto e = cache.load("//x.txt",base + "//x.txt","text/plain");
+        CHECK(e && e->content == "one");
+        CHECK(cache.acquire("/x.txt") == e);
+        CHECK(cache.acquire("/./x.txt") == e);
+        write_file(base + "/x.txt","two");
+        CHECK(dropped(cache,"/x.txt"));
+        CHECK(!cache.acquire("//x.txt"));
+        e = cache.load("/x.txt",base + "/x.txt","text/plain");
+        CHECK(e && e->content == "two");
+
+        /* one directory by two paths,a change drops the file under both */
+        auto real = cache.load("/real/y.txt",base + "/real/y.txt","text/plain");
+        auto link = cache.load("/link/y.txt",base + "/link/y.txt","text/plain");
+        CHECK(real && link && real != link);
+        write_file(base + "/real/y.txt","two");
+        CHECK(dropped(cache,"/real/y.txt"));
+        CHECK(dropped(cache,"/link/y.txt"));
+    }
+
+    CHECK(system(("rm -rf " + base).c_str()) == 0);
+    if(check_failures() == 0) printf("file_cache_alias ok\n");
+    return check_failures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,150 @@
+/**
+  * @brief receive flow control of h2c : whole DATA frames are charged,padding and served bodies
+  *        are given back,a body past http2_max_body is answered 413
+  * @note test/conf/http2_flow_control.json sets http2_max_body to 100000
+  */
+#include "http/http2_conn.h"
+#include "test/check.h"
+#include <string>
+#include <vector>
+
+namespace {
+
+    struct frame
+    {
+        uint8_t type;
+        uint8_t flags;
+        uint32_t id;
+        std::string payload;
+    };
+
+    uint32_t u32(const std::string& s,size_t at)
+    {
+        auto* p = (const uint8_t*)s.data() + at;
+        return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+    }
+
+    void put_frame(std::string& out,uint8_t type,uint8_t flags,uint32_t id,const std::string& payload)
+    {
+        size_t n = payload.size();
+        char h[9] = {(char)(n >> 16),(char)(n >> 8),(char)n,(char)type,(char)flags,
+                     (char)(id >> 24),(char)(id >> 16),(char)(id >> 8),(char)id};
+        out.append(h,9);
+        out += payload;
+    }
+
+    class client {
+        conn_pair<hzd::http2_conn> pair;
+        std::string received;
+    public:
+        /* send bytes,let the connection handle them,return the frames it answered */
+        std::vector<frame> exchange(const std::string& data)
+        {
+            std::vector<frame> frames;
+            if(!pair.send(data)) return frames;
+            drive(pair.c,hzd::conn::IN);
+            received += pair.read();
+            size_t cursor = 0;
+            while(received.size() - cursor >= 9)
+            {
+                auto* h = (const uint8_t*)received.data() + cursor;
+                size_t length = ((size_t)h[0] << 16) | ((size_t)h[1] << 8) | h[2];
+                if(received.size() - cursor < 9 + length) break;
+                frames.push_back({h[3],h[4],u32(received,cursor + 5) & 0x7fffffff,received.substr(cursor + 9,length)});
+                cursor += 9 + length;
+            }
+            received.erase(0,cursor);
+            return frames;
+        }
+    };
+
+    std::string request_headers(hzd::hpack_encoder& encoder,const char* method)
+    {
+        std::string block;
+        encoder.encode(":method",method,block);
+        encoder.encode(":scheme","http",block);
+        encoder.encode(":path","/upload",block);
+        encoder.encode(":authority","localhost",block);
+        return block;
+    }
+
+    const frame* find(const std::vector<frame>& frames,uint8_t type,uint32_t id)
+    {
+        for(const auto& f : frames) if(f.type == type && f.id == id) return &f;
+        return nullptr;
+    }
+
+    /* sum of WINDOW_UPDATE increments on a stream (0 is the connection) */
+    uint64_t window_updates(const std::vector<frame>& frames,uint32_t id)
+    {
+        uint64_t sum = 0;
+        for(const auto& f : frames) if(f.type == hzd::H2_WINDOW_UPDATE && f.id == id) sum += u32(f.payload,0);
+        return sum;
+    }
+
+    std::string status_of(hzd::hpack_decoder& decoder,const frame* f)
+    {
+        if(!f) return {};
+        std::vector<hzd::hpack_field> fields;
+        if(!decoder.decode((const uint8_t*)f->payload.data(),f->payload.size(),fields)) return {};
+        for(const auto& p : fields) if(p.first == ":status") return p.second;
+        return {};
+    }
+}
+
+int main()
+{
+    int64_t window = hzd::http2_conn::max_body + 1;
+    CHECK(hzd::http2_conn::max_body == 100000);
+
+    client h2;
+    hzd::hpack_encoder encoder;
+    hzd::hpack_decoder decoder;
+    std::string data(HTTP2_PREFACE,HTTP2_PREFACE_SIZE);
+    put_frame(data,hzd::H2_SETTINGS,0,0,"");
+    auto frames = h2.exchange(data);
+
+    /* SETTINGS announce the stream window,the connection window is opened as wide */
+    const frame* settings = find(frames,hzd::H2_SETTINGS,0);
+    CHECK(settings && settings->payload.size() == 18);
+    CHECK(settings && (uint8_t)settings->payload[7] == hzd::H2_INITIAL_WINDOW_SIZE && u32(settings->payload,8) == window);
+    CHECK(window_updates(frames,0) == (uint64_t)(window - HTTP2_DEFAULT_WINDOW));
+
+    /* padding is given back on both windows at once,the body only to the connection once served */
+    data.clear();
+    put_frame(data,hzd::H2_HEADERS,hzd::H2_END_HEADERS,1,request_headers(encoder,"POST"));
+    put_frame(data,hzd::H2_DATA,hzd::H2_PADDED,1,std::string(1,(char)10) + std::string(100,'a') + std::string(10,'\0'));
+    frames = h2.exchange(data);
+    CHECK(window_updates(frames,1) == 11);
+    CHECK(window_updates(frames,0) == 11);
+    data.clear();
+    put_frame(data,hzd::H2_DATA,hzd::H2_END_STREAM,1,std::string(20,'b'));
+    frames = h2.exchange(data);
+    CHECK(window_updates(frames,1) == 0);
+    CHECK(window_updates(frames,0) == 120);
+    CHECK(!status_of(decoder,find(frames,hzd::H2_HEADERS,1)).empty());
+
+    /* a body past http2_max_body is answered 413,the stream is stopped and all its bytes given back */
+    data.clear();
+    put_frame(data,hzd::H2_HEADERS,hzd::H2_END_HEADERS,3,request_headers(encoder,"POST"));
+    /* max_body + 1 bytes fill both windows exactly */
+    for(int i = 0;i < 6;i++) put_frame(data,hzd::H2_DATA,0,3,std::string(16384,'c'));
+    put_frame(data,hzd::H2_DATA,0,3,std::string(window - 6 * 16384,'c'));
+    frames = h2.exchange(data);
+    CHECK(status_of(decoder,find(frames,hzd::H2_HEADERS,3)) == "413");
+    const frame* rst = find(frames,hzd::H2_RST_STREAM,3);
+    CHECK(rst && u32(rst->payload,0) == hzd::H2_NO_ERROR);
+    CHECK(window_updates(frames,0) == (uint64_t)window);
+    CHECK(find(frames,hzd::H2_GOAWAY,0) == nullptr);
+
+    /* the rest of a stopped body is refused but still given back to the connection */
+    data.clear();
+    put_frame(data,hzd::H2_DATA,hzd::H2_END_STREAM,3,std::string(500,'d'));
+    frames = h2.exchange(data);
+    rst = find(frames,hzd::H2_RST_STREAM,3);
+    CHECK(rst && u32(rst->payload,0) == hzd::H2_STREAM_CLOSED);
+    CHECK(window_updates(frames,0) == 500);
+
+    if(check_failures() == 0) printf("http2_flow_control ok\n");
+    return check_failures() == 0 ? 0 : 1;
+}
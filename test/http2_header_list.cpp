@@ -0,0 +1,91 @@
+/**
+  * @brief decoded header fields of a block are bounded,not only its encoded size
+  * @note one indexed 4000 byte field referenced again by one byte each used to decode to
+  *       hundreds of MB from a block under HTTP2_MAX_HEADER_BLOCK
+  */
+#include "http/http2_conn.h"
+#include "test/check.h"
+#include <string>
+#include <vector>
+
+namespace {
+
+    void put_frame(std::string& out,uint8_t type,uint8_t flags,uint32_t id,const std::string& payload)
+    {
+        size_t n = payload.size();
+        char h[9] = {(char)(n >> 16),(char)(n >> 8),(char)n,(char)type,(char)flags,
+                     (char)(id >> 24),(char)(id >> 16),(char)(id >> 8),(char)id};
+        out.append(h,9);
+        out += payload;
+    }
+
+    /* a literal field added to the dynamic table,then references to it (index 62) */
+    std::string expanding_block(size_t references)
+    {
+        hzd::hpack_encoder encoder;
+        std::string block;
+        encoder.encode(":method","GET",block);
+        encoder.encode(":scheme","http",block);
+        encoder.encode(":path","/",block);
+        encoder.encode("x-big",std::string(4000,'v'),block);
+        block.append(references,(char)0xBE);
+        return block;
+    }
+
+    /* error code of the GOAWAY closing data,-1 without one */
+    int64_t goaway_error(const std::string& data)
+    {
+        if(data.size() < 17) return -1;
+        const auto* f = (const uint8_t*)data.data() + data.size() - 17;
+        if(f[3] != hzd::H2_GOAWAY || f[2] != 8) return -1;
+        return ((uint32_t)f[13] << 24) | ((uint32_t)f[14] << 16) | ((uint32_t)f[15] << 8) | f[16];
+    }
+}
+
+int main()
+{
+    /* the decoder stops at max_list_size,and tells that was the reason */
+    {
+        std::string block = expanding_block(100);
+        hzd::hpack_decoder decoder;
+        std::vector<hzd::hpack_field> fields;
+        CHECK(!decoder.decode((const uint8_t*)block.data(),block.size(),fields,HTTP2_MAX_HEADER_LIST));
+        CHECK(decoder.list_too_large());
+        CHECK(fields.size() < 104);
+        hzd::hpack_decoder unbounded;
+        fields.clear();
+        CHECK(unbounded.decode((const uint8_t*)block.data(),block.size(),fields));
+        CHECK(fields.size() == 104);
+        hzd::hpack_decoder bad;
+        const uint8_t garbage[] = {0xFF};
+        CHECK(!bad.decode(garbage,1,fields,HTTP2_MAX_HEADER_LIST) && !bad.list_too_large());
+    }
+    /* SETTINGS announce the limit,a block past it closes the connection */
+    {
+        conn_pair<hzd::http2_conn> pair;
+        std::string data(HTTP2_PREFACE,HTTP2_PREFACE_SIZE);
+        put_frame(data,hzd::H2_SETTINGS,0,0,"");
+        CHECK(pair.send(data));
+        drive(pair.c,hzd::conn::IN);
+        std::string answer = pair.read();
+        std::string limit{0,(char)hzd::H2_MAX_HEADER_LIST_SIZE,0,1,0,0};
+        CHECK(answer.find(limit) != std::string::npos);
+
+        data.clear();
+        /* HEADERS and CONTINUATION of the peer's default max frame size */
+        std::string block = expanding_block(60000);
+        for(size_t at = 0;at < block.size();at += HTTP2_DEFAULT_FRAME_SIZE)
+        {
+            uint8_t flags = at + HTTP2_DEFAULT_FRAME_SIZE >= block.size() ? hzd::H2_END_HEADERS : 0;
+            if(at == 0) put_frame(data,hzd::H2_HEADERS,flags | hzd::H2_END_STREAM,1,block.substr(at,HTTP2_DEFAULT_FRAME_SIZE));
+            else put_frame(data,hzd::H2_CONTINUATION,flags,1,block.substr(at,HTTP2_DEFAULT_FRAME_SIZE));
+        }
+        CHECK(pair.send(data));
+        CHECK(!drive(pair.c,hzd::conn::IN));
+        CHECK(pair.c->status == hzd::conn::CLOSE);
+        CHECK(goaway_error(pair.read()) == hzd::H2_ENHANCE_YOUR_CALM);
+    }
+
+    if(check_failures() == 0) printf("http2_header_list ok\n");
+    return check_failures() == 0 ? 0 : 1;
+}
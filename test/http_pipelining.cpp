@@ -0,0 +1,81 @@
+/**
+  * @brief requests pipelined in one write are all answered,in order
+  * @note everything after the first request of a read used to be dropped
+  */
+#include "http/http_conn.h"
+#include "test/check.h"
+#include <string>
+
+namespace {
+
+    class echo : public hzd::router {
+    public:
+        echo() : router("/echo",{hzd::POST}) {}
+        bool method_post(hzd::http_conn* c) override
+        {
+            return c->send_str(c->req_body.raw,"text/plain");
+        }
+    };
+    ROUTER(echo)
+
+    /* status codes of the responses in data,in order */
+    std::string statuses(const std::string& data)
+    {
+        std::string codes;
+        size_t pos = 0;
+        while((pos = data.find("HTTP/1.1 ",pos)) != std::string::npos)
+        {
+            codes += data.substr(pos + 9,3) + " ";
+            pos += 9;
+        }
+        return codes;
+    }
+}
+
+int main()
+{
+    /* three requests in one write,the body of the second is only its Content-Length bytes */
+    {
+        conn_pair<hzd::http_conn> pair;
+        CHECK(pair.send("GET /missing HTTP/1.1\r\n\r\n"
+                        "POST /echo HTTP/1.1\r\nContent-Length: 5\r\n\r\nhello"
+                        "GET /missing HTTP/1.1\r\n\r\n"));
+        CHECK(drive(pair.c,hzd::conn::IN));
+        for(int i = 0;i < 3;i++)
+        {
+            CHECK(pair.c->in_flight());
+            CHECK(drive(pair.c,hzd::conn::OUT));
+        }
+        CHECK(!pair.c->in_flight());
+        std::string data = pair.read();
+        CHECK(statuses(data) == "404 200 404 ");
+        CHECK(data.find("\r\n\r\nhelloHTTP/1.1 404") != std::string::npos);
+    }
+    /* the second request split over two reads */
+    {
+        conn_pair<hzd::http_conn> pair;
+        CHECK(pair.send("GET /missing HTTP/1.1\r\n\r\nGET /miss"));
+        CHECK(drive(pair.c,hzd::conn::IN));
+        CHECK(drive(pair.c,hzd::conn::OUT));
+        CHECK(!pair.c->in_flight());
+        CHECK(pair.send("ing HTTP/1.1\r\n\r\n"));
+        CHECK(drive(pair.c,hzd::conn::IN));
+        CHECK(drive(pair.c,hzd::conn::OUT));
+        CHECK(statuses(pair.read()) == "404 404 ");
+    }
+    /* the peer closes after its requests : all are answered,then the connection closes */
+    {
+        conn_pair<hzd::http_conn> pair;
+        CHECK(pair.send("GET /missing HTTP/1.1\r\n\r\nGET /missing HTTP/1.1\r\n\r\n"));
+        pair.shutdown_peer();
+        CHECK(drive(pair.c,hzd::conn::IN));
+        CHECK(drive(pair.c,hzd::conn::OUT));
+        CHECK(pair.c->status != hzd::conn::CLOSE);
+        CHECK(drive(pair.c,hzd::conn::OUT));
+        CHECK(pair.c->status == hzd::conn::CLOSE);
+        CHECK(statuses(pair.read()) == "404 404 ");
+    }
+
+    if(check_failures() == 0) printf("http_pipelining ok\n");
+    return check_failures() == 0 ? 0 : 1;
+}
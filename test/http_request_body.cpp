@@ -0,0 +1,92 @@
+/**
+  * @brief a request body is kept until Content-Length bytes came,over as many reads as it takes
+  * @note a body the peer closed before sending used to be waited for forever.
+  *       test/conf/http_request_body.json sets http_max_body to 1000
+  */
+#include "http/http_conn.h"
+#include "test/check.h"
+#include <string>
+
+namespace {
+
+    class probe : public hzd::http_conn {
+    public:
+        const std::string& body() const { return req_body.raw; }
+    };
+
+    std::string post(size_t length,const std::string& body)
+    {
+        return "POST /upload HTTP/1.1\r\nContent-Type: text/plain\r\nContent-Length: " +
+               std::to_string(length) + "\r\n\r\n" + body;
+    }
+}
+
+int main()
+{
+    /* the peer closes with 3 of 10 bytes sent : 400,never a truncated body */
+    {
+        conn_pair<probe> pair;
+        CHECK(pair.send(post(10,"abc")));
+        pair.shutdown_peer();
+        CHECK(!drive(pair.c,hzd::conn::IN));
+        CHECK(pair.c->status == hzd::conn::CLOSE);
+        CHECK(pair.read().compare(0,12,"HTTP/1.1 400") == 0);
+    }
+    /* a body trickling in waits for EPOLLIN between reads */
+    {
+        conn_pair<probe> pair;
+        CHECK(pair.send(post(10,"abc")));
+        CHECK(drive(pair.c,hzd::conn::IN));
+        CHECK(pair.c->status != hzd::conn::CLOSE && !pair.c->in_flight());
+        CHECK(pair.send("defg"));
+        CHECK(drive(pair.c,hzd::conn::IN));
+        CHECK(!pair.c->in_flight());
+        CHECK(pair.send("hij"));
+        CHECK(drive(pair.c,hzd::conn::IN));
+        CHECK(pair.c->in_flight());
+        CHECK(pair.c->body() == "abcdefghij");
+        CHECK(pair.read().empty());
+    }
+    /* only Content-Length bytes are the body */
+    {
+        conn_pair<probe> pair;
+        CHECK(pair.send(post(3,"abcGET / HTTP/1.1\r\n\r\n")));
+        CHECK(drive(pair.c,hzd::conn::IN));
+        CHECK(pair.c->body() == "abc");
+    }
+    /* a header split over reads */
+    {
+        conn_pair<probe> pair;
+        std::string request = post(2,"ok");
+        CHECK(pair.send(request.substr(0,20)));
+        CHECK(drive(pair.c,hzd::conn::IN));
+        CHECK(!pair.c->in_flight());
+        CHECK(pair.send(request.substr(20)));
+        CHECK(drive(pair.c,hzd::conn::IN));
+        CHECK(pair.c->body() == "ok");
+    }
+    /* past http_max_body,not a number,a header the peer never ends */
+    {
+        conn_pair<probe> pair;
+        CHECK(pair.send(post(1001,"")));
+        CHECK(!drive(pair.c,hzd::conn::IN));
+        CHECK(pair.read().compare(0,12,"HTTP/1.1 413") == 0);
+    }
+    {
+        conn_pair<probe> pair;
+        CHECK(pair.send("POST / HTTP/1.1\r\nContent-Length: 1x\r\n\r\n"));
+        CHECK(!drive(pair.c,hzd::conn::IN));
+        CHECK(pair.read().compare(0,12,"HTTP/1.1 400") == 0);
+    }
+    {
+        conn_pair<probe> pair;
+        CHECK(pair.send("GET / HTTP/1.1\r\nHost: a"));
+        pair.shutdown_peer();
+        CHECK(!drive(pair.c,hzd::conn::IN));
+        CHECK(pair.c->status == hzd::conn::CLOSE);
+        CHECK(pair.read().empty());
+    }
+
+    if(check_failures() == 0) printf("http_request_body ok\n");
+    return check_failures() == 0 ? 0 : 1;
+}
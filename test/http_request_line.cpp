@@ -0,0 +1,57 @@
+/**
+  * @brief malformed request lines are answered 400,well formed ones parse
+  */
+#include "http/http_conn.h"
+#include "test/check.h"
+#include <string>
+
+namespace {
+
+    class probe : public hzd::http_conn {
+    public:
+        bool parse(const std::string& data) { return parse_header(data); }
+        const request_header& header() const { return req_header; }
+    };
+
+    /* response of one request sent on a fresh connection */
+    std::string exchange(const std::string& request)
+    {
+        conn_pair<probe> pair;
+        if(!pair.send(request)) return {};
+        drive(pair.c,hzd::conn::IN);
+        return pair.read();
+    }
+
+    bool bad_request(const std::string& request)
+    {
+        return exchange(request).compare(0,12,"HTTP/1.1 400") == 0;
+    }
+}
+
+int main()
+{
+    /* no first space,no second space,empty url,no line end,space only in a later line */
+    CHECK(bad_request("GET\r\n\r\n"));
+    CHECK(bad_request("GET /index.html\r\n\r\n"));
+    CHECK(bad_request("GET  HTTP/1.1\r\n\r\n"));
+    CHECK(bad_request("GET/index.html\r\nHost: a b\r\n\r\n"));
+    CHECK(bad_request("GET /index.html\r\nUser-Agent: a b\r\n\r\n"));
+    CHECK(bad_request("FETCH / HTTP/1.1\r\n\r\n"));
+    CHECK(bad_request("GET / HTTP/9.9\r\n\r\n"));
+
+    probe p;
+    CHECK(!p.parse("GET / HTTP/1.1"));
+    CHECK(!p.parse("GET /a\r\nHost: x y\r\n"));
+    CHECK(p.parse("GET /a/b?x=1&y=2 HTTP/1.0\r\nHost: example\r\n"));
+    CHECK(p.header().method == hzd::GET);
+    CHECK(p.header().url == "/a/b");
+    CHECK(p.header().query == "x=1&y=2");
+    CHECK(p.header().version == hzd::HTTP_1_0);
+    CHECK(p.parse("POST /form HTTP/1.1\r\n"));
+    CHECK(p.header().method == hzd::POST);
+    CHECK(p.header().url == "/form");
+    CHECK(p.header().version == hzd::HTTP_1_1);
+
+    if(check_failures() == 0) printf("http_request_line ok\n");
+    return check_failures() == 0 ? 0 : 1;
+}
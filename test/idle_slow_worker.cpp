@@ -0,0 +1,94 @@
+/**
+  * @brief a handler running longer than keep_alive_timeout in the thread pool is not closed under it
+  * @note the idle sweep used to close such a connection and free it while the worker still ran.
+  *       the response must arrive whole,then the idle connection must still be closed.
+  *       idle_slow_worker single|multi,run with test/conf/idle_slow_worker.json
+  */
+#include "http/http_conn.h"
+#include "test/check.h"
+#include <chrono>
+#include <string>
+#include <thread>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+namespace {
+
+    class slow : public hzd::router {
+    public:
+        slow() : router("/slow",{hzd::GET}) {}
+        bool method_get(hzd::http_conn* c) override
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2500));
+            return c->send_str("slow done");
+        }
+    };
+    ROUTER(slow)
+
+    int connect_to(int port)
+    {
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)port);
+        inet_pton(AF_INET,"127.0.0.1",&addr.sin_addr);
+        for(int i = 0;i < 100;i++)
+        {
+            int fd = socket(AF_INET,SOCK_STREAM,0);
+            if(fd < 0) return -1;
+            if(connect(fd,(sockaddr*)&addr,sizeof(addr)) == 0) return fd;
+            ::close(fd);
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        return -1;
+    }
+
+    void client(int port)
+    {
+        int fd = connect_to(port);
+        CHECK(fd >= 0);
+        if(fd >= 0)
+        {
+            timeval tv{10,0};
+            setsockopt(fd,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));
+            const std::string request = "GET /slow HTTP/1.1\r\nHost: test\r\n\r\n";
+            CHECK(::send(fd,request.data(),request.size(),MSG_NOSIGNAL) == (ssize_t)request.size());
+            std::string response;
+            char buffer[1024];
+            while(response.find("slow done") == std::string::npos)
+            {
+                ssize_t n = ::recv(fd,buffer,sizeof(buffer),0);
+                if(n <= 0) break;
+                response.append(buffer,n);
+            }
+            CHECK(response.compare(0,12,"HTTP/1.1 200") == 0);
+            CHECK(response.find("slow done") != std::string::npos);
+            /* nothing runs any more,so the idle sweep closes it */
+            auto begin = std::chrono::steady_clock::now();
+            ssize_t n = ::recv(fd,buffer,sizeof(buffer),0);
+            CHECK(n == 0);
+            CHECK(std::chrono::steady_clock::now() - begin < std::chrono::seconds(5));
+            ::close(fd);
+        }
+        if(check_failures() == 0) printf("idle_slow_worker ok\n");
+        fflush(stdout);
+        _exit(check_failures() == 0 ? 0 : 1);
+    }
+}
+
+int main(int argc,char** argv)
+{
+    std::string model = argc > 1 ? argv[1] : "single";
+    std::thread(client,(int32_t)hzd::configure::get_config()["port"]).detach();
+    if(model == "multi")
+    {
+        hzd::conv_http_multi server;
+        server.wait();
+    }
+    else
+    {
+        hzd::conv_http_single server;
+        server.wait();
+    }
+    return 1;
+}
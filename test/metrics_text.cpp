@@ -0,0 +1,51 @@
+/**
+  * @brief the Prometheus text is well formed line by line,and a failed send counts no bytes
+  * @note the admission/shed block used to be cut by a fixed line buffer,
+  *       and send() on a dead socket used to add (size_t)-1 to the sent bytes
+  */
+#include "core/include/conn.h"
+#include "test/check.h"
+#include <sstream>
+#include <string>
+
+namespace {
+
+    class probe : public hzd::conn {
+    public:
+        bool process_in() override { return true; }
+        bool process_out() override { return true; }
+    };
+}
+
+int main()
+{
+    hzd::metrics::enabled() = true;
+
+    {
+        conn_pair<probe> pair;
+        pair.close_peer();
+        uint64_t before = hzd::metrics::snapshot().total(hzd::M_BYTES_OUT);
+        CHECK(!pair.c->send("lost",4));
+        CHECK(hzd::metrics::snapshot().total(hzd::M_BYTES_OUT) == before);
+    }
+
+    std::string text = hzd::metrics::prometheus();
+    std::istringstream lines(text);
+    std::string line;
+    size_t count = 0;
+    while(std::getline(lines,line))
+    {
+        count++;
+        bool comment = line.compare(0,7,"# HELP ") == 0 || line.compare(0,7,"# TYPE ") == 0;
+        CHECK(comment || line.compare(0,11,"conv_event_") == 0);
+        CHECK(line.find('#',comment ? 1 : 0) == std::string::npos);
+    }
+    CHECK(count > 0);
+    CHECK(text.find("\n# HELP conv_event_admission_rejected_total Connections refused by max_connect_per_ip.\n"
+                    "# TYPE conv_event_admission_rejected_total counter\nconv_event_admission_rejected_total ") != std::string::npos);
+    CHECK(text.find("\n# HELP conv_event_shed_total Requests answered 503 by shed_queue_delay.\n"
+                    "# TYPE conv_event_shed_total counter\nconv_event_shed_total ") != std::string::npos);
+
+    if(check_failures() == 0) printf("metrics_text ok\n");
+    return check_failures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,122 @@
+/**
+  * @brief an rpc connection is in flight while a worker runs one of its calls or a response
+  *        is still buffered,and a connected rpc_client refuses a second connect
+  */
+#include "rpc/rpc_conn.h"
+#include "test/check.h"
+#include <chrono>
+#include <string>
+#include <thread>
+
+namespace {
+
+    class slow : public hzd::rpc_conn::method {
+    public:
+        slow() : method("slow") {}
+        hzd::rpc_Status call(const std::string& request,std::string& response) override
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(300));
+            response = request;
+            return hzd::RPC_OK;
+        }
+    };
+    RPC_METHOD(slow)
+
+    class big : public hzd::rpc_conn::method {
+    public:
+        big() : method("big") {}
+        hzd::rpc_Status call(const std::string&,std::string& response) override
+        {
+            response.assign(4 * 1024 * 1024,'x');
+            return hzd::RPC_OK;
+        }
+    };
+    RPC_METHOD(big)
+
+    std::string request(uint64_t id,const std::string& name,const std::string& body)
+    {
+        hzd::header h{sizeof(hzd::rpc_header) + name.size() + body.size()};
+        hzd::rpc_header r{id,hzd::RPC_REQUEST,hzd::RPC_OK,(uint16_t)name.size()};
+        std::string frame((const char*)&h,sizeof(h));
+        frame.append((const char*)&r,sizeof(hzd::rpc_header));
+        return frame + name + body;
+    }
+
+    /* read one whole response frame,its size or 0 */
+    size_t response(int fd)
+    {
+        hzd::header h{};
+        if(::recv(fd,&h,sizeof(h),MSG_WAITALL) != (ssize_t)sizeof(h)) return 0;
+        std::string payload(h.size,'\0');
+        size_t got = 0;
+        while(got < payload.size())
+        {
+            ssize_t n = ::recv(fd,&payload[got],payload.size() - got,0);
+            if(n <= 0) return 0;
+            got += n;
+        }
+        return h.size;
+    }
+
+    bool wait_until(const std::function<bool()>& done)
+    {
+        for(int i = 0;i < 200;i++)
+        {
+            if(done()) return true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return false;
+    }
+}
+
+int main()
+{
+    {
+        conn_pair<hzd::rpc_conn> pair;
+        hzd::rpc_conn* c = pair.c;
+        CHECK(!c->in_flight());
+
+        /* a call run by a worker */
+        CHECK(pair.send(request(1,"slow","ping")));
+        drive(c,hzd::conn::IN);
+        CHECK(hzd::rpc_conn::rpc_thread_count == 0 || c->in_flight());
+        CHECK(response(pair.peer()) == sizeof(hzd::rpc_header) + 4);
+        CHECK(wait_until([c] { return !c->in_flight(); }));
+
+        /* a response larger than the socket buffer stays buffered until written */
+        CHECK(pair.send(request(2,"big","")));
+        drive(c,hzd::conn::IN);
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        CHECK(c->in_flight());
+        std::thread drain([c] {
+            while(c->in_flight())
+            {
+                drive(c,hzd::conn::OUT);
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        });
+        CHECK(response(pair.peer()) == sizeof(hzd::rpc_header) + 4 * 1024 * 1024);
+        drain.join();
+        CHECK(!c->in_flight());
+    }
+
+    /* connecting a connected client is refused instead of replacing its reader thread */
+    int listener = socket(AF_INET,SOCK_STREAM,0);
+    sockaddr_in local{};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t size = sizeof(local);
+    CHECK(bind(listener,(sockaddr*)&local,sizeof(local)) == 0 && listen(listener,4) == 0);
+    getsockname(listener,(sockaddr*)&local,&size);
+    {
+        hzd::rpc_client client;
+        CHECK(client.connect("127.0.0.1",ntohs(local.sin_port)));
+        CHECK(!client.connect("127.0.0.1",ntohs(local.sin_port)));
+        client.close();
+        CHECK(client.connect("127.0.0.1",ntohs(local.sin_port)));
+    }
+    ::close(listener);
+
+    if(check_failures() == 0) printf("rpc_in_flight ok\n");
+    return check_failures() == 0 ? 0 : 1;
+}
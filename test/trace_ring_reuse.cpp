@@ -0,0 +1,40 @@
+/**
+  * @brief a trace ring taken over from a thread that left starts empty
+  * @note the records of the old thread used to be dumped under the name and tid of the new one
+  */
+#include "core/include/trace.h"
+#include "test/check.h"
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+int main()
+{
+    hzd::trace::enabled() = true;
+    std::thread([] {
+        hzd::trace::name_thread("first");
+        for(int i = 0;i < 10;i++) hzd::trace::instant(hzd::TR_HANDOFF,1000 + i);
+    }).join();
+    std::thread([] {
+        hzd::trace::name_thread("second");
+        hzd::trace::instant(hzd::TR_HANDOFF,2000);
+    }).join();
+
+    const char* path = "trace_ring_reuse.json";
+    CHECK(hzd::trace::dump(path));
+    std::ifstream in(path);
+    std::stringstream text;
+    text << in.rdbuf();
+    std::remove(path);
+
+    /* one ring,reused by the second thread,with only its record */
+    CHECK(text.str().find("\"name\":\"second\"") != std::string::npos);
+    CHECK(text.str().find("\"name\":\"first\"") == std::string::npos);
+    CHECK(text.str().find("\"fd\":2000") != std::string::npos);
+    CHECK(text.str().find("\"fd\":1000") == std::string::npos);
+
+    if(check_failures() == 0) printf("trace_ring_reuse ok\n");
+    return check_failures() == 0 ? 0 : 1;
+}
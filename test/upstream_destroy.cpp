@@ -0,0 +1,64 @@
+/**
+  * @brief a destroyed upstream leaves nothing in outbound_table
+  * @note one connection is kept alive in the pool and one is still handed out when the
+  *       upstream goes away,a reactor must not find either afterwards.
+  *       the connects complete on an epoll of this test,driven like a reactor would
+  */
+#include "core/include/connector.h"
+#include "test/check.h"
+#include <vector>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+
+namespace {
+
+    /* run epoll events through outbound_dispatch until done or a second passed */
+    void drive(int epoll_fd,const std::function<bool()>& done)
+    {
+        epoll_event events[16];
+        for(int i = 0;i < 100 && !done();i++)
+        {
+            int n = epoll_wait(epoll_fd,events,16,10);
+            for(int j = 0;j < n;j++) hzd::outbound_dispatch(events[j].data.fd,events[j].events);
+        }
+    }
+}
+
+int main()
+{
+    int listener = socket(AF_INET,SOCK_STREAM,0);
+    sockaddr_in local{};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t size = sizeof(local);
+    CHECK(bind(listener,(sockaddr*)&local,sizeof(local)) == 0 && listen(listener,4) == 0);
+    getsockname(listener,(sockaddr*)&local,&size);
+    int epoll_fd = epoll_create1(0);
+
+    std::vector<int> fds;
+    {
+        hzd::upstream backend("backend");
+        CHECK(backend.add_server("127.0.0.1",ntohs(local.sin_port)));
+        std::vector<hzd::outbound*> connected;
+        for(int i = 0;i < 2;i++)
+        {
+            backend.connect(epoll_fd,[&](hzd::outbound* o) { if(o) connected.push_back(o); });
+        }
+        drive(epoll_fd,[&] { return connected.size() == 2; });
+        CHECK(connected.size() == 2);
+        for(auto* o : connected)
+        {
+            fds.push_back(o->fd());
+            CHECK(hzd::outbound_table::find(o->fd()) == o);
+        }
+        /* one idle in the keep-alive pool,one busy */
+        if(!connected.empty()) connected[0]->release(true);
+    }
+    CHECK(fds.size() == 2);
+    for(int fd : fds) CHECK(hzd::outbound_table::find(fd) == nullptr);
+
+    ::close(epoll_fd);
+    ::close(listener);
+    if(check_failures() == 0) printf("upstream_destroy ok\n");
+    return check_failures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,99 @@
+/**
+  * @brief close frames : codes that must not be on the wire and invalid reasons are refused,
+  *        a valid close is echoed,a close code that can't be sent goes out without code
+  */
+#include "http/websocket_conn.h"
+#include "test/check.h"
+#include <string>
+
+namespace {
+
+    class session {
+    public:
+        conn_pair<hzd::websocket_conn> pair;
+
+        /* send bytes,let the connection read and answer them,return what it wrote */
+        std::string exchange(const std::string& data)
+        {
+            if(!data.empty() && !pair.send(data)) return {};
+            drive(pair.c,hzd::conn::IN);
+            if(pair.c->status != hzd::conn::CLOSE) drive(pair.c,hzd::conn::OUT);
+            return pair.read();
+        }
+        bool open()
+        {
+            std::string response = exchange("GET /chat HTTP/1.1\r\n"
+                                            "Host: localhost\r\n"
+                                            "Upgrade: websocket\r\n"
+                                            "Connection: Upgrade\r\n"
+                                            "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                                            "Sec-WebSocket-Version: 13\r\n\r\n");
+            return response.compare(0,12,"HTTP/1.1 101") == 0;
+        }
+    };
+
+    /* masked client close frame,code 0 sends no payload */
+    std::string client_close(uint16_t code,const std::string& reason = {})
+    {
+        std::string payload;
+        if(code) payload = std::string{(char)(code >> 8),(char)code} + reason;
+        const char key[4] = {0x11,0x22,0x33,0x44};
+        std::string frame{(char)(0x80 | hzd::WS_CLOSE),(char)(0x80 | payload.size())};
+        frame.append(key,4);
+        for(size_t i = 0;i < payload.size();i++) frame += (char)(payload[i] ^ key[i & 3]);
+        return frame;
+    }
+
+    /* close code of the server close frame in data,-1 without close frame,0 without code */
+    int close_code(const std::string& data)
+    {
+        if(data.size() < 2 || (uint8_t)data[0] != (0x80 | hzd::WS_CLOSE)) return -1;
+        size_t size = data[1] & 0x7F;
+        if(size < 2) return 0;
+        if(data.size() < 4) return -1;
+        return ((uint8_t)data[2] << 8) | (uint8_t)data[3];
+    }
+
+    int answer_to(const std::string& frame)
+    {
+        session s;
+        if(!s.open()) return -2;
+        return close_code(s.exchange(frame));
+    }
+}
+
+int main()
+{
+    CHECK(answer_to(client_close(1000,"bye")) == 1000);
+    CHECK(answer_to(client_close(4000)) == 4000);
+    CHECK(answer_to(client_close(0)) == 0);
+    /* only reported locally,reserved or out of range */
+    CHECK(answer_to(client_close(1005)) == hzd::WS_PROTOCOL_ERROR);
+    CHECK(answer_to(client_close(1006)) == hzd::WS_PROTOCOL_ERROR);
+    CHECK(answer_to(client_close(1015)) == hzd::WS_PROTOCOL_ERROR);
+    CHECK(answer_to(client_close(1004)) == hzd::WS_PROTOCOL_ERROR);
+    CHECK(answer_to(client_close(999)) == hzd::WS_PROTOCOL_ERROR);
+    CHECK(answer_to(client_close(2000)) == hzd::WS_PROTOCOL_ERROR);
+    CHECK(answer_to(client_close(5000)) == hzd::WS_PROTOCOL_ERROR);
+    /* reason must be utf-8 */
+    CHECK(answer_to(client_close(1000,"\xc0\xaf")) == hzd::WS_INVALID_PAYLOAD);
+    CHECK(answer_to(client_close(1000,"\xed\xa0\x80")) == hzd::WS_INVALID_PAYLOAD);
+    CHECK(answer_to(client_close(1000,"caf\xc3\xa9")) == 1000);
+
+    /* a code that can't be sent closes without code */
+    {
+        session s;
+        CHECK(s.open());
+        s.pair.c->send_close(1006);
+        CHECK(close_code(s.exchange({})) == 0);
+    }
+    {
+        session s;
+        CHECK(s.open());
+        s.pair.c->send_close(hzd::WS_GOING_AWAY);
+        CHECK(close_code(s.exchange({})) == hzd::WS_GOING_AWAY);
+    }
+
+    if(check_failures() == 0) printf("websocket_close ok\n");
+    return check_failures() == 0 ? 0 : 1;
+}